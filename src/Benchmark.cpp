@@ -0,0 +1,449 @@
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "CommandRecorder.h"
+#include "TransformSystem.h"
+
+#include <chrono>
+#include <cmath>
+#include <random>
+
+uint32_t Benchmark::RecordingChunks = 256;
+uint32_t Benchmark::RecordingCommandsPerChunk = 512;
+int Benchmark::RecordingIterations = 20;
+VkDeviceSize Benchmark::UploadSize = 64 * 1024 * 1024;
+VkDeviceSize Benchmark::UploadChunkSize = 1024 * 1024;
+int Benchmark::UploadIterations = 10;
+uint32_t Benchmark::SubmissionCount = 256;
+int Benchmark::SubmissionIterations = 20;
+uint32_t Benchmark::AllocatorOperations = 100000;
+uint32_t Benchmark::AllocatorLiveCount = 512;
+int Benchmark::AllocatorIterations = 10;
+uint32_t Benchmark::TransformCount = 100000;
+int Benchmark::TransformIterations = 50;
+
+void Benchmark::RecordingScaling(VkDevice logicalDevice, SubmissionScheduler &scheduler, int familyIndex, DeviceMemoryAllocator &memoryAllocator,
+	const VkAllocationCallbacks *pAllocator, std::ostream &out, std::vector<S_BenchmarkMetric> *pMetrics)
+{
+	// Each command fills its own 16 byte slot, so chunks never overlap.
+	VkDeviceSize slotSize = 16;
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = slotSize * RecordingChunks * RecordingCommandsPerChunk;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkBuffer scratchBuffer;
+	VkResult result = vkCreateBuffer(logicalDevice, &bufferInfo, pAllocator, &scratchBuffer);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create benchmark scratch buffer.");
+
+	S_DeviceAllocationRequest request;
+	vkGetBufferMemoryRequirements(logicalDevice, scratchBuffer, &request.requirements);
+	request.preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	S_DeviceAllocation scratchMemory = memoryAllocator.Allocate(request);
+	result = vkBindBufferMemory(logicalDevice, scratchBuffer, scratchMemory.memory, scratchMemory.offset);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to bind benchmark scratch buffer.");
+
+	// The primary only executes secondaries, so a single reusable one is enough.
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	poolInfo.queueFamilyIndex = familyIndex;
+
+	VkCommandPool primaryPool;
+	result = vkCreateCommandPool(logicalDevice, &poolInfo, pAllocator, &primaryPool);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create benchmark command pool.");
+
+	VkCommandBufferAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocateInfo.commandPool = primaryPool;
+	allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocateInfo.commandBufferCount = 1;
+
+	VkCommandBuffer primary;
+	result = vkAllocateCommandBuffers(logicalDevice, &allocateInfo, &primary);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to allocate benchmark command buffer.");
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	auto recordChunk = [scratchBuffer, slotSize](VkCommandBuffer commandBuffer, uint32_t chunk)
+	{
+		VkDeviceSize offset = slotSize * RecordingCommandsPerChunk * chunk;
+		for (uint32_t i = 0; i < RecordingCommandsPerChunk; i++, offset += slotSize)
+			vkCmdFillBuffer(commandBuffer, scratchBuffer, offset, slotSize, chunk ^ i);
+	};
+
+	int maxThreads = std::max(1, (int)std::thread::hardware_concurrency());
+	double commandCount = (double)RecordingChunks * RecordingCommandsPerChunk;
+	double baseline = 0.0;
+
+	out << "Recording " << RecordingChunks << " chunks x " << RecordingCommandsPerChunk << " commands, "
+		<< RecordingIterations << " iterations" << std::endl;
+
+	std::vector<int> threadCounts;
+	for (int threads = 1; threads < maxThreads; threads *= 2) threadCounts.push_back(threads);
+	threadCounts.push_back(maxThreads);
+
+	for (int threads : threadCounts)
+	{
+		JobSystem jobSystem(threads);
+		CommandRecorder recorder(logicalDevice, familyIndex, threads, 1, pAllocator);
+
+		// The first pass allocates every secondary, so it isn't timed.
+		double bestSeconds = 0.0;
+		for (int iteration = 0; iteration <= RecordingIterations; iteration++)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			recorder.BeginFrame(0);
+			vkResetCommandBuffer(primary, 0);
+			vkBeginCommandBuffer(primary, &beginInfo);
+			recorder.RecordParallel(jobSystem, primary, RecordingChunks, nullptr, recordChunk);
+			vkEndCommandBuffer(primary);
+			double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+			if (iteration > 0 && (bestSeconds == 0.0 || seconds < bestSeconds)) bestSeconds = seconds;
+		}
+
+		// Submit the last recording once, so the driver (and validation) actually sees what we recorded.
+		S_Submission submission;
+		submission.commandBuffers.push_back(primary);
+		scheduler.Wait(scheduler.Submit(QUEUE_GRAPHICS, submission));
+
+		if (threads == 1) baseline = bestSeconds;
+		out << "  " << threads << " thread(s): " << bestSeconds * 1000.0 << " ms, "
+			<< (uint64_t)(commandCount / bestSeconds) << " commands/s, "
+			<< baseline / bestSeconds << "x" << std::endl;
+		AddMetric(pMetrics, "recording.threads" + std::to_string(threads), commandCount / bestSeconds, "commands/s");
+	}
+
+	vkDestroyCommandPool(logicalDevice, primaryPool, pAllocator);
+	vkDestroyBuffer(logicalDevice, scratchBuffer, pAllocator);
+	memoryAllocator.Free(scratchMemory);
+}
+
+void Benchmark::UploadBandwidth(VkDevice logicalDevice, SubmissionScheduler &scheduler, int familyIndex, UploadService &uploadService,
+	DeviceMemoryAllocator &memoryAllocator, const VkAllocationCallbacks *pAllocator, std::ostream &out, std::vector<S_BenchmarkMetric> *pMetrics)
+{
+	// Small enough that several batches are in flight at once, the way streaming uses the ring.
+	VkDeviceSize chunkSize = std::min(UploadChunkSize, uploadService.GetRingSize() / 4);
+	VkDeviceSize size = std::max(UploadSize / chunkSize, (VkDeviceSize)1) * chunkSize;
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkBuffer buffer;
+	VkResult result = vkCreateBuffer(logicalDevice, &bufferInfo, pAllocator, &buffer);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create benchmark upload buffer.");
+
+	S_DeviceAllocationRequest request;
+	vkGetBufferMemoryRequirements(logicalDevice, buffer, &request.requirements);
+	request.preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	S_DeviceAllocation memory = memoryAllocator.Allocate(request);
+	result = vkBindBufferMemory(logicalDevice, buffer, memory.memory, memory.offset);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to bind benchmark upload buffer.");
+
+	std::vector<uint8_t> data((size_t)size);
+	for (size_t i = 0; i < data.size(); i++) data[i] = (uint8_t)(i * 7);
+
+	// The first pass warms the ring and the transfer queue, so it isn't timed.
+	double bestSeconds = 0.0;
+	for (int iteration = 0; iteration <= UploadIterations; iteration++)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		for (VkDeviceSize offset = 0; offset < size; offset += chunkSize)
+			uploadService.UploadBuffer(buffer, offset, data.data() + offset, chunkSize);
+		uploadService.Flush();
+		uploadService.WaitIdle();
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		if (iteration > 0 && (bestSeconds == 0.0 || seconds < bestSeconds)) bestSeconds = seconds;
+	}
+
+	// Take the buffer back on graphics, so nothing we released is left for the next frame to acquire.
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	poolInfo.queueFamilyIndex = familyIndex;
+
+	VkCommandPool commandPool;
+	result = vkCreateCommandPool(logicalDevice, &poolInfo, pAllocator, &commandPool);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create benchmark command pool.");
+
+	VkCommandBufferAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocateInfo.commandPool = commandPool;
+	allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocateInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	result = vkAllocateCommandBuffers(logicalDevice, &allocateInfo, &commandBuffer);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to allocate benchmark command buffer.");
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	S_Submission submission;
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	uploadService.RecordAcquire(commandBuffer, submission.waits);
+	vkEndCommandBuffer(commandBuffer);
+	submission.commandBuffers.push_back(commandBuffer);
+	S_TimelinePoint acquired = scheduler.Submit(QUEUE_GRAPHICS, submission);
+	scheduler.Flush();
+
+	// Nobody needs to wait for the acquire, it's enough that everything goes away once it's done.
+	DeviceMemoryAllocator *pMemoryAllocator = &memoryAllocator;
+	scheduler.Retire(acquired, [logicalDevice, commandPool, buffer, memory, pMemoryAllocator, pAllocator]()
+	{
+		vkDestroyCommandPool(logicalDevice, commandPool, pAllocator);
+		vkDestroyBuffer(logicalDevice, buffer, pAllocator);
+		pMemoryAllocator->Free(memory);
+	});
+
+	double bytesPerSecond = (double)size / bestSeconds;
+	out << "Uploading " << size / (1024 * 1024) << " MiB in " << chunkSize / 1024 << " KiB chunks, " << UploadIterations << " iterations" << std::endl;
+	out << "  " << bestSeconds * 1000.0 << " ms, " << bytesPerSecond / (1024.0 * 1024.0 * 1024.0) << " GiB/s"
+		<< (uploadService.OwnershipTransfers() ? " on a dedicated transfer queue" : "") << std::endl;
+	AddMetric(pMetrics, "upload.bandwidth", bytesPerSecond / (1024.0 * 1024.0 * 1024.0), "GiB/s");
+}
+
+// The command buffers are empty, so what's timed is the CPU side of Submit and Flush, and the driver's vkQueueSubmit.
+// Each pass waits for the GPU before the next, untimed, so they all start from an idle queue.
+void Benchmark::SubmissionBatching(VkDevice logicalDevice, SubmissionScheduler &scheduler, int familyIndex,
+	const VkAllocationCallbacks *pAllocator, std::ostream &out, std::vector<S_BenchmarkMetric> *pMetrics)
+{
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = familyIndex;
+
+	VkCommandPool commandPool;
+	VkResult result = vkCreateCommandPool(logicalDevice, &poolInfo, pAllocator, &commandPool);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create benchmark command pool.");
+
+	VkCommandBufferAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocateInfo.commandPool = commandPool;
+	allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocateInfo.commandBufferCount = SubmissionCount;
+
+	std::vector<VkCommandBuffer> commandBuffers(SubmissionCount);
+	result = vkAllocateCommandBuffers(logicalDevice, &allocateInfo, commandBuffers.data());
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to allocate benchmark command buffers.");
+
+	// Recorded once and submitted over and over, so no one time submit flag.
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	for (VkCommandBuffer commandBuffer : commandBuffers)
+	{
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		vkEndCommandBuffer(commandBuffer);
+	}
+
+	// The first pass of each isn't timed.
+	auto run = [&](bool batched)
+	{
+		double bestSeconds = 0.0;
+		for (int iteration = 0; iteration <= SubmissionIterations; iteration++)
+		{
+			S_TimelinePoint last;
+			auto start = std::chrono::high_resolution_clock::now();
+			for (VkCommandBuffer commandBuffer : commandBuffers)
+			{
+				S_Submission submission;
+				submission.commandBuffers.push_back(commandBuffer);
+				last = scheduler.Submit(QUEUE_GRAPHICS, submission);
+				if (!batched) scheduler.Flush();
+			}
+			if (batched) scheduler.Flush();
+			double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+			scheduler.Wait(last);
+
+			if (iteration > 0 && (bestSeconds == 0.0 || seconds < bestSeconds)) bestSeconds = seconds;
+		}
+		return bestSeconds * 1000000.0 / SubmissionCount;
+	};
+
+	double unbatched = run(false);
+	double batched = run(true);
+	vkDestroyCommandPool(logicalDevice, commandPool, pAllocator);
+
+	out << "Submitting " << SubmissionCount << " command buffers, " << SubmissionIterations << " iterations, "
+		<< ((scheduler.UsesTimelineSemaphores()) ? "timeline semaphores" : "fences") << std::endl;
+	out << "  One vkQueueSubmit each: " << unbatched << " us per command buffer" << std::endl;
+	out << "  Batched: " << batched << " us per command buffer, " << unbatched / batched << "x" << std::endl;
+	AddMetric(pMetrics, "submission.unbatched", unbatched, "us");
+	AddMetric(pMetrics, "submission.batched", batched, "us");
+}
+
+void Benchmark::AllocatorThroughput(DeviceMemoryAllocator &memoryAllocator, std::ostream &out, std::vector<S_BenchmarkMetric> *pMetrics)
+{
+	// Decided up front, so every run does exactly the same work and the generator isn't timed.
+	// Sizes are 4 KiB to 256 KiB, and a free picks its victim from whatever is alive at the time.
+	struct S_Operation
+	{
+		bool allocate;
+		VkDeviceSize size;
+		uint32_t victim;
+	};
+	std::vector<S_Operation> operations(AllocatorOperations);
+	std::mt19937 random(13);
+	std::uniform_int_distribution<int> sizeShift(12, 18);
+	std::uniform_int_distribution<uint32_t> victim;
+	for (S_Operation &operation : operations)
+	{
+		operation.allocate = (random() & 1) != 0;
+		operation.size = (VkDeviceSize)1 << sizeShift(random);
+		operation.victim = victim(random);
+	}
+
+	S_DeviceAllocationRequest request;
+	request.requirements.memoryTypeBits = ~0u;
+	request.requirements.alignment = 256;
+	request.preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+	std::vector<S_DeviceAllocation> live;
+	live.reserve(AllocatorLiveCount);
+	double bestSeconds = 0.0;
+	for (int iteration = 0; iteration <= AllocatorIterations; iteration++)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		for (const S_Operation &operation : operations)
+		{
+			if (live.empty() || (operation.allocate && live.size() < AllocatorLiveCount))
+			{
+				request.requirements.size = operation.size;
+				live.push_back(memoryAllocator.Allocate(request));
+			}
+			else
+			{
+				size_t index = operation.victim % live.size();
+				memoryAllocator.Free(live[index]);
+				live[index] = live.back();
+				live.pop_back();
+			}
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		for (const S_DeviceAllocation &allocation : live) memoryAllocator.Free(allocation);
+		live.clear();
+		if (iteration > 0 && (bestSeconds == 0.0 || seconds < bestSeconds)) bestSeconds = seconds;
+	}
+
+	out << "Allocating " << AllocatorOperations << " times with up to " << AllocatorLiveCount << " alive, "
+		<< AllocatorIterations << " iterations" << std::endl;
+	out << "  " << bestSeconds * 1000.0 << " ms, " << (uint64_t)(AllocatorOperations / bestSeconds) << " operations/s" << std::endl;
+	AddMetric(pMetrics, "allocator.throughput", AllocatorOperations / bestSeconds, "operations/s");
+}
+
+void Benchmark::TransformThroughput(std::ostream &out, std::vector<S_BenchmarkMetric> *pMetrics)
+{
+	uint32_t count = (TransformCount + TransformSystem::BatchSize - 1) / TransformSystem::BatchSize * TransformSystem::BatchSize;
+
+	// The same random transforms in both layouts.
+	struct S_Object
+	{
+		glm::vec3 position;
+		glm::vec4 rotation;
+		glm::vec3 scale;
+	};
+	std::vector<S_Object> objects(count);
+	S_TransformArrays arrays;
+	arrays.Resize(count);
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		S_Object &object = objects[i];
+		object.position = glm::vec3(distribution(random), distribution(random), distribution(random)) * 100.0f;
+		object.rotation = glm::vec4(distribution(random), distribution(random), distribution(random), distribution(random));
+		if (glm::length(object.rotation) < 0.001f) object.rotation = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		object.rotation = glm::normalize(object.rotation);
+		object.scale = glm::vec3(1.0f) + glm::vec3(distribution(random), distribution(random), distribution(random)) * 0.5f;
+
+		arrays.positionX[i] = object.position.x;
+		arrays.positionY[i] = object.position.y;
+		arrays.positionZ[i] = object.position.z;
+		arrays.rotationX[i] = object.rotation.x;
+		arrays.rotationY[i] = object.rotation.y;
+		arrays.rotationZ[i] = object.rotation.z;
+		arrays.rotationW[i] = object.rotation.w;
+		arrays.scaleX[i] = object.scale.x;
+		arrays.scaleY[i] = object.scale.y;
+		arrays.scaleZ[i] = object.scale.z;
+	}
+
+	glm::mat4 viewProjection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f)
+		* glm::lookAt(glm::vec3(0.0f, 50.0f, -200.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+	// Kept 16 byte aligned, as the mapped instance buffer is, so the SIMD path gets to use streaming stores.
+	std::vector<glm::vec4> storage(count * sizeof(S_InstanceTransform) / sizeof(glm::vec4) * 2 + 1);
+	S_InstanceTransform *pScalar = (S_InstanceTransform*)(((uintptr_t)storage.data() + 15) & ~(uintptr_t)15);
+	S_InstanceTransform *pSimd = pScalar + count;
+
+	auto time = [](const std::function<void()> &run)
+	{
+		double bestSeconds = 0.0;
+		for (int iteration = 0; iteration <= TransformIterations; iteration++)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			run();
+			double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+			if (iteration > 0 && (bestSeconds == 0.0 || seconds < bestSeconds)) bestSeconds = seconds;
+		}
+		return bestSeconds;
+	};
+
+	// What the transform system replaces: a matrix per step, multiplied together.
+	double arraySeconds = time([&]()
+	{
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const glm::vec4 &q = objects[i].rotation;
+			glm::mat4 rotation(1.0f);
+			rotation[0] = glm::vec4(1.0f - 2.0f * (q.y * q.y + q.z * q.z), 2.0f * (q.x * q.y + q.w * q.z), 2.0f * (q.x * q.z - q.w * q.y), 0.0f);
+			rotation[1] = glm::vec4(2.0f * (q.x * q.y - q.w * q.z), 1.0f - 2.0f * (q.x * q.x + q.z * q.z), 2.0f * (q.y * q.z + q.w * q.x), 0.0f);
+			rotation[2] = glm::vec4(2.0f * (q.x * q.z + q.w * q.y), 2.0f * (q.y * q.z - q.w * q.x), 1.0f - 2.0f * (q.x * q.x + q.y * q.y), 0.0f);
+			glm::mat4 world = glm::translate(glm::mat4(1.0f), objects[i].position) * rotation * glm::scale(glm::mat4(1.0f), objects[i].scale);
+			pScalar[i].world = world;
+			pScalar[i].worldViewProjection = viewProjection * world;
+		}
+	});
+	double scalarSeconds = time([&]() { TransformSystem::ComputeScalar(arrays, 0, count, viewProjection, pScalar); });
+	double simdSeconds = time([&]() { TransformSystem::ComputeSimd(arrays, 0, count, viewProjection, pSimd); });
+
+	// Relative to each matrix's largest element, since the projection makes some of them large.
+	float maxError = 0.0f;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const float *pA = &pScalar[i].world[0][0];
+		const float *pB = &pSimd[i].world[0][0];
+		float magnitude = 1.0f;
+		for (int j = 0; j < 32; j++) magnitude = std::max(magnitude, std::abs(pA[j]));
+		for (int j = 0; j < 32; j++) maxError = std::max(maxError, std::abs(pA[j] - pB[j]) / magnitude);
+	}
+
+	out << "Transforming " << count << " objects, " << TransformIterations << " iterations" << std::endl;
+	out << "  AoS glm:    " << arraySeconds * 1000.0 << " ms, " << (uint64_t)(count / arraySeconds) << " objects/s" << std::endl;
+	out << "  SoA scalar: " << scalarSeconds * 1000.0 << " ms, " << (uint64_t)(count / scalarSeconds) << " objects/s, "
+		<< arraySeconds / scalarSeconds << "x" << std::endl;
+#ifdef TRANSFORMSYSTEM_SSE
+	out << "  SoA SSE:    ";
+#else
+	out << "  SoA SIMD (scalar fallback): ";
+#endif
+	out << simdSeconds * 1000.0 << " ms, " << (uint64_t)(count / simdSeconds) << " objects/s, " << arraySeconds / simdSeconds << "x" << std::endl;
+	out << "  Largest SIMD difference from scalar: " << maxError << std::endl;
+
+	AddMetric(pMetrics, "transforms.aos", count / arraySeconds, "objects/s");
+	AddMetric(pMetrics, "transforms.soaScalar", count / scalarSeconds, "objects/s");
+	AddMetric(pMetrics, "transforms.soaSimd", count / simdSeconds, "objects/s");
+}
+
+void Benchmark::AddMetric(std::vector<S_BenchmarkMetric> *pMetrics, const std::string &name, double value, const char *unit)
+{
+	if (pMetrics != nullptr) pMetrics->push_back({ name, value, unit });
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "DeviceMemoryAllocator.h"
+#include "SubmissionScheduler.h"
+#include "UploadService.h"
+
+// One number out of a benchmark, for the JSON the benchmark suite writes.
+struct S_BenchmarkMetric
+{
+	std::string name;
+	double value;
+	std::string unit;
+};
+
+// Timing runs that need no window. The device ones are driven from headless mode.
+// Each prints what it measured, and also adds it to pMetrics if there is one.
+class Benchmark
+{
+public:
+
+	// Record the same synthetic scene with 1, 2, 4... threads up to one per core, and report how recording throughput scales.
+	// Every chunk is a secondary command buffer full of small fills into a scratch buffer, so the GPU side stays trivial.
+	static void RecordingScaling(VkDevice logicalDevice, SubmissionScheduler &scheduler, int familyIndex, DeviceMemoryAllocator &memoryAllocator,
+		const VkAllocationCallbacks *pAllocator, std::ostream &out, std::vector<S_BenchmarkMetric> *pMetrics = nullptr);
+
+	// Push a device local buffer's worth of data through the upload service, and report the bandwidth from the first copy
+	// until the transfer queue is done. familyIndex is graphics, where the buffer is acquired afterwards.
+	static void UploadBandwidth(VkDevice logicalDevice, SubmissionScheduler &scheduler, int familyIndex, UploadService &uploadService,
+		DeviceMemoryAllocator &memoryAllocator, const VkAllocationCallbacks *pAllocator, std::ostream &out,
+		std::vector<S_BenchmarkMetric> *pMetrics = nullptr);
+
+	// Submit the same empty command buffers on graphics, flushing after every one and then once for all of them,
+	// and report the CPU time per command buffer both ways. The difference is what batching saves.
+	static void SubmissionBatching(VkDevice logicalDevice, SubmissionScheduler &scheduler, int familyIndex,
+		const VkAllocationCallbacks *pAllocator, std::ostream &out, std::vector<S_BenchmarkMetric> *pMetrics = nullptr);
+
+	// Allocate and free a fixed random mix of sizes with a bounded number alive at once, and report operations per second.
+	// Blocks the allocator pulls from the device on the way count too, but the first pass isn't timed.
+	static void AllocatorThroughput(DeviceMemoryAllocator &memoryAllocator, std::ostream &out, std::vector<S_BenchmarkMetric> *pMetrics = nullptr);
+
+	// Compute world and world-view-projection matrices for many objects three ways: glm on an array of structures,
+	// the transform system's scalar path over its structure of arrays, and its SIMD path. CPU only.
+	static void TransformThroughput(std::ostream &out, std::vector<S_BenchmarkMetric> *pMetrics = nullptr);
+
+	static uint32_t RecordingChunks;
+	static uint32_t RecordingCommandsPerChunk;
+	static int RecordingIterations;
+	static VkDeviceSize UploadSize;
+	static VkDeviceSize UploadChunkSize; // Capped to a quarter of the staging ring.
+	static int UploadIterations;
+	static uint32_t SubmissionCount;
+	static int SubmissionIterations;
+	static uint32_t AllocatorOperations;
+	static uint32_t AllocatorLiveCount;
+	static int AllocatorIterations;
+	static uint32_t TransformCount;
+	static int TransformIterations;
+
+private:
+
+	static void AddMetric(std::vector<S_BenchmarkMetric> *pMetrics, const std::string &name, double value, const char *unit);
+};
+
+#endif
@@ -0,0 +1,43 @@
+#include "stdafx.h"
+#include "BenchmarkSuite.h"
+
+// The benchmark suite on its own, for machines that only ever run headless, like the Linux fleet on lavapipe.
+// Run it from the directory holding shaders/, or point --shader-dir at them.
+int main(int argc, char *argv[])
+{
+	// Validation would dominate the timings, and a pipeline cache left by the last run would hide compile times.
+	Vulkan::ValidationLayers.clear();
+	Vulkan::PipelineCachePath.clear();
+
+	// Parse command line options.
+	// --json PATH is where the results go, benchmark.json by default.
+	// --frames N is how many offscreen frames are timed, after the warm-up ones.
+	// --no-timeline submits with fences instead of timeline semaphores, to compare the two.
+	std::string jsonPath = "benchmark.json";
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) jsonPath = argv[++i];
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) BenchmarkSuite::TimedFrames = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--validation") == 0) Vulkan::ValidationLayers = { "VK_LAYER_KHRONOS_validation" };
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) Vulkan::WorkerThreads = std::max(0, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--shader-dir") == 0 && i + 1 < argc) Vulkan::ShaderDirectory = argv[++i];
+		else if (strcmp(argv[i], "--cull-instances") == 0 && i + 1 < argc) Vulkan::CullInstances = (uint32_t)std::max(0, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--no-timeline") == 0) Vulkan::TimelineSemaphores = false;
+	}
+
+	std::ofstream json(jsonPath);
+	if (!json.is_open())
+	{
+		std::cerr << "Failed to open " << jsonPath << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	try { BenchmarkSuite::Run(json, std::cout); }
+	catch (const std::runtime_error& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
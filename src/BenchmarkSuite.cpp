@@ -0,0 +1,74 @@
+#include "stdafx.h"
+#include "BenchmarkSuite.h"
+
+#include <chrono>
+
+int BenchmarkSuite::WarmupFrames = 10;
+int BenchmarkSuite::TimedFrames = 200;
+
+void BenchmarkSuite::Run(std::ostream &json, std::ostream &log)
+{
+	Vulkan::Headless = true;
+	Vulkan app;
+	app.Init();
+
+	// Startup, stage by stage, as the engine timed it.
+	std::vector<S_BenchmarkMetric> metrics;
+	const StartupReport &startupReport = app.GetStartupReport();
+	for (const StartupReport::S_Stage &stage : startupReport.GetStages())
+		metrics.push_back({ "init." + stage.name, stage.milliseconds, "ms" });
+	metrics.push_back({ "init.total", startupReport.GetTotalMilliseconds(), "ms" });
+	log << "Startup took " << startupReport.GetTotalMilliseconds() << " ms" << std::endl;
+
+	Benchmark::RecordingScaling(app.GetDevice(), app.GetScheduler(), app.GetGraphicsFamily(), app.GetMemoryAllocator(),
+		app.GetAllocationCallbacks(), log, &metrics);
+	Benchmark::UploadBandwidth(app.GetDevice(), app.GetScheduler(), app.GetGraphicsFamily(), app.GetUploadService(),
+		app.GetMemoryAllocator(), app.GetAllocationCallbacks(), log, &metrics);
+	Benchmark::SubmissionBatching(app.GetDevice(), app.GetScheduler(), app.GetGraphicsFamily(), app.GetAllocationCallbacks(), log, &metrics);
+	Benchmark::AllocatorThroughput(app.GetMemoryAllocator(), log, &metrics);
+	Benchmark::TransformThroughput(log, &metrics);
+
+	// Whole frames, CPU and GPU, since each one waits for the last. The first few are streaming and compiling.
+	std::vector<double> frameTimes;
+	for (int frame = 0; frame < WarmupFrames + TimedFrames; frame++)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		app.DrawOffscreenFrame(frame);
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		if (frame >= WarmupFrames) frameTimes.push_back(milliseconds);
+	}
+
+	if (!frameTimes.empty())
+	{
+		double total = 0.0;
+		for (double milliseconds : frameTimes) total += milliseconds;
+		std::sort(frameTimes.begin(), frameTimes.end());
+		double mean = total / frameTimes.size();
+		double median = frameTimes[frameTimes.size() / 2];
+		double p95 = frameTimes[std::min(frameTimes.size() - 1, frameTimes.size() * 95 / 100)];
+
+		log << "Drawing " << frameTimes.size() << " offscreen frames at " << Vulkan::Width << "x" << Vulkan::Height << std::endl;
+		log << "  mean " << mean << " ms, median " << median << " ms, 95th percentile " << p95 << " ms" << std::endl;
+		metrics.push_back({ "frame.mean", mean, "ms" });
+		metrics.push_back({ "frame.median", median, "ms" });
+		metrics.push_back({ "frame.p95", p95, "ms" });
+	}
+
+	WriteJson(json, app.GetDeviceProfile(), metrics); // The profile goes with the device.
+	app.Cleanup();
+}
+
+// Flat, so a tracker can match metrics between runs by name alone.
+void BenchmarkSuite::WriteJson(std::ostream &out, const DeviceCapabilityProfile &profile, const std::vector<S_BenchmarkMetric> &metrics)
+{
+	out << "{" << std::endl;
+	StartupReport::WriteDeviceJson(out, profile);
+	out << "  \"metrics\": [" << std::endl;
+	for (size_t i = 0; i < metrics.size(); i++)
+	{
+		out << "    { \"name\": \"" << StartupReport::Escape(metrics[i].name) << "\", \"value\": " << metrics[i].value
+			<< ", \"unit\": \"" << StartupReport::Escape(metrics[i].unit) << "\" }" << ((i + 1 < metrics.size()) ? "," : "") << std::endl;
+	}
+	out << "  ]" << std::endl;
+	out << "}" << std::endl;
+}
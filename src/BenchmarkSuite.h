@@ -0,0 +1,26 @@
+#pragma once
+
+#ifndef BENCHMARKSUITE_H
+#define BENCHMARKSUITE_H
+
+#include "Vulkan.h"
+#include "Benchmark.h"
+
+// Every benchmark in one headless run, written out as JSON so a regression tracker can diff runs.
+// It drives the engine through Vulkan::Init and DrawOffscreenFrame, so startup is timed by the engine's own
+// startup report and frames are the engine's own offscreen frames, not a copy of them.
+class BenchmarkSuite
+{
+public:
+
+	// Forces headless, everything else about the engine is left as configured. Progress and details go to log.
+	// Throws like Vulkan::Run does.
+	static void Run(std::ostream &json, std::ostream &log);
+
+	static void WriteJson(std::ostream &out, const DeviceCapabilityProfile &profile, const std::vector<S_BenchmarkMetric> &metrics);
+
+	static int WarmupFrames;
+	static int TimedFrames;
+};
+
+#endif
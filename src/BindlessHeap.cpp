@@ -0,0 +1,211 @@
+#include "stdafx.h"
+#include "BindlessHeap.h"
+
+BindlessHeap::BindlessHeap(VkDevice logicalDevice, const DeviceCapabilityProfile &profile, uint32_t maxSampledImages, uint32_t maxStorageBuffers,
+	SubmissionScheduler &scheduler, const VkAllocationCallbacks *pAllocator)
+	: m_LogicalDevice(logicalDevice), m_Scheduler(scheduler), m_pAllocator(pAllocator)
+{
+	if (!profile.SupportsBindless()) throw std::runtime_error("Device doesn't support bindless descriptors.");
+
+	// Combined image samplers count against both the sampler and the sampled image limits.
+	// Both bindings are visible to every stage, so they share the per-stage resource limit too.
+	const VkPhysicalDeviceDescriptorIndexingPropertiesEXT &limits = profile.GetDescriptorIndexingProperties();
+	m_SampledImages.capacity = std::min({ maxSampledImages,
+		limits.maxPerStageDescriptorUpdateAfterBindSampledImages, limits.maxDescriptorSetUpdateAfterBindSampledImages,
+		limits.maxPerStageDescriptorUpdateAfterBindSamplers, limits.maxDescriptorSetUpdateAfterBindSamplers });
+	m_StorageBuffers.capacity = std::min({ maxStorageBuffers,
+		limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers, limits.maxDescriptorSetUpdateAfterBindStorageBuffers });
+	uint32_t resourceLimit = std::min(limits.maxPerStageUpdateAfterBindResources, limits.maxUpdateAfterBindDescriptorsInAllPools);
+	if (m_SampledImages.capacity + m_StorageBuffers.capacity > resourceLimit)
+	{
+		m_SampledImages.capacity = std::min(m_SampledImages.capacity, resourceLimit / 2);
+		m_StorageBuffers.capacity = std::min(m_StorageBuffers.capacity, resourceLimit - m_SampledImages.capacity);
+	}
+
+	VkDescriptorSetLayoutBinding bindings[2] = {};
+	bindings[0].binding = SampledImageBinding;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[0].descriptorCount = m_SampledImages.capacity;
+	bindings[0].stageFlags = VK_SHADER_STAGE_ALL;
+	bindings[1].binding = StorageBufferBinding;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[1].descriptorCount = m_StorageBuffers.capacity;
+	bindings[1].stageFlags = VK_SHADER_STAGE_ALL;
+
+	VkDescriptorBindingFlagsEXT bindingFlags[2];
+	bindingFlags[0] = bindingFlags[1] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+		VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT;
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = {};
+	bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+	bindingFlagsInfo.bindingCount = 2;
+	bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = &bindingFlagsInfo;
+	layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+	layoutInfo.bindingCount = 2;
+	layoutInfo.pBindings = bindings;
+	VkResult result = vkCreateDescriptorSetLayout(m_LogicalDevice, &layoutInfo, m_pAllocator, &m_DescriptorSetLayout);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create bindless descriptor set layout.");
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_ALL;
+	pushConstantRange.size = PushConstantSize;
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &m_DescriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+	result = vkCreatePipelineLayout(m_LogicalDevice, &pipelineLayoutInfo, m_pAllocator, &m_PipelineLayout);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create bindless pipeline layout.");
+
+	// The one and only set, it lives as long as the heap.
+	VkDescriptorPoolSize poolSizes[2] = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[0].descriptorCount = m_SampledImages.capacity;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[1].descriptorCount = m_StorageBuffers.capacity;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 2;
+	poolInfo.pPoolSizes = poolSizes;
+	result = vkCreateDescriptorPool(m_LogicalDevice, &poolInfo, m_pAllocator, &m_DescriptorPool);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create bindless descriptor pool.");
+
+	VkDescriptorSetAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocateInfo.descriptorPool = m_DescriptorPool;
+	allocateInfo.descriptorSetCount = 1;
+	allocateInfo.pSetLayouts = &m_DescriptorSetLayout;
+	result = vkAllocateDescriptorSets(m_LogicalDevice, &allocateInfo, &m_DescriptorSet);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to allocate bindless descriptor set.");
+}
+
+BindlessHeap::~BindlessHeap()
+{
+	vkDestroyDescriptorPool(m_LogicalDevice, m_DescriptorPool, m_pAllocator); // Frees the set too.
+	vkDestroyPipelineLayout(m_LogicalDevice, m_PipelineLayout, m_pAllocator);
+	vkDestroyDescriptorSetLayout(m_LogicalDevice, m_DescriptorSetLayout, m_pAllocator);
+}
+
+void BindlessHeap::EndFrame(S_TimelinePoint submitted)
+{
+	std::vector<uint32_t> sampledImages, storageBuffers;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		sampledImages.swap(m_SampledImages.removed);
+		storageBuffers.swap(m_StorageBuffers.removed);
+	}
+	if (sampledImages.empty() && storageBuffers.empty()) return;
+
+	m_Scheduler.Retire(submitted, [this, sampledImages, storageBuffers]()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_SampledImages.freeSlots.insert(m_SampledImages.freeSlots.end(), sampledImages.begin(), sampledImages.end());
+		m_StorageBuffers.freeSlots.insert(m_StorageBuffers.freeSlots.end(), storageBuffers.begin(), storageBuffers.end());
+	});
+}
+
+uint32_t BindlessHeap::Allocate(S_SlotArray &slots)
+{
+	uint32_t handle = InvalidHandle;
+	if (!slots.freeSlots.empty())
+	{
+		handle = slots.freeSlots.back();
+		slots.freeSlots.pop_back();
+	}
+	else if (slots.highWater < slots.capacity) handle = slots.highWater++;
+	if (handle != InvalidHandle) slots.live++;
+	return handle;
+}
+
+void BindlessHeap::Retire(S_SlotArray &slots, uint32_t handle)
+{
+	if (handle >= slots.highWater) throw std::runtime_error("Invalid bindless handle.");
+	slots.removed.push_back(handle);
+	slots.live--;
+}
+
+// The descriptor write happens under the lock too, since the set can't be updated from two threads at once.
+uint32_t BindlessHeap::AddSampledImage(VkImageView imageView, VkSampler sampler, VkImageLayout layout)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	uint32_t handle = Allocate(m_SampledImages);
+	if (handle == InvalidHandle) return InvalidHandle;
+
+	VkDescriptorImageInfo imageInfo = {};
+	imageInfo.sampler = sampler;
+	imageInfo.imageView = imageView;
+	imageInfo.imageLayout = layout;
+
+	VkWriteDescriptorSet write = {};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = m_DescriptorSet;
+	write.dstBinding = SampledImageBinding;
+	write.dstArrayElement = handle;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	write.pImageInfo = &imageInfo;
+	vkUpdateDescriptorSets(m_LogicalDevice, 1, &write, 0, nullptr);
+	return handle;
+}
+
+uint32_t BindlessHeap::AddStorageBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	uint32_t handle = Allocate(m_StorageBuffers);
+	if (handle == InvalidHandle) return InvalidHandle;
+
+	VkDescriptorBufferInfo bufferInfo = {};
+	bufferInfo.buffer = buffer;
+	bufferInfo.offset = offset;
+	bufferInfo.range = range;
+
+	VkWriteDescriptorSet write = {};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = m_DescriptorSet;
+	write.dstBinding = StorageBufferBinding;
+	write.dstArrayElement = handle;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	write.pBufferInfo = &bufferInfo;
+	vkUpdateDescriptorSets(m_LogicalDevice, 1, &write, 0, nullptr);
+	return handle;
+}
+
+// The descriptor is left as it is. Nothing should index it anymore, and partially bound arrays don't mind.
+void BindlessHeap::RemoveSampledImage(uint32_t handle)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	Retire(m_SampledImages, handle);
+}
+
+void BindlessHeap::RemoveStorageBuffer(uint32_t handle)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	Retire(m_StorageBuffers, handle);
+}
+
+void BindlessHeap::Bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint) const
+{
+	vkCmdBindDescriptorSets(commandBuffer, bindPoint, m_PipelineLayout, 0, 1, &m_DescriptorSet, 0, nullptr);
+}
+
+uint32_t BindlessHeap::GetSampledImageCount() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_SampledImages.live;
+}
+
+uint32_t BindlessHeap::GetStorageBufferCount() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_StorageBuffers.live;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#ifndef BINDLESSHEAP_H
+#define BINDLESSHEAP_H
+
+#include <mutex>
+
+#include "DeviceCapabilityProfile.h"
+#include "SubmissionScheduler.h"
+
+// One global descriptor set holding every sampled image and storage buffer, bound once per command buffer.
+// Shaders index the arrays with a handle passed in push constants, so draws never bind descriptor sets
+// (see shaders/bindless.glsl). Both bindings are update-after-bind and partially bound, so slots can be
+// filled while frames that don't use them are in flight.
+// A removed slot may still be read by frames in flight, so it only goes back on the free list once the
+// frame that removed it has finished. Adding and removing is safe from any thread.
+class BindlessHeap
+{
+public:
+
+	static const uint32_t SampledImageBinding = 0; // Combined image samplers.
+	static const uint32_t StorageBufferBinding = 1;
+	static const uint32_t PushConstantSize = 128; // The least every device supports.
+	static const uint32_t InvalidHandle = UINT32_MAX;
+
+	// The counts are clamped to the device's update-after-bind limits.
+	BindlessHeap(VkDevice logicalDevice, const DeviceCapabilityProfile &profile, uint32_t maxSampledImages, uint32_t maxStorageBuffers,
+		SubmissionScheduler &scheduler, const VkAllocationCallbacks *pAllocator);
+	~BindlessHeap();
+
+	// Retires the slots removed since the last call against the frame that was just submitted.
+	void EndFrame(S_TimelinePoint submitted);
+
+	// Return InvalidHandle once the heap is full.
+	uint32_t AddSampledImage(VkImageView imageView, VkSampler sampler, VkImageLayout layout);
+	uint32_t AddStorageBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
+	void RemoveSampledImage(uint32_t handle);
+	void RemoveStorageBuffer(uint32_t handle);
+
+	// Every pipeline that reads the heap uses this layout, so the set stays bound across pipeline changes.
+	void Bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint) const;
+	VkDescriptorSetLayout GetDescriptorSetLayout() const { return m_DescriptorSetLayout; }
+	VkPipelineLayout GetPipelineLayout() const { return m_PipelineLayout; }
+
+	uint32_t GetSampledImageCapacity() const { return m_SampledImages.capacity; }
+	uint32_t GetStorageBufferCapacity() const { return m_StorageBuffers.capacity; }
+	uint32_t GetSampledImageCount() const;
+	uint32_t GetStorageBufferCount() const;
+
+private:
+
+	// Slots are handed out from the free list first, then from the end of what's ever been used.
+	struct S_SlotArray
+	{
+		uint32_t capacity = 0;
+		uint32_t highWater = 0;
+		std::vector<uint32_t> freeSlots;
+		std::vector<uint32_t> removed; // Since the last EndFrame.
+		uint32_t live = 0;
+	};
+
+	VkDevice m_LogicalDevice;
+	SubmissionScheduler &m_Scheduler;
+	const VkAllocationCallbacks *m_pAllocator;
+	VkDescriptorSetLayout m_DescriptorSetLayout = VK_NULL_HANDLE;
+	VkPipelineLayout m_PipelineLayout = VK_NULL_HANDLE;
+	VkDescriptorPool m_DescriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSet m_DescriptorSet = VK_NULL_HANDLE;
+
+	mutable std::mutex m_Mutex;
+	S_SlotArray m_SampledImages;
+	S_SlotArray m_StorageBuffers;
+
+	static uint32_t Allocate(S_SlotArray &slots);
+	void Retire(S_SlotArray &slots, uint32_t handle);
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include "stdafx.h"
+#include "CommandRecorder.h"
+
+#include <cassert>
+
+CommandRecorder::CommandRecorder(VkDevice logicalDevice, int familyIndex, int threadCount, int frameCount, const VkAllocationCallbacks *pAllocator)
+	: m_LogicalDevice(logicalDevice), m_pAllocator(pAllocator)
+{
+	// Transient, since everything in these pools is re-recorded every frame.
+	VkCommandPoolCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	createInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	createInfo.queueFamilyIndex = familyIndex;
+
+	m_Pools.resize(frameCount);
+	for (std::vector<S_ThreadPool> &framePools : m_Pools)
+	{
+		framePools.resize(threadCount);
+		for (S_ThreadPool &threadPool : framePools)
+		{
+			VkResult result = vkCreateCommandPool(m_LogicalDevice, &createInfo, m_pAllocator, &threadPool.commandPool);
+			if (result != VK_SUCCESS) throw std::runtime_error("Failed to create per-thread command pool.");
+		}
+	}
+}
+
+CommandRecorder::~CommandRecorder()
+{
+	for (std::vector<S_ThreadPool> &framePools : m_Pools)
+		for (S_ThreadPool &threadPool : framePools)
+			vkDestroyCommandPool(m_LogicalDevice, threadPool.commandPool, m_pAllocator); // Frees the buffers too.
+}
+
+// Resetting the whole pool is much cheaper than resetting each buffer.
+void CommandRecorder::BeginFrame(int frameIndex)
+{
+	m_FrameIndex = frameIndex;
+	for (S_ThreadPool &threadPool : m_Pools[frameIndex])
+	{
+		vkResetCommandPool(m_LogicalDevice, threadPool.commandPool, 0);
+		threadPool.used = 0;
+	}
+}
+
+VkCommandBuffer CommandRecorder::NextCommandBuffer(S_ThreadPool &threadPool)
+{
+	if (threadPool.used == threadPool.commandBuffers.size())
+	{
+		VkCommandBufferAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocateInfo.commandPool = threadPool.commandPool;
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocateInfo.commandBufferCount = 1;
+
+		VkCommandBuffer commandBuffer;
+		VkResult result = vkAllocateCommandBuffers(m_LogicalDevice, &allocateInfo, &commandBuffer);
+		if (result != VK_SUCCESS) throw std::runtime_error("Failed to allocate secondary command buffer.");
+		threadPool.commandBuffers.push_back(commandBuffer);
+	}
+	return threadPool.commandBuffers[threadPool.used++];
+}
+
+void CommandRecorder::RecordParallel(JobSystem &jobSystem, VkCommandBuffer primary, uint32_t chunkCount,
+	const VkCommandBufferInheritanceInfo *pInheritance, std::function<void(VkCommandBuffer commandBuffer, uint32_t chunk)> recordChunk)
+{
+	if (chunkCount == 0) return;
+
+	// Secondaries always need inheritance info, even outside a render pass.
+	VkCommandBufferInheritanceInfo emptyInheritance = {};
+	emptyInheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if (pInheritance != nullptr && pInheritance->renderPass != VK_NULL_HANDLE) beginInfo.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	beginInfo.pInheritanceInfo = (pInheritance != nullptr) ? pInheritance : &emptyInheritance;
+
+	// Each chunk is recorded on whichever thread picks it up, using that thread's pool.
+	std::vector<S_ThreadPool> &framePools = m_Pools[m_FrameIndex];
+	if (jobSystem.GetThreadCount() > (int)framePools.size()) throw std::runtime_error("Job system has more threads than the recorder has pools.");
+	m_Chunks.assign(chunkCount, VK_NULL_HANDLE);
+	jobSystem.ParallelFor(chunkCount, 1, [&](uint32_t chunk, int threadIndex)
+	{
+		assert(threadIndex >= 0 && threadIndex < (int)framePools.size());
+		VkCommandBuffer commandBuffer = NextCommandBuffer(framePools[threadIndex]);
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		recordChunk(commandBuffer, chunk);
+		vkEndCommandBuffer(commandBuffer);
+		m_Chunks[chunk] = commandBuffer;
+	});
+
+	vkCmdExecuteCommands(primary, chunkCount, m_Chunks.data());
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#ifndef COMMANDRECORDER_H
+#define COMMANDRECORDER_H
+
+#include "JobSystem.h"
+
+// Records secondary command buffers on every thread of a job system, then executes them from a primary.
+// Command pools can't be used from two threads at once, so every thread gets its own pool for every frame in flight.
+class CommandRecorder
+{
+public:
+
+	CommandRecorder(VkDevice logicalDevice, int familyIndex, int threadCount, int frameCount, const VkAllocationCallbacks *pAllocator);
+	~CommandRecorder();
+
+	// Reset all of this frame's pools. Only call once the frame's fence has signaled.
+	void BeginFrame(int frameIndex);
+
+	// Record chunkCount secondaries in parallel, then execute them in chunk order from the primary.
+	// pInheritance describes the render pass the chunks run in, or null if they run outside one.
+	void RecordParallel(JobSystem &jobSystem, VkCommandBuffer primary, uint32_t chunkCount,
+		const VkCommandBufferInheritanceInfo *pInheritance, std::function<void(VkCommandBuffer commandBuffer, uint32_t chunk)> recordChunk);
+
+private:
+
+	// Secondaries are allocated once and reused, we just rewind the count each frame.
+	struct S_ThreadPool
+	{
+		VkCommandPool commandPool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> commandBuffers;
+		uint32_t used = 0;
+	};
+
+	VkDevice m_LogicalDevice;
+	const VkAllocationCallbacks *m_pAllocator;
+	std::vector<std::vector<S_ThreadPool>> m_Pools; // Indexed by frame, then thread.
+	std::vector<VkCommandBuffer> m_Chunks; // Recorded secondaries, in chunk order.
+	int m_FrameIndex = 0;
+
+	VkCommandBuffer NextCommandBuffer(S_ThreadPool &threadPool);
+};
+
+#endif
@@ -0,0 +1,205 @@
+#include "stdafx.h"
+#include "ComputeKernels.h"
+
+#include <exception>
+
+ComputeKernels::ComputeKernels(VkDevice logicalDevice, DeviceMemoryAllocator &memoryAllocator, ShaderCache &shaderCache,
+	uint32_t workgroupSize, uint32_t maxCount, JobSystem *pJobSystem, const VkAllocationCallbacks *pAllocator)
+	: m_LogicalDevice(logicalDevice), m_MemoryAllocator(memoryAllocator), m_pAllocator(pAllocator),
+	m_WorkgroupSize(workgroupSize), m_MaxCount(std::max(1u, maxCount))
+{
+	// The shared memory trees need a power of two, and the histogram needs a thread per bucket.
+	if (workgroupSize < RadixBuckets || (workgroupSize & (workgroupSize - 1)) != 0)
+		throw std::runtime_error("Compute workgroup size must be a power of two of at least 16.");
+
+	// Pipeline creation only touches the device and the shader cache, which are safe from any thread.
+	// Exceptions can't cross a worker thread, so we hold on to them until every pipeline is done.
+	struct S_Kernel
+	{
+		ComputePipeline **ppPipeline;
+		const char *fileName;
+		uint32_t bufferCount;
+	};
+	const S_Kernel kernels[] =
+	{
+		{ &m_pReduce, "reduce.spv", 2 },
+		{ &m_pScan, "scan.spv", 2 },
+		{ &m_pScanAdd, "scan_add.spv", 2 },
+		{ &m_pHistogram, "radix_histogram.spv", 2 },
+		{ &m_pScatter, "radix_scatter.spv", 3 },
+	};
+	const uint32_t kernelCount = sizeof(kernels) / sizeof(kernels[0]);
+	std::exception_ptr errors[kernelCount];
+
+	auto build = [&](uint32_t index, int threadIndex)
+	{
+		try
+		{
+			const S_Kernel &kernel = kernels[index];
+			*kernel.ppPipeline = shaderCache.GetComputePipeline(kernel.fileName, kernel.bufferCount, m_WorkgroupSize);
+		}
+		catch (...) { errors[index] = std::current_exception(); }
+	};
+	if (pJobSystem != nullptr) pJobSystem->ParallelFor(kernelCount, 1, build);
+	else for (uint32_t i = 0; i < kernelCount; i++) build(i, 0);
+
+	for (std::exception_ptr &error : errors)
+	{
+		if (error) std::rethrow_exception(error);
+	}
+
+	VkDescriptorPoolSize poolSize = {};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = MaxDescriptorSets * 3;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = MaxDescriptorSets;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	VkResult result = vkCreateDescriptorPool(m_LogicalDevice, &poolInfo, m_pAllocator, &m_DescriptorPool);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create compute descriptor pool.");
+
+	// Each level of a scan or reduce shrinks the data by one block, until a single block is left.
+	// The last level still gets a buffer, since the scan always writes its block total.
+	// Sorting scans the histograms, which can outnumber the keys for tiny inputs.
+	uint32_t blockSize = m_WorkgroupSize * 2;
+	uint32_t levelCount = std::max(m_MaxCount, GroupCount(m_MaxCount, m_WorkgroupSize) * RadixBuckets);
+	do
+	{
+		levelCount = GroupCount(levelCount, blockSize);
+		m_LevelBuffers.push_back(CreateStorageBuffer(levelCount * sizeof(uint32_t), false));
+	} while (levelCount > 1);
+
+	m_Histograms = CreateStorageBuffer((VkDeviceSize)GroupCount(m_MaxCount, m_WorkgroupSize) * RadixBuckets * sizeof(uint32_t), false);
+	m_SortScratch = CreateStorageBuffer((VkDeviceSize)m_MaxCount * sizeof(uint32_t), false);
+}
+
+ComputeKernels::~ComputeKernels()
+{
+	for (S_ComputeBuffer &buffer : m_LevelBuffers) DestroyStorageBuffer(buffer);
+	DestroyStorageBuffer(m_Histograms);
+	DestroyStorageBuffer(m_SortScratch);
+	vkDestroyDescriptorPool(m_LogicalDevice, m_DescriptorPool, m_pAllocator); // Frees the sets too.
+}
+
+S_ComputeBuffer ComputeKernels::CreateStorageBuffer(VkDeviceSize size, bool hostVisible)
+{
+	return ComputePipeline::CreateBuffer(m_LogicalDevice, m_MemoryAllocator, size,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, hostVisible, m_pAllocator);
+}
+
+void ComputeKernels::DestroyStorageBuffer(S_ComputeBuffer &buffer)
+{
+	ComputePipeline::DestroyBuffer(m_LogicalDevice, m_MemoryAllocator, buffer, m_pAllocator);
+}
+
+void ComputeKernels::ResetDescriptors()
+{
+	vkResetDescriptorPool(m_LogicalDevice, m_DescriptorPool, 0);
+}
+
+void ComputeKernels::CheckCount(uint32_t count) const
+{
+	if (count > m_MaxCount) throw std::runtime_error("Compute kernel input is larger than the scratch buffers.");
+}
+
+// Each pass sums two elements per thread and writes one partial sum per workgroup, until one workgroup is left.
+void ComputeKernels::RecordReduce(VkCommandBuffer commandBuffer, VkBuffer input, uint32_t count, VkBuffer output)
+{
+	CheckCount(count);
+
+	VkBuffer source = input;
+	uint32_t blockSize = m_WorkgroupSize * 2;
+	for (size_t level = 0;; level++)
+	{
+		S_ComputePushConstants pushConstants;
+		pushConstants.count = count;
+		pushConstants.groupCount = std::max(1u, GroupCount(count, blockSize)); // An empty input still writes a zero.
+
+		VkBuffer destination = (pushConstants.groupCount == 1) ? output : m_LevelBuffers[level].buffer;
+		m_pReduce->Dispatch(commandBuffer, m_pReduce->BindBuffers(m_DescriptorPool, { source, destination }), pushConstants, pushConstants.groupCount);
+		if (pushConstants.groupCount == 1) break;
+
+		ComputePipeline::RecordBarrier(commandBuffer);
+		source = destination;
+		count = pushConstants.groupCount;
+	}
+}
+
+void ComputeKernels::RecordScan(VkCommandBuffer commandBuffer, VkBuffer data, uint32_t count)
+{
+	CheckCount(count);
+	if (count > 0) RecordScanLevel(commandBuffer, data, count, 0);
+}
+
+// Scan every block and keep the block totals, then scan the totals and add them back to their blocks.
+void ComputeKernels::RecordScanLevel(VkCommandBuffer commandBuffer, VkBuffer data, uint32_t count, size_t level)
+{
+	S_ComputePushConstants pushConstants;
+	pushConstants.count = count;
+	pushConstants.groupCount = GroupCount(count, m_WorkgroupSize * 2);
+
+	VkBuffer blockSums = m_LevelBuffers[level].buffer;
+	m_pScan->Dispatch(commandBuffer, m_pScan->BindBuffers(m_DescriptorPool, { data, blockSums }), pushConstants, pushConstants.groupCount);
+	if (pushConstants.groupCount == 1) return;
+
+	ComputePipeline::RecordBarrier(commandBuffer);
+	RecordScanLevel(commandBuffer, blockSums, pushConstants.groupCount, level + 1);
+	ComputePipeline::RecordBarrier(commandBuffer);
+	m_pScanAdd->Dispatch(commandBuffer, m_pScanAdd->BindBuffers(m_DescriptorPool, { data, blockSums }), pushConstants, pushConstants.groupCount);
+}
+
+// Least significant digit first, RadixBits at a time, ping-ponging between the keys and the scratch buffer.
+// Each pass counts digits per workgroup, scans the counts into output offsets, then scatters in order.
+void ComputeKernels::RecordRadixSort(VkCommandBuffer commandBuffer, VkBuffer keys, uint32_t count)
+{
+	CheckCount(count);
+	if (count <= 1) return;
+
+	S_ComputePushConstants pushConstants;
+	pushConstants.count = count;
+	pushConstants.groupCount = GroupCount(count, m_WorkgroupSize);
+
+	VkBuffer source = keys, destination = m_SortScratch.buffer;
+	for (uint32_t shift = 0; shift < 32; shift += RadixBits)
+	{
+		pushConstants.shift = shift;
+		m_pHistogram->Dispatch(commandBuffer, m_pHistogram->BindBuffers(m_DescriptorPool, { source, m_Histograms.buffer }),
+			pushConstants, pushConstants.groupCount);
+		ComputePipeline::RecordBarrier(commandBuffer);
+		RecordScanLevel(commandBuffer, m_Histograms.buffer, pushConstants.groupCount * RadixBuckets, 0);
+		ComputePipeline::RecordBarrier(commandBuffer);
+		m_pScatter->Dispatch(commandBuffer, m_pScatter->BindBuffers(m_DescriptorPool, { source, destination, m_Histograms.buffer }),
+			pushConstants, pushConstants.groupCount);
+		ComputePipeline::RecordBarrier(commandBuffer);
+		std::swap(source, destination);
+	}
+	// An even number of passes, so the sorted keys end up back in the caller's buffer.
+}
+
+uint32_t ComputeKernels::ReferenceReduce(const std::vector<uint32_t> &data)
+{
+	uint32_t sum = 0;
+	for (uint32_t value : data) sum += value; // Wraps the same way the shader does.
+	return sum;
+}
+
+std::vector<uint32_t> ComputeKernels::ReferenceScan(const std::vector<uint32_t> &data)
+{
+	std::vector<uint32_t> result(data.size());
+	uint32_t sum = 0;
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		result[i] = sum;
+		sum += data[i];
+	}
+	return result;
+}
+
+std::vector<uint32_t> ComputeKernels::ReferenceSort(const std::vector<uint32_t> &data)
+{
+	std::vector<uint32_t> result = data;
+	std::sort(result.begin(), result.end());
+	return result;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#ifndef COMPUTEKERNELS_H
+#define COMPUTEKERNELS_H
+
+#include "DeviceMemoryAllocator.h"
+#include "JobSystem.h"
+#include "ShaderCache.h"
+
+// Scan, reduce and radix sort over uint32 storage buffers.
+// The Record functions only record dispatches and the barriers between them. The caller still has to
+// make the input visible to compute shaders before, and barrier on the shader writes after.
+// Every kernel runs on the same workgroup size, which has to be a power of two of at least RadixBuckets.
+// Given a job system, the pipelines compile on its worker threads instead of one after the other.
+// The pipelines belong to the shader cache, which may rebuild them underneath us when their shaders change.
+class ComputeKernels
+{
+public:
+
+	static const uint32_t RadixBits = 4;
+	static const uint32_t RadixBuckets = 1 << RadixBits;
+
+	ComputeKernels(VkDevice logicalDevice, DeviceMemoryAllocator &memoryAllocator, ShaderCache &shaderCache,
+		uint32_t workgroupSize, uint32_t maxCount, JobSystem *pJobSystem, const VkAllocationCallbacks *pAllocator);
+	~ComputeKernels();
+
+	// Descriptor sets are allocated per dispatch. Reset once everything recorded since the last reset has finished.
+	void ResetDescriptors();
+
+	void RecordReduce(VkCommandBuffer commandBuffer, VkBuffer input, uint32_t count, VkBuffer output); // Sum into output[0].
+	void RecordScan(VkCommandBuffer commandBuffer, VkBuffer data, uint32_t count); // Exclusive prefix sum, in place.
+	void RecordRadixSort(VkCommandBuffer commandBuffer, VkBuffer keys, uint32_t count); // Ascending and stable, in place.
+
+	S_ComputeBuffer CreateStorageBuffer(VkDeviceSize size, bool hostVisible);
+	void DestroyStorageBuffer(S_ComputeBuffer &buffer);
+
+	// What the kernels should produce, for checking them against the CPU.
+	static uint32_t ReferenceReduce(const std::vector<uint32_t> &data);
+	static std::vector<uint32_t> ReferenceScan(const std::vector<uint32_t> &data);
+	static std::vector<uint32_t> ReferenceSort(const std::vector<uint32_t> &data);
+
+	uint32_t GetMaxCount() const { return m_MaxCount; }
+
+private:
+
+	static const uint32_t MaxDescriptorSets = 512;
+
+	VkDevice m_LogicalDevice;
+	DeviceMemoryAllocator &m_MemoryAllocator;
+	const VkAllocationCallbacks *m_pAllocator;
+	uint32_t m_WorkgroupSize;
+	uint32_t m_MaxCount;
+
+	ComputePipeline *m_pReduce = nullptr;
+	ComputePipeline *m_pScan = nullptr;
+	ComputePipeline *m_pScanAdd = nullptr;
+	ComputePipeline *m_pHistogram = nullptr;
+	ComputePipeline *m_pScatter = nullptr;
+	VkDescriptorPool m_DescriptorPool = VK_NULL_HANDLE;
+
+	// Scratch space, sized for m_MaxCount up front.
+	std::vector<S_ComputeBuffer> m_LevelBuffers; // Block sums for each level of a scan, and partial sums for a reduce.
+	S_ComputeBuffer m_Histograms;
+	S_ComputeBuffer m_SortScratch;
+
+	void RecordScanLevel(VkCommandBuffer commandBuffer, VkBuffer data, uint32_t count, size_t level);
+	void CheckCount(uint32_t count) const;
+	static uint32_t GroupCount(uint32_t count, uint32_t elementsPerGroup) { return (count + elementsPerGroup - 1) / elementsPerGroup; }
+};
+
+#endif
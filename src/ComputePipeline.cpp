@@ -0,0 +1,187 @@
+#include "stdafx.h"
+#include "ComputePipeline.h"
+
+ComputePipeline::ComputePipeline(VkDevice logicalDevice, VkShaderModule shaderModule, uint32_t bufferCount, uint32_t workgroupSize,
+	const std::vector<S_SpecializationConstant> &constants, VkPipelineCache pipelineCache, const VkAllocationCallbacks *pAllocator)
+	: m_LogicalDevice(logicalDevice), m_pAllocator(pAllocator), m_BufferCount(bufferCount), m_WorkgroupSize(workgroupSize),
+	m_Constants(constants), m_PipelineCache(pipelineCache)
+{
+	// Binding i is storage buffer i.
+	std::vector<VkDescriptorSetLayoutBinding> bindings(bufferCount);
+	for (uint32_t i = 0; i < bufferCount; i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = bufferCount;
+	layoutInfo.pBindings = bindings.data();
+	VkResult result = vkCreateDescriptorSetLayout(m_LogicalDevice, &layoutInfo, m_pAllocator, &m_DescriptorSetLayout);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create compute descriptor set layout.");
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.size = sizeof(S_ComputePushConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &m_DescriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+	result = vkCreatePipelineLayout(m_LogicalDevice, &pipelineLayoutInfo, m_pAllocator, &m_PipelineLayout);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create compute pipeline layout.");
+
+	m_Pipeline = BuildPipeline(shaderModule);
+}
+
+ComputePipeline::~ComputePipeline()
+{
+	vkDestroyPipeline(m_LogicalDevice, m_Pipeline, m_pAllocator);
+	vkDestroyPipelineLayout(m_LogicalDevice, m_PipelineLayout, m_pAllocator);
+	vkDestroyDescriptorSetLayout(m_LogicalDevice, m_DescriptorSetLayout, m_pAllocator);
+}
+
+VkPipeline ComputePipeline::BuildPipeline(VkShaderModule shaderModule) const
+{
+	// local_size_x_id = 0 in every kernel. The variant's constants follow it.
+	std::vector<uint32_t> data = { m_WorkgroupSize };
+	std::vector<VkSpecializationMapEntry> entries(1 + m_Constants.size());
+	for (const S_SpecializationConstant &constant : m_Constants) data.push_back(constant.value);
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		entries[i].constantID = (i == 0) ? 0 : m_Constants[i - 1].id;
+		entries[i].offset = (uint32_t)(i * sizeof(uint32_t));
+		entries[i].size = sizeof(uint32_t);
+	}
+
+	VkSpecializationInfo specializationInfo = {};
+	specializationInfo.mapEntryCount = (uint32_t)entries.size();
+	specializationInfo.pMapEntries = entries.data();
+	specializationInfo.dataSize = data.size() * sizeof(uint32_t);
+	specializationInfo.pData = data.data();
+
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = shaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.stage.pSpecializationInfo = &specializationInfo;
+	pipelineInfo.layout = m_PipelineLayout;
+
+	VkPipeline pipeline;
+	VkResult result = vkCreateComputePipelines(m_LogicalDevice, m_PipelineCache, 1, &pipelineInfo, m_pAllocator, &pipeline);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create compute pipeline.");
+	return pipeline;
+}
+
+VkPipeline ComputePipeline::SwapPipeline(VkPipeline pipeline)
+{
+	std::swap(m_Pipeline, pipeline);
+	return pipeline;
+}
+
+std::vector<uint32_t> ComputePipeline::LoadSpirv(const std::string &path)
+{
+	std::ifstream file(path, std::ios::ate | std::ios::binary);
+	if (!file.is_open()) throw std::runtime_error("Failed to open shader file " + path + ".");
+
+	size_t size = (size_t)file.tellg();
+	if (size == 0 || size % sizeof(uint32_t) != 0) throw std::runtime_error("Shader file " + path + " is not SPIR-V.");
+
+	std::vector<uint32_t> spirv(size / sizeof(uint32_t));
+	file.seekg(0);
+	file.read((char*)spirv.data(), size);
+	if (!file || spirv[0] != SpirvMagic) throw std::runtime_error("Shader file " + path + " is not SPIR-V."); // Or it's still being written.
+	return spirv;
+}
+
+void ComputePipeline::Dispatch(VkCommandBuffer commandBuffer, VkDescriptorSet descriptorSet, const S_ComputePushConstants &pushConstants, uint32_t groupCount) const
+{
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_Pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_PipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, m_PipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(S_ComputePushConstants), &pushConstants);
+	vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+}
+
+void ComputePipeline::RecordBarrier(VkCommandBuffer commandBuffer)
+{
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+VkDescriptorSet ComputePipeline::BindBuffers(VkDescriptorPool descriptorPool, std::initializer_list<VkBuffer> buffers) const
+{
+	VkDescriptorSetAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocateInfo.descriptorPool = descriptorPool;
+	allocateInfo.descriptorSetCount = 1;
+	allocateInfo.pSetLayouts = &m_DescriptorSetLayout;
+
+	VkDescriptorSet descriptorSet;
+	VkResult result = vkAllocateDescriptorSets(m_LogicalDevice, &allocateInfo, &descriptorSet);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to allocate compute descriptor set.");
+
+	std::vector<VkDescriptorBufferInfo> bufferInfos;
+	std::vector<VkWriteDescriptorSet> writes;
+	bufferInfos.reserve(buffers.size()); // The writes point into this.
+	for (VkBuffer buffer : buffers)
+	{
+		VkDescriptorBufferInfo bufferInfo = {};
+		bufferInfo.buffer = buffer;
+		bufferInfo.range = VK_WHOLE_SIZE;
+		bufferInfos.push_back(bufferInfo);
+
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = descriptorSet;
+		write.dstBinding = (uint32_t)writes.size();
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		write.pBufferInfo = &bufferInfos.back();
+		writes.push_back(write);
+	}
+	vkUpdateDescriptorSets(m_LogicalDevice, (uint32_t)writes.size(), writes.data(), 0, nullptr);
+	return descriptorSet;
+}
+
+S_ComputeBuffer ComputePipeline::CreateBuffer(VkDevice logicalDevice, DeviceMemoryAllocator &memoryAllocator, VkDeviceSize size,
+	VkBufferUsageFlags usage, bool hostVisible, const VkAllocationCallbacks *pAllocator)
+{
+	S_ComputeBuffer buffer;
+	buffer.size = size;
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VkResult result = vkCreateBuffer(logicalDevice, &bufferInfo, pAllocator, &buffer.buffer);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create compute buffer.");
+
+	S_DeviceAllocationRequest request;
+	vkGetBufferMemoryRequirements(logicalDevice, buffer.buffer, &request.requirements);
+	if (hostVisible) request.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	else request.preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	buffer.memory = memoryAllocator.Allocate(request);
+	result = vkBindBufferMemory(logicalDevice, buffer.buffer, buffer.memory.memory, buffer.memory.offset);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to bind compute buffer memory.");
+	return buffer;
+}
+
+void ComputePipeline::DestroyBuffer(VkDevice logicalDevice, DeviceMemoryAllocator &memoryAllocator, S_ComputeBuffer &buffer,
+	const VkAllocationCallbacks *pAllocator)
+{
+	if (buffer.buffer != VK_NULL_HANDLE) vkDestroyBuffer(logicalDevice, buffer.buffer, pAllocator);
+	memoryAllocator.Free(buffer.memory);
+	buffer = S_ComputeBuffer();
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#ifndef COMPUTEPIPELINE_H
+#define COMPUTEPIPELINE_H
+
+#include <initializer_list>
+
+#include "DeviceMemoryAllocator.h"
+
+// Push constants shared by every kernel, so they all use the same range.
+struct S_ComputePushConstants
+{
+	uint32_t count = 0; // Elements to process.
+	uint32_t shift = 0; // Radix sort digit.
+	uint32_t groupCount = 0; // Workgroups in the dispatch, for kernels that index per-group data.
+	uint32_t padding = 0;
+};
+
+struct S_ComputeBuffer
+{
+	VkBuffer buffer = VK_NULL_HANDLE;
+	S_DeviceAllocation memory;
+	VkDeviceSize size = 0;
+};
+
+// One specialization constant of a pipeline variant. They're all 32 bits, which covers bool, int, uint and float.
+struct S_SpecializationConstant
+{
+	uint32_t id = 0;
+	uint32_t value = 0;
+};
+
+// A compute shader whose bindings are all storage buffers.
+// The workgroup size is specialization constant 0, so one SPIR-V module serves every size. Any other constants are the variant's.
+// The module belongs to the caller. The pipeline can be rebuilt from a new one, while the layouts stay as they are.
+class ComputePipeline
+{
+public:
+
+	static const uint32_t SpirvMagic = 0x07230203;
+
+	ComputePipeline(VkDevice logicalDevice, VkShaderModule shaderModule, uint32_t bufferCount, uint32_t workgroupSize,
+		const std::vector<S_SpecializationConstant> &constants, VkPipelineCache pipelineCache, const VkAllocationCallbacks *pAllocator);
+	~ComputePipeline();
+
+	static std::vector<uint32_t> LoadSpirv(const std::string &path);
+
+	// A pipeline like ours from another module, with the same layout and constants. Safe from any thread.
+	VkPipeline BuildPipeline(VkShaderModule shaderModule) const;
+
+	// Returns the old pipeline, which the caller destroys once no command buffer uses it.
+	VkPipeline SwapPipeline(VkPipeline pipeline);
+
+	void Dispatch(VkCommandBuffer commandBuffer, VkDescriptorSet descriptorSet, const S_ComputePushConstants &pushConstants, uint32_t groupCount) const;
+
+	// Make one dispatch's writes visible to the next one.
+	static void RecordBarrier(VkCommandBuffer commandBuffer);
+
+	// A set from the pool with each buffer bound whole, in binding order.
+	VkDescriptorSet BindBuffers(VkDescriptorPool descriptorPool, std::initializer_list<VkBuffer> buffers) const;
+
+	// Buffers for the kernels to bind. Host visible ones are coherent and stay mapped.
+	static S_ComputeBuffer CreateBuffer(VkDevice logicalDevice, DeviceMemoryAllocator &memoryAllocator, VkDeviceSize size,
+		VkBufferUsageFlags usage, bool hostVisible, const VkAllocationCallbacks *pAllocator);
+	static void DestroyBuffer(VkDevice logicalDevice, DeviceMemoryAllocator &memoryAllocator, S_ComputeBuffer &buffer,
+		const VkAllocationCallbacks *pAllocator);
+
+	VkDescriptorSetLayout GetDescriptorSetLayout() const { return m_DescriptorSetLayout; }
+	uint32_t GetBufferCount() const { return m_BufferCount; }
+	uint32_t GetWorkgroupSize() const { return m_WorkgroupSize; }
+	const std::vector<S_SpecializationConstant>& GetConstants() const { return m_Constants; }
+
+private:
+
+	VkDevice m_LogicalDevice;
+	const VkAllocationCallbacks *m_pAllocator;
+	uint32_t m_BufferCount;
+	uint32_t m_WorkgroupSize;
+	std::vector<S_SpecializationConstant> m_Constants;
+	VkPipelineCache m_PipelineCache;
+	VkDescriptorSetLayout m_DescriptorSetLayout = VK_NULL_HANDLE;
+	VkPipelineLayout m_PipelineLayout = VK_NULL_HANDLE;
+	VkPipeline m_Pipeline = VK_NULL_HANDLE;
+};
+
+#endif
@@ -0,0 +1,248 @@
+#include "stdafx.h"
+#include "DebugMessenger.h"
+
+// Appends to a fixed buffer, cutting off whatever doesn't fit. Safe to call from the callback.
+static void AppendText(char *pBuffer, size_t capacity, size_t &length, const char *pText)
+{
+	if (pText == nullptr) return;
+	while (*pText != '\0' && length + 1 < capacity) pBuffer[length++] = *pText++;
+	pBuffer[length] = '\0';
+}
+
+static const char* ObjectTypeName(VkObjectType type)
+{
+	switch (type)
+	{
+	case VK_OBJECT_TYPE_QUEUE: return "Queue";
+	case VK_OBJECT_TYPE_COMMAND_BUFFER: return "CommandBuffer";
+	case VK_OBJECT_TYPE_COMMAND_POOL: return "CommandPool";
+	case VK_OBJECT_TYPE_FENCE: return "Fence";
+	case VK_OBJECT_TYPE_SEMAPHORE: return "Semaphore";
+	case VK_OBJECT_TYPE_DEVICE_MEMORY: return "DeviceMemory";
+	case VK_OBJECT_TYPE_BUFFER: return "Buffer";
+	case VK_OBJECT_TYPE_IMAGE: return "Image";
+	case VK_OBJECT_TYPE_IMAGE_VIEW: return "ImageView";
+	case VK_OBJECT_TYPE_PIPELINE: return "Pipeline";
+	case VK_OBJECT_TYPE_DESCRIPTOR_SET: return "DescriptorSet";
+	case VK_OBJECT_TYPE_SWAPCHAIN_KHR: return "Swapchain";
+	default: return "Object";
+	}
+}
+
+DebugMessenger::DebugMessenger(VkInstance instance, VkDebugUtilsMessageSeverityFlagsEXT severities, std::ostream &out,
+	const VkAllocationCallbacks *pAllocator)
+	: m_Instance(instance), m_pAllocator(pAllocator), m_Out(out), m_Slots(new S_Slot[RingCapacity])
+{
+	for (uint32_t i = 0; i < RingCapacity; i++) m_Slots[i].sequence.store(i, std::memory_order_relaxed);
+
+	// The consumer has to be running before the first message can arrive.
+	m_Consumer = std::thread(&DebugMessenger::ConsumerLoop, this);
+
+	VkDebugUtilsMessengerCreateInfoEXT createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+	createInfo.messageSeverity = severities;
+	createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
+		VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+	createInfo.pfnUserCallback = Callback;
+	createInfo.pUserData = this;
+
+	VkResult result = VK_ERROR_EXTENSION_NOT_PRESENT;
+	auto fn = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
+	if (fn != nullptr) result = fn(instance, &createInfo, m_pAllocator, &m_Messenger);
+	if (result != VK_SUCCESS)
+	{
+		m_Stop = true;
+		m_WakeCondition.notify_all();
+		m_Consumer.join();
+		throw std::runtime_error("Failed to set up debug messenger.");
+	}
+
+	m_pfnSetObjectName = (PFN_vkSetDebugUtilsObjectNameEXT)vkGetInstanceProcAddr(instance, "vkSetDebugUtilsObjectNameEXT");
+	m_pfnBeginLabel = (PFN_vkCmdBeginDebugUtilsLabelEXT)vkGetInstanceProcAddr(instance, "vkCmdBeginDebugUtilsLabelEXT");
+	m_pfnEndLabel = (PFN_vkCmdEndDebugUtilsLabelEXT)vkGetInstanceProcAddr(instance, "vkCmdEndDebugUtilsLabelEXT");
+}
+
+DebugMessenger::~DebugMessenger()
+{
+	auto fn = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(m_Instance, "vkDestroyDebugUtilsMessengerEXT");
+	if (fn != nullptr) fn(m_Instance, m_Messenger, m_pAllocator);
+
+	// No more messages can arrive, so the consumer drains what's left and stops.
+	{
+		std::lock_guard<std::mutex> lock(m_WakeMutex);
+		m_Stop = true;
+	}
+	m_WakeCondition.notify_all();
+	m_Consumer.join();
+
+	// The last window of each message never closed, so report what it held back.
+	for (const auto &repeat : m_Repeats)
+	{
+		if (repeat.second.suppressed > 0) PrintSuppressed(repeat.first, repeat.second.suppressed);
+	}
+	uint32_t dropped = GetDroppedCount();
+	if (dropped > 0) m_Out << "Debug messenger dropped " << dropped << " message(s), the ring was full.\n";
+	m_Out.flush();
+}
+
+void DebugMessenger::SetObjectName(VkDevice logicalDevice, VkObjectType type, uint64_t handle, const char *name) const
+{
+	if (m_pfnSetObjectName == nullptr || handle == 0) return;
+
+	VkDebugUtilsObjectNameInfoEXT nameInfo = {};
+	nameInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT;
+	nameInfo.objectType = type;
+	nameInfo.objectHandle = handle;
+	nameInfo.pObjectName = name;
+	m_pfnSetObjectName(logicalDevice, &nameInfo);
+}
+
+void DebugMessenger::BeginLabel(VkCommandBuffer commandBuffer, const char *name) const
+{
+	if (m_pfnBeginLabel == nullptr) return;
+
+	VkDebugUtilsLabelEXT label = {};
+	label.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT;
+	label.pLabelName = name;
+	m_pfnBeginLabel(commandBuffer, &label);
+}
+
+void DebugMessenger::EndLabel(VkCommandBuffer commandBuffer) const
+{
+	if (m_pfnEndLabel != nullptr) m_pfnEndLabel(commandBuffer);
+}
+
+// Runs on whatever thread the driver or layer reports from. It only copies, and never waits.
+VKAPI_ATTR VkBool32 VKAPI_CALL DebugMessenger::Callback(VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+	VkDebugUtilsMessageTypeFlagsEXT types, const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData, void *pUserData)
+{
+	DebugMessenger *pMessenger = static_cast<DebugMessenger*>(pUserData);
+	if (severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) pMessenger->m_ErrorCount.fetch_add(1, std::memory_order_relaxed);
+	if (!pMessenger->TryPush(severity, types, *pCallbackData)) pMessenger->m_DroppedCount.fetch_add(1, std::memory_order_relaxed);
+	return VK_FALSE; // Never abort the call that triggered the message.
+}
+
+// A bounded multi-producer queue. A producer claims a slot by bumping the head, fills it in,
+// then publishes it by advancing the slot's sequence, which is what the consumer waits for.
+bool DebugMessenger::TryPush(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT types,
+	const VkDebugUtilsMessengerCallbackDataEXT &callbackData)
+{
+	uint64_t position = m_Head.load(std::memory_order_relaxed);
+	S_Slot *pSlot;
+	for (;;)
+	{
+		pSlot = &m_Slots[position & (RingCapacity - 1)];
+		int64_t difference = (int64_t)pSlot->sequence.load(std::memory_order_acquire) - (int64_t)position;
+		if (difference == 0)
+		{
+			if (m_Head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+		}
+		else if (difference < 0) return false; // Full, the consumer hasn't freed this slot yet.
+		else position = m_Head.load(std::memory_order_relaxed); // Someone else claimed it first.
+	}
+
+	S_DebugMessage &message = pSlot->message;
+	message.severity = severity;
+	message.types = types;
+	message.messageId = callbackData.messageIdNumber;
+
+	size_t length = 0;
+	message.idName[0] = '\0';
+	AppendText(message.idName, S_DebugMessage::MaxIdNameLength, length, callbackData.pMessageIdName);
+
+	length = 0;
+	message.text[0] = '\0';
+	AppendText(message.text, S_DebugMessage::MaxTextLength, length, callbackData.pMessage);
+
+	// Names make it obvious which resource a message is about.
+	for (uint32_t i = 0; i < callbackData.objectCount; i++)
+	{
+		const VkDebugUtilsObjectNameInfoEXT &object = callbackData.pObjects[i];
+		if (object.pObjectName == nullptr) continue;
+		AppendText(message.text, S_DebugMessage::MaxTextLength, length, "\n    ");
+		AppendText(message.text, S_DebugMessage::MaxTextLength, length, ObjectTypeName(object.objectType));
+		AppendText(message.text, S_DebugMessage::MaxTextLength, length, " \"");
+		AppendText(message.text, S_DebugMessage::MaxTextLength, length, object.pObjectName);
+		AppendText(message.text, S_DebugMessage::MaxTextLength, length, "\"");
+	}
+	for (uint32_t i = 0; i < callbackData.cmdBufLabelCount; i++)
+	{
+		AppendText(message.text, S_DebugMessage::MaxTextLength, length, "\n    in label \"");
+		AppendText(message.text, S_DebugMessage::MaxTextLength, length, callbackData.pCmdBufLabels[i].pLabelName);
+		AppendText(message.text, S_DebugMessage::MaxTextLength, length, "\"");
+	}
+
+	pSlot->sequence.store(position + 1, std::memory_order_release);
+	return true;
+}
+
+bool DebugMessenger::TryPop(S_DebugMessage &message)
+{
+	S_Slot &slot = m_Slots[m_Tail & (RingCapacity - 1)];
+	if (slot.sequence.load(std::memory_order_acquire) != m_Tail + 1) return false; // Empty, or still being filled in.
+
+	message = slot.message;
+	slot.sequence.store(m_Tail + RingCapacity, std::memory_order_release); // Free for the producer one lap ahead.
+	m_Tail++;
+	return true;
+}
+
+// Producers never signal, so the consumer polls. Messages wait at most one poll interval to be printed.
+void DebugMessenger::ConsumerLoop()
+{
+	S_DebugMessage message;
+	for (;;)
+	{
+		bool printed = false;
+		while (TryPop(message))
+		{
+			Print(message);
+			printed = true;
+		}
+		if (printed) m_Out.flush(); // Once per batch, instead of once per line.
+
+		std::unique_lock<std::mutex> lock(m_WakeMutex);
+		if (m_Stop)
+		{
+			lock.unlock();
+			while (TryPop(message)) Print(message);
+			return;
+		}
+		m_WakeCondition.wait_for(lock, std::chrono::milliseconds(10));
+	}
+}
+
+void DebugMessenger::Print(const S_DebugMessage &message)
+{
+	// Message IDs are 0 on older layers, so the name is part of the key.
+	std::string key = std::string(message.idName) + " (" + std::to_string(message.messageId) + ")";
+	S_RepeatState &repeat = m_Repeats[key];
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (now - repeat.windowStart >= std::chrono::milliseconds(RepeatWindowMs))
+	{
+		if (repeat.suppressed > 0) PrintSuppressed(key, repeat.suppressed);
+		repeat.windowStart = now;
+		repeat.printed = 0;
+		repeat.suppressed = 0;
+	}
+	if (repeat.printed >= RepeatLimit)
+	{
+		repeat.suppressed++;
+		return;
+	}
+	repeat.printed++;
+
+	const char *severity = "Verbose";
+	if (message.severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) severity = "Error";
+	else if (message.severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) severity = "Warning";
+	else if (message.severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT) severity = "Info";
+	const char *type = (message.types & VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT) ? " [Performance]" : "";
+
+	m_Out << severity << type << ": " << key << "\n  " << message.text << "\n";
+}
+
+void DebugMessenger::PrintSuppressed(const std::string &key, uint32_t count)
+{
+	m_Out << "  ... " << count << " more of " << key << " suppressed.\n";
+}
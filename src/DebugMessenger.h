@@ -0,0 +1,99 @@
+#pragma once
+
+#ifndef DEBUGMESSENGER_H
+#define DEBUGMESSENGER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+// One message, copied out of the callback since the driver's strings only live for the call.
+struct S_DebugMessage
+{
+	static const size_t MaxIdNameLength = 64;
+	static const size_t MaxTextLength = 1024; // Longer messages are cut off.
+
+	VkDebugUtilsMessageSeverityFlagBitsEXT severity;
+	VkDebugUtilsMessageTypeFlagsEXT types;
+	int32_t messageId;
+	char idName[MaxIdNameLength];
+	char text[MaxTextLength]; // The message, then the named objects and labels it refers to.
+};
+
+// Receives validation messages through VK_EXT_debug_utils without ever blocking the thread that reports them.
+// The callback copies each message into a bounded lock-free ring, and a background thread formats and prints them.
+// If the ring is full the message is dropped and counted, so a flood of messages can't stall the driver.
+// Each message ID is printed at most RepeatLimit times per RepeatWindowMs, the rest are counted and summarized.
+// The object and label functions do nothing if the extension isn't there, so callers don't have to check.
+class DebugMessenger
+{
+public:
+
+	static const uint32_t RingCapacity = 1024; // Power of two.
+	static const uint32_t RepeatLimit = 5;
+	static const uint32_t RepeatWindowMs = 1000;
+
+	DebugMessenger(VkInstance instance, VkDebugUtilsMessageSeverityFlagsEXT severities, std::ostream &out,
+		const VkAllocationCallbacks *pAllocator);
+	~DebugMessenger(); // Prints whatever is still queued, and a summary of what was suppressed.
+
+	void SetObjectName(VkDevice logicalDevice, VkObjectType type, uint64_t handle, const char *name) const;
+	void BeginLabel(VkCommandBuffer commandBuffer, const char *name) const;
+	void EndLabel(VkCommandBuffer commandBuffer) const;
+
+	uint32_t GetErrorCount() const { return m_ErrorCount.load(std::memory_order_relaxed); }
+	uint32_t GetDroppedCount() const { return m_DroppedCount.load(std::memory_order_relaxed); }
+
+private:
+
+	// Each slot's sequence tells producers and the consumer whose turn it is, so nobody takes a lock.
+	struct S_Slot
+	{
+		std::atomic<uint64_t> sequence;
+		S_DebugMessage message;
+	};
+
+	struct S_RepeatState
+	{
+		uint32_t printed = 0; // In the current window.
+		uint32_t suppressed = 0; // In the current window, reported when it closes.
+		std::chrono::steady_clock::time_point windowStart;
+	};
+
+	VkInstance m_Instance;
+	const VkAllocationCallbacks *m_pAllocator;
+	std::ostream &m_Out;
+	VkDebugUtilsMessengerEXT m_Messenger = VK_NULL_HANDLE;
+
+	PFN_vkSetDebugUtilsObjectNameEXT m_pfnSetObjectName = nullptr;
+	PFN_vkCmdBeginDebugUtilsLabelEXT m_pfnBeginLabel = nullptr;
+	PFN_vkCmdEndDebugUtilsLabelEXT m_pfnEndLabel = nullptr;
+
+	std::unique_ptr<S_Slot[]> m_Slots;
+	std::atomic<uint64_t> m_Head{ 0 }; // Next slot a producer claims.
+	uint64_t m_Tail = 0; // Next slot the consumer reads. Only the consumer touches it.
+	std::atomic<uint32_t> m_ErrorCount{ 0 };
+	std::atomic<uint32_t> m_DroppedCount{ 0 };
+
+	std::thread m_Consumer;
+	std::atomic<bool> m_Stop{ false };
+	std::mutex m_WakeMutex;
+	std::condition_variable m_WakeCondition;
+	std::unordered_map<std::string, S_RepeatState> m_Repeats; // Keyed by message ID. Only the consumer touches it.
+
+	static VKAPI_ATTR VkBool32 VKAPI_CALL Callback(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT types,
+		const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData, void *pUserData);
+
+	bool TryPush(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT types,
+		const VkDebugUtilsMessengerCallbackDataEXT &callbackData);
+	bool TryPop(S_DebugMessage &message);
+	void ConsumerLoop();
+	void Print(const S_DebugMessage &message);
+	void PrintSuppressed(const std::string &key, uint32_t count);
+};
+
+#endif
@@ -0,0 +1,118 @@
+#include "stdafx.h"
+#include "DeviceCapabilityProfile.h"
+
+DeviceCapabilityProfile::DeviceCapabilityProfile(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface,
+	PFN_vkGetPhysicalDeviceFeatures2KHR pfnGetFeatures2, PFN_vkGetPhysicalDeviceProperties2KHR pfnGetProperties2)
+	: m_PhysicalDevice(physicalDevice), m_SwapchainSupport()
+{
+	vkGetPhysicalDeviceProperties(physicalDevice, &m_Properties);
+	vkGetPhysicalDeviceFeatures(physicalDevice, &m_Features);
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &m_MemoryProperties);
+
+	// The spec guarantees at least one device local heap.
+	for (uint32_t i = 0; i < m_MemoryProperties.memoryHeapCount; i++)
+	{
+		const VkMemoryHeap &heap = m_MemoryProperties.memoryHeaps[i];
+		if (!(heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)) continue;
+		const VkMemoryHeap &best = m_MemoryProperties.memoryHeaps[m_DeviceLocalHeap];
+		if (!(best.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) || heap.size > best.size) m_DeviceLocalHeap = i;
+	}
+
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	m_QueueFamilies.resize(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, m_QueueFamilies.data());
+
+	m_PresentSupport.assign(queueFamilyCount, false);
+	if (surface != VK_NULL_HANDLE)
+	{
+		for (uint32_t i = 0; i < queueFamilyCount; i++)
+		{
+			VkBool32 presentation = VK_FALSE;
+			vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, surface, &presentation);
+			m_PresentSupport[i] = (presentation == VK_TRUE);
+		}
+		m_SwapchainSupport = Swapchain::QuerySupport(physicalDevice, surface);
+	}
+
+	// A set, so every later check is a lookup instead of a scan.
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+	for (const VkExtensionProperties &extension : extensions) m_Extensions.insert(extension.extensionName);
+
+	QueryDescriptorIndexing(pfnGetFeatures2, pfnGetProperties2);
+	QueryTimelineSemaphores(pfnGetFeatures2);
+
+	// Older SDK headers don't know about the budget extension, so it's never enabled with them.
+#ifdef VK_EXT_memory_budget
+	m_SupportsMemoryBudget = (pfnGetProperties2 != nullptr) && HasExtension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+#endif
+}
+
+// The extension also needs maintenance3, which it builds on.
+void DeviceCapabilityProfile::QueryDescriptorIndexing(PFN_vkGetPhysicalDeviceFeatures2KHR pfnGetFeatures2,
+	PFN_vkGetPhysicalDeviceProperties2KHR pfnGetProperties2)
+{
+	m_DescriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	m_DescriptorIndexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+	if (pfnGetFeatures2 == nullptr || pfnGetProperties2 == nullptr) return;
+	if (!HasExtension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) || !HasExtension(VK_KHR_MAINTENANCE3_EXTENSION_NAME)) return;
+
+	VkPhysicalDeviceFeatures2KHR features = {};
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+	features.pNext = &m_DescriptorIndexingFeatures;
+	pfnGetFeatures2(m_PhysicalDevice, &features);
+
+	VkPhysicalDeviceProperties2KHR properties = {};
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+	properties.pNext = &m_DescriptorIndexingProperties;
+	pfnGetProperties2(m_PhysicalDevice, &properties);
+
+	// Profiles get copied around, so nothing may point out of them.
+	m_DescriptorIndexingFeatures.pNext = nullptr;
+	m_DescriptorIndexingProperties.pNext = nullptr;
+
+	const VkPhysicalDeviceDescriptorIndexingFeaturesEXT &indexing = m_DescriptorIndexingFeatures;
+	m_SupportsBindless = indexing.runtimeDescriptorArray && indexing.descriptorBindingPartiallyBound &&
+		indexing.descriptorBindingUpdateUnusedWhilePending && indexing.descriptorBindingSampledImageUpdateAfterBind &&
+		indexing.descriptorBindingStorageBufferUpdateAfterBind && indexing.shaderSampledImageArrayNonUniformIndexing;
+}
+
+// Older SDK headers don't know about timeline semaphores either, and the scheduler falls back to fences with them.
+void DeviceCapabilityProfile::QueryTimelineSemaphores(PFN_vkGetPhysicalDeviceFeatures2KHR pfnGetFeatures2)
+{
+#ifdef VK_KHR_timeline_semaphore
+	if (pfnGetFeatures2 == nullptr || !HasExtension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)) return;
+
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = {};
+	timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+	VkPhysicalDeviceFeatures2KHR features = {};
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+	features.pNext = &timelineFeatures;
+	pfnGetFeatures2(m_PhysicalDevice, &features);
+	m_SupportsTimelineSemaphores = (timelineFeatures.timelineSemaphore == VK_TRUE);
+#else
+	(void)pfnGetFeatures2;
+#endif
+}
+
+// Headers older than the KHR extension only know the AMD one.
+const char* DeviceCapabilityProfile::GetDrawIndirectCountExtension() const
+{
+#ifdef VK_KHR_draw_indirect_count
+	if (HasExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) return VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME;
+#endif
+	if (HasExtension(VK_AMD_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) return VK_AMD_DRAW_INDIRECT_COUNT_EXTENSION_NAME;
+	return nullptr;
+}
+
+bool DeviceCapabilityProfile::HasExtensions(const std::vector<const char*> &names) const
+{
+	for (const char *name : names)
+	{
+		if (!HasExtension(name)) return false;
+	}
+	return true;
+}
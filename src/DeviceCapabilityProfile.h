@@ -0,0 +1,71 @@
+#pragma once
+
+#ifndef DEVICECAPABILITYPROFILE_H
+#define DEVICECAPABILITYPROFILE_H
+
+#include "Swapchain.h"
+
+// Everything we ask a physical device during startup, queried once and reused from then on.
+// Surface support is only gathered when there is a surface. The surface capabilities change with the window,
+// so the swapchain still queries those itself when it's (re)created.
+// Descriptor indexing can only be queried through VK_KHR_get_physical_device_properties2. Without its functions,
+// the device is treated as not supporting it.
+class DeviceCapabilityProfile
+{
+public:
+
+	DeviceCapabilityProfile(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface,
+		PFN_vkGetPhysicalDeviceFeatures2KHR pfnGetFeatures2 = nullptr, PFN_vkGetPhysicalDeviceProperties2KHR pfnGetProperties2 = nullptr);
+
+	bool HasExtension(const std::string &name) const { return m_Extensions.count(name) > 0; }
+	bool HasExtensions(const std::vector<const char*> &names) const;
+	bool SupportsPresent(uint32_t family) const { return family < m_PresentSupport.size() && m_PresentSupport[family]; }
+
+	VkPhysicalDevice GetPhysicalDevice() const { return m_PhysicalDevice; }
+	const VkPhysicalDeviceProperties& GetProperties() const { return m_Properties; }
+	const VkPhysicalDeviceFeatures& GetFeatures() const { return m_Features; }
+	const VkPhysicalDeviceMemoryProperties& GetMemoryProperties() const { return m_MemoryProperties; }
+	const std::vector<VkQueueFamilyProperties>& GetQueueFamilies() const { return m_QueueFamilies; }
+	const std::set<std::string>& GetExtensions() const { return m_Extensions; }
+	const S_SwapchainSupport& GetSwapchainSupport() const { return m_SwapchainSupport; }
+
+	// The largest device local heap, which is where our images and buffers end up.
+	uint32_t GetDeviceLocalHeap() const { return m_DeviceLocalHeap; }
+	VkDeviceSize GetDeviceLocalBytes() const { return m_MemoryProperties.memoryHeaps[m_DeviceLocalHeap].size; }
+
+	// VK_EXT_memory_budget, which also needs memory properties 2 from the instance.
+	bool SupportsMemoryBudget() const { return m_SupportsMemoryBudget; }
+
+	// VK_KHR_timeline_semaphore, with its feature on. Like the budget, it needs features 2 from the instance to check.
+	bool SupportsTimelineSemaphores() const { return m_SupportsTimelineSemaphores; }
+
+	// VK_KHR_draw_indirect_count, or the AMD extension it came from. Null if the device has neither.
+	const char* GetDrawIndirectCountExtension() const;
+
+	// Bindless needs update-after-bind, partially bound runtime arrays, and non-uniform indexing of sampled images.
+	bool SupportsBindless() const { return m_SupportsBindless; }
+	const VkPhysicalDeviceDescriptorIndexingFeaturesEXT& GetDescriptorIndexingFeatures() const { return m_DescriptorIndexingFeatures; }
+	const VkPhysicalDeviceDescriptorIndexingPropertiesEXT& GetDescriptorIndexingProperties() const { return m_DescriptorIndexingProperties; }
+
+private:
+
+	VkPhysicalDevice m_PhysicalDevice;
+	VkPhysicalDeviceProperties m_Properties;
+	VkPhysicalDeviceFeatures m_Features;
+	VkPhysicalDeviceMemoryProperties m_MemoryProperties;
+	std::vector<VkQueueFamilyProperties> m_QueueFamilies;
+	std::vector<bool> m_PresentSupport; // Per queue family, all false without a surface.
+	std::set<std::string> m_Extensions;
+	S_SwapchainSupport m_SwapchainSupport;
+	uint32_t m_DeviceLocalHeap = 0;
+	bool m_SupportsMemoryBudget = false;
+	bool m_SupportsTimelineSemaphores = false;
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT m_DescriptorIndexingFeatures = {};
+	VkPhysicalDeviceDescriptorIndexingPropertiesEXT m_DescriptorIndexingProperties = {};
+	bool m_SupportsBindless = false;
+
+	void QueryDescriptorIndexing(PFN_vkGetPhysicalDeviceFeatures2KHR pfnGetFeatures2, PFN_vkGetPhysicalDeviceProperties2KHR pfnGetProperties2);
+	void QueryTimelineSemaphores(PFN_vkGetPhysicalDeviceFeatures2KHR pfnGetFeatures2);
+};
+
+#endif
@@ -0,0 +1,496 @@
+#include "stdafx.h"
+#include "DeviceMemoryAllocator.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+VkDeviceSize DeviceMemoryAllocator::DefaultBlockSize = 64 * 1024 * 1024;
+
+// Index of the highest set bit. The value must not be 0.
+static uint32_t HighestBit(uint64_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return (uint32_t)index;
+#else
+	return 63 - (uint32_t)__builtin_clzll(value);
+#endif
+}
+
+// Index of the lowest set bit. The value must not be 0.
+static uint32_t LowestBit(uint64_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return (uint32_t)index;
+#else
+	return (uint32_t)__builtin_ctzll(value);
+#endif
+}
+
+static VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+TlsfMetadata::TlsfMetadata(VkDeviceSize size)
+	: m_Size(size), m_FreeBytes(size)
+{
+	memset(m_SecondLevelBitmaps, 0, sizeof(m_SecondLevelBitmaps));
+	for (uint32_t f = 0; f < FirstLevelCount; f++)
+		for (uint32_t s = 0; s < SecondLevelCount; s++)
+			m_FreeHeads[f][s] = -1;
+
+	// The whole block starts out as one free range.
+	int index = NewRange();
+	m_Ranges[index].offset = 0;
+	m_Ranges[index].size = size;
+	InsertFree(index);
+}
+
+// Small sizes map linearly into the first list. Above that, the first level is the power of two,
+// and the second level splits each power of two into SecondLevelCount equal classes.
+void TlsfMetadata::Mapping(VkDeviceSize size, uint32_t &firstLevel, uint32_t &secondLevel)
+{
+	if (size < SecondLevelCount)
+	{
+		firstLevel = 0;
+		secondLevel = (uint32_t)size;
+		return;
+	}
+
+	uint32_t highest = HighestBit(size);
+	secondLevel = (uint32_t)(size >> (highest - SecondLevelBits)) ^ SecondLevelCount;
+	firstLevel = highest - SecondLevelBits + 1;
+}
+
+// Find a free range that's guaranteed to hold size, without walking any lists.
+// We round the size up to the next class first, so anything in that class or above fits.
+int TlsfMetadata::FindFreeRange(VkDeviceSize size)
+{
+	if (size >= SecondLevelCount)
+	{
+		VkDeviceSize roundUp = ((VkDeviceSize)1 << (HighestBit(size) - SecondLevelBits)) - 1;
+		if (size + roundUp < size) return -1; // Overflow, nothing can be this big.
+		size += roundUp;
+	}
+
+	uint32_t firstLevel, secondLevel;
+	Mapping(size, firstLevel, secondLevel);
+	if (firstLevel >= FirstLevelCount) return -1;
+
+	// Check the remaining classes at this level, then move up to the next non-empty level.
+	uint32_t secondLevelMap = m_SecondLevelBitmaps[firstLevel] & (~0u << secondLevel);
+	if (secondLevelMap == 0)
+	{
+		uint64_t firstLevelMap = (firstLevel + 1 < 64) ? (m_FirstLevelBitmap & (~0ull << (firstLevel + 1))) : 0;
+		if (firstLevelMap == 0) return -1; // Out of space.
+
+		firstLevel = LowestBit(firstLevelMap);
+		secondLevelMap = m_SecondLevelBitmaps[firstLevel];
+	}
+	secondLevel = LowestBit(secondLevelMap);
+	return m_FreeHeads[firstLevel][secondLevel];
+}
+
+int TlsfMetadata::NewRange()
+{
+	if (!m_UnusedRanges.empty())
+	{
+		int index = m_UnusedRanges.back();
+		m_UnusedRanges.pop_back();
+		m_Ranges[index] = S_Range();
+		return index;
+	}
+	m_Ranges.push_back(S_Range());
+	return (int)m_Ranges.size() - 1;
+}
+
+void TlsfMetadata::InsertFree(int index)
+{
+	S_Range &range = m_Ranges[index];
+	uint32_t firstLevel, secondLevel;
+	Mapping(range.size, firstLevel, secondLevel);
+
+	range.free = true;
+	range.prevFree = -1;
+	range.nextFree = m_FreeHeads[firstLevel][secondLevel];
+	if (range.nextFree >= 0) m_Ranges[range.nextFree].prevFree = index;
+	m_FreeHeads[firstLevel][secondLevel] = index;
+
+	m_FirstLevelBitmap |= 1ull << firstLevel;
+	m_SecondLevelBitmaps[firstLevel] |= 1u << secondLevel;
+}
+
+void TlsfMetadata::RemoveFree(int index)
+{
+	S_Range &range = m_Ranges[index];
+	uint32_t firstLevel, secondLevel;
+	Mapping(range.size, firstLevel, secondLevel);
+
+	if (range.prevFree >= 0) m_Ranges[range.prevFree].nextFree = range.nextFree;
+	else m_FreeHeads[firstLevel][secondLevel] = range.nextFree;
+	if (range.nextFree >= 0) m_Ranges[range.nextFree].prevFree = range.prevFree;
+
+	// Clear the bitmaps if that was the last range in its class.
+	if (m_FreeHeads[firstLevel][secondLevel] < 0)
+	{
+		m_SecondLevelBitmaps[firstLevel] &= ~(1u << secondLevel);
+		if (m_SecondLevelBitmaps[firstLevel] == 0) m_FirstLevelBitmap &= ~(1ull << firstLevel);
+	}
+
+	range.free = false;
+	range.prevFree = range.nextFree = -1;
+}
+
+int TlsfMetadata::Split(int index, VkDeviceSize size)
+{
+	int rest = NewRange(); // May reallocate m_Ranges, so grab references after this.
+	S_Range &range = m_Ranges[index];
+	S_Range &restRange = m_Ranges[rest];
+
+	restRange.offset = range.offset + size;
+	restRange.size = range.size - size;
+	restRange.prevPhysical = index;
+	restRange.nextPhysical = range.nextPhysical;
+	if (range.nextPhysical >= 0) m_Ranges[range.nextPhysical].prevPhysical = rest;
+
+	range.size = size;
+	range.nextPhysical = rest;
+	return rest;
+}
+
+// Fold next into index. Both have to be out of the free lists already.
+void TlsfMetadata::Merge(int index, int next)
+{
+	S_Range &range = m_Ranges[index];
+	S_Range &nextRange = m_Ranges[next];
+
+	range.size += nextRange.size;
+	range.nextPhysical = nextRange.nextPhysical;
+	if (nextRange.nextPhysical >= 0) m_Ranges[nextRange.nextPhysical].prevPhysical = index;
+	m_UnusedRanges.push_back(next);
+}
+
+bool TlsfMetadata::Allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *pOffset)
+{
+	if (size == 0 || alignment == 0) return false;
+
+	// Ask for enough extra to align the start of whatever range we get.
+	int index = FindFreeRange(size + alignment - 1);
+	if (index < 0) return false;
+	RemoveFree(index);
+
+	// Give the alignment padding back as its own free range.
+	VkDeviceSize padding = AlignUp(m_Ranges[index].offset, alignment) - m_Ranges[index].offset;
+	if (padding > 0)
+	{
+		int aligned = Split(index, padding);
+		InsertFree(index);
+		index = aligned;
+	}
+
+	// Give the tail back too.
+	if (m_Ranges[index].size > size)
+	{
+		int rest = Split(index, size);
+		InsertFree(rest);
+	}
+
+	m_FreeBytes -= size;
+	m_AllocatedRanges[m_Ranges[index].offset] = index;
+	*pOffset = m_Ranges[index].offset;
+	return true;
+}
+
+void TlsfMetadata::Free(VkDeviceSize offset)
+{
+	auto it = m_AllocatedRanges.find(offset);
+	if (it == m_AllocatedRanges.end()) throw std::runtime_error("Freeing an offset that was never allocated.");
+	int index = it->second;
+	m_AllocatedRanges.erase(it);
+	m_FreeBytes += m_Ranges[index].size;
+
+	// Coalesce with free neighbours, so free ranges never sit next to each other.
+	int prev = m_Ranges[index].prevPhysical;
+	if (prev >= 0 && m_Ranges[prev].free)
+	{
+		RemoveFree(prev);
+		Merge(prev, index);
+		index = prev;
+	}
+	int next = m_Ranges[index].nextPhysical;
+	if (next >= 0 && m_Ranges[next].free)
+	{
+		RemoveFree(next);
+		Merge(index, next);
+	}
+	InsertFree(index);
+}
+
+// Only the highest non-empty class can hold the largest range, so we walk just that list.
+VkDeviceSize TlsfMetadata::GetLargestFreeRange() const
+{
+	if (m_FirstLevelBitmap == 0) return 0;
+
+	uint32_t firstLevel = HighestBit(m_FirstLevelBitmap);
+	uint32_t secondLevel = HighestBit(m_SecondLevelBitmaps[firstLevel]);
+
+	VkDeviceSize largest = 0;
+	for (int i = m_FreeHeads[firstLevel][secondLevel]; i >= 0; i = m_Ranges[i].nextFree)
+		largest = std::max(largest, m_Ranges[i].size);
+	return largest;
+}
+
+DeviceMemoryAllocator::DeviceMemoryAllocator(const VkPhysicalDeviceMemoryProperties &memoryProperties, VkDeviceSize bufferImageGranularity,
+	S_DeviceMemoryBackend backend, VkDeviceSize blockSize)
+	: m_MemoryProperties(memoryProperties), m_BufferImageGranularity(bufferImageGranularity), m_Backend(backend)
+{
+	// Each memory type gets a linear pool and an optimal pool.
+	m_Pools.resize(memoryProperties.memoryTypeCount * 2);
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+	{
+		// Don't let a single block take up a large part of a small heap.
+		VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[i].heapIndex].size;
+		VkDeviceSize poolBlockSize = (heapSize / 8 < blockSize) ? heapSize / 8 : blockSize;
+
+		for (uint32_t kind = 0; kind < 2; kind++)
+		{
+			m_Pools[i * 2 + kind].memoryTypeIndex = i;
+			m_Pools[i * 2 + kind].blockSize = poolBlockSize;
+		}
+	}
+}
+
+DeviceMemoryAllocator::~DeviceMemoryAllocator()
+{
+	for (S_Pool &pool : m_Pools)
+	{
+		for (auto &block : pool.blocks) m_Backend.free(block->memory);
+		for (S_Dedicated &dedicated : pool.dedicated) m_Backend.free(dedicated.memory);
+	}
+}
+
+S_DeviceMemoryBackend DeviceMemoryAllocator::CreateVulkanBackend(VkDevice logicalDevice, const VkAllocationCallbacks *pAllocator)
+{
+	S_DeviceMemoryBackend backend;
+	backend.allocate = [logicalDevice, pAllocator](uint32_t memoryTypeIndex, VkDeviceSize size, VkDeviceMemory *pMemory)
+	{
+		VkMemoryAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocateInfo.allocationSize = size;
+		allocateInfo.memoryTypeIndex = memoryTypeIndex;
+		return vkAllocateMemory(logicalDevice, &allocateInfo, pAllocator, pMemory);
+	};
+	backend.free = [logicalDevice, pAllocator](VkDeviceMemory memory)
+	{
+		vkFreeMemory(logicalDevice, memory, pAllocator); // Unmaps implicitly.
+	};
+	backend.map = [logicalDevice](VkDeviceMemory memory)
+	{
+		void *pData = nullptr;
+		vkMapMemory(logicalDevice, memory, 0, VK_WHOLE_SIZE, 0, &pData);
+		return pData;
+	};
+	return backend;
+}
+
+// Linear and optimal resources only need separate pools if the granularity is bigger than a byte.
+uint32_t DeviceMemoryAllocator::PoolIndex(uint32_t memoryTypeIndex, E_ResourceKind kind) const
+{
+	if (m_BufferImageGranularity <= 1) return memoryTypeIndex * 2;
+	return memoryTypeIndex * 2 + (kind == RESOURCE_OPTIMAL ? 1 : 0);
+}
+
+bool DeviceMemoryAllocator::IsHostVisible(uint32_t memoryTypeIndex) const
+{
+	return (m_MemoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+}
+
+int DeviceMemoryAllocator::FindMemoryType(uint32_t typeBits, VkMemoryPropertyFlags requiredFlags, VkMemoryPropertyFlags preferredFlags) const
+{
+	int best = -1;
+	int bestScore = -1;
+	for (uint32_t i = 0; i < m_MemoryProperties.memoryTypeCount; i++)
+	{
+		VkMemoryPropertyFlags flags = m_MemoryProperties.memoryTypes[i].propertyFlags;
+		if ((typeBits & (1u << i)) == 0) continue;
+		if ((flags & requiredFlags) != requiredFlags) continue;
+
+		// Count how many of the preferred flags this type has.
+		int score = 0;
+		for (VkMemoryPropertyFlags bits = flags & preferredFlags; bits != 0; bits &= bits - 1) score++;
+		if (score > bestScore)
+		{
+			best = (int)i;
+			bestScore = score;
+		}
+	}
+	return best;
+}
+
+S_DeviceAllocation DeviceMemoryAllocator::Allocate(const S_DeviceAllocationRequest &request)
+{
+	int memoryTypeIndex = FindMemoryType(request.requirements.memoryTypeBits, request.requiredFlags, request.preferredFlags);
+	if (memoryTypeIndex < 0) throw std::runtime_error("Failed to find a suitable memory type.");
+
+	uint32_t poolIndex = PoolIndex((uint32_t)memoryTypeIndex, request.kind);
+	S_Pool &pool = m_Pools[poolIndex];
+
+	// Anything bigger than half a block would mostly waste the rest of it.
+	VkDeviceSize size = request.requirements.size;
+	if (request.dedicated || size > pool.blockSize / 2) return AllocateDedicated(pool, poolIndex, size);
+
+	S_DeviceAllocation allocation;
+	allocation.memoryTypeIndex = (uint32_t)memoryTypeIndex;
+	allocation.poolIndex = poolIndex;
+	allocation.size = size;
+
+	// Try the existing blocks first, newest first since they're most likely to have room.
+	VkDeviceSize alignment = std::max<VkDeviceSize>(request.requirements.alignment, 1);
+	for (auto it = pool.blocks.rbegin(); it != pool.blocks.rend(); ++it)
+	{
+		S_Block &block = **it;
+		if (block.metadata.GetFreeBytes() < size) continue;
+		if (!block.metadata.Allocate(size, alignment, &allocation.offset)) continue;
+
+		allocation.memory = block.memory;
+		allocation.pMapped = (block.pMapped != nullptr) ? (char*)block.pMapped + allocation.offset : nullptr;
+		return allocation;
+	}
+
+	// No room anywhere, so pull a new block from the device.
+	std::unique_ptr<S_Block> block(new S_Block(pool.blockSize));
+	VkResult result = m_Backend.allocate(pool.memoryTypeIndex, pool.blockSize, &block->memory);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to allocate device memory block.");
+	if (IsHostVisible(pool.memoryTypeIndex) && m_Backend.map) block->pMapped = m_Backend.map(block->memory);
+
+	if (!block->metadata.Allocate(size, alignment, &allocation.offset))
+	{
+		m_Backend.free(block->memory);
+		throw std::runtime_error("Failed to sub-allocate from a new device memory block.");
+	}
+
+	allocation.memory = block->memory;
+	allocation.pMapped = (block->pMapped != nullptr) ? (char*)block->pMapped + allocation.offset : nullptr;
+	pool.blocks.push_back(std::move(block));
+	return allocation;
+}
+
+S_DeviceAllocation DeviceMemoryAllocator::AllocateDedicated(S_Pool &pool, uint32_t poolIndex, VkDeviceSize size)
+{
+	S_Dedicated dedicated;
+	dedicated.size = size;
+	VkResult result = m_Backend.allocate(pool.memoryTypeIndex, size, &dedicated.memory);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to allocate dedicated device memory.");
+	pool.dedicated.push_back(dedicated);
+
+	S_DeviceAllocation allocation;
+	allocation.memory = dedicated.memory;
+	allocation.size = size;
+	allocation.memoryTypeIndex = pool.memoryTypeIndex;
+	allocation.poolIndex = poolIndex;
+	allocation.dedicated = true;
+	if (IsHostVisible(pool.memoryTypeIndex) && m_Backend.map) allocation.pMapped = m_Backend.map(dedicated.memory);
+	return allocation;
+}
+
+void DeviceMemoryAllocator::Free(const S_DeviceAllocation &allocation)
+{
+	if (allocation.memory == VK_NULL_HANDLE) return;
+	S_Pool &pool = m_Pools[allocation.poolIndex];
+
+	if (allocation.dedicated)
+	{
+		for (auto it = pool.dedicated.begin(); it != pool.dedicated.end(); ++it)
+		{
+			if (it->memory != allocation.memory) continue;
+			m_Backend.free(it->memory);
+			pool.dedicated.erase(it);
+			return;
+		}
+		throw std::runtime_error("Freeing a dedicated allocation that doesn't belong to this allocator.");
+	}
+
+	for (auto it = pool.blocks.begin(); it != pool.blocks.end(); ++it)
+	{
+		S_Block &block = **it;
+		if (block.memory != allocation.memory) continue;
+		block.metadata.Free(allocation.offset);
+
+		// Give empty blocks back to the device, but keep the last one around to avoid thrashing.
+		if (block.metadata.IsEmpty() && pool.blocks.size() > 1)
+		{
+			m_Backend.free(block.memory);
+			pool.blocks.erase(it);
+		}
+		return;
+	}
+	throw std::runtime_error("Freeing an allocation that doesn't belong to this allocator.");
+}
+
+void DeviceMemoryAllocator::AccumulateStats(const S_Pool &pool, S_DeviceMemoryStats &stats) const
+{
+	for (const auto &block : pool.blocks)
+	{
+		const TlsfMetadata &metadata = block->metadata;
+		stats.blockCount++;
+		stats.allocationCount += metadata.GetAllocationCount();
+		stats.reservedBytes += metadata.GetSize();
+		stats.usedBytes += metadata.GetSize() - metadata.GetFreeBytes();
+		stats.freeBytes += metadata.GetFreeBytes();
+		stats.largestFreeRange = std::max(stats.largestFreeRange, metadata.GetLargestFreeRange());
+	}
+	for (const S_Dedicated &dedicated : pool.dedicated)
+	{
+		stats.dedicatedCount++;
+		stats.allocationCount++;
+		stats.reservedBytes += dedicated.size;
+		stats.usedBytes += dedicated.size;
+	}
+}
+
+void DeviceMemoryAllocator::FinishStats(S_DeviceMemoryStats &stats)
+{
+	if (stats.freeBytes == 0) stats.fragmentation = 0.0f;
+	else stats.fragmentation = 1.0f - (float)((double)stats.largestFreeRange / (double)stats.freeBytes);
+}
+
+S_DeviceMemoryStats DeviceMemoryAllocator::GetStats() const
+{
+	S_DeviceMemoryStats stats;
+	for (const S_Pool &pool : m_Pools) AccumulateStats(pool, stats);
+	FinishStats(stats);
+	return stats;
+}
+
+S_DeviceMemoryStats DeviceMemoryAllocator::GetStats(uint32_t memoryTypeIndex) const
+{
+	S_DeviceMemoryStats stats;
+	AccumulateStats(m_Pools[memoryTypeIndex * 2], stats);
+	AccumulateStats(m_Pools[memoryTypeIndex * 2 + 1], stats);
+	FinishStats(stats);
+	return stats;
+}
+
+void DeviceMemoryAllocator::PrintStats(std::ostream &out) const
+{
+	out << "Device memory by type:" << "\n";
+	for (uint32_t i = 0; i < m_MemoryProperties.memoryTypeCount; i++)
+	{
+		S_DeviceMemoryStats stats = GetStats(i);
+		if (stats.blockCount == 0 && stats.dedicatedCount == 0) continue;
+		out << "  type " << i
+			<< ": blocks " << stats.blockCount
+			<< ", dedicated " << stats.dedicatedCount
+			<< ", allocations " << stats.allocationCount
+			<< ", reserved " << stats.reservedBytes << " bytes"
+			<< ", used " << stats.usedBytes << " bytes"
+			<< ", largest free " << stats.largestFreeRange << " bytes"
+			<< ", fragmentation " << stats.fragmentation << "\n";
+	}
+	out.flush();
+}
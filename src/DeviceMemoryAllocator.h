@@ -0,0 +1,176 @@
+#pragma once
+
+#ifndef DEVICEMEMORYALLOCATOR_H
+#define DEVICEMEMORYALLOCATOR_H
+
+#include <memory>
+
+// Hooks the allocator uses to talk to the device.
+// Swap these out for fakes to exercise the allocator without a GPU.
+struct S_DeviceMemoryBackend
+{
+	std::function<VkResult(uint32_t memoryTypeIndex, VkDeviceSize size, VkDeviceMemory *pMemory)> allocate;
+	std::function<void(VkDeviceMemory memory)> free;
+	std::function<void*(VkDeviceMemory memory)> map; // Only called for host visible memory, may be empty.
+};
+
+// What the caller is placing in memory. Linear and optimal resources can't share a
+// bufferImageGranularity page, so we keep them in separate blocks when the device cares.
+enum E_ResourceKind
+{
+	RESOURCE_LINEAR, // Buffers and linear images.
+	RESOURCE_OPTIMAL, // Optimal tiling images.
+};
+
+struct S_DeviceAllocationRequest
+{
+	VkMemoryRequirements requirements = {};
+	VkMemoryPropertyFlags requiredFlags = 0;
+	VkMemoryPropertyFlags preferredFlags = 0;
+	E_ResourceKind kind = RESOURCE_LINEAR;
+	bool dedicated = false; // Force a VkDeviceMemory of its own, e.g. for large render targets.
+};
+
+// A range inside a VkDeviceMemory block. Pass this back to Free when done.
+struct S_DeviceAllocation
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	void *pMapped = nullptr; // Points at offset, if the memory is host visible.
+	uint32_t memoryTypeIndex = 0;
+	uint32_t poolIndex = 0;
+	bool dedicated = false;
+};
+
+struct S_DeviceMemoryStats
+{
+	uint32_t blockCount = 0;
+	uint32_t dedicatedCount = 0;
+	uint32_t allocationCount = 0;
+	VkDeviceSize reservedBytes = 0; // Bytes pulled from the device, including dedicated allocations.
+	VkDeviceSize usedBytes = 0;
+	VkDeviceSize freeBytes = 0; // Free bytes inside blocks.
+	VkDeviceSize largestFreeRange = 0;
+	float fragmentation = 0.0f; // 0 when all free space is one range, approaching 1 as it splinters.
+};
+
+// Two-level segregated fit bookkeeping for a single block.
+// This only deals with offsets, so it knows nothing about the device.
+class TlsfMetadata
+{
+public:
+
+	TlsfMetadata(VkDeviceSize size);
+
+	bool Allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *pOffset);
+	void Free(VkDeviceSize offset);
+
+	VkDeviceSize GetSize() const { return m_Size; }
+	VkDeviceSize GetFreeBytes() const { return m_FreeBytes; }
+	VkDeviceSize GetLargestFreeRange() const;
+	uint32_t GetAllocationCount() const { return (uint32_t)m_AllocatedRanges.size(); }
+	bool IsEmpty() const { return m_AllocatedRanges.empty(); }
+
+private:
+
+	static const uint32_t SecondLevelBits = 4;
+	static const uint32_t SecondLevelCount = 1 << SecondLevelBits;
+	static const uint32_t FirstLevelCount = 64 - SecondLevelBits + 1;
+
+	// Ranges are linked physically (by offset) and, while free, into their size class list.
+	struct S_Range
+	{
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		int prevPhysical = -1;
+		int nextPhysical = -1;
+		int prevFree = -1;
+		int nextFree = -1;
+		bool free = false;
+	};
+
+	VkDeviceSize m_Size;
+	VkDeviceSize m_FreeBytes;
+	std::vector<S_Range> m_Ranges;
+	std::vector<int> m_UnusedRanges; // Recycled slots in m_Ranges.
+	std::map<VkDeviceSize, int> m_AllocatedRanges; // Offset to range, so Free only needs the offset.
+
+	uint64_t m_FirstLevelBitmap = 0;
+	uint32_t m_SecondLevelBitmaps[FirstLevelCount];
+	int m_FreeHeads[FirstLevelCount][SecondLevelCount];
+
+	static void Mapping(VkDeviceSize size, uint32_t &firstLevel, uint32_t &secondLevel);
+	int FindFreeRange(VkDeviceSize size);
+	int NewRange();
+	void InsertFree(int index);
+	void RemoveFree(int index);
+	int Split(int index, VkDeviceSize size); // Returns the new range holding everything after size.
+	void Merge(int index, int next);
+};
+
+// Sub-allocates buffers and images out of large VkDeviceMemory blocks, one set of blocks per memory type.
+// Large or explicitly dedicated requests get a VkDeviceMemory of their own.
+class DeviceMemoryAllocator
+{
+public:
+
+	static VkDeviceSize DefaultBlockSize;
+
+	DeviceMemoryAllocator(const VkPhysicalDeviceMemoryProperties &memoryProperties, VkDeviceSize bufferImageGranularity,
+		S_DeviceMemoryBackend backend, VkDeviceSize blockSize = DefaultBlockSize);
+	~DeviceMemoryAllocator();
+
+	// Backend that goes straight to vkAllocateMemory/vkFreeMemory/vkMapMemory.
+	static S_DeviceMemoryBackend CreateVulkanBackend(VkDevice logicalDevice, const VkAllocationCallbacks *pAllocator);
+
+	S_DeviceAllocation Allocate(const S_DeviceAllocationRequest &request);
+	void Free(const S_DeviceAllocation &allocation);
+
+	// Picks the memory type with all required flags, preferring the one that also has the most preferred flags.
+	int FindMemoryType(uint32_t typeBits, VkMemoryPropertyFlags requiredFlags, VkMemoryPropertyFlags preferredFlags) const;
+	const VkPhysicalDeviceMemoryProperties& GetMemoryProperties() const { return m_MemoryProperties; }
+
+	S_DeviceMemoryStats GetStats() const;
+	S_DeviceMemoryStats GetStats(uint32_t memoryTypeIndex) const;
+	void PrintStats(std::ostream &out) const;
+
+private:
+
+	struct S_Block
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		void *pMapped = nullptr;
+		TlsfMetadata metadata;
+
+		S_Block(VkDeviceSize size) : metadata(size) {}
+	};
+
+	struct S_Dedicated
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+	};
+
+	// One pool per memory type and resource kind.
+	struct S_Pool
+	{
+		uint32_t memoryTypeIndex = 0;
+		VkDeviceSize blockSize = 0;
+		std::vector<std::unique_ptr<S_Block>> blocks;
+		std::vector<S_Dedicated> dedicated;
+	};
+
+	VkPhysicalDeviceMemoryProperties m_MemoryProperties;
+	VkDeviceSize m_BufferImageGranularity;
+	S_DeviceMemoryBackend m_Backend;
+	std::vector<S_Pool> m_Pools;
+
+	uint32_t PoolIndex(uint32_t memoryTypeIndex, E_ResourceKind kind) const;
+	bool IsHostVisible(uint32_t memoryTypeIndex) const;
+	S_DeviceAllocation AllocateDedicated(S_Pool &pool, uint32_t poolIndex, VkDeviceSize size);
+	void AccumulateStats(const S_Pool &pool, S_DeviceMemoryStats &stats) const;
+	static void FinishStats(S_DeviceMemoryStats &stats);
+};
+
+#endif
@@ -0,0 +1,301 @@
+#include "stdafx.h"
+#include "FrameReadback.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+FrameReadback::FrameReadback(VkDevice logicalDevice, DeviceMemoryAllocator &memoryAllocator, SubmissionScheduler &scheduler, uint32_t width, uint32_t height, VkFormat format,
+	E_ReadbackFormat outputFormat, const std::string &path, uint32_t ringSize, uint32_t frameRate, VkDeviceSize nonCoherentAtomSize,
+	const VkAllocationCallbacks *pAllocator)
+	: m_LogicalDevice(logicalDevice), m_MemoryAllocator(memoryAllocator), m_Scheduler(scheduler), m_pAllocator(pAllocator), m_Width(width), m_Height(height),
+	m_OutputFormat(outputFormat), m_AtomSize(std::max<VkDeviceSize>(nonCoherentAtomSize, 1))
+{
+	if (!IsSupportedFormat(format)) throw std::runtime_error("Readback only supports 8 bit RGBA and BGRA formats.");
+	m_Bgra = (format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB);
+	m_FrameSize = (VkDeviceSize)width * height * 4;
+
+	if (path == "-")
+	{
+#ifdef _WIN32
+		_setmode(_fileno(stdout), _O_BINARY); // Or every 0x0a gets a 0x0d in front of it.
+#endif
+		m_pFile = stdout;
+	}
+	else
+	{
+		m_pFile = fopen(path.c_str(), "wb");
+		if (m_pFile == nullptr) throw std::runtime_error("Failed to open readback output: " + path);
+		m_OwnsFile = true;
+	}
+
+	// Y4M has one header for the whole stream, the frames follow it.
+	if (m_OutputFormat == READBACK_Y4M)
+	{
+		char header[128];
+		int length = snprintf(header, sizeof(header), "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n", width, height, std::max(1u, frameRate));
+		if (fwrite(header, 1, (size_t)length, m_pFile) != (size_t)length) throw std::runtime_error("Failed to write readback output: " + path);
+	}
+
+	// The host reads every byte of these, so cached memory is worth a lot more than being device local.
+	// Allocations cover whole atoms, so an invalidate never reaches into anyone else's memory.
+	m_Slots.resize(std::max(1u, ringSize));
+	for (size_t i = 0; i < m_Slots.size(); i++)
+	{
+		S_Slot &slot = m_Slots[i];
+
+		VkBufferCreateInfo bufferInfo = {};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = m_FrameSize;
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		VkResult result = vkCreateBuffer(m_LogicalDevice, &bufferInfo, m_pAllocator, &slot.buffer);
+		if (result != VK_SUCCESS) throw std::runtime_error("Failed to create readback buffer.");
+
+		S_DeviceAllocationRequest request;
+		vkGetBufferMemoryRequirements(m_LogicalDevice, slot.buffer, &request.requirements);
+		request.requirements.alignment = std::max(request.requirements.alignment, m_AtomSize);
+		request.requirements.size = (request.requirements.size + m_AtomSize - 1) / m_AtomSize * m_AtomSize;
+		request.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+		request.preferredFlags = VK_MEMORY_PROPERTY_HOST_CACHED_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		slot.memory = m_MemoryAllocator.Allocate(request);
+		result = vkBindBufferMemory(m_LogicalDevice, slot.buffer, slot.memory.memory, slot.memory.offset);
+		if (result != VK_SUCCESS) throw std::runtime_error("Failed to bind readback buffer memory.");
+		if (slot.memory.pMapped == nullptr) throw std::runtime_error("Failed to map readback buffer memory.");
+
+		m_Free.push_back((int)i);
+	}
+
+	VkMemoryPropertyFlags flags = m_MemoryAllocator.GetMemoryProperties().memoryTypes[m_Slots[0].memory.memoryTypeIndex].propertyFlags;
+	m_Coherent = (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+	m_Encoder = std::thread(&FrameReadback::EncoderLoop, this);
+}
+
+FrameReadback::~FrameReadback()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+	}
+	m_Submitted.notify_one();
+	if (m_Encoder.joinable()) m_Encoder.join();
+
+	if (m_OwnsFile) fclose(m_pFile);
+	else if (m_pFile != nullptr) fflush(m_pFile);
+
+	for (S_Slot &slot : m_Slots)
+	{
+		if (slot.buffer != VK_NULL_HANDLE) vkDestroyBuffer(m_LogicalDevice, slot.buffer, m_pAllocator);
+		m_MemoryAllocator.Free(slot.memory);
+	}
+}
+
+bool FrameReadback::IsSupportedFormat(VkFormat format)
+{
+	return format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB
+		|| format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+}
+
+void FrameReadback::RecordCopy(VkCommandBuffer commandBuffer, VkImage image)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_Free.empty())
+		{
+			m_Stats.framesDropped++;
+			return;
+		}
+		m_Recorded = m_Free.back();
+		m_Free.pop_back();
+		if (m_FirstCopy == Clock::time_point()) m_FirstCopy = Clock::now();
+	}
+
+	// Tightly packed, so row length and height stay 0.
+	VkBufferImageCopy region = {};
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent = { m_Width, m_Height, 1 };
+	vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_Slots[m_Recorded].buffer, 1, &region);
+
+	// The timeline only makes the copy available, the host still has to be able to see it.
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = m_Slots[m_Recorded].buffer;
+	barrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void FrameReadback::Submit(S_TimelinePoint point)
+{
+	if (m_Recorded < 0) return;
+
+	m_Slots[m_Recorded].point = point;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Pending.push_back(m_Recorded);
+	}
+	m_Recorded = -1;
+	m_Submitted.notify_one();
+}
+
+// Frames are written in the order they were submitted. Once stopping, we keep going until nothing is pending.
+void FrameReadback::EncoderLoop()
+{
+	for (;;)
+	{
+		int index;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Submitted.wait(lock, [this]() { return m_Stopping || !m_Pending.empty(); });
+			if (m_Pending.empty()) return;
+			index = m_Pending.front();
+			m_Pending.pop_front();
+		}
+
+		S_Slot &slot = m_Slots[index];
+		m_Scheduler.Wait(slot.point);
+		if (!m_Coherent)
+		{
+			VkMappedMemoryRange range = {};
+			range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+			range.memory = slot.memory.memory;
+			range.offset = slot.memory.offset;
+			range.size = (m_FrameSize + m_AtomSize - 1) / m_AtomSize * m_AtomSize;
+			vkInvalidateMappedMemoryRanges(m_LogicalDevice, 1, &range);
+		}
+
+		// Only the encoder ever sets writeFailed, so it can read it without the lock.
+		Clock::time_point start = Clock::now();
+		uint64_t bytes = (m_Stats.writeFailed) ? 0 : Write((const uint8_t*)slot.memory.pMapped);
+		Clock::time_point end = Clock::now();
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (bytes > 0)
+		{
+			m_Stats.framesWritten++;
+			m_Stats.bytesWritten += bytes;
+			m_LastWrite = end;
+		}
+		else m_Stats.writeFailed = true;
+		m_Stats.encodeSeconds += std::chrono::duration<double>(end - start).count();
+		m_Free.push_back(index);
+	}
+}
+
+// Flushed every frame, so whatever is on the other end of a pipe gets it right away.
+uint64_t FrameReadback::Write(const uint8_t *pTexels)
+{
+	const uint8_t *pData = pTexels;
+	size_t size = (size_t)m_FrameSize;
+	if (m_OutputFormat != READBACK_RAW)
+	{
+		if (m_OutputFormat == READBACK_PPM) EncodePpm(pTexels);
+		else EncodeY4m(pTexels);
+		pData = m_Encoded.data();
+		size = m_Encoded.size();
+	}
+
+	if (fwrite(pData, 1, size, m_pFile) != size || fflush(m_pFile) != 0) return 0;
+	return size;
+}
+
+void FrameReadback::Texel(const uint8_t *pTexels, uint32_t x, uint32_t y, int &r, int &g, int &b) const
+{
+	const uint8_t *pTexel = pTexels + ((size_t)y * m_Width + x) * 4;
+	r = pTexel[(m_Bgra) ? 2 : 0];
+	g = pTexel[1];
+	b = pTexel[(m_Bgra) ? 0 : 2];
+}
+
+void FrameReadback::EncodePpm(const uint8_t *pTexels)
+{
+	char header[64];
+	int length = snprintf(header, sizeof(header), "P6\n%u %u\n255\n", m_Width, m_Height);
+	m_Encoded.resize((size_t)length + (size_t)m_Width * m_Height * 3);
+	memcpy(m_Encoded.data(), header, (size_t)length);
+
+	uint8_t *pOut = m_Encoded.data() + length;
+	for (uint32_t y = 0; y < m_Height; y++)
+	{
+		for (uint32_t x = 0; x < m_Width; x++, pOut += 3)
+		{
+			int r, g, b;
+			Texel(pTexels, x, y, r, g, b);
+			pOut[0] = (uint8_t)r;
+			pOut[1] = (uint8_t)g;
+			pOut[2] = (uint8_t)b;
+		}
+	}
+}
+
+// Full range BT.601 in 8.8 fixed point, which is what C420jpeg means. Chroma is the average of each 2x2 block,
+// with the last row and column repeated when the size is odd.
+void FrameReadback::EncodeY4m(const uint8_t *pTexels)
+{
+	static const char FrameHeader[] = "FRAME\n";
+	size_t headerSize = sizeof(FrameHeader) - 1;
+	uint32_t chromaWidth = (m_Width + 1) / 2;
+	uint32_t chromaHeight = (m_Height + 1) / 2;
+	size_t lumaSize = (size_t)m_Width * m_Height;
+	size_t chromaSize = (size_t)chromaWidth * chromaHeight;
+	m_Encoded.resize(headerSize + lumaSize + chromaSize * 2);
+	memcpy(m_Encoded.data(), FrameHeader, headerSize);
+
+	uint8_t *pY = m_Encoded.data() + headerSize;
+	uint8_t *pU = pY + lumaSize;
+	uint8_t *pV = pU + chromaSize;
+	for (uint32_t y = 0; y < m_Height; y++)
+	{
+		for (uint32_t x = 0; x < m_Width; x++)
+		{
+			int r, g, b;
+			Texel(pTexels, x, y, r, g, b);
+			*pY++ = (uint8_t)((77 * r + 150 * g + 29 * b + 128) >> 8);
+		}
+	}
+
+	for (uint32_t y = 0; y < chromaHeight; y++)
+	{
+		for (uint32_t x = 0; x < chromaWidth; x++)
+		{
+			int r = 0, g = 0, b = 0;
+			for (uint32_t i = 0; i < 4; i++)
+			{
+				int sampleR, sampleG, sampleB;
+				Texel(pTexels, std::min(x * 2 + (i & 1), m_Width - 1), std::min(y * 2 + (i >> 1), m_Height - 1), sampleR, sampleG, sampleB);
+				r += sampleR;
+				g += sampleG;
+				b += sampleB;
+			}
+
+			// Offset by 128 before the shift, so it never sees a negative number.
+			*pU++ = (uint8_t)std::min(255, (4 * 32896 - 43 * r - 85 * g + 128 * b) >> 10);
+			*pV++ = (uint8_t)std::min(255, (4 * 32896 + 128 * r - 107 * g - 21 * b) >> 10);
+		}
+	}
+}
+
+S_ReadbackStats FrameReadback::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	S_ReadbackStats stats = m_Stats;
+	double seconds = std::chrono::duration<double>(m_LastWrite - m_FirstCopy).count();
+	if (stats.framesWritten > 0 && seconds > 0.0) stats.framesPerSecond = stats.framesWritten / seconds;
+	return stats;
+}
+
+void FrameReadback::PrintStats(std::ostream &out) const
+{
+	S_ReadbackStats stats = GetStats();
+	out << "Readback: " << stats.framesWritten << " frames written (" << stats.framesDropped << " dropped), "
+		<< stats.bytesWritten / (1024 * 1024) << " MB, " << stats.framesPerSecond << " frames/s exported";
+	if (stats.framesWritten > 0) out << ", " << stats.encodeSeconds * 1000.0 / stats.framesWritten << " ms encoding per frame";
+	if (stats.writeFailed) out << ", writing failed";
+	out << std::endl;
+}
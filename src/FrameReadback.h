@@ -0,0 +1,105 @@
+#pragma once
+
+#ifndef FRAMEREADBACK_H
+#define FRAMEREADBACK_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "DeviceMemoryAllocator.h"
+#include "SubmissionScheduler.h"
+
+enum E_ReadbackFormat
+{
+	READBACK_RAW, // The image's own texels, tightly packed, one frame after another.
+	READBACK_PPM, // A binary PPM per frame, back to back, the way ffmpeg's image2pipe reads them.
+	READBACK_Y4M, // One YUV4MPEG2 stream in 4:2:0, full range BT.601, for anything that takes raw video.
+};
+
+struct S_ReadbackStats
+{
+	uint32_t framesWritten = 0;
+	uint32_t framesDropped = 0; // The ring was full of frames still waiting to be written.
+	uint64_t bytesWritten = 0;
+	double encodeSeconds = 0.0; // Converting and writing, on the encoder thread.
+	double framesPerSecond = 0.0; // From the first copy to the last frame written.
+	bool writeFailed = false; // Nothing is written after the first failure.
+};
+
+// Copies rendered frames into a ring of host visible buffers, and writes them out on an encoder thread of its own.
+// The encoder waits for each frame's point on the graphics timeline and does all the conversion and I/O, so the render
+// thread only records a copy. When the encoder falls behind and every buffer is taken, frames are dropped and
+// counted rather than stalling rendering, so size the ring for how far the disk or pipe can fall behind.
+class FrameReadback
+{
+public:
+
+	// path is a file, or "-" for stdout. frameRate only goes into the Y4M header.
+	FrameReadback(VkDevice logicalDevice, DeviceMemoryAllocator &memoryAllocator, SubmissionScheduler &scheduler, uint32_t width, uint32_t height, VkFormat format,
+		E_ReadbackFormat outputFormat, const std::string &path, uint32_t ringSize, uint32_t frameRate, VkDeviceSize nonCoherentAtomSize,
+		const VkAllocationCallbacks *pAllocator);
+	~FrameReadback(); // Waits for every frame already submitted to be written.
+
+	// Record the copy out of the image, which has to be in TRANSFER_SRC_OPTIMAL. Records nothing if the ring is full.
+	void RecordCopy(VkCommandBuffer commandBuffer, VkImage image);
+
+	// Call with the point the submission the copy went into signals. Hands the frame to the encoder, which waits for it.
+	void Submit(S_TimelinePoint point);
+
+	S_ReadbackStats GetStats() const;
+	void PrintStats(std::ostream &out) const;
+
+	static bool IsSupportedFormat(VkFormat format); // 8 bit RGBA and BGRA.
+
+private:
+
+	struct S_Slot
+	{
+		VkBuffer buffer = VK_NULL_HANDLE;
+		S_DeviceAllocation memory;
+		S_TimelinePoint point; // Where the copy is done.
+	};
+
+	typedef std::chrono::steady_clock Clock;
+
+	VkDevice m_LogicalDevice;
+	DeviceMemoryAllocator &m_MemoryAllocator;
+	SubmissionScheduler &m_Scheduler;
+	const VkAllocationCallbacks *m_pAllocator;
+	uint32_t m_Width;
+	uint32_t m_Height;
+	bool m_Bgra;
+	E_ReadbackFormat m_OutputFormat;
+	VkDeviceSize m_FrameSize;
+	VkDeviceSize m_AtomSize;
+	bool m_Coherent = true;
+	FILE *m_pFile = nullptr;
+	bool m_OwnsFile = false; // Not when it's stdout.
+
+	std::vector<S_Slot> m_Slots;
+	int m_Recorded = -1; // The slot this frame's copy went into, until Submit.
+
+	// Everything below is shared with the encoder.
+	mutable std::mutex m_Mutex;
+	std::condition_variable m_Submitted;
+	std::vector<int> m_Free;
+	std::deque<int> m_Pending; // Submitted, oldest first.
+	bool m_Stopping = false;
+	S_ReadbackStats m_Stats;
+	Clock::time_point m_FirstCopy;
+	Clock::time_point m_LastWrite;
+	std::thread m_Encoder;
+
+	std::vector<uint8_t> m_Encoded; // Only touched by the encoder.
+
+	void EncoderLoop();
+	uint64_t Write(const uint8_t *pTexels); // Bytes written, 0 if it failed.
+	void EncodePpm(const uint8_t *pTexels);
+	void EncodeY4m(const uint8_t *pTexels);
+	void Texel(const uint8_t *pTexels, uint32_t x, uint32_t y, int &r, int &g, int &b) const;
+};
+
+#endif
@@ -0,0 +1,231 @@
+#include "stdafx.h"
+#include "GpuCulling.h"
+
+GpuCulling::GpuCulling(VkDevice logicalDevice, const DeviceCapabilityProfile &profile, DeviceMemoryAllocator &memoryAllocator, UploadService &uploadService,
+	ShaderCache &shaderCache, SubmissionScheduler &scheduler, uint32_t workgroupSize, uint32_t maxInstances, uint32_t hizWidth, uint32_t hizHeight,
+	const VkAllocationCallbacks *pAllocator)
+	: m_LogicalDevice(logicalDevice), m_MemoryAllocator(memoryAllocator), m_UploadService(uploadService), m_Scheduler(scheduler), m_pAllocator(pAllocator),
+	m_WorkgroupSize(workgroupSize), m_MaxInstances(std::max(1u, maxInstances)), m_HiZWidth(hizWidth), m_HiZHeight(hizHeight)
+{
+	// The device was created with whichever of these the profile found.
+	const char *drawCountExtension = profile.GetDrawIndirectCountExtension();
+	if (drawCountExtension != nullptr)
+	{
+		const char *name = (strcmp(drawCountExtension, VK_AMD_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0) ?
+			"vkCmdDrawIndexedIndirectCountAMD" : "vkCmdDrawIndexedIndirectCountKHR";
+		m_pfnDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountAMD)vkGetDeviceProcAddr(m_LogicalDevice, name);
+	}
+
+	S_SpecializationConstant compact;
+	compact.id = ConstantCompact;
+	compact.value = (HasDrawCount()) ? VK_TRUE : VK_FALSE;
+	m_pCull = shaderCache.GetComputePipeline("cull.spv", 5, m_WorkgroupSize, { compact });
+	m_pHiZReduce = shaderCache.GetComputePipeline("hiz_reduce.spv", 2, m_WorkgroupSize);
+
+	// Every level down to 1x1.
+	VkDeviceSize hizTexels = 0;
+	if (m_HiZWidth > 0 && m_HiZHeight > 0)
+	{
+		do
+		{
+			hizTexels += (VkDeviceSize)std::max(1u, m_HiZWidth >> m_HiZLevels) * std::max(1u, m_HiZHeight >> m_HiZLevels);
+			m_HiZLevels++;
+		} while ((m_HiZWidth >> (m_HiZLevels - 1)) > 1 || (m_HiZHeight >> (m_HiZLevels - 1)) > 1);
+	}
+
+	m_Instances = CreateBuffer(m_MaxInstances * sizeof(S_CullInstance), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, false);
+	m_View = CreateBuffer(sizeof(S_CullView), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, false);
+	m_Draws = CreateBuffer(m_MaxInstances * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, false);
+	m_Count = CreateBuffer(sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, false);
+	m_HiZ = CreateBuffer(std::max<VkDeviceSize>(hizTexels, 1) * sizeof(float), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, false);
+
+	// The buffers never change, so the sets are written once.
+	VkDescriptorPoolSize poolSize = {};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = 7;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = 2;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	VkResult result = vkCreateDescriptorPool(m_LogicalDevice, &poolInfo, m_pAllocator, &m_DescriptorPool);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create culling descriptor pool.");
+
+	m_CullSet = m_pCull->BindBuffers(m_DescriptorPool, { m_Instances.buffer, m_View.buffer, m_Draws.buffer, m_Count.buffer, m_HiZ.buffer });
+	m_HiZSet = m_pHiZReduce->BindBuffers(m_DescriptorPool, { m_View.buffer, m_HiZ.buffer });
+}
+
+GpuCulling::~GpuCulling()
+{
+	DestroyBuffer(m_Instances);
+	DestroyBuffer(m_View);
+	DestroyBuffer(m_Draws);
+	DestroyBuffer(m_Count);
+	DestroyBuffer(m_HiZ);
+	for (S_ComputeBuffer &buffer : m_Readbacks) DestroyBuffer(buffer);
+	vkDestroyDescriptorPool(m_LogicalDevice, m_DescriptorPool, m_pAllocator); // Frees the sets too.
+}
+
+S_ComputeBuffer GpuCulling::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, bool hostVisible)
+{
+	return ComputePipeline::CreateBuffer(m_LogicalDevice, m_MemoryAllocator, size, usage, hostVisible, m_pAllocator);
+}
+
+void GpuCulling::DestroyBuffer(S_ComputeBuffer &buffer)
+{
+	ComputePipeline::DestroyBuffer(m_LogicalDevice, m_MemoryAllocator, buffer, m_pAllocator);
+}
+
+void GpuCulling::SetInstances(const std::vector<S_CullInstance> &instances)
+{
+	if (instances.size() > m_MaxInstances) throw std::runtime_error("More culling instances than the buffers were sized for.");
+	m_InstanceCount = (uint32_t)instances.size();
+	if (m_InstanceCount > 0) m_UploadService.UploadBuffer(m_Instances.buffer, 0, instances.data(), m_InstanceCount * sizeof(S_CullInstance));
+}
+
+// Level 0 is a straight copy of the depth, and every level after it is reduced from the one before.
+void GpuCulling::RecordBuildHiZ(VkCommandBuffer commandBuffer, VkImage depthImage)
+{
+	if (m_HiZLevels == 0) return;
+
+	// The last cull may still be reading the pyramid.
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+	VkBufferImageCopy region = {};
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent = { m_HiZWidth, m_HiZHeight, 1 };
+	vkCmdCopyImageToBuffer(commandBuffer, depthImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_HiZ.buffer, 1, &region);
+
+	// The reduce reads the sizes from the view buffer.
+	S_CullView view = {};
+	view.hizWidth = m_HiZWidth;
+	view.hizHeight = m_HiZHeight;
+	view.hizLevels = m_HiZLevels;
+	vkCmdUpdateBuffer(commandBuffer, m_View.buffer, 0, sizeof(view), &view);
+
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	for (uint32_t level = 1; level < m_HiZLevels; level++)
+	{
+		S_ComputePushConstants pushConstants;
+		pushConstants.count = std::max(1u, m_HiZWidth >> level) * std::max(1u, m_HiZHeight >> level);
+		pushConstants.shift = level;
+		pushConstants.groupCount = GroupCount(pushConstants.count, m_WorkgroupSize);
+		m_pHiZReduce->Dispatch(commandBuffer, m_HiZSet, pushConstants, pushConstants.groupCount);
+		ComputePipeline::RecordBarrier(commandBuffer);
+	}
+	m_HiZValid = true;
+}
+
+void GpuCulling::RecordCull(VkCommandBuffer commandBuffer, const glm::mat4 &viewProjection)
+{
+	// Last frame's draws, cull and readback may still be using what we're about to overwrite.
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+	S_CullView view = {};
+	view.viewProjection = viewProjection;
+	ExtractFrustumPlanes(viewProjection, view.planes);
+	view.flags = (m_HiZValid) ? FlagOcclusion : 0;
+	view.hizWidth = m_HiZWidth;
+	view.hizHeight = m_HiZHeight;
+	view.hizLevels = m_HiZLevels;
+	vkCmdUpdateBuffer(commandBuffer, m_View.buffer, 0, sizeof(view), &view);
+	vkCmdFillBuffer(commandBuffer, m_Count.buffer, 0, sizeof(uint32_t), 0);
+
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	if (m_InstanceCount > 0)
+	{
+		S_ComputePushConstants pushConstants;
+		pushConstants.count = m_InstanceCount;
+		pushConstants.groupCount = GroupCount(m_InstanceCount, m_WorkgroupSize);
+		m_pCull->Dispatch(commandBuffer, m_CullSet, pushConstants, pushConstants.groupCount);
+	}
+
+	// The draws read the commands and the count, and the vertex shader may read the instances' commands too.
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+		VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	// The count comes back once the frame has finished, for the statistics. There's a buffer for each frame in flight,
+	// made the first time every one of them is still waiting.
+	if (m_Readback == NoReadback)
+	{
+		if (m_FreeReadbacks.empty())
+		{
+			m_FreeReadbacks.push_back((uint32_t)m_Readbacks.size());
+			m_Readbacks.push_back(CreateBuffer(sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT, true));
+		}
+		m_Readback = m_FreeReadbacks.back();
+		m_FreeReadbacks.pop_back();
+	}
+	VkBufferCopy copy = {};
+	copy.size = sizeof(uint32_t);
+	vkCmdCopyBuffer(commandBuffer, m_Count.buffer, m_Readbacks[m_Readback].buffer, 1, &copy);
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void GpuCulling::RecordDraw(VkCommandBuffer commandBuffer) const
+{
+	if (m_InstanceCount == 0) return;
+	uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	if (m_pfnDrawIndexedIndirectCount != nullptr)
+		m_pfnDrawIndexedIndirectCount(commandBuffer, m_Draws.buffer, 0, m_Count.buffer, 0, m_InstanceCount, stride);
+	else vkCmdDrawIndexedIndirect(commandBuffer, m_Draws.buffer, 0, m_InstanceCount, stride); // Culled ones draw nothing.
+}
+
+void GpuCulling::EndFrame(S_TimelinePoint submitted)
+{
+	if (m_Readback == NoReadback) return;
+	uint32_t readback = m_Readback;
+	m_Readback = NoReadback;
+	m_Scheduler.Retire(submitted, [this, readback]()
+	{
+		uint32_t visible = *(const uint32_t*)m_Readbacks[readback].memory.pMapped;
+		m_Stats.frames++;
+		m_Stats.visibleTotal += visible;
+		m_Stats.visibleMin = std::min(m_Stats.visibleMin, visible);
+		m_Stats.visibleMax = std::max(m_Stats.visibleMax, visible);
+		m_FreeReadbacks.push_back(readback);
+	});
+}
+
+void GpuCulling::PrintStats(std::ostream &out) const
+{
+	out << "Culling: " << m_InstanceCount << " instances";
+	if (m_Stats.frames > 0)
+	{
+		out << ", " << m_Stats.visibleTotal / m_Stats.frames << " visible on average (" << m_Stats.visibleMin << " to "
+			<< m_Stats.visibleMax << ") over " << m_Stats.frames << " frames";
+	}
+	out << ((HasDrawCount()) ? ", compacted for indirect count" : ", one command per instance") << std::endl;
+}
+
+// Gribb and Hartmann. Each plane is a sum or difference of the matrix's rows, and with zero to one depth the
+// near plane is the third row on its own.
+void GpuCulling::ExtractFrustumPlanes(const glm::mat4 &viewProjection, glm::vec4 planes[6])
+{
+	glm::mat4 rows = glm::transpose(viewProjection);
+	planes[0] = rows[3] + rows[0]; // Left.
+	planes[1] = rows[3] - rows[0]; // Right.
+	planes[2] = rows[3] + rows[1]; // Bottom.
+	planes[3] = rows[3] - rows[1]; // Top.
+	planes[4] = rows[2]; // Near.
+	planes[5] = rows[3] - rows[2]; // Far.
+	for (int i = 0; i < 6; i++) planes[i] = planes[i] / glm::length(glm::vec3(planes[i].x, planes[i].y, planes[i].z));
+}
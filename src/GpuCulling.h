@@ -0,0 +1,123 @@
+#pragma once
+
+#ifndef GPUCULLING_H
+#define GPUCULLING_H
+
+#include "DeviceCapabilityProfile.h"
+#include "ShaderCache.h"
+#include "UploadService.h"
+
+// One instance's bounds and the index range it draws. Matches Instance in shaders/cull.comp.
+struct S_CullInstance
+{
+	glm::vec4 boundingSphere; // Center in xyz, radius in w, in world space.
+	uint32_t indexCount = 0;
+	uint32_t firstIndex = 0;
+	int32_t vertexOffset = 0;
+	uint32_t padding = 0;
+};
+static_assert(sizeof(S_CullInstance) == 32, "S_CullInstance must match the shader.");
+
+struct S_GpuCullingStats
+{
+	uint32_t frames = 0; // Frames whose results have come back.
+	uint64_t visibleTotal = 0;
+	uint32_t visibleMin = UINT32_MAX;
+	uint32_t visibleMax = 0;
+};
+
+// GPU driven draws. A compute pass tests every instance's bounding sphere against the frustum, and against a
+// Hi-Z pyramid of an earlier frame's depth if there is one, then appends the survivors to an indirect command
+// buffer for a single vkCmdDrawIndexedIndirectCount. Without a draw count extension, each instance keeps its own
+// command and culled ones draw no instances, so one multi-draw still covers them all. Which of the two the kernel
+// does is a specialization constant, so each device only ever builds the variant it uses.
+// The draws' firstInstance is the instance index, for the vertex shader to find its data with.
+// The pyramid lives in a storage buffer, every level back to back, so the kernels only ever bind storage buffers.
+class GpuCulling
+{
+public:
+
+	// A zero size Hi-Z skips occlusion culling.
+	GpuCulling(VkDevice logicalDevice, const DeviceCapabilityProfile &profile, DeviceMemoryAllocator &memoryAllocator, UploadService &uploadService,
+		ShaderCache &shaderCache, SubmissionScheduler &scheduler, uint32_t workgroupSize, uint32_t maxInstances, uint32_t hizWidth, uint32_t hizHeight,
+		const VkAllocationCallbacks *pAllocator);
+	~GpuCulling();
+
+	// Queues the upload, so the instances are in place for the next frame's cull.
+	void SetInstances(const std::vector<S_CullInstance> &instances);
+
+	// Copies a D32 depth image, in the transfer source layout and the Hi-Z size, into the pyramid and reduces it.
+	// From then on, every cull also tests against it.
+	void RecordBuildHiZ(VkCommandBuffer commandBuffer, VkImage depthImage);
+
+	// Outside a render pass. Leaves the commands ready for indirect reads and vertex shader reads.
+	void RecordCull(VkCommandBuffer commandBuffer, const glm::mat4 &viewProjection);
+
+	// Inside a render pass, with the pipeline and index buffer bound.
+	void RecordDraw(VkCommandBuffer commandBuffer) const;
+
+	// The visible count the frame's cull copied back is read once the frame that was just submitted has finished.
+	void EndFrame(S_TimelinePoint submitted);
+
+	bool HasDrawCount() const { return m_pfnDrawIndexedIndirectCount != nullptr; }
+	uint32_t GetInstanceCount() const { return m_InstanceCount; }
+	const S_GpuCullingStats& GetStats() const { return m_Stats; }
+	void PrintStats(std::ostream &out) const;
+
+	// Normalized, pointing inwards. Depth is zero to one, as GLM is set up for in stdafx.h.
+	static void ExtractFrustumPlanes(const glm::mat4 &viewProjection, glm::vec4 planes[6]);
+
+private:
+
+	static const uint32_t ConstantCompact = 1; // Specialization constant id of Compact in shaders/cull.comp.
+	static const uint32_t FlagOcclusion = 1;
+	static const uint32_t NoReadback = UINT32_MAX;
+
+	// Matches View in shaders/cull.comp and shaders/hiz_reduce.comp.
+	struct S_CullView
+	{
+		glm::mat4 viewProjection;
+		glm::vec4 planes[6];
+		uint32_t flags;
+		uint32_t hizWidth;
+		uint32_t hizHeight;
+		uint32_t hizLevels;
+	};
+
+	VkDevice m_LogicalDevice;
+	DeviceMemoryAllocator &m_MemoryAllocator;
+	UploadService &m_UploadService;
+	SubmissionScheduler &m_Scheduler;
+	const VkAllocationCallbacks *m_pAllocator;
+	uint32_t m_WorkgroupSize;
+	uint32_t m_MaxInstances;
+	uint32_t m_InstanceCount = 0;
+	PFN_vkCmdDrawIndexedIndirectCountAMD m_pfnDrawIndexedIndirectCount = nullptr; // The KHR and AMD versions are the same function.
+
+	uint32_t m_HiZWidth;
+	uint32_t m_HiZHeight;
+	uint32_t m_HiZLevels = 0;
+	bool m_HiZValid = false; // Set once a pyramid has been built.
+
+	ComputePipeline *m_pCull; // Both belong to the shader cache.
+	ComputePipeline *m_pHiZReduce;
+	VkDescriptorPool m_DescriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSet m_CullSet = VK_NULL_HANDLE;
+	VkDescriptorSet m_HiZSet = VK_NULL_HANDLE;
+
+	S_ComputeBuffer m_Instances;
+	S_ComputeBuffer m_View;
+	S_ComputeBuffer m_Draws;
+	S_ComputeBuffer m_Count;
+	S_ComputeBuffer m_HiZ; // A single float when there's no pyramid, since the binding still needs a buffer.
+	std::vector<S_ComputeBuffer> m_Readbacks; // The visible count copied back, one for each frame still in flight.
+	std::vector<uint32_t> m_FreeReadbacks;
+	uint32_t m_Readback = NoReadback; // The one this frame's cull copies into.
+	S_GpuCullingStats m_Stats;
+
+	S_ComputeBuffer CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, bool hostVisible);
+	void DestroyBuffer(S_ComputeBuffer &buffer);
+	static uint32_t GroupCount(uint32_t count, uint32_t groupSize) { return (count + groupSize - 1) / groupSize; }
+};
+
+#endif
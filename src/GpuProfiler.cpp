@@ -0,0 +1,250 @@
+#include "stdafx.h"
+#include "GpuProfiler.h"
+
+// Results come back in bit order, so the names have to follow it too.
+const VkQueryPipelineStatisticFlags GpuProfiler::StatisticFlags =
+	VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT | VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT | VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+const char *GpuProfiler::StatisticNames[StatisticCount] =
+{
+	"Vertices", "Primitives", "Vertex invocations", "Clipping primitives", "Fragment invocations", "Compute invocations"
+};
+
+GpuProfiler::GpuProfiler(VkDevice logicalDevice, const DeviceCapabilityProfile &profile, int queueFamily, uint32_t frameCount,
+	const VkAllocationCallbacks *pAllocator)
+	: m_LogicalDevice(logicalDevice), m_pAllocator(pAllocator), m_Origin(Clock::now()), m_Frames(frameCount)
+{
+	// Queues without valid timestamp bits can't write timestamps at all, we still get CPU times from them.
+	uint32_t validBits = profile.GetQueueFamilies()[queueFamily].timestampValidBits;
+	m_TimestampPeriod = profile.GetProperties().limits.timestampPeriod;
+	m_TimestampsEnabled = (validBits > 0 && m_TimestampPeriod > 0.0);
+	m_TimestampMask = (validBits >= 64) ? ~0ull : ((1ull << validBits) - 1);
+
+	// The frame's statistics query stays active while the scene's secondaries execute, so those have to inherit it.
+	const VkPhysicalDeviceFeatures &features = profile.GetFeatures();
+	m_StatisticsEnabled = (features.pipelineStatisticsQuery && features.inheritedQueries);
+
+	for (S_FrameSlot &frame : m_Frames)
+	{
+		VkQueryPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		if (m_TimestampsEnabled)
+		{
+			poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			poolInfo.queryCount = 2 + 2 * MaxScopesPerFrame; // Frame begin and end, then begin and end for each scope.
+			VkResult result = vkCreateQueryPool(m_LogicalDevice, &poolInfo, m_pAllocator, &frame.timestampPool);
+			if (result != VK_SUCCESS) throw std::runtime_error("Failed to create timestamp query pool.");
+		}
+		if (m_StatisticsEnabled)
+		{
+			poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+			poolInfo.queryCount = 1;
+			poolInfo.pipelineStatistics = StatisticFlags;
+			VkResult result = vkCreateQueryPool(m_LogicalDevice, &poolInfo, m_pAllocator, &frame.statisticsPool);
+			if (result != VK_SUCCESS) throw std::runtime_error("Failed to create pipeline statistics query pool.");
+		}
+		frame.scopes.reserve(MaxScopesPerFrame);
+	}
+}
+
+GpuProfiler::~GpuProfiler()
+{
+	for (S_FrameSlot &frame : m_Frames)
+	{
+		if (frame.timestampPool != VK_NULL_HANDLE) vkDestroyQueryPool(m_LogicalDevice, frame.timestampPool, m_pAllocator);
+		if (frame.statisticsPool != VK_NULL_HANDLE) vkDestroyQueryPool(m_LogicalDevice, frame.statisticsPool, m_pAllocator);
+	}
+}
+
+double GpuProfiler::Now() const
+{
+	return std::chrono::duration<double, std::micro>(Clock::now() - m_Origin).count();
+}
+
+// The caller has waited on this slot's fence before re-recording it, so its queries are normally done by now.
+void GpuProfiler::BeginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+{
+	S_FrameSlot &frame = m_Frames[frameIndex];
+	if (frame.pending) Collect(frame);
+
+	double now = Now();
+	if (m_LastFrameBegin >= 0.0) PushSample(m_CpuFrameTimes, m_CpuFrameIndex, (now - m_LastFrameBegin) / 1000.0);
+	m_LastFrameBegin = now;
+
+	frame.pending = true;
+	frame.frameNumber = m_FrameNumber++;
+	frame.cpuBegin = now;
+	frame.scopes.clear();
+	m_pCurrent = &frame;
+	m_OpenScopes = 0;
+
+	if (m_TimestampsEnabled)
+	{
+		vkCmdResetQueryPool(commandBuffer, frame.timestampPool, 0, 2 + 2 * MaxScopesPerFrame);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.timestampPool, 0);
+	}
+	if (m_StatisticsEnabled)
+	{
+		vkCmdResetQueryPool(commandBuffer, frame.statisticsPool, 0, 1);
+		vkCmdBeginQuery(commandBuffer, frame.statisticsPool, 0, 0);
+	}
+}
+
+void GpuProfiler::EndFrame(VkCommandBuffer commandBuffer)
+{
+	if (m_pCurrent == nullptr) return;
+	if (m_OpenScopes > 0) throw std::runtime_error("Profiler scope left open at the end of the frame.");
+
+	if (m_StatisticsEnabled) vkCmdEndQuery(commandBuffer, m_pCurrent->statisticsPool, 0);
+	if (m_TimestampsEnabled) vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_pCurrent->timestampPool, 1);
+	m_pCurrent->cpuEnd = Now();
+	m_pCurrent = nullptr;
+}
+
+uint32_t GpuProfiler::BeginScope(VkCommandBuffer commandBuffer, const char *name)
+{
+	if (m_pCurrent == nullptr || m_pCurrent->scopes.size() >= MaxScopesPerFrame) return UINT32_MAX;
+
+	uint32_t scope = (uint32_t)m_pCurrent->scopes.size();
+	S_Scope newScope;
+	newScope.name = name;
+	newScope.cpuBegin = Now();
+	m_pCurrent->scopes.push_back(newScope);
+	m_OpenScopes++;
+
+	if (m_TimestampsEnabled) vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_pCurrent->timestampPool, 2 + 2 * scope);
+	return scope;
+}
+
+void GpuProfiler::EndScope(VkCommandBuffer commandBuffer, uint32_t scope)
+{
+	if (m_pCurrent == nullptr || scope >= m_pCurrent->scopes.size()) return;
+
+	m_pCurrent->scopes[scope].cpuEnd = Now();
+	m_OpenScopes--;
+	if (m_TimestampsEnabled) vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_pCurrent->timestampPool, 3 + 2 * scope);
+}
+
+void GpuProfiler::Finish()
+{
+	for (S_FrameSlot &frame : m_Frames)
+	{
+		if (frame.pending) Collect(frame);
+	}
+}
+
+// Never waits. Anything that isn't ready is counted as missed, and the CPU side is still traced.
+void GpuProfiler::Collect(S_FrameSlot &frame)
+{
+	frame.pending = false;
+	std::string frameName = "Frame " + std::to_string(frame.frameNumber);
+	AddEvent(frameName, 'X', 0, frame.cpuBegin, frame.cpuEnd - frame.cpuBegin, 0);
+	for (const S_Scope &scope : frame.scopes)
+		AddEvent(scope.name, 'X', 0, scope.cpuBegin, scope.cpuEnd - scope.cpuBegin, 0);
+
+	if (m_TimestampsEnabled)
+	{
+		uint32_t queryCount = 2 + 2 * (uint32_t)frame.scopes.size();
+		std::vector<uint64_t> ticks(queryCount);
+		VkResult result = vkGetQueryPoolResults(m_LogicalDevice, frame.timestampPool, 0, queryCount,
+			ticks.size() * sizeof(uint64_t), ticks.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+		if (result == VK_SUCCESS)
+		{
+			// Everything is relative to the frame's first timestamp, masked so a counter wrap doesn't go negative.
+			uint64_t begin = ticks[0];
+			auto toMicroseconds = [&](uint64_t tick) { return (double)((tick - begin) & m_TimestampMask) * m_TimestampPeriod / 1000.0; };
+
+			double gpuFrame = toMicroseconds(ticks[1]);
+			PushSample(m_GpuFrameTimes, m_GpuFrameIndex, gpuFrame / 1000.0);
+			AddEvent(frameName, 'X', 1, frame.cpuBegin, gpuFrame, 0);
+			for (size_t i = 0; i < frame.scopes.size(); i++)
+			{
+				double scopeBegin = toMicroseconds(ticks[2 + 2 * i]);
+				double scopeEnd = toMicroseconds(ticks[3 + 2 * i]);
+				AddEvent(frame.scopes[i].name, 'X', 1, frame.cpuBegin + scopeBegin, scopeEnd - scopeBegin, 0);
+			}
+		}
+		else m_MissedFrames++;
+	}
+
+	if (m_StatisticsEnabled)
+	{
+		uint64_t values[StatisticCount];
+		VkResult result = vkGetQueryPoolResults(m_LogicalDevice, frame.statisticsPool, 0, 1,
+			sizeof(values), values, sizeof(values), VK_QUERY_RESULT_64_BIT);
+		if (result == VK_SUCCESS)
+		{
+			for (uint32_t i = 0; i < StatisticCount; i++)
+				AddEvent(StatisticNames[i], 'C', 1, frame.cpuBegin, 0.0, values[i]);
+		}
+	}
+}
+
+void GpuProfiler::AddEvent(const std::string &name, char phase, int threadId, double timestamp, double duration, uint64_t counterValue)
+{
+	if (m_TraceEvents.size() >= MaxTraceEvents) return;
+	m_TraceEvents.push_back({ name, phase, threadId, timestamp, duration, counterValue });
+}
+
+void GpuProfiler::PushSample(std::vector<double> &samples, size_t &index, double value)
+{
+	if (samples.size() < StatsWindow) samples.push_back(value);
+	else samples[index] = value;
+	index = (index + 1) % StatsWindow;
+}
+
+// Nearest rank, on a copy so the ring keeps its order.
+double GpuProfiler::Percentile(std::vector<double> samples, double fraction)
+{
+	if (samples.empty()) return 0.0;
+	size_t rank = (size_t)(fraction * (samples.size() - 1) + 0.5);
+	std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+	return samples[rank];
+}
+
+S_FrameTimeStats GpuProfiler::GetFrameTimeStats() const
+{
+	S_FrameTimeStats stats;
+	stats.sampleCount = (uint32_t)m_CpuFrameTimes.size();
+	stats.cpuP50 = Percentile(m_CpuFrameTimes, 0.50);
+	stats.cpuP99 = Percentile(m_CpuFrameTimes, 0.99);
+	stats.gpuP50 = Percentile(m_GpuFrameTimes, 0.50);
+	stats.gpuP99 = Percentile(m_GpuFrameTimes, 0.99);
+	return stats;
+}
+
+void GpuProfiler::PrintStats(std::ostream &out) const
+{
+	S_FrameTimeStats stats = GetFrameTimeStats();
+	out << "Frame time over the last " << stats.sampleCount << " frames:" << std::endl;
+	out << "  CPU p50 " << stats.cpuP50 << " ms, p99 " << stats.cpuP99 << " ms" << std::endl;
+	if (m_TimestampsEnabled) out << "  GPU p50 " << stats.gpuP50 << " ms, p99 " << stats.gpuP99 << " ms" << std::endl;
+	else out << "  GPU timestamps aren't supported on this queue." << std::endl;
+	if (m_MissedFrames > 0) out << "  " << m_MissedFrames << " frame(s) had no GPU results in time." << std::endl;
+}
+
+// Chrome's trace event format. Complete events nest by time, counters become graphs.
+bool GpuProfiler::WriteChromeTrace(const std::string &path) const
+{
+	std::ofstream out(path);
+	if (!out.is_open()) return false;
+
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"CPU\"}},\n";
+	out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,\"args\":{\"name\":\"GPU\"}}";
+	for (const S_TraceEvent &event : m_TraceEvents)
+	{
+		out << ",\n{\"name\":\"";
+		for (char c : event.name)
+		{
+			if (c == '"' || c == '\\') out << '\\';
+			out << c;
+		}
+		out << "\",\"ph\":\"" << event.phase << "\",\"pid\":0,\"tid\":" << event.threadId << ",\"ts\":" << event.timestamp;
+		if (event.phase == 'X') out << ",\"dur\":" << event.duration << "}";
+		else out << ",\"args\":{\"value\":" << event.counterValue << "}}";
+	}
+	out << "\n]}\n";
+	return (bool)out;
+}
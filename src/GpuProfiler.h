@@ -0,0 +1,149 @@
+#pragma once
+
+#ifndef GPUPROFILER_H
+#define GPUPROFILER_H
+
+#include <chrono>
+
+#include "DeviceCapabilityProfile.h"
+
+// Rolling frame time percentiles, in milliseconds.
+struct S_FrameTimeStats
+{
+	uint32_t sampleCount = 0;
+	double cpuP50 = 0.0;
+	double cpuP99 = 0.0;
+	double gpuP50 = 0.0;
+	double gpuP99 = 0.0;
+};
+
+// Measures CPU and GPU time per frame and per named scope, and writes it all out as a Chrome trace
+// (load it in chrome://tracing or Perfetto).
+// Every frame in flight gets its own timestamp and pipeline statistics query pools. A frame's results are
+// read the next time its slot comes around, when its fence has already been waited on, so we never stall.
+// Results that still aren't available then are skipped rather than waited for.
+// GPU timestamps have no common clock with the CPU, so each GPU frame is placed at the CPU time it was recorded.
+// Scopes are recorded into the primary command buffer, from the thread that records it.
+class GpuProfiler
+{
+public:
+
+	static const uint32_t MaxScopesPerFrame = 64;
+	static const uint32_t StatsWindow = 256; // Frames the percentiles are taken over.
+	static const size_t MaxTraceEvents = 1 << 20; // Stop tracing rather than grow without bound.
+
+	// The queue family is where the frames are submitted, it decides if timestamps are supported at all.
+	// Pipeline statistics are only collected if the device was created with pipelineStatisticsQuery and inheritedQueries.
+	GpuProfiler(VkDevice logicalDevice, const DeviceCapabilityProfile &profile, int queueFamily, uint32_t frameCount,
+		const VkAllocationCallbacks *pAllocator);
+	~GpuProfiler();
+
+	// Call right after beginning the frame's command buffer, and right before ending it.
+	// BeginFrame collects the results from the last time this slot was used.
+	void BeginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+	void EndFrame(VkCommandBuffer commandBuffer);
+
+	// Returns a scope index to pass to EndScope, or UINT32_MAX once the frame is out of scopes.
+	uint32_t BeginScope(VkCommandBuffer commandBuffer, const char *name);
+	void EndScope(VkCommandBuffer commandBuffer, uint32_t scope);
+
+	// Collect every frame that's still outstanding. Only call once the device is idle.
+	void Finish();
+
+	// Secondaries executed inside a frame have to inherit the statistics we're collecting.
+	VkQueryPipelineStatisticFlags GetInheritedStatistics() const { return m_StatisticsEnabled ? StatisticFlags : 0; }
+	bool HasTimestamps() const { return m_TimestampsEnabled; }
+
+	S_FrameTimeStats GetFrameTimeStats() const;
+	void PrintStats(std::ostream &out) const;
+	bool WriteChromeTrace(const std::string &path) const;
+
+private:
+
+	typedef std::chrono::steady_clock Clock;
+
+	static const VkQueryPipelineStatisticFlags StatisticFlags;
+	static const uint32_t StatisticCount = 6;
+	static const char *StatisticNames[StatisticCount];
+
+	struct S_Scope
+	{
+		std::string name;
+		double cpuBegin = 0.0; // Microseconds since the profiler was created.
+		double cpuEnd = 0.0;
+	};
+
+	// Everything recorded into one frame in flight, waiting for its queries to come back.
+	struct S_FrameSlot
+	{
+		VkQueryPool timestampPool = VK_NULL_HANDLE;
+		VkQueryPool statisticsPool = VK_NULL_HANDLE;
+		bool pending = false;
+		uint64_t frameNumber = 0;
+		double cpuBegin = 0.0;
+		double cpuEnd = 0.0;
+		std::vector<S_Scope> scopes;
+	};
+
+	struct S_TraceEvent
+	{
+		std::string name;
+		char phase; // 'X' for a complete event, 'C' for a counter.
+		int threadId; // 0 for the CPU, 1 for the GPU.
+		double timestamp; // Microseconds.
+		double duration;
+		uint64_t counterValue;
+	};
+
+	VkDevice m_LogicalDevice;
+	const VkAllocationCallbacks *m_pAllocator;
+	bool m_TimestampsEnabled = false;
+	bool m_StatisticsEnabled = false;
+	double m_TimestampPeriod = 1.0; // Nanoseconds per tick.
+	uint64_t m_TimestampMask = ~0ull;
+
+	Clock::time_point m_Origin;
+	std::vector<S_FrameSlot> m_Frames;
+	S_FrameSlot *m_pCurrent = nullptr;
+	uint32_t m_OpenScopes = 0;
+	uint64_t m_FrameNumber = 0;
+	double m_LastFrameBegin = -1.0;
+
+	std::vector<double> m_CpuFrameTimes; // Rings of StatsWindow.
+	std::vector<double> m_GpuFrameTimes;
+	size_t m_CpuFrameIndex = 0;
+	size_t m_GpuFrameIndex = 0;
+	uint64_t m_MissedFrames = 0; // Results that weren't ready when we came back for them.
+	std::vector<S_TraceEvent> m_TraceEvents;
+
+	double Now() const;
+	void Collect(S_FrameSlot &frame);
+	void AddEvent(const std::string &name, char phase, int threadId, double timestamp, double duration, uint64_t counterValue);
+	static void PushSample(std::vector<double> &samples, size_t &index, double value);
+	static double Percentile(std::vector<double> samples, double fraction);
+};
+
+// Times everything recorded between construction and destruction, on the CPU and the GPU.
+// Does nothing without a profiler, so it can stay in the code when profiling is off.
+class GpuProfileScope
+{
+public:
+
+	GpuProfileScope(GpuProfiler *pProfiler, VkCommandBuffer commandBuffer, const char *name)
+		: m_pProfiler(pProfiler), m_CommandBuffer(commandBuffer)
+	{
+		if (m_pProfiler != nullptr) m_Scope = m_pProfiler->BeginScope(m_CommandBuffer, name);
+	}
+	~GpuProfileScope()
+	{
+		if (m_pProfiler != nullptr) m_pProfiler->EndScope(m_CommandBuffer, m_Scope);
+	}
+
+private:
+
+	GpuProfiler *m_pProfiler;
+	VkCommandBuffer m_CommandBuffer;
+	uint32_t m_Scope = UINT32_MAX;
+};
+
+#endif
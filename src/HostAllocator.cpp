@@ -0,0 +1,277 @@
+#include "stdafx.h"
+#include "HostAllocator.h"
+
+// Round value up to the next multiple of alignment (which must be a power of two).
+static uintptr_t AlignUp(uintptr_t value, size_t alignment)
+{
+	return (value + (alignment - 1)) & ~(uintptr_t)(alignment - 1);
+}
+
+HostAllocator::HostAllocator()
+{
+	m_Callbacks = {};
+	m_Callbacks.pUserData = this; // The trampolines use this to find us again.
+	m_Callbacks.pfnAllocation = AllocationCallback;
+	m_Callbacks.pfnReallocation = ReallocationCallback;
+	m_Callbacks.pfnFree = FreeCallback;
+	m_Callbacks.pfnInternalAllocation = InternalAllocationCallback;
+	m_Callbacks.pfnInternalFree = InternalFreeCallback;
+
+	// Each pool holds slots twice the size of the previous one.
+	for (size_t i = 0; i < PoolCount; i++)
+		m_Pools[i].slotSize = (size_t)1 << (MinSlotShift + i);
+}
+
+HostAllocator::~HostAllocator()
+{
+	for (size_t i = 0; i < PoolCount; i++)
+		for (void *slab : m_Pools[i].slabs) free(slab);
+	for (void *chunk : m_Arena.chunks) free(chunk);
+}
+
+S_HostAllocationStats HostAllocator::GetStats(VkSystemAllocationScope scope)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Stats[scope];
+}
+
+void HostAllocator::PrintStats(std::ostream &out)
+{
+	static const char *scopeNames[HOST_ALLOCATION_SCOPE_COUNT] = { "command", "object", "cache", "device", "instance" };
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	out << "Host allocations by scope:" << "\n";
+	for (int i = 0; i < HOST_ALLOCATION_SCOPE_COUNT; i++)
+	{
+		const S_HostAllocationStats &stats = m_Stats[i];
+		out << "  " << scopeNames[i]
+			<< ": allocations " << stats.allocations
+			<< ", frees " << stats.frees
+			<< ", live " << stats.liveAllocations << " (" << stats.liveBytes << " bytes)"
+			<< ", peak " << stats.peakBytes << " bytes"
+			<< ", total " << stats.totalBytes << " bytes"
+			<< ", internal " << stats.internalBytes << " bytes" << "\n";
+	}
+	out.flush();
+}
+
+// Command scope allocations only live for the duration of a single call, so they go into the arena.
+// Small allocations with default alignment go to the pools, everything else goes to the heap.
+void* HostAllocator::Allocate(size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+	if (size == 0) return nullptr;
+
+	S_Header header = {};
+	header.size = size;
+	header.scope = (uint8_t)scope;
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	char *pMemory = nullptr;
+	if (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND && size + alignment + HeaderSize <= ArenaChunkSize / 4)
+	{
+		header.source = SOURCE_ARENA;
+		pMemory = (char*)AllocateFromArena(size, alignment);
+	}
+	else if (alignment <= HeaderSize && size + HeaderSize <= m_Pools[PoolCount - 1].slotSize)
+	{
+		// Find the smallest pool that fits the header and the allocation.
+		size_t sizeClass = 0;
+		while (m_Pools[sizeClass].slotSize < size + HeaderSize) sizeClass++;
+
+		header.source = SOURCE_POOL;
+		header.sizeClass = (uint8_t)sizeClass;
+		char *pSlot = (char*)AllocateFromPool(sizeClass);
+		if (pSlot != nullptr) pMemory = pSlot + HeaderSize;
+	}
+	else
+	{
+		header.source = SOURCE_HEAP;
+		pMemory = (char*)AllocateFromHeap(size, alignment, header);
+	}
+
+	if (pMemory == nullptr) return nullptr; // The driver will report VK_ERROR_OUT_OF_HOST_MEMORY.
+
+	memcpy(pMemory - HeaderSize, &header, sizeof(S_Header));
+	CountAllocation(scope, size);
+	return pMemory;
+}
+
+// Pooled allocations can grow in place if the slot is large enough. Otherwise we move them.
+void* HostAllocator::Reallocate(void *pOriginal, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+	if (pOriginal == nullptr) return Allocate(size, alignment, scope);
+	if (size == 0)
+	{
+		Free(pOriginal);
+		return nullptr;
+	}
+
+	S_Header *pHeader = (S_Header*)((char*)pOriginal - HeaderSize);
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (pHeader->source == SOURCE_POOL && alignment <= HeaderSize && size + HeaderSize <= m_Pools[pHeader->sizeClass].slotSize)
+		{
+			CountFree(pHeader->scope, pHeader->size);
+			CountAllocation(scope, size);
+			pHeader->size = size;
+			pHeader->scope = (uint8_t)scope;
+			return pOriginal;
+		}
+	}
+
+	void *pMemory = Allocate(size, alignment, scope);
+	if (pMemory == nullptr) return nullptr; // The original allocation stays valid.
+
+	memcpy(pMemory, pOriginal, (size_t)std::min<uint64_t>(pHeader->size, size));
+	Free(pOriginal);
+	return pMemory;
+}
+
+void HostAllocator::Free(void *pMemory)
+{
+	if (pMemory == nullptr) return; // Freeing null is allowed.
+
+	S_Header header;
+	memcpy(&header, (char*)pMemory - HeaderSize, sizeof(S_Header));
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	switch (header.source)
+	{
+	case SOURCE_POOL: FreeToPool((char*)pMemory - HeaderSize, header.sizeClass); break;
+	case SOURCE_ARENA: FreeToArena(); break;
+	default: free((char*)pMemory - header.offset); break;
+	}
+	CountFree(header.scope, header.size);
+}
+
+// Pop a slot from the free-list. If it's empty, we carve a new slab into slots first.
+void* HostAllocator::AllocateFromPool(size_t sizeClass)
+{
+	S_Pool &pool = m_Pools[sizeClass];
+	if (pool.freeList == nullptr)
+	{
+		// Over-allocate so we can align the first slot.
+		void *pSlab = malloc(SlabSize + HeaderSize);
+		if (pSlab == nullptr) return nullptr;
+		pool.slabs.push_back(pSlab);
+
+		// Thread every slot in the slab onto the free-list.
+		char *pFirst = (char*)AlignUp((uintptr_t)pSlab, HeaderSize);
+		size_t slotCount = SlabSize / pool.slotSize;
+		for (size_t i = 0; i < slotCount; i++)
+		{
+			char *pSlot = pFirst + i * pool.slotSize;
+			*(void**)pSlot = pool.freeList;
+			pool.freeList = pSlot;
+		}
+	}
+
+	void *pSlot = pool.freeList;
+	pool.freeList = *(void**)pSlot;
+	return pSlot;
+}
+
+// Bump allocate from the current chunk, moving on to the next chunk if it doesn't fit.
+// Chunks are kept around after a reset, so steady state command allocations never touch the heap.
+void* HostAllocator::AllocateFromArena(size_t size, size_t alignment)
+{
+	size_t align = std::max(alignment, (size_t)HeaderSize);
+	for (;;)
+	{
+		if (m_Arena.chunkIndex == m_Arena.chunks.size())
+		{
+			void *pChunk = malloc(ArenaChunkSize + HeaderSize);
+			if (pChunk == nullptr) return nullptr;
+			m_Arena.chunks.push_back(pChunk);
+		}
+
+		uintptr_t base = AlignUp((uintptr_t)m_Arena.chunks[m_Arena.chunkIndex], HeaderSize);
+		uintptr_t user = AlignUp(base + m_Arena.chunkOffset + HeaderSize, align);
+		if (user + size <= base + ArenaChunkSize)
+		{
+			m_Arena.chunkOffset = (size_t)(user + size - base);
+			m_Arena.liveAllocations++;
+			return (void*)user;
+		}
+
+		// Doesn't fit, so try the next chunk.
+		m_Arena.chunkIndex++;
+		m_Arena.chunkOffset = 0;
+	}
+}
+
+// Heap allocations are over-allocated so we can align the user pointer and still fit the header.
+void* HostAllocator::AllocateFromHeap(size_t size, size_t alignment, S_Header &header)
+{
+	size_t align = std::max(alignment, (size_t)HeaderSize);
+	char *pRaw = (char*)malloc(size + align + HeaderSize);
+	if (pRaw == nullptr) return nullptr;
+
+	char *pMemory = (char*)AlignUp((uintptr_t)pRaw + HeaderSize, align);
+	header.offset = (uint32_t)(pMemory - pRaw);
+	return pMemory;
+}
+
+void HostAllocator::FreeToPool(void *pSlot, size_t sizeClass)
+{
+	S_Pool &pool = m_Pools[sizeClass];
+	*(void**)pSlot = pool.freeList;
+	pool.freeList = pSlot;
+}
+
+// Once the last command allocation is gone, the whole arena can be reused from the start.
+void HostAllocator::FreeToArena()
+{
+	if (--m_Arena.liveAllocations > 0) return;
+	m_Arena.chunkIndex = 0;
+	m_Arena.chunkOffset = 0;
+}
+
+void HostAllocator::CountAllocation(VkSystemAllocationScope scope, uint64_t size)
+{
+	S_HostAllocationStats &stats = m_Stats[scope];
+	stats.allocations++;
+	stats.liveAllocations++;
+	stats.liveBytes += size;
+	stats.totalBytes += size;
+	stats.peakBytes = std::max(stats.peakBytes, stats.liveBytes);
+}
+
+void HostAllocator::CountFree(uint8_t scope, uint64_t size)
+{
+	S_HostAllocationStats &stats = m_Stats[scope];
+	stats.frees++;
+	stats.liveAllocations--;
+	stats.liveBytes -= size;
+}
+
+void* VKAPI_CALL HostAllocator::AllocationCallback(void *pUserData, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+	return ((HostAllocator*)pUserData)->Allocate(size, alignment, scope);
+}
+
+void* VKAPI_CALL HostAllocator::ReallocationCallback(void *pUserData, void *pOriginal, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+	return ((HostAllocator*)pUserData)->Reallocate(pOriginal, size, alignment, scope);
+}
+
+void VKAPI_CALL HostAllocator::FreeCallback(void *pUserData, void *pMemory)
+{
+	((HostAllocator*)pUserData)->Free(pMemory);
+}
+
+// The driver tells us about memory it allocated itself (usually executable memory), we only count it.
+void VKAPI_CALL HostAllocator::InternalAllocationCallback(void *pUserData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope)
+{
+	HostAllocator *pAllocator = (HostAllocator*)pUserData;
+	std::lock_guard<std::mutex> lock(pAllocator->m_Mutex);
+	pAllocator->m_Stats[scope].internalBytes += size;
+}
+
+void VKAPI_CALL HostAllocator::InternalFreeCallback(void *pUserData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope)
+{
+	HostAllocator *pAllocator = (HostAllocator*)pUserData;
+	std::lock_guard<std::mutex> lock(pAllocator->m_Mutex);
+	pAllocator->m_Stats[scope].internalBytes -= size;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#ifndef HOSTALLOCATOR_H
+#define HOSTALLOCATOR_H
+
+#include <mutex>
+
+// Number of VkSystemAllocationScope values (COMMAND through INSTANCE).
+#define HOST_ALLOCATION_SCOPE_COUNT 5
+
+// Counters for a single allocation scope.
+struct S_HostAllocationStats
+{
+	uint64_t allocations = 0; // Number of allocations made, including reallocations.
+	uint64_t frees = 0;
+	uint64_t liveAllocations = 0;
+	uint64_t liveBytes = 0;
+	uint64_t peakBytes = 0;
+	uint64_t totalBytes = 0; // Bytes requested over the lifetime of the allocator.
+	uint64_t internalBytes = 0; // Bytes the driver reported allocating on its own.
+};
+
+// Host allocator that the driver calls through VkAllocationCallbacks.
+// Small allocations come from size-class pools, command scope allocations come from a linear arena,
+// and anything else falls through to the heap. Every allocation is counted against its scope.
+class HostAllocator
+{
+public:
+
+	HostAllocator();
+	~HostAllocator();
+
+	// The callbacks to pass to every vkCreate*/vkDestroy* call.
+	const VkAllocationCallbacks* Callbacks() const { return &m_Callbacks; }
+
+	S_HostAllocationStats GetStats(VkSystemAllocationScope scope);
+	void PrintStats(std::ostream &out);
+
+private:
+
+	// Where an allocation came from, so we know how to give it back.
+	enum E_Source : uint8_t { SOURCE_POOL, SOURCE_ARENA, SOURCE_HEAP };
+
+	// Stored right before every pointer we hand out.
+	struct S_Header
+	{
+		uint64_t size; // Size the driver asked for.
+		uint32_t offset; // Distance from the raw allocation to the user pointer (heap only).
+		uint8_t scope;
+		uint8_t source;
+		uint8_t sizeClass;
+		uint8_t padding;
+	};
+
+	// A free-list of equally sized slots, carved out of larger slabs.
+	struct S_Pool
+	{
+		size_t slotSize = 0;
+		void *freeList = nullptr;
+		std::vector<void*> slabs;
+	};
+
+	// A bump allocator that is reset once everything in it has been freed.
+	struct S_Arena
+	{
+		std::vector<void*> chunks;
+		size_t chunkIndex = 0;
+		size_t chunkOffset = 0;
+		uint64_t liveAllocations = 0;
+	};
+
+	static const size_t HeaderSize = 16;
+	static const size_t MinSlotShift = 5; // 32 byte slots.
+	static const size_t PoolCount = 7; // Up to 2048 byte slots.
+	static const size_t SlabSize = 64 * 1024;
+	static const size_t ArenaChunkSize = 256 * 1024;
+
+	VkAllocationCallbacks m_Callbacks;
+	std::mutex m_Mutex;
+	S_Pool m_Pools[PoolCount];
+	S_Arena m_Arena;
+	S_HostAllocationStats m_Stats[HOST_ALLOCATION_SCOPE_COUNT];
+
+	void* Allocate(size_t size, size_t alignment, VkSystemAllocationScope scope);
+	void* Reallocate(void *pOriginal, size_t size, size_t alignment, VkSystemAllocationScope scope);
+	void Free(void *pMemory);
+
+	void* AllocateFromPool(size_t sizeClass);
+	void* AllocateFromArena(size_t size, size_t alignment);
+	void* AllocateFromHeap(size_t size, size_t alignment, S_Header &header);
+	void FreeToPool(void *pSlot, size_t sizeClass);
+	void FreeToArena();
+
+	void CountAllocation(VkSystemAllocationScope scope, uint64_t size);
+	void CountFree(uint8_t scope, uint64_t size);
+
+	// Static trampolines that the driver calls. pUserData points back to the allocator.
+	static void* VKAPI_CALL AllocationCallback(void *pUserData, size_t size, size_t alignment, VkSystemAllocationScope scope);
+	static void* VKAPI_CALL ReallocationCallback(void *pUserData, void *pOriginal, size_t size, size_t alignment, VkSystemAllocationScope scope);
+	static void VKAPI_CALL FreeCallback(void *pUserData, void *pMemory);
+	static void VKAPI_CALL InternalAllocationCallback(void *pUserData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+	static void VKAPI_CALL InternalFreeCallback(void *pUserData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+};
+
+#endif
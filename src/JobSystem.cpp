@@ -0,0 +1,141 @@
+#include "stdafx.h"
+#include "JobSystem.h"
+
+// Which job system the running thread works for, if any, and its queue there.
+static thread_local const JobSystem *t_pJobSystem = nullptr;
+static thread_local int t_ThreadIndex = 0;
+
+JobSystem::JobSystem(int threadCount)
+{
+	if (threadCount <= 0) threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+
+	for (int i = 0; i < threadCount; i++)
+		m_Queues.push_back(std::unique_ptr<S_WorkQueue>(new S_WorkQueue()));
+
+	for (int i = 1; i < threadCount; i++)
+		m_Workers.push_back(std::thread(&JobSystem::WorkerLoop, this, i));
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_SleepMutex);
+		m_Stop = true;
+	}
+	m_WakeCondition.notify_all();
+	for (std::thread &worker : m_Workers) worker.join();
+}
+
+int JobSystem::GetCurrentThreadIndex() const
+{
+	return (t_pJobSystem == this) ? t_ThreadIndex : 0;
+}
+
+// Jobs go to the back of the submitting thread's own deque, so they stay warm in its cache.
+// Threads outside the job system hand their jobs to queue 0.
+void JobSystem::Submit(Job job, S_JobCounter *pCounter)
+{
+	if (pCounter != nullptr)
+	{
+		pCounter->pending.fetch_add(1, std::memory_order_relaxed);
+		job = [job, pCounter]()
+		{
+			job();
+			pCounter->pending.fetch_sub(1, std::memory_order_release);
+		};
+	}
+
+	int threadIndex = GetCurrentThreadIndex();
+	{
+		std::lock_guard<std::mutex> lock(m_Queues[threadIndex]->mutex);
+		m_Queues[threadIndex]->jobs.push_back(std::move(job));
+	}
+
+	// Take the sleep lock so a worker can't miss the wakeup between checking and sleeping.
+	{
+		std::lock_guard<std::mutex> lock(m_SleepMutex);
+		m_QueuedJobs.fetch_add(1, std::memory_order_release);
+	}
+	m_WakeCondition.notify_one();
+}
+
+void JobSystem::Wait(S_JobCounter &counter)
+{
+	int threadIndex = GetCurrentThreadIndex();
+	while (!counter.isDone())
+	{
+		if (!TryRunJob(threadIndex)) std::this_thread::yield(); // Someone else is running the last jobs.
+	}
+}
+
+void JobSystem::ParallelFor(uint32_t count, uint32_t batchSize, std::function<void(uint32_t index, int threadIndex)> body)
+{
+	if (count == 0) return;
+	batchSize = std::max(1u, batchSize);
+
+	S_JobCounter counter;
+	for (uint32_t begin = 0; begin < count; begin += batchSize)
+	{
+		uint32_t end = std::min(count, begin + batchSize);
+		Submit([this, &body, begin, end]()
+		{
+			int threadIndex = GetCurrentThreadIndex();
+			for (uint32_t i = begin; i < end; i++) body(i, threadIndex);
+		}, &counter);
+	}
+	Wait(counter);
+}
+
+void JobSystem::WorkerLoop(int threadIndex)
+{
+	t_pJobSystem = this;
+	t_ThreadIndex = threadIndex;
+	for (;;)
+	{
+		if (TryRunJob(threadIndex)) continue;
+
+		// Nothing to do anywhere, so sleep until something is submitted.
+		std::unique_lock<std::mutex> lock(m_SleepMutex);
+		m_WakeCondition.wait(lock, [this]() { return m_Stop.load() || m_QueuedJobs.load(std::memory_order_acquire) > 0; });
+		if (m_Stop) return;
+	}
+}
+
+bool JobSystem::TryRunJob(int threadIndex)
+{
+	Job job;
+	if (!PopOwn(threadIndex, job) && !Steal(threadIndex, job)) return false;
+
+	m_QueuedJobs.fetch_sub(1, std::memory_order_relaxed);
+	job();
+	return true;
+}
+
+// Newest first from our own deque.
+bool JobSystem::PopOwn(int threadIndex, Job &job)
+{
+	S_WorkQueue &queue = *m_Queues[threadIndex];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.jobs.empty()) return false;
+
+	job = std::move(queue.jobs.back());
+	queue.jobs.pop_back();
+	return true;
+}
+
+// Oldest first from someone else's deque, starting with our neighbour so thieves spread out.
+bool JobSystem::Steal(int threadIndex, Job &job)
+{
+	int threadCount = GetThreadCount();
+	for (int offset = 1; offset < threadCount; offset++)
+	{
+		S_WorkQueue &queue = *m_Queues[(threadIndex + offset) % threadCount];
+		std::unique_lock<std::mutex> lock(queue.mutex, std::try_to_lock); // Don't wait on a busy victim.
+		if (!lock.owns_lock() || queue.jobs.empty()) continue;
+
+		job = std::move(queue.jobs.front());
+		queue.jobs.pop_front();
+		return true;
+	}
+	return false;
+}
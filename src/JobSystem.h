@@ -0,0 +1,65 @@
+#pragma once
+
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Counts outstanding jobs, so a caller can wait for a batch to finish.
+struct S_JobCounter
+{
+	std::atomic<int> pending{ 0 };
+
+	bool isDone() const { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+// A pool of worker threads, one per core, each with its own deque of jobs.
+// Owners push and pop at the back, idle workers steal from the front of everybody else's deque.
+// Workers are thread indices 1 through GetThreadCount() - 1. Index 0 belongs to every thread outside the job system,
+// which helps out with queue 0 whenever it waits. Indices are per job system, a worker of one is outside all the others.
+class JobSystem
+{
+public:
+
+	typedef std::function<void()> Job;
+
+	JobSystem(int threadCount = 0); // 0 uses one thread per core.
+	~JobSystem();
+
+	void Submit(Job job, S_JobCounter *pCounter = nullptr);
+	void Wait(S_JobCounter &counter); // Runs other jobs while waiting, so it never deadlocks.
+
+	// Runs body(index, threadIndex) for every index in [0, count), split into batches of batchSize.
+	// No two threads running body at once share a threadIndex, as long as only one outside thread calls this at a time.
+	void ParallelFor(uint32_t count, uint32_t batchSize, std::function<void(uint32_t index, int threadIndex)> body);
+
+	int GetThreadCount() const { return (int)m_Queues.size(); }
+	int GetCurrentThreadIndex() const; // 0 on threads that aren't this job system's workers.
+
+private:
+
+	struct S_WorkQueue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	std::vector<std::unique_ptr<S_WorkQueue>> m_Queues; // One per thread, including the creating thread.
+	std::vector<std::thread> m_Workers;
+	std::atomic<int> m_QueuedJobs{ 0 };
+	std::atomic<bool> m_Stop{ false };
+	std::mutex m_SleepMutex;
+	std::condition_variable m_WakeCondition;
+
+	void WorkerLoop(int threadIndex);
+	bool TryRunJob(int threadIndex);
+	bool PopOwn(int threadIndex, Job &job);
+	bool Steal(int threadIndex, Job &job);
+};
+
+#endif
@@ -0,0 +1,96 @@
+#include "stdafx.h"
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string &path)
+{
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) throw std::runtime_error("Failed to open file: " + path);
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		throw std::runtime_error("Failed to map empty file: " + path);
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	void *pData = (mapping != nullptr) ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (pData == nullptr)
+	{
+		if (mapping != nullptr) CloseHandle(mapping);
+		CloseHandle(file);
+		throw std::runtime_error("Failed to map file: " + path);
+	}
+
+	m_File = file;
+	m_Mapping = mapping;
+	m_pData = (const uint8_t*)pData;
+	m_Size = (uint64_t)size.QuadPart;
+}
+
+MappedFile::~MappedFile()
+{
+	UnmapViewOfFile(m_pData);
+	CloseHandle(m_Mapping);
+	CloseHandle(m_File);
+}
+
+// PrefetchVirtualMemory needs Windows 8, so we rely on the sequential scan hint instead.
+void MappedFile::Prefetch(uint64_t offset, uint64_t size) const
+{
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &path)
+{
+	int file = open(path.c_str(), O_RDONLY);
+	if (file < 0) throw std::runtime_error("Failed to open file: " + path);
+
+	struct stat status;
+	if (fstat(file, &status) != 0 || status.st_size == 0)
+	{
+		close(file);
+		throw std::runtime_error("Failed to map empty file: " + path);
+	}
+
+	// The mapping keeps the file alive, so the descriptor isn't needed past this.
+	void *pData = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if (pData == MAP_FAILED) throw std::runtime_error("Failed to map file: " + path);
+	madvise(pData, (size_t)status.st_size, MADV_SEQUENTIAL);
+
+	m_pData = (const uint8_t*)pData;
+	m_Size = (uint64_t)status.st_size;
+}
+
+MappedFile::~MappedFile()
+{
+	munmap((void*)m_pData, (size_t)m_Size);
+}
+
+void MappedFile::Prefetch(uint64_t offset, uint64_t size) const
+{
+	if (offset >= m_Size) return;
+	size = std::min(size, m_Size - offset);
+
+	// madvise wants a page aligned start.
+	uint64_t pageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+	uint64_t start = offset & ~(pageSize - 1);
+	madvise((void*)(m_pData + start), (size_t)(offset + size - start), MADV_WILLNEED);
+}
+
+#endif
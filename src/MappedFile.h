@@ -0,0 +1,36 @@
+#pragma once
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstdint>
+
+// A whole file mapped read-only into memory. Pages are only read in when they're first touched,
+// so mapping is cheap however large the file is, and reads never go through a copy of our own.
+class MappedFile
+{
+public:
+
+	MappedFile(const std::string &path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const uint8_t* GetData() const { return m_pData; }
+	uint64_t GetSize() const { return m_Size; }
+
+	// Ask for a range to be read in ahead of time, so touching it later doesn't stall. Just a hint.
+	void Prefetch(uint64_t offset, uint64_t size) const;
+
+private:
+
+	const uint8_t *m_pData = nullptr;
+	uint64_t m_Size = 0;
+#ifdef _WIN32
+	void *m_File = nullptr;
+	void *m_Mapping = nullptr;
+#endif
+};
+
+#endif
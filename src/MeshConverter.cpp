@@ -0,0 +1,365 @@
+#include "stdafx.h"
+#include "MeshConverter.h"
+
+#include <cfloat>
+#include <cmath>
+#include <sstream>
+#include <unordered_map>
+
+// The few vector operations the converter needs, on the plain float arrays the format uses.
+static void Subtract(const float *a, const float *b, float *pOut)
+{
+	for (int i = 0; i < 3; i++) pOut[i] = a[i] - b[i];
+}
+
+static void Cross(const float *a, const float *b, float *pOut)
+{
+	pOut[0] = a[1] * b[2] - a[2] * b[1];
+	pOut[1] = a[2] * b[0] - a[0] * b[2];
+	pOut[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static float Dot(const float *a, const float *b)
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static float Normalize(float *v)
+{
+	float length = std::sqrt(Dot(v, v));
+	if (length > 0.0f) for (int i = 0; i < 3; i++) v[i] /= length;
+	return length;
+}
+
+// Area weighted, since the cross product's length is twice the triangle's area.
+static void FaceNormal(const S_MeshVertex &v0, const S_MeshVertex &v1, const S_MeshVertex &v2, float *pOut)
+{
+	float edge1[3], edge2[3];
+	Subtract(v1.position, v0.position, edge1);
+	Subtract(v2.position, v0.position, edge2);
+	Cross(edge1, edge2, pOut);
+}
+
+void MeshConverter::ConvertObj(const std::string &inputPath, const std::string &outputPath, std::ostream &out)
+{
+	std::ifstream file(inputPath);
+	if (!file.is_open()) throw std::runtime_error("Failed to open mesh: " + inputPath);
+	std::vector<S_SourceMesh> meshes = ParseObj(file);
+	if (meshes.empty()) throw std::runtime_error("Mesh has no faces: " + inputPath);
+
+	Write(meshes, outputPath);
+
+	size_t vertexCount = 0, triangleCount = 0;
+	for (const S_SourceMesh &mesh : meshes)
+	{
+		vertexCount += mesh.vertices.size();
+		triangleCount += mesh.indices.size() / 3;
+	}
+	out << "Converted " << inputPath << " to " << outputPath << ": " << meshes.size() << " meshes, "
+		<< vertexCount << " vertices, " << triangleCount << " triangles" << std::endl;
+}
+
+std::vector<S_SourceMesh> MeshConverter::ParseObj(std::istream &in)
+{
+	// OBJ indexes positions, texture coordinates and normals separately. A vertex is one combination of the three.
+	struct S_Corner
+	{
+		int position, uv, normal;
+		bool operator==(const S_Corner &other) const { return position == other.position && uv == other.uv && normal == other.normal; }
+	};
+	struct S_CornerHash
+	{
+		size_t operator()(const S_Corner &corner) const
+		{
+			return std::hash<int>()(corner.position) ^ (std::hash<int>()(corner.uv) * 31) ^ (std::hash<int>()(corner.normal) * 961);
+		}
+	};
+
+	std::vector<float> positions, uvs, normals;
+	std::vector<S_SourceMesh> meshes;
+	S_SourceMesh mesh;
+	std::unordered_map<S_Corner, uint32_t, S_CornerHash> corners;
+	std::vector<bool> generateNormal; // Per vertex of the current mesh.
+
+	auto finishMesh = [&]()
+	{
+		if (mesh.indices.empty()) return;
+
+		// Smooth normals for the corners that didn't come with one.
+		if (std::find(generateNormal.begin(), generateNormal.end(), true) != generateNormal.end())
+		{
+			for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+			{
+				float normal[3];
+				FaceNormal(mesh.vertices[mesh.indices[i]], mesh.vertices[mesh.indices[i + 1]], mesh.vertices[mesh.indices[i + 2]], normal);
+				for (size_t corner = i; corner < i + 3; corner++)
+				{
+					if (!generateNormal[mesh.indices[corner]]) continue;
+					float *pNormal = mesh.vertices[mesh.indices[corner]].normal;
+					for (int axis = 0; axis < 3; axis++) pNormal[axis] += normal[axis];
+				}
+			}
+			for (size_t i = 0; i < mesh.vertices.size(); i++) if (generateNormal[i]) Normalize(mesh.vertices[i].normal);
+		}
+
+		meshes.push_back(std::move(mesh));
+		mesh = S_SourceMesh();
+		corners.clear();
+		generateNormal.clear();
+	};
+
+	// 1 based, and negative indices count back from the last one read.
+	auto resolve = [](const std::string &token, size_t count)
+	{
+		if (token.empty()) return -1;
+		int index = atoi(token.c_str());
+		index = (index < 0) ? (int)count + index : index - 1;
+		if (index < 0 || index >= (int)count) throw std::runtime_error("Mesh face index out of range: " + token);
+		return index;
+	};
+
+	std::string line;
+	std::vector<uint32_t> face;
+	while (std::getline(in, line))
+	{
+		std::istringstream stream(line);
+		std::string keyword;
+		stream >> keyword;
+
+		if (keyword == "v" || keyword == "vn")
+		{
+			std::vector<float> &target = (keyword == "v") ? positions : normals;
+			float x = 0.0f, y = 0.0f, z = 0.0f;
+			stream >> x >> y >> z;
+			target.insert(target.end(), { x, y, z });
+		}
+		else if (keyword == "vt")
+		{
+			float u = 0.0f, v = 0.0f;
+			stream >> u >> v;
+			uvs.insert(uvs.end(), { u, 1.0f - v }); // OBJ puts the origin at the bottom, Vulkan at the top.
+		}
+		else if (keyword == "o" || keyword == "g")
+		{
+			finishMesh();
+			std::getline(stream >> std::ws, mesh.name);
+		}
+		else if (keyword == "f")
+		{
+			face.clear();
+			std::string token;
+			while (stream >> token)
+			{
+				// v, v/vt, v//vn or v/vt/vn.
+				size_t slash1 = token.find('/');
+				size_t slash2 = (slash1 == std::string::npos) ? std::string::npos : token.find('/', slash1 + 1);
+				S_Corner corner;
+				corner.position = resolve(token.substr(0, slash1), positions.size() / 3);
+				corner.uv = (slash1 == std::string::npos) ? -1 : resolve(token.substr(slash1 + 1, slash2 - slash1 - 1), uvs.size() / 2);
+				corner.normal = (slash2 == std::string::npos) ? -1 : resolve(token.substr(slash2 + 1), normals.size() / 3);
+				if (corner.position < 0) throw std::runtime_error("Mesh face is missing a position: " + token);
+
+				auto it = corners.find(corner);
+				if (it == corners.end())
+				{
+					S_MeshVertex vertex = {};
+					memcpy(vertex.position, &positions[corner.position * 3], sizeof(vertex.position));
+					if (corner.uv >= 0) memcpy(vertex.uv, &uvs[corner.uv * 2], sizeof(vertex.uv));
+					if (corner.normal >= 0) memcpy(vertex.normal, &normals[corner.normal * 3], sizeof(vertex.normal));
+					it = corners.insert(std::make_pair(corner, (uint32_t)mesh.vertices.size())).first;
+					mesh.vertices.push_back(vertex);
+					generateNormal.push_back(corner.normal < 0);
+				}
+				face.push_back(it->second);
+			}
+
+			// Fan out from the first corner, which is right for the convex polygons OBJ exporters write.
+			for (size_t i = 2; i < face.size(); i++) mesh.indices.insert(mesh.indices.end(), { face[0], face[i - 1], face[i] });
+		}
+	}
+	finishMesh();
+
+	for (size_t i = 0; i < meshes.size(); i++) if (meshes[i].name.empty()) meshes[i].name = "mesh" + std::to_string(i);
+	return meshes;
+}
+
+// Greedy, in index order: a meshlet is closed as soon as the next triangle wouldn't fit.
+// Index order is usually good enough for locality, since exporters tend to write connected faces together.
+void MeshConverter::BuildMeshlets(const S_SourceMesh &mesh, uint32_t vertexBase, std::vector<S_MeshletRecord> &meshlets,
+	std::vector<uint32_t> &meshletVertices, std::vector<uint32_t> &meshletTriangles)
+{
+	std::vector<uint32_t> localIndex(mesh.vertices.size(), UINT32_MAX);
+	std::vector<uint32_t> vertices; // Mesh vertices in the current meshlet.
+	size_t firstTriangle = meshletTriangles.size();
+
+	auto finishMeshlet = [&]()
+	{
+		size_t triangleCount = meshletTriangles.size() - firstTriangle;
+		if (triangleCount == 0) return;
+
+		S_MeshletRecord meshlet = {};
+		meshlet.vertexOffset = (uint32_t)meshletVertices.size();
+		meshlet.triangleOffset = (uint32_t)firstTriangle;
+		meshlet.vertexCount = (uint32_t)vertices.size();
+		meshlet.triangleCount = (uint32_t)triangleCount;
+
+		S_MeshBounds bounds = ComputeBounds(mesh.vertices.data(), vertices.data(), vertices.size());
+		memcpy(meshlet.center, bounds.center, sizeof(meshlet.center));
+		meshlet.radius = bounds.radius;
+
+		// The cone axis is the average normal, and the cutoff is the normal furthest from it.
+		std::vector<float> normals;
+		float axis[3] = {};
+		for (size_t i = firstTriangle; i < meshletTriangles.size(); i++)
+		{
+			uint32_t packed = meshletTriangles[i];
+			float normal[3];
+			FaceNormal(mesh.vertices[vertices[packed & 0xFF]], mesh.vertices[vertices[(packed >> 8) & 0xFF]],
+				mesh.vertices[vertices[(packed >> 16) & 0xFF]], normal);
+			if (Normalize(normal) == 0.0f) continue; // Degenerate.
+			normals.insert(normals.end(), normal, normal + 3);
+			for (int axisIndex = 0; axisIndex < 3; axisIndex++) axis[axisIndex] += normal[axisIndex];
+		}
+		meshlet.coneCutoff = -1.0f;
+		if (Normalize(axis) > 0.0f)
+		{
+			float cutoff = 1.0f;
+			for (size_t i = 0; i < normals.size(); i += 3) cutoff = std::min(cutoff, Dot(axis, &normals[i]));
+			memcpy(meshlet.coneAxis, axis, sizeof(meshlet.coneAxis));
+			if (cutoff > 0.0f) meshlet.coneCutoff = cutoff; // Anything wider than a hemisphere faces every way.
+		}
+		meshlets.push_back(meshlet);
+
+		for (uint32_t vertex : vertices)
+		{
+			meshletVertices.push_back(vertexBase + vertex);
+			localIndex[vertex] = UINT32_MAX;
+		}
+		vertices.clear();
+		firstTriangle = meshletTriangles.size();
+	};
+
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+	{
+		const uint32_t *pTriangle = &mesh.indices[i];
+		uint32_t newVertices = 0;
+		for (int corner = 0; corner < 3; corner++) if (localIndex[pTriangle[corner]] == UINT32_MAX) newVertices++;
+		if (vertices.size() + newVertices > MaxMeshletVertices || meshletTriangles.size() - firstTriangle == MaxMeshletTriangles)
+			finishMeshlet();
+
+		uint32_t packed = 0;
+		for (int corner = 0; corner < 3; corner++)
+		{
+			uint32_t &local = localIndex[pTriangle[corner]];
+			if (local == UINT32_MAX)
+			{
+				local = (uint32_t)vertices.size();
+				vertices.push_back(pTriangle[corner]);
+			}
+			packed |= local << (corner * 8);
+		}
+		meshletTriangles.push_back(packed);
+	}
+	finishMeshlet();
+}
+
+// The sphere is centered on the box, which is never far off and takes one pass.
+// Without indices, the first count vertices are used.
+S_MeshBounds MeshConverter::ComputeBounds(const S_MeshVertex *pVertices, const uint32_t *pIndices, size_t count)
+{
+	S_MeshBounds bounds = {};
+	if (count == 0) return bounds;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		bounds.min[axis] = FLT_MAX;
+		bounds.max[axis] = -FLT_MAX;
+	}
+	for (size_t i = 0; i < count; i++)
+	{
+		const float *pPosition = pVertices[(pIndices != nullptr) ? pIndices[i] : i].position;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			bounds.min[axis] = std::min(bounds.min[axis], pPosition[axis]);
+			bounds.max[axis] = std::max(bounds.max[axis], pPosition[axis]);
+		}
+	}
+
+	for (int axis = 0; axis < 3; axis++) bounds.center[axis] = (bounds.min[axis] + bounds.max[axis]) * 0.5f;
+	float radiusSquared = 0.0f;
+	for (size_t i = 0; i < count; i++)
+	{
+		float offset[3];
+		Subtract(pVertices[(pIndices != nullptr) ? pIndices[i] : i].position, bounds.center, offset);
+		radiusSquared = std::max(radiusSquared, Dot(offset, offset));
+	}
+	bounds.radius = std::sqrt(radiusSquared);
+	return bounds;
+}
+
+void MeshConverter::Write(const std::vector<S_SourceMesh> &meshes, const std::string &path)
+{
+	std::vector<S_MeshRecord> records;
+	std::vector<S_MeshletRecord> meshlets;
+	std::vector<S_MeshVertex> vertices;
+	std::vector<uint32_t> indices, meshletVertices, meshletTriangles;
+
+	S_MeshFileHeader header = {};
+	header.magic = MeshFormatMagic;
+	header.version = MeshFormatVersion;
+	header.vertexStride = sizeof(S_MeshVertex);
+
+	// Every blob is the meshes' pieces back to back, in mesh order.
+	for (const S_SourceMesh &mesh : meshes)
+	{
+		S_MeshRecord record = {};
+		strncpy(record.name, mesh.name.c_str(), sizeof(record.name) - 1);
+		record.firstVertex = (uint32_t)vertices.size();
+		record.vertexCount = (uint32_t)mesh.vertices.size();
+		record.firstIndex = (uint32_t)indices.size();
+		record.indexCount = (uint32_t)mesh.indices.size();
+		record.firstMeshlet = (uint32_t)meshlets.size();
+		record.firstMeshletVertex = (uint32_t)meshletVertices.size();
+		record.firstMeshletTriangle = (uint32_t)meshletTriangles.size();
+		BuildMeshlets(mesh, record.firstVertex, meshlets, meshletVertices, meshletTriangles);
+		record.meshletCount = (uint32_t)meshlets.size() - record.firstMeshlet;
+		record.meshletVertexCount = (uint32_t)meshletVertices.size() - record.firstMeshletVertex;
+		record.meshletTriangleCount = (uint32_t)meshletTriangles.size() - record.firstMeshletTriangle;
+		record.bounds = ComputeBounds(mesh.vertices.data(), nullptr, mesh.vertices.size());
+		records.push_back(record);
+
+		vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+		indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+	}
+	header.meshCount = (uint32_t)records.size();
+	header.meshletCount = (uint32_t)meshlets.size();
+	header.bounds = ComputeBounds(vertices.data(), nullptr, vertices.size());
+
+	const void *pSectionData[MESH_SECTION_COUNT] = { records.data(), meshlets.data(), vertices.data(), indices.data(),
+		meshletVertices.data(), meshletTriangles.data() };
+	uint64_t sectionSizes[MESH_SECTION_COUNT] = { records.size() * sizeof(S_MeshRecord), meshlets.size() * sizeof(S_MeshletRecord),
+		vertices.size() * sizeof(S_MeshVertex), indices.size() * sizeof(uint32_t), meshletVertices.size() * sizeof(uint32_t),
+		meshletTriangles.size() * sizeof(uint32_t) };
+
+	// The mesh table follows the header, which is already 16 byte aligned. Everything else gets the full alignment.
+	uint64_t offset = sizeof(S_MeshFileHeader);
+	for (int i = 0; i < MESH_SECTION_COUNT; i++)
+	{
+		if (i != MESH_SECTION_MESHES) offset = (offset + MeshSectionAlignment - 1) & ~(MeshSectionAlignment - 1);
+		header.sections[i].offset = offset;
+		header.sections[i].size = sectionSizes[i];
+		offset += sectionSizes[i];
+	}
+	header.fileSize = offset;
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) throw std::runtime_error("Failed to open mesh file for writing: " + path);
+	file.write((const char*)&header, sizeof(header));
+	const char padding[MeshSectionAlignment] = {};
+	for (int i = 0; i < MESH_SECTION_COUNT; i++)
+	{
+		file.write(padding, (std::streamsize)(header.sections[i].offset - (uint64_t)file.tellp()));
+		file.write((const char*)pSectionData[i], (std::streamsize)sectionSizes[i]);
+	}
+	if (!file.good()) throw std::runtime_error("Failed to write mesh file: " + path);
+}
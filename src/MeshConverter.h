@@ -0,0 +1,41 @@
+#pragma once
+
+#ifndef MESHCONVERTER_H
+#define MESHCONVERTER_H
+
+#include "MeshFormat.h"
+
+// A mesh as it comes out of the source file, before it's split into meshlets.
+struct S_SourceMesh
+{
+	std::string name;
+	std::vector<S_MeshVertex> vertices;
+	std::vector<uint32_t> indices; // Triangle list.
+};
+
+// The offline half of the mesh pipeline. Source files are parsed once here, and written out as .vmesh files
+// that the streamer can use as they are. Run it with --convert-mesh, it never touches the device.
+class MeshConverter
+{
+public:
+
+	static const uint32_t MaxMeshletVertices = 64;
+	static const uint32_t MaxMeshletTriangles = 124;
+
+	// Convert a Wavefront OBJ, with a mesh per object or group.
+	static void ConvertObj(const std::string &inputPath, const std::string &outputPath, std::ostream &out);
+
+	// Faces are triangulated as fans and identical corners are merged. Missing normals are generated from the faces.
+	static std::vector<S_SourceMesh> ParseObj(std::istream &in);
+
+	// Throws if the file can't be written.
+	static void Write(const std::vector<S_SourceMesh> &meshes, const std::string &path);
+
+	// Splits the mesh into meshlets in index order. Meshlet vertices are offset by vertexBase.
+	static void BuildMeshlets(const S_SourceMesh &mesh, uint32_t vertexBase, std::vector<S_MeshletRecord> &meshlets,
+		std::vector<uint32_t> &meshletVertices, std::vector<uint32_t> &meshletTriangles);
+
+	static S_MeshBounds ComputeBounds(const S_MeshVertex *pVertices, const uint32_t *pIndices, size_t count);
+};
+
+#endif
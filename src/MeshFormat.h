@@ -0,0 +1,101 @@
+#pragma once
+
+#ifndef MESHFORMAT_H
+#define MESHFORMAT_H
+
+#include <cstdint>
+
+// The binary mesh format (.vmesh) written by MeshConverter and streamed by MeshStreamer.
+// Everything is little endian and fixed size, so a mapped file is read in place. The header and the mesh table
+// come first, then every other section starts on a MeshSectionAlignment boundary, in E_MeshSection order.
+// Within each section, meshes are stored in the same order as the mesh table, so a file can be streamed mesh by mesh.
+// Bump MeshFormatVersion whenever any of this changes. Files with any other version are rejected, not converted.
+static const uint32_t MeshFormatMagic = 0x48534D56; // "VMSH"
+static const uint32_t MeshFormatVersion = 1;
+static const uint64_t MeshSectionAlignment = 256; // The largest minStorageBufferOffsetAlignment allowed.
+
+enum E_MeshSection
+{
+	MESH_SECTION_MESHES, // S_MeshRecord per mesh. Only read on the CPU.
+	MESH_SECTION_MESHLETS, // S_MeshletRecord per meshlet.
+	MESH_SECTION_VERTICES, // S_MeshVertex per vertex.
+	MESH_SECTION_INDICES, // uint32_t per index, relative to the mesh's first vertex.
+	MESH_SECTION_MESHLET_VERTICES, // uint32_t per meshlet vertex, indexing the whole vertex section.
+	MESH_SECTION_MESHLET_TRIANGLES, // uint32_t per triangle, three 8 bit indices into the meshlet's vertices.
+	MESH_SECTION_COUNT,
+};
+
+struct S_MeshSection
+{
+	uint64_t offset;
+	uint64_t size;
+};
+
+// A bounding sphere and box, laid out as three vec4s so shaders can read them straight from the buffer.
+struct S_MeshBounds
+{
+	float center[3];
+	float radius;
+	float min[3];
+	float padding0;
+	float max[3];
+	float padding1;
+};
+
+struct S_MeshVertex
+{
+	float position[3];
+	float normal[3];
+	float uv[2];
+};
+
+struct S_MeshRecord
+{
+	char name[64]; // Null terminated, cut short if it has to be.
+	uint32_t firstVertex;
+	uint32_t vertexCount;
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;
+	uint32_t firstMeshletVertex;
+	uint32_t meshletVertexCount;
+	uint32_t firstMeshletTriangle;
+	uint32_t meshletTriangleCount;
+	uint32_t padding[2];
+	S_MeshBounds bounds;
+};
+
+// Every triangle normal is within acos(coneCutoff) of coneAxis. A cutoff of -1 means the cone is too wide to cull with.
+struct S_MeshletRecord
+{
+	uint32_t vertexOffset; // Into the meshlet vertex section.
+	uint32_t triangleOffset; // Into the meshlet triangle section.
+	uint32_t vertexCount;
+	uint32_t triangleCount;
+	float center[3];
+	float radius;
+	float coneAxis[3];
+	float coneCutoff;
+};
+
+struct S_MeshFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t meshCount;
+	uint32_t meshletCount;
+	uint32_t vertexStride; // Always sizeof(S_MeshVertex), checked so a layout change can't slip through unversioned.
+	uint32_t padding;
+	uint64_t fileSize;
+	S_MeshBounds bounds; // Of every mesh in the file.
+	S_MeshSection sections[MESH_SECTION_COUNT];
+};
+
+static_assert(sizeof(S_MeshBounds) == 48, "S_MeshBounds layout changed, bump MeshFormatVersion.");
+static_assert(sizeof(S_MeshVertex) == 32, "S_MeshVertex layout changed, bump MeshFormatVersion.");
+static_assert(sizeof(S_MeshRecord) == 160, "S_MeshRecord layout changed, bump MeshFormatVersion.");
+static_assert(sizeof(S_MeshletRecord) == 48, "S_MeshletRecord layout changed, bump MeshFormatVersion.");
+static_assert(sizeof(S_MeshFileHeader) == 176, "S_MeshFileHeader layout changed, bump MeshFormatVersion.");
+
+#endif
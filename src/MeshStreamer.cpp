@@ -0,0 +1,182 @@
+#include "stdafx.h"
+#include "MeshStreamer.h"
+
+const VkDeviceSize MeshStreamer::MaxChunkSize;
+
+MeshStreamer::MeshStreamer(VkDevice logicalDevice, DeviceMemoryAllocator &memoryAllocator, UploadService &uploadService,
+	const std::string &path, const VkAllocationCallbacks *pAllocator)
+	: m_LogicalDevice(logicalDevice), m_MemoryAllocator(memoryAllocator), m_UploadService(uploadService), m_pAllocator(pAllocator), m_Path(path)
+{
+	// Several chunks have to fit in the ring at once, or every Stream call would wait on the last one.
+	m_ChunkSize = std::min(MaxChunkSize, m_UploadService.GetRingSize() / (2 * UploadService::BatchCount));
+
+	m_pFile = new MappedFile(path);
+	try
+	{
+		if (m_pFile->GetSize() < sizeof(S_MeshFileHeader)) throw std::runtime_error("Invalid mesh file, too small: " + path);
+		memcpy(&m_Header, m_pFile->GetData(), sizeof(m_Header));
+		Validate();
+
+		const S_MeshRecord *pMeshes = (const S_MeshRecord*)(m_pFile->GetData() + m_Header.sections[MESH_SECTION_MESHES].offset);
+		m_Meshes.assign(pMeshes, pMeshes + m_Header.meshCount);
+		for (S_MeshRecord &mesh : m_Meshes) mesh.name[sizeof(mesh.name) - 1] = '\0';
+
+		CreateBuffer();
+		BuildChunks();
+	}
+	catch (...)
+	{
+		delete m_pFile;
+		if (m_Buffer != VK_NULL_HANDLE) vkDestroyBuffer(m_LogicalDevice, m_Buffer, m_pAllocator);
+		m_MemoryAllocator.Free(m_Memory);
+		throw;
+	}
+}
+
+MeshStreamer::~MeshStreamer()
+{
+	delete m_pFile;
+	if (m_Buffer != VK_NULL_HANDLE) vkDestroyBuffer(m_LogicalDevice, m_Buffer, m_pAllocator);
+	m_MemoryAllocator.Free(m_Memory);
+}
+
+// Everything the rest of the streamer relies on, so a truncated or hand edited file can't send copies out of bounds.
+void MeshStreamer::Validate() const
+{
+	const S_MeshFileHeader &header = m_Header;
+	if (header.magic != MeshFormatMagic) throw std::runtime_error("Invalid mesh file, not a .vmesh file: " + m_Path);
+	if (header.version != MeshFormatVersion) throw std::runtime_error("Mesh file was written for a different version, convert it again: " + m_Path);
+	if (header.vertexStride != sizeof(S_MeshVertex)) throw std::runtime_error("Invalid mesh file, unexpected vertex stride: " + m_Path);
+	if (header.fileSize != m_pFile->GetSize()) throw std::runtime_error("Invalid mesh file, truncated: " + m_Path);
+	if (header.meshCount == 0) throw std::runtime_error("Mesh file has no meshes: " + m_Path);
+
+	// Sections are in order, aligned, and inside the file.
+	uint64_t end = sizeof(S_MeshFileHeader);
+	for (int i = 0; i < MESH_SECTION_COUNT; i++)
+	{
+		const S_MeshSection &section = header.sections[i];
+		uint64_t alignment = (i == MESH_SECTION_MESHES) ? 16 : MeshSectionAlignment;
+		if (section.offset < end || section.offset % alignment != 0 || section.offset > header.fileSize ||
+			section.size > header.fileSize - section.offset)
+			throw std::runtime_error("Invalid mesh file, bad section table: " + m_Path);
+		end = section.offset + section.size;
+	}
+
+	const S_MeshSection *sections = header.sections;
+	if (sections[MESH_SECTION_MESHES].size != (uint64_t)header.meshCount * sizeof(S_MeshRecord) ||
+		sections[MESH_SECTION_MESHLETS].size != (uint64_t)header.meshletCount * sizeof(S_MeshletRecord) ||
+		sections[MESH_SECTION_VERTICES].size % sizeof(S_MeshVertex) != 0 ||
+		sections[MESH_SECTION_INDICES].size % sizeof(uint32_t) != 0 ||
+		sections[MESH_SECTION_MESHLET_VERTICES].size % sizeof(uint32_t) != 0 ||
+		sections[MESH_SECTION_MESHLET_TRIANGLES].size % sizeof(uint32_t) != 0)
+		throw std::runtime_error("Invalid mesh file, section sizes don't match their counts: " + m_Path);
+
+	// The ranges themselves can be anything, as long as they stay inside their sections.
+	const S_MeshRecord *pMeshes = (const S_MeshRecord*)(m_pFile->GetData() + sections[MESH_SECTION_MESHES].offset);
+	auto inside = [](uint32_t first, uint32_t count, uint64_t sectionSize, uint64_t stride)
+	{
+		return ((uint64_t)first + count) * stride <= sectionSize;
+	};
+	for (uint32_t i = 0; i < header.meshCount; i++)
+	{
+		const S_MeshRecord &mesh = pMeshes[i];
+		if (!inside(mesh.firstVertex, mesh.vertexCount, sections[MESH_SECTION_VERTICES].size, sizeof(S_MeshVertex)) ||
+			!inside(mesh.firstIndex, mesh.indexCount, sections[MESH_SECTION_INDICES].size, sizeof(uint32_t)) ||
+			!inside(mesh.firstMeshlet, mesh.meshletCount, sections[MESH_SECTION_MESHLETS].size, sizeof(S_MeshletRecord)) ||
+			!inside(mesh.firstMeshletVertex, mesh.meshletVertexCount, sections[MESH_SECTION_MESHLET_VERTICES].size, sizeof(uint32_t)) ||
+			!inside(mesh.firstMeshletTriangle, mesh.meshletTriangleCount, sections[MESH_SECTION_MESHLET_TRIANGLES].size, sizeof(uint32_t)))
+			throw std::runtime_error("Invalid mesh file, mesh " + std::to_string(i) + " is out of range: " + m_Path);
+	}
+
+	// Meshlets point into the meshlet vertex and triangle sections, which the shaders read without checking.
+	const S_MeshletRecord *pMeshlets = (const S_MeshletRecord*)(m_pFile->GetData() + sections[MESH_SECTION_MESHLETS].offset);
+	for (uint32_t i = 0; i < header.meshletCount; i++)
+	{
+		const S_MeshletRecord &meshlet = pMeshlets[i];
+		if (!inside(meshlet.vertexOffset, meshlet.vertexCount, sections[MESH_SECTION_MESHLET_VERTICES].size, sizeof(uint32_t)) ||
+			!inside(meshlet.triangleOffset, meshlet.triangleCount, sections[MESH_SECTION_MESHLET_TRIANGLES].size, sizeof(uint32_t)))
+			throw std::runtime_error("Invalid mesh file, meshlet " + std::to_string(i) + " is out of range: " + m_Path);
+	}
+}
+
+// One buffer for every section the device reads, laid out as in the file.
+void MeshStreamer::CreateBuffer()
+{
+	m_BufferStart = m_Header.sections[MESH_SECTION_MESHLETS].offset;
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = std::max<VkDeviceSize>(m_Header.fileSize - m_BufferStart, 1);
+	bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VkResult result = vkCreateBuffer(m_LogicalDevice, &bufferInfo, m_pAllocator, &m_Buffer);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create mesh buffer.");
+
+	S_DeviceAllocationRequest request;
+	vkGetBufferMemoryRequirements(m_LogicalDevice, m_Buffer, &request.requirements);
+	request.preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	m_Memory = m_MemoryAllocator.Allocate(request);
+	result = vkBindBufferMemory(m_LogicalDevice, m_Buffer, m_Memory.memory, m_Memory.offset);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to bind mesh buffer memory.");
+}
+
+// Mesh by mesh, each of its ranges in section order, split into chunks no bigger than m_ChunkSize.
+void MeshStreamer::BuildChunks()
+{
+	for (const S_MeshRecord &mesh : m_Meshes)
+	{
+		AddChunks(MESH_SECTION_MESHLETS, mesh.firstMeshlet, mesh.meshletCount, sizeof(S_MeshletRecord));
+		AddChunks(MESH_SECTION_VERTICES, mesh.firstVertex, mesh.vertexCount, sizeof(S_MeshVertex));
+		AddChunks(MESH_SECTION_INDICES, mesh.firstIndex, mesh.indexCount, sizeof(uint32_t));
+		AddChunks(MESH_SECTION_MESHLET_VERTICES, mesh.firstMeshletVertex, mesh.meshletVertexCount, sizeof(uint32_t));
+		AddChunks(MESH_SECTION_MESHLET_TRIANGLES, mesh.firstMeshletTriangle, mesh.meshletTriangleCount, sizeof(uint32_t));
+		m_MeshEnds.push_back(m_Chunks.size());
+	}
+}
+
+void MeshStreamer::AddChunks(E_MeshSection section, uint64_t first, uint64_t count, uint64_t stride)
+{
+	uint64_t offset = m_Header.sections[section].offset + first * stride;
+	uint64_t end = offset + count * stride;
+	while (offset < end)
+	{
+		uint64_t size = std::min<uint64_t>(m_ChunkSize, end - offset);
+		m_Chunks.push_back({ offset, size });
+		m_TotalBytes += size;
+		offset += size;
+	}
+}
+
+// The upload service copies each chunk out before returning, so nothing here has to outlive the call.
+bool MeshStreamer::Stream(VkDeviceSize budget)
+{
+	if (IsComplete()) return true;
+
+	VkDeviceSize queued = 0;
+	while (m_NextChunk < m_Chunks.size() && (queued == 0 || queued < budget))
+	{
+		const S_Chunk &chunk = m_Chunks[m_NextChunk++];
+		m_UploadService.UploadBuffer(m_Buffer, chunk.offset - m_BufferStart, m_pFile->GetData() + chunk.offset, chunk.size);
+		queued += chunk.size;
+	}
+	m_StreamedBytes += queued;
+
+	while (m_ResidentMeshes < m_Meshes.size() && m_MeshEnds[m_ResidentMeshes] <= m_NextChunk) m_ResidentMeshes++;
+
+	if (IsComplete())
+	{
+		delete m_pFile;
+		m_pFile = nullptr;
+		return true;
+	}
+
+	// Get the OS reading what the next call will copy, so it doesn't fault the pages in one at a time.
+	VkDeviceSize prefetched = 0;
+	for (size_t i = m_NextChunk; i < m_Chunks.size() && prefetched < budget; i++)
+	{
+		m_pFile->Prefetch(m_Chunks[i].offset, m_Chunks[i].size);
+		prefetched += m_Chunks[i].size;
+	}
+	return false;
+}
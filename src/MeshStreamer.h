@@ -0,0 +1,81 @@
+#pragma once
+
+#ifndef MESHSTREAMER_H
+#define MESHSTREAMER_H
+
+#include "MeshFormat.h"
+#include "MappedFile.h"
+#include "UploadService.h"
+
+// Streams a .vmesh file into a device local buffer a few chunks at a time, so a large scene can start
+// rendering long before all of it has arrived. The file is mapped, and chunks are copied straight from the
+// mapping into the upload service's staging ring, so the geometry never passes through the heap.
+// The buffer holds everything after the mesh table exactly as it is laid out in the file, so each section can be
+// bound at its offset as a vertex, index or storage buffer. Meshes arrive in file order.
+class MeshStreamer
+{
+public:
+
+	static const VkDeviceSize MaxChunkSize = 1024 * 1024;
+
+	// Maps and validates the file, and creates the buffer. Nothing is uploaded until Stream.
+	MeshStreamer(VkDevice logicalDevice, DeviceMemoryAllocator &memoryAllocator, UploadService &uploadService,
+		const std::string &path, const VkAllocationCallbacks *pAllocator);
+	~MeshStreamer();
+
+	// Queue at least one chunk, and keep going until budget bytes have been queued. Call before the upload service
+	// is flushed. Returns true once everything has been queued, at which point the file is unmapped.
+	bool Stream(VkDeviceSize budget);
+	bool IsComplete() const { return m_NextChunk == m_Chunks.size(); }
+
+	// Meshes whose chunks have all been queued. They can be drawn by any submission that acquires the uploads after that.
+	uint32_t GetResidentMeshCount() const { return m_ResidentMeshes; }
+	uint32_t GetMeshCount() const { return (uint32_t)m_Meshes.size(); }
+	const S_MeshRecord& GetMesh(uint32_t mesh) const { return m_Meshes[mesh]; }
+	const S_MeshBounds& GetBounds() const { return m_Header.bounds; }
+	uint32_t GetMeshletCount() const { return m_Header.meshletCount; }
+
+	VkBuffer GetBuffer() const { return m_Buffer; }
+	VkDeviceSize GetSectionOffset(E_MeshSection section) const { return m_Header.sections[section].offset - m_BufferStart; }
+	VkDeviceSize GetSectionSize(E_MeshSection section) const { return m_Header.sections[section].size; }
+	VkDeviceSize GetStreamedBytes() const { return m_StreamedBytes; }
+	VkDeviceSize GetTotalBytes() const { return m_TotalBytes; }
+
+private:
+
+	// A range of the file, copied to the same place in the buffer.
+	struct S_Chunk
+	{
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	VkDevice m_LogicalDevice;
+	DeviceMemoryAllocator &m_MemoryAllocator;
+	UploadService &m_UploadService;
+	const VkAllocationCallbacks *m_pAllocator;
+	std::string m_Path;
+
+	MappedFile *m_pFile = nullptr; // Only until everything has been queued.
+	S_MeshFileHeader m_Header;
+	std::vector<S_MeshRecord> m_Meshes; // Copied out, since the file doesn't stay mapped.
+
+	VkBuffer m_Buffer = VK_NULL_HANDLE;
+	S_DeviceAllocation m_Memory;
+	uint64_t m_BufferStart = 0; // Where the buffer starts in the file.
+
+	VkDeviceSize m_ChunkSize;
+	std::vector<S_Chunk> m_Chunks;
+	std::vector<size_t> m_MeshEnds; // One past each mesh's last chunk.
+	size_t m_NextChunk = 0;
+	uint32_t m_ResidentMeshes = 0;
+	VkDeviceSize m_StreamedBytes = 0;
+	VkDeviceSize m_TotalBytes = 0;
+
+	void Validate() const;
+	void CreateBuffer();
+	void BuildChunks();
+	void AddChunks(E_MeshSection section, uint64_t first, uint64_t count, uint64_t stride);
+};
+
+#endif
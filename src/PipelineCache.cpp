@@ -0,0 +1,205 @@
+#include "stdafx.h"
+#include "PipelineCache.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+// The header the driver puts at the start of its own data. Layout is fixed by the spec.
+static const size_t DriverHeaderSize = 16 + VK_UUID_SIZE;
+
+PipelineCache::PipelineCache(VkDevice logicalDevice, const VkPhysicalDeviceProperties &deviceProperties, const std::string &path,
+	const VkAllocationCallbacks *pAllocator)
+	: m_LogicalDevice(logicalDevice), m_DeviceProperties(deviceProperties), m_Path(path), m_pAllocator(pAllocator)
+{
+	std::vector<char> file = Load();
+	if (!file.empty())
+	{
+		const char *pData = file.data() + sizeof(S_PipelineCacheFileHeader);
+		size_t size = file.size() - sizeof(S_PipelineCacheFileHeader);
+		m_PipelineCache = CreateCache(pData, size);
+		if (m_PipelineCache != VK_NULL_HANDLE)
+		{
+			m_LoadedSize = size;
+			m_LoadedChecksum = Checksum(pData, size);
+			std::cout << "Loaded pipeline cache: " << m_Path << " (" << size << " bytes)" << std::endl;
+		}
+		else std::cerr << "Discarding pipeline cache " << m_Path << ": the driver rejected it." << std::endl;
+	}
+
+	// Nothing usable on disk, so we start empty.
+	if (m_PipelineCache == VK_NULL_HANDLE) m_PipelineCache = CreateCache(nullptr, 0);
+	if (m_PipelineCache == VK_NULL_HANDLE) throw std::runtime_error("Failed to create pipeline cache.");
+}
+
+PipelineCache::~PipelineCache()
+{
+	vkDestroyPipelineCache(m_LogicalDevice, m_PipelineCache, m_pAllocator);
+}
+
+VkPipelineCache PipelineCache::CreateCache(const char *pData, size_t size)
+{
+	VkPipelineCacheCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	createInfo.initialDataSize = size;
+	createInfo.pInitialData = pData;
+
+	VkPipelineCache pipelineCache;
+	VkResult result = vkCreatePipelineCache(m_LogicalDevice, &createInfo, m_pAllocator, &pipelineCache);
+	return (result == VK_SUCCESS) ? pipelineCache : VK_NULL_HANDLE;
+}
+
+// Returns the whole file if it's valid for this device, and nothing otherwise.
+std::vector<char> PipelineCache::Load()
+{
+	if (m_Path.empty()) return std::vector<char>();
+
+	std::ifstream stream(m_Path, std::ios::binary | std::ios::ate);
+	if (!stream.is_open()) return std::vector<char>(); // First run, nothing to warn about.
+
+	std::vector<char> file((size_t)stream.tellg());
+	stream.seekg(0);
+	stream.read(file.data(), file.size());
+
+	std::string reason;
+	if (!stream || !Validate(file, m_DeviceProperties, reason))
+	{
+		if (reason.empty()) reason = "couldn't read it.";
+		std::cerr << "Discarding pipeline cache " << m_Path << ": " << reason << std::endl;
+		return std::vector<char>();
+	}
+	return file;
+}
+
+// Drivers are only required to reject data from another device, not data that's been truncated or scribbled on,
+// so everything gets checked here before the driver ever sees it.
+bool PipelineCache::Validate(const std::vector<char> &file, const VkPhysicalDeviceProperties &deviceProperties, std::string &reason)
+{
+	S_PipelineCacheFileHeader header;
+	if (file.size() < sizeof(header))
+	{
+		reason = "file is too small.";
+		return false;
+	}
+	memcpy(&header, file.data(), sizeof(header));
+
+	if (header.magic != FileMagic || header.version != FileVersion)
+	{
+		reason = "not a pipeline cache, or written by another version.";
+		return false;
+	}
+	if (header.vendorID != deviceProperties.vendorID || header.deviceID != deviceProperties.deviceID ||
+		header.driverVersion != deviceProperties.driverVersion ||
+		memcmp(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+	{
+		reason = "written for another device or driver.";
+		return false;
+	}
+
+	const char *pData = file.data() + sizeof(header);
+	size_t size = file.size() - sizeof(header);
+	if (header.dataSize != size || Checksum(pData, size) != header.checksum)
+	{
+		reason = "file is corrupt.";
+		return false;
+	}
+
+	// The driver's own header has to agree with ours too.
+	uint32_t driverHeader[4];
+	if (size < DriverHeaderSize)
+	{
+		reason = "driver data is too small.";
+		return false;
+	}
+	memcpy(driverHeader, pData, sizeof(driverHeader));
+	if (driverHeader[0] < DriverHeaderSize || driverHeader[0] > size || driverHeader[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+		driverHeader[2] != deviceProperties.vendorID || driverHeader[3] != deviceProperties.deviceID ||
+		memcmp(pData + 16, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+	{
+		reason = "driver header doesn't match the device.";
+		return false;
+	}
+
+	return true;
+}
+
+// 64-bit FNV-1a. Not cryptographic, just enough to catch torn or damaged files.
+uint64_t PipelineCache::Checksum(const char *pData, size_t size)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= (uint8_t)pData[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+void PipelineCache::Save()
+{
+	if (m_Path.empty()) return;
+
+	size_t size = 0;
+	VkResult result = vkGetPipelineCacheData(m_LogicalDevice, m_PipelineCache, &size, nullptr);
+	if (result != VK_SUCCESS || size == 0) return;
+
+	std::vector<char> file(sizeof(S_PipelineCacheFileHeader) + size);
+	char *pData = file.data() + sizeof(S_PipelineCacheFileHeader);
+	result = vkGetPipelineCacheData(m_LogicalDevice, m_PipelineCache, &size, pData);
+	if (result != VK_SUCCESS)
+	{
+		std::cerr << "Failed to get pipeline cache data." << std::endl;
+		return;
+	}
+	file.resize(sizeof(S_PipelineCacheFileHeader) + size); // The driver may hand back less than it asked for.
+
+	// Nothing new got compiled, so the file on disk is still right.
+	uint64_t checksum = Checksum(pData, size);
+	if (size == m_LoadedSize && checksum == m_LoadedChecksum) return;
+
+	S_PipelineCacheFileHeader header;
+	header.magic = FileMagic;
+	header.version = FileVersion;
+	header.vendorID = m_DeviceProperties.vendorID;
+	header.deviceID = m_DeviceProperties.deviceID;
+	header.driverVersion = m_DeviceProperties.driverVersion;
+	memcpy(header.pipelineCacheUUID, m_DeviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+	header.dataSize = size;
+	header.checksum = checksum;
+	memcpy(file.data(), &header, sizeof(header));
+
+	if (!WriteFileAtomic(m_Path, file))
+	{
+		std::cerr << "Failed to write pipeline cache: " << m_Path << std::endl;
+		return;
+	}
+	m_LoadedSize = size;
+	m_LoadedChecksum = checksum;
+}
+
+// Write next to the target and rename over it, so readers see either the old file or the new one.
+// If power goes out before the data reaches the disk, the checksum catches it on the next load.
+bool PipelineCache::WriteFileAtomic(const std::string &path, const std::vector<char> &file)
+{
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream stream(tempPath, std::ios::binary | std::ios::trunc);
+		stream.write(file.data(), file.size());
+		stream.close();
+		if (!stream)
+		{
+			std::remove(tempPath.c_str());
+			return false;
+		}
+	}
+
+#ifdef _WIN32
+	bool renamed = MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	bool renamed = std::rename(tempPath.c_str(), path.c_str()) == 0;
+#endif
+	if (!renamed) std::remove(tempPath.c_str());
+	return renamed;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#ifndef PIPELINECACHE_H
+#define PIPELINECACHE_H
+
+// What we write in front of the driver's cache data, so we can tell if a file belongs to this device and driver,
+// and if it made it to disk in one piece.
+struct S_PipelineCacheFileHeader
+{
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	uint32_t vendorID = 0;
+	uint32_t deviceID = 0;
+	uint32_t driverVersion = 0;
+	uint32_t reserved = 0; // Keeps the 64-bit fields aligned.
+	uint8_t pipelineCacheUUID[VK_UUID_SIZE] = {};
+	uint64_t dataSize = 0;
+	uint64_t checksum = 0;
+};
+
+// A VkPipelineCache that persists between runs.
+// The file is loaded on construction and only trusted if it was written for the same device and driver.
+// Anything stale or corrupt is discarded, and we start from an empty cache instead.
+// Save writes to a temporary file and renames it over the old one, so a crash never leaves half a cache behind.
+class PipelineCache
+{
+public:
+
+	static const uint32_t FileMagic = 0x4350564b; // "VKPC"
+	static const uint32_t FileVersion = 1;
+
+	PipelineCache(VkDevice logicalDevice, const VkPhysicalDeviceProperties &deviceProperties, const std::string &path,
+		const VkAllocationCallbacks *pAllocator);
+	~PipelineCache();
+
+	// Write the cache back to disk. Does nothing if there's no path or nothing changed since loading.
+	// Failures are reported but never thrown, a missing cache only costs startup time.
+	void Save();
+
+	// Check a cache file against the device. On success, the driver's data starts at sizeof(S_PipelineCacheFileHeader).
+	static bool Validate(const std::vector<char> &file, const VkPhysicalDeviceProperties &deviceProperties, std::string &reason);
+	static uint64_t Checksum(const char *pData, size_t size);
+
+	VkPipelineCache GetHandle() const { return m_PipelineCache; }
+	bool WasLoaded() const { return m_LoadedSize > 0; }
+	size_t GetLoadedSize() const { return m_LoadedSize; }
+
+private:
+
+	VkDevice m_LogicalDevice;
+	VkPhysicalDeviceProperties m_DeviceProperties;
+	std::string m_Path;
+	const VkAllocationCallbacks *m_pAllocator;
+
+	VkPipelineCache m_PipelineCache = VK_NULL_HANDLE;
+	size_t m_LoadedSize = 0;
+	uint64_t m_LoadedChecksum = 0;
+
+	std::vector<char> Load();
+	VkPipelineCache CreateCache(const char *pData, size_t size);
+	static bool WriteFileAtomic(const std::string &path, const std::vector<char> &file);
+};
+
+#endif
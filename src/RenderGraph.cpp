@@ -0,0 +1,502 @@
+#include "stdafx.h"
+#include "RenderGraph.h"
+
+RenderGraph::~RenderGraph()
+{
+	Release();
+}
+
+uint32_t RenderGraph::CreateImage(const std::string &name, const S_RenderImageDesc &desc)
+{
+	S_Resource resource;
+	resource.name = name;
+	resource.desc = desc;
+	m_Resources.push_back(resource);
+	return (uint32_t)m_Resources.size() - 1;
+}
+
+uint32_t RenderGraph::ImportImage(const std::string &name, const S_RenderImageDesc &desc, VkImageLayout initialLayout,
+	VkPipelineStageFlags initialStages, E_RenderAccess finalAccess)
+{
+	S_Resource resource;
+	resource.name = name;
+	resource.desc = desc;
+	resource.imported = true;
+	resource.initialLayout = initialLayout;
+	resource.initialStages = initialStages;
+	resource.finalAccess = finalAccess;
+	m_Resources.push_back(resource);
+	return (uint32_t)m_Resources.size() - 1;
+}
+
+void RenderGraph::SetImportedImage(uint32_t resource, VkImage image)
+{
+	if (resource >= m_Resources.size() || !m_Resources[resource].imported) throw std::runtime_error("Render graph resource isn't imported.");
+	m_Resources[resource].image = image;
+}
+
+uint32_t RenderGraph::AddPass(const std::string &name, std::function<void(VkCommandBuffer commandBuffer)> execute)
+{
+	S_Pass pass;
+	pass.name = name;
+	pass.execute = execute;
+	m_Passes.push_back(pass);
+	return (uint32_t)m_Passes.size() - 1;
+}
+
+void RenderGraph::Use(uint32_t pass, uint32_t resource, E_RenderAccess access)
+{
+	if (pass >= m_Passes.size() || resource >= m_Resources.size()) throw std::runtime_error("Render graph pass or resource out of range.");
+	if (FindUse(pass, resource) != nullptr)
+		throw std::runtime_error("Render graph pass " + m_Passes[pass].name + " uses " + m_Resources[resource].name + " twice.");
+	m_Passes[pass].uses.push_back({ resource, access });
+}
+
+void RenderGraph::SetSideEffects(uint32_t pass)
+{
+	if (pass >= m_Passes.size()) throw std::runtime_error("Render graph pass out of range.");
+	m_Passes[pass].sideEffects = true;
+}
+
+const RenderGraph::S_Use* RenderGraph::FindUse(uint32_t pass, uint32_t resource) const
+{
+	for (const S_Use &use : m_Passes[pass].uses)
+	{
+		if (use.resource == resource) return &use;
+	}
+	return nullptr;
+}
+
+S_RenderAccessInfo RenderGraph::GetAccessInfo(E_RenderAccess access)
+{
+	switch (access)
+	{
+	case RENDER_ACCESS_COLOR_ATTACHMENT:
+		return { VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, true };
+	case RENDER_ACCESS_DEPTH_ATTACHMENT:
+		return { VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, true };
+	case RENDER_ACCESS_SAMPLED:
+		return { VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_USAGE_SAMPLED_BIT, false };
+	case RENDER_ACCESS_STORAGE_READ:
+		return { VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_USAGE_STORAGE_BIT, false };
+	case RENDER_ACCESS_STORAGE_WRITE:
+		return { VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_USAGE_STORAGE_BIT, true };
+	case RENDER_ACCESS_TRANSFER_READ:
+		return { VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, false };
+	case RENDER_ACCESS_TRANSFER_WRITE:
+		return { VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_USAGE_TRANSFER_DST_BIT, true };
+	case RENDER_ACCESS_PRESENT:
+	default:
+		// The present semaphore takes care of visibility, so all we need is the layout.
+		return { VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, false };
+	}
+}
+
+VkImageAspectFlags RenderGraph::GetAspect(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_D16_UNORM:
+	case VK_FORMAT_D32_SFLOAT:
+		return VK_IMAGE_ASPECT_DEPTH_BIT;
+	case VK_FORMAT_D16_UNORM_S8_UINT:
+	case VK_FORMAT_D24_UNORM_S8_UINT:
+	case VK_FORMAT_D32_SFLOAT_S8_UINT:
+		return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+	default:
+		return VK_IMAGE_ASPECT_COLOR_BIT;
+	}
+}
+
+void RenderGraph::Compile(RequirementsFunction getRequirements)
+{
+	m_CompiledPasses.clear();
+	m_FinalBarriers = S_RenderBarrierBatch();
+	m_Heaps.clear();
+	m_Stats = S_RenderGraphStats();
+	for (S_Resource &resource : m_Resources)
+	{
+		resource.usage = 0;
+		resource.requirements = {};
+		resource.placement = S_TransientPlacement();
+	}
+
+	CullPasses();
+	ComputeLifetimes();
+	PlaceTransients(getRequirements);
+	BuildBarriers();
+}
+
+// Walk backwards from the imported images, keeping every pass that writes something a kept pass needs.
+// Nothing is ever dropped from the needed set, since a pass might only write part of an image.
+void RenderGraph::CullPasses()
+{
+	std::vector<bool> needed(m_Resources.size());
+	for (size_t i = 0; i < m_Resources.size(); i++) needed[i] = m_Resources[i].imported;
+
+	std::vector<bool> live(m_Passes.size());
+	for (size_t i = m_Passes.size(); i-- > 0;)
+	{
+		const S_Pass &pass = m_Passes[i];
+		bool isLive = pass.sideEffects;
+		for (const S_Use &use : pass.uses)
+		{
+			if (GetAccessInfo(use.access).write && needed[use.resource]) isLive = true;
+		}
+		if (!isLive) continue;
+
+		live[i] = true;
+		for (const S_Use &use : pass.uses)
+		{
+			// Storage writes may read what was there before, so whoever wrote it first is needed too.
+			if (!GetAccessInfo(use.access).write || use.access == RENDER_ACCESS_STORAGE_WRITE) needed[use.resource] = true;
+		}
+	}
+
+	for (uint32_t i = 0; i < (uint32_t)m_Passes.size(); i++)
+	{
+		if (!live[i]) continue;
+		S_CompiledPass compiled;
+		compiled.pass = i;
+		m_CompiledPasses.push_back(compiled);
+	}
+	m_Stats.passCount = (uint32_t)m_CompiledPasses.size();
+	m_Stats.culledPassCount = (uint32_t)(m_Passes.size() - m_CompiledPasses.size());
+}
+
+void RenderGraph::ComputeLifetimes()
+{
+	for (uint32_t position = 0; position < (uint32_t)m_CompiledPasses.size(); position++)
+	{
+		const S_Pass &pass = m_Passes[m_CompiledPasses[position].pass];
+		for (const S_Use &use : pass.uses)
+		{
+			S_Resource &resource = m_Resources[use.resource];
+			S_RenderAccessInfo info = GetAccessInfo(use.access);
+
+			// A transient starts out undefined every frame, so reading it first would read garbage.
+			if (!resource.imported && resource.placement.firstUse == UINT32_MAX && !info.write)
+				throw std::runtime_error("Render graph pass " + pass.name + " reads " + resource.name + " before anything writes it.");
+
+			resource.usage |= info.usage;
+			resource.placement.firstUse = std::min(resource.placement.firstUse, position);
+			resource.placement.lastUse = std::max(resource.placement.lastUse, position);
+		}
+	}
+}
+
+static VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+// Largest first, each transient goes at the lowest offset that doesn't overlap anything alive at the same time.
+// Images only share a heap if they can live in exactly the same memory types.
+void RenderGraph::PlaceTransients(RequirementsFunction &getRequirements)
+{
+	std::vector<uint32_t> transients;
+	for (uint32_t i = 0; i < (uint32_t)m_Resources.size(); i++)
+	{
+		S_Resource &resource = m_Resources[i];
+		if (resource.imported || resource.placement.firstUse == UINT32_MAX) continue;
+		resource.requirements = getRequirements(i, resource.desc, resource.usage);
+		resource.placement.size = resource.requirements.size;
+		m_Stats.transientBytes += resource.requirements.size;
+		transients.push_back(i);
+	}
+	std::stable_sort(transients.begin(), transients.end(),
+		[this](uint32_t a, uint32_t b) { return m_Resources[a].requirements.size > m_Resources[b].requirements.size; });
+
+	std::vector<uint32_t> placed;
+	for (uint32_t index : transients)
+	{
+		S_Resource &resource = m_Resources[index];
+		const VkMemoryRequirements &requirements = resource.requirements;
+
+		int heap = -1;
+		for (size_t i = 0; i < m_Heaps.size(); i++)
+		{
+			if (m_Heaps[i].memoryTypeBits == requirements.memoryTypeBits) heap = (int)i;
+		}
+		if (heap < 0)
+		{
+			S_TransientHeap newHeap;
+			newHeap.memoryTypeBits = requirements.memoryTypeBits;
+			m_Heaps.push_back(newHeap);
+			heap = (int)m_Heaps.size() - 1;
+		}
+
+		// The memory ranges already taken while this image is alive, in offset order.
+		std::vector<std::pair<VkDeviceSize, VkDeviceSize>> taken;
+		for (uint32_t other : placed)
+		{
+			const S_TransientPlacement &placement = m_Resources[other].placement;
+			if (placement.heap != heap) continue;
+			if (placement.lastUse < resource.placement.firstUse || resource.placement.lastUse < placement.firstUse) continue;
+			taken.push_back({ placement.offset, placement.offset + placement.size });
+		}
+		std::sort(taken.begin(), taken.end());
+
+		VkDeviceSize offset = 0;
+		for (const std::pair<VkDeviceSize, VkDeviceSize> &range : taken)
+		{
+			if (AlignUp(offset, requirements.alignment) + requirements.size <= range.first) break;
+			offset = std::max(offset, range.second);
+		}
+		offset = AlignUp(offset, requirements.alignment);
+
+		resource.placement.heap = heap;
+		resource.placement.offset = offset;
+		m_Heaps[heap].size = std::max(m_Heaps[heap].size, offset + requirements.size);
+		m_Heaps[heap].alignment = std::max(m_Heaps[heap].alignment, requirements.alignment);
+		placed.push_back(index);
+	}
+
+	for (const S_TransientHeap &heap : m_Heaps) m_Stats.aliasedBytes += heap.size;
+}
+
+void RenderGraph::BuildBarriers()
+{
+	std::vector<S_State> states(m_Resources.size());
+	for (size_t i = 0; i < m_Resources.size(); i++)
+	{
+		if (!m_Resources[i].imported) continue;
+		states[i].layout = m_Resources[i].initialLayout;
+		states[i].writeStages = m_Resources[i].initialStages;
+		states[i].touched = true;
+	}
+
+	for (uint32_t position = 0; position < (uint32_t)m_CompiledPasses.size(); position++)
+	{
+		S_CompiledPass &compiled = m_CompiledPasses[position];
+		for (const S_Use &use : m_Passes[compiled.pass].uses)
+		{
+			S_RenderAccessInfo info = GetAccessInfo(use.access);
+			S_State &state = states[use.resource];
+			if (!info.write)
+			{
+				ReadBarrier(states, position, use, compiled.barriers);
+				continue;
+			}
+
+			// Writes wait on everything before them. A transient's first write also waits on whatever
+			// was in its memory before, and throws away the old contents.
+			VkPipelineStageFlags srcStages = state.writeStages | state.readStages;
+			VkAccessFlags srcAccess = state.writeAccess;
+			if (!state.touched) AliasSource(states, use.resource, srcStages, srcAccess);
+			AddBarrier(compiled.barriers, use.resource, state.layout, info.layout, srcStages, srcAccess, info.stages, info.access);
+
+			state.layout = info.layout;
+			state.writeStages = info.stages;
+			state.writeAccess = info.access;
+			state.readStages = 0;
+			state.visibleStages = 0;
+			state.visibleAccess = 0;
+			state.touched = true;
+		}
+		if (!compiled.barriers.imageBarriers.empty()) m_Stats.barrierBatchCount++;
+		m_Stats.imageBarrierCount += (uint32_t)compiled.barriers.imageBarriers.size();
+	}
+
+	// Leave imported images the way their owner expects them.
+	for (uint32_t i = 0; i < (uint32_t)m_Resources.size(); i++)
+	{
+		const S_Resource &resource = m_Resources[i];
+		if (!resource.imported) continue;
+		S_RenderAccessInfo info = GetAccessInfo(resource.finalAccess);
+		const S_State &state = states[i];
+		if (state.layout == info.layout && state.writeAccess == 0) continue;
+		AddBarrier(m_FinalBarriers, i, state.layout, info.layout, state.writeStages | state.readStages, state.writeAccess, info.stages, info.access);
+	}
+	if (!m_FinalBarriers.imageBarriers.empty()) m_Stats.barrierBatchCount++;
+	m_Stats.imageBarrierCount += (uint32_t)m_FinalBarriers.imageBarriers.size();
+}
+
+// Reads only need a barrier if the layout changes, or the last write isn't visible to them yet.
+// When they do, the barrier covers every read that follows until the next write, so those don't need one.
+void RenderGraph::ReadBarrier(std::vector<S_State> &states, uint32_t position, const S_Use &use, S_RenderBarrierBatch &batch) const
+{
+	S_RenderAccessInfo info = GetAccessInfo(use.access);
+	S_State &state = states[use.resource];
+	bool sameLayout = (state.layout == info.layout);
+	bool visible = (state.writeAccess == 0) || ((info.stages & ~state.visibleStages) == 0 && (info.access & ~state.visibleAccess) == 0);
+	if (sameLayout && visible)
+	{
+		state.readStages |= info.stages;
+		return;
+	}
+
+	VkPipelineStageFlags dstStages = info.stages;
+	VkAccessFlags dstAccess = info.access;
+	for (uint32_t next = position + 1; next < (uint32_t)m_CompiledPasses.size(); next++)
+	{
+		const S_Use *pNextUse = FindUse(m_CompiledPasses[next].pass, use.resource);
+		if (pNextUse == nullptr) continue;
+		S_RenderAccessInfo nextInfo = GetAccessInfo(pNextUse->access);
+		if (nextInfo.write || nextInfo.layout != info.layout) break;
+		dstStages |= nextInfo.stages;
+		dstAccess |= nextInfo.access;
+	}
+
+	// A layout transition is a write of its own, so it has to wait for earlier reads too.
+	VkPipelineStageFlags srcStages = state.writeStages | (sameLayout ? 0 : state.readStages);
+	AddBarrier(batch, use.resource, state.layout, info.layout, srcStages, state.writeAccess, dstStages, dstAccess);
+
+	if (!sameLayout)
+	{
+		state.layout = info.layout;
+		state.readStages = 0;
+		state.visibleStages = 0;
+		state.visibleAccess = 0;
+	}
+	state.visibleStages |= dstStages;
+	state.visibleAccess |= dstAccess;
+	state.readStages |= info.stages;
+}
+
+// Everything that used this transient's memory before it has to be done before the first write.
+void RenderGraph::AliasSource(const std::vector<S_State> &states, uint32_t resource, VkPipelineStageFlags &srcStages, VkAccessFlags &srcAccess) const
+{
+	const S_TransientPlacement &placement = m_Resources[resource].placement;
+	if (placement.heap < 0) return;
+	for (uint32_t i = 0; i < (uint32_t)m_Resources.size(); i++)
+	{
+		const S_TransientPlacement &other = m_Resources[i].placement;
+		if (i == resource || other.heap != placement.heap || other.lastUse >= placement.firstUse) continue;
+		if (other.offset >= placement.offset + placement.size || placement.offset >= other.offset + other.size) continue;
+		srcStages |= states[i].writeStages | states[i].readStages;
+		srcAccess |= states[i].writeAccess;
+	}
+}
+
+void RenderGraph::AddBarrier(S_RenderBarrierBatch &batch, uint32_t resource, VkImageLayout oldLayout, VkImageLayout newLayout,
+	VkPipelineStageFlags srcStages, VkAccessFlags srcAccess, VkPipelineStageFlags dstStages, VkAccessFlags dstAccess)
+{
+	S_RenderImageBarrier barrier;
+	barrier.resource = resource;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcAccess = srcAccess;
+	barrier.dstAccess = dstAccess;
+	batch.imageBarriers.push_back(barrier);
+	if (srcStages == 0) srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT; // Nothing to wait on.
+	batch.srcStages |= srcStages;
+	batch.dstStages |= dstStages;
+}
+
+// Transients are created first so Compile gets their real requirements, then bound once they're placed.
+void RenderGraph::Realize(VkDevice logicalDevice, DeviceMemoryAllocator &memoryAllocator, const VkAllocationCallbacks *pAllocator)
+{
+	Release();
+	m_LogicalDevice = logicalDevice;
+	m_pMemoryAllocator = &memoryAllocator;
+	m_pAllocator = pAllocator;
+
+	Compile([this](uint32_t resource, const S_RenderImageDesc &desc, VkImageUsageFlags usage)
+	{
+		VkImageCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		createInfo.imageType = VK_IMAGE_TYPE_2D;
+		createInfo.format = desc.format;
+		createInfo.extent = { desc.width, desc.height, 1 };
+		createInfo.mipLevels = 1;
+		createInfo.arrayLayers = 1;
+		createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		createInfo.usage = usage;
+		createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		VkImage &image = m_Resources[resource].image;
+		VkResult result = vkCreateImage(m_LogicalDevice, &createInfo, m_pAllocator, &image);
+		if (result != VK_SUCCESS) throw std::runtime_error("Failed to create render graph image " + m_Resources[resource].name + ".");
+
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements(m_LogicalDevice, image, &requirements);
+		return requirements;
+	});
+
+	// Each heap is one dedicated allocation, the images inside it are placed by hand.
+	for (const S_TransientHeap &heap : m_Heaps)
+	{
+		S_DeviceAllocationRequest request;
+		request.requirements.size = heap.size;
+		request.requirements.alignment = heap.alignment;
+		request.requirements.memoryTypeBits = heap.memoryTypeBits;
+		request.preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		request.kind = RESOURCE_OPTIMAL;
+		request.dedicated = true;
+		m_HeapMemory.push_back(m_pMemoryAllocator->Allocate(request));
+	}
+
+	for (const S_Resource &resource : m_Resources)
+	{
+		if (resource.imported || resource.placement.heap < 0) continue;
+		const S_DeviceAllocation &memory = m_HeapMemory[resource.placement.heap];
+		VkResult result = vkBindImageMemory(m_LogicalDevice, resource.image, memory.memory, memory.offset + resource.placement.offset);
+		if (result != VK_SUCCESS) throw std::runtime_error("Failed to bind render graph image memory.");
+	}
+}
+
+void RenderGraph::Release()
+{
+	if (m_LogicalDevice == VK_NULL_HANDLE) return;
+	for (S_Resource &resource : m_Resources)
+	{
+		if (resource.imported || resource.image == VK_NULL_HANDLE) continue;
+		vkDestroyImage(m_LogicalDevice, resource.image, m_pAllocator);
+		resource.image = VK_NULL_HANDLE;
+	}
+	for (const S_DeviceAllocation &memory : m_HeapMemory) m_pMemoryAllocator->Free(memory);
+	m_HeapMemory.clear();
+	m_LogicalDevice = VK_NULL_HANDLE;
+}
+
+void RenderGraph::Execute(VkCommandBuffer commandBuffer) const
+{
+	for (const S_CompiledPass &compiled : m_CompiledPasses)
+	{
+		RecordBarriers(commandBuffer, compiled.barriers);
+		m_Passes[compiled.pass].execute(commandBuffer);
+	}
+	RecordBarriers(commandBuffer, m_FinalBarriers);
+}
+
+void RenderGraph::RecordBarriers(VkCommandBuffer commandBuffer, const S_RenderBarrierBatch &batch) const
+{
+	if (batch.imageBarriers.empty()) return;
+
+	std::vector<VkImageMemoryBarrier> barriers(batch.imageBarriers.size());
+	for (size_t i = 0; i < batch.imageBarriers.size(); i++)
+	{
+		const S_RenderImageBarrier &imageBarrier = batch.imageBarriers[i];
+		const S_Resource &resource = m_Resources[imageBarrier.resource];
+		if (resource.image == VK_NULL_HANDLE) throw std::runtime_error("Render graph image " + resource.name + " has no image.");
+
+		VkImageMemoryBarrier &barrier = barriers[i];
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = imageBarrier.srcAccess;
+		barrier.dstAccessMask = imageBarrier.dstAccess;
+		barrier.oldLayout = imageBarrier.oldLayout;
+		barrier.newLayout = imageBarrier.newLayout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = resource.image;
+		barrier.subresourceRange.aspectMask = GetAspect(resource.desc.format);
+		barrier.subresourceRange.levelCount = 1;
+		barrier.subresourceRange.layerCount = 1;
+	}
+	vkCmdPipelineBarrier(commandBuffer, batch.srcStages, batch.dstStages, 0, 0, nullptr, 0, nullptr, (uint32_t)barriers.size(), barriers.data());
+}
+
+void RenderGraph::PrintStats(std::ostream &out) const
+{
+	out << "Render graph: " << m_Stats.passCount << " passes (" << m_Stats.culledPassCount << " culled), "
+		<< m_Stats.barrierBatchCount << " barrier batches with " << m_Stats.imageBarrierCount << " image barriers" << std::endl;
+	out << "  Transient memory: " << m_Stats.transientBytes / 1024 << " KB aliased into " << m_Stats.aliasedBytes / 1024
+		<< " KB over " << m_Heaps.size() << " heap(s)" << std::endl;
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#ifndef RENDERGRAPH_H
+#define RENDERGRAPH_H
+
+#include "DeviceMemoryAllocator.h"
+
+// How a pass uses an image. Each one decides the layout, stages and access the image needs for the pass.
+enum E_RenderAccess
+{
+	RENDER_ACCESS_COLOR_ATTACHMENT, // Write.
+	RENDER_ACCESS_DEPTH_ATTACHMENT, // Write.
+	RENDER_ACCESS_SAMPLED, // Read, from fragment or compute shaders.
+	RENDER_ACCESS_STORAGE_READ,
+	RENDER_ACCESS_STORAGE_WRITE, // Write, and may read too.
+	RENDER_ACCESS_TRANSFER_READ,
+	RENDER_ACCESS_TRANSFER_WRITE,
+	RENDER_ACCESS_PRESENT, // Read, only makes sense as the final access of an imported image.
+};
+
+struct S_RenderAccessInfo
+{
+	VkImageLayout layout;
+	VkPipelineStageFlags stages;
+	VkAccessFlags access;
+	VkImageUsageFlags usage;
+	bool write;
+};
+
+// Single mip, single layer 2D images, which is all our passes render to.
+struct S_RenderImageDesc
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+};
+
+struct S_RenderImageBarrier
+{
+	uint32_t resource = 0;
+	VkImageLayout oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	VkImageLayout newLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	VkAccessFlags srcAccess = 0;
+	VkAccessFlags dstAccess = 0;
+};
+
+// Everything a pass needs to wait on, recorded as a single vkCmdPipelineBarrier.
+struct S_RenderBarrierBatch
+{
+	VkPipelineStageFlags srcStages = 0;
+	VkPipelineStageFlags dstStages = 0;
+	std::vector<S_RenderImageBarrier> imageBarriers;
+};
+
+// A pass that survived culling, in execution order, with the barriers to record before it.
+struct S_CompiledPass
+{
+	uint32_t pass = 0;
+	S_RenderBarrierBatch barriers;
+};
+
+// Where a transient image lives. Images in the same heap only overlap if their lifetimes don't.
+struct S_TransientPlacement
+{
+	int heap = -1; // -1 for imported images, and transients no live pass uses.
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	uint32_t firstUse = UINT32_MAX; // Positions in the compiled pass order.
+	uint32_t lastUse = 0;
+};
+
+struct S_TransientHeap
+{
+	uint32_t memoryTypeBits = 0;
+	VkDeviceSize size = 0;
+	VkDeviceSize alignment = 1;
+};
+
+struct S_RenderGraphStats
+{
+	uint32_t passCount = 0;
+	uint32_t culledPassCount = 0;
+	uint32_t barrierBatchCount = 0;
+	uint32_t imageBarrierCount = 0;
+	VkDeviceSize transientBytes = 0; // What the transients would take with an allocation each.
+	VkDeviceSize aliasedBytes = 0; // What they take in the heaps.
+};
+
+// Passes declare the images they read and write, and Compile works out the rest for the whole frame:
+// - Passes that don't contribute to an imported image, or aren't marked as having side effects, are culled.
+// - Each pass gets one batch of barriers. Consecutive reads in the same layout share a single barrier.
+// - Transient images whose lifetimes don't overlap are placed in the same memory.
+// Passes run in the order they were added, so add them in an order where writes come before reads.
+// Compile never touches the device. Memory requirements come from the function it's given, so the graph
+// can be compiled and checked with made up requirements. Realize does the same with real images.
+class RenderGraph
+{
+public:
+
+	RenderGraph() {}
+	~RenderGraph();
+
+	// Transient images only live for the frame, and are created and placed by Realize.
+	uint32_t CreateImage(const std::string &name, const S_RenderImageDesc &desc);
+
+	// Imported images belong to someone else, so they're never culled or aliased. They start in initialLayout,
+	// last used in initialStages, and are left ready for finalAccess. Set the actual image every frame.
+	uint32_t ImportImage(const std::string &name, const S_RenderImageDesc &desc, VkImageLayout initialLayout,
+		VkPipelineStageFlags initialStages, E_RenderAccess finalAccess);
+	void SetImportedImage(uint32_t resource, VkImage image);
+
+	uint32_t AddPass(const std::string &name, std::function<void(VkCommandBuffer commandBuffer)> execute);
+	void Use(uint32_t pass, uint32_t resource, E_RenderAccess access); // Once per image per pass.
+	void SetSideEffects(uint32_t pass); // Its results leave the graph some other way, so it's never culled.
+
+	typedef std::function<VkMemoryRequirements(uint32_t resource, const S_RenderImageDesc &desc, VkImageUsageFlags usage)> RequirementsFunction;
+	void Compile(RequirementsFunction getRequirements);
+
+	// Creates the transient images, compiles against their real requirements, and binds them into one
+	// dedicated allocation per heap. Call again to rebuild, once the device is done with the old images.
+	void Realize(VkDevice logicalDevice, DeviceMemoryAllocator &memoryAllocator, const VkAllocationCallbacks *pAllocator);
+	void Release(); // Destroys the transient images and their memory.
+
+	// Records every compiled pass with its barriers, then the transitions to each imported image's final access.
+	void Execute(VkCommandBuffer commandBuffer) const;
+
+	VkImage GetImage(uint32_t resource) const { return m_Resources[resource].image; }
+	const std::vector<S_CompiledPass>& GetCompiledPasses() const { return m_CompiledPasses; }
+	const S_RenderBarrierBatch& GetFinalBarriers() const { return m_FinalBarriers; }
+	const S_TransientPlacement& GetPlacement(uint32_t resource) const { return m_Resources[resource].placement; }
+	const std::vector<S_TransientHeap>& GetHeaps() const { return m_Heaps; }
+	const S_RenderGraphStats& GetStats() const { return m_Stats; }
+	void PrintStats(std::ostream &out) const;
+
+	static S_RenderAccessInfo GetAccessInfo(E_RenderAccess access);
+	static VkImageAspectFlags GetAspect(VkFormat format);
+
+private:
+
+	struct S_Use
+	{
+		uint32_t resource;
+		E_RenderAccess access;
+	};
+
+	struct S_Pass
+	{
+		std::string name;
+		std::function<void(VkCommandBuffer commandBuffer)> execute;
+		std::vector<S_Use> uses;
+		bool sideEffects = false;
+	};
+
+	// Where an image was left by the passes compiled so far.
+	struct S_State
+	{
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags writeStages = 0; // Of the last write or transition.
+		VkAccessFlags writeAccess = 0; // Not yet visible to everyone, 0 if nothing was written.
+		VkPipelineStageFlags readStages = 0; // Since the last write.
+		VkPipelineStageFlags visibleStages = 0; // The last write has been made visible to these.
+		VkAccessFlags visibleAccess = 0;
+		bool touched = false;
+	};
+
+	struct S_Resource
+	{
+		std::string name;
+		S_RenderImageDesc desc;
+		bool imported = false;
+		VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags initialStages = 0;
+		E_RenderAccess finalAccess = RENDER_ACCESS_PRESENT;
+
+		// Filled in by Compile.
+		VkImageUsageFlags usage = 0;
+		VkMemoryRequirements requirements = {};
+		S_TransientPlacement placement;
+
+		VkImage image = VK_NULL_HANDLE;
+	};
+
+	std::vector<S_Resource> m_Resources;
+	std::vector<S_Pass> m_Passes;
+
+	std::vector<S_CompiledPass> m_CompiledPasses;
+	S_RenderBarrierBatch m_FinalBarriers;
+	std::vector<S_TransientHeap> m_Heaps;
+	S_RenderGraphStats m_Stats;
+
+	// Only set once realized.
+	VkDevice m_LogicalDevice = VK_NULL_HANDLE;
+	DeviceMemoryAllocator *m_pMemoryAllocator = nullptr;
+	const VkAllocationCallbacks *m_pAllocator = nullptr;
+	std::vector<S_DeviceAllocation> m_HeapMemory;
+
+	void CullPasses();
+	void ComputeLifetimes();
+	void PlaceTransients(RequirementsFunction &getRequirements);
+	void BuildBarriers();
+	void ReadBarrier(std::vector<S_State> &states, uint32_t position, const S_Use &use, S_RenderBarrierBatch &batch) const;
+	void AliasSource(const std::vector<S_State> &states, uint32_t resource, VkPipelineStageFlags &srcStages, VkAccessFlags &srcAccess) const;
+	static void AddBarrier(S_RenderBarrierBatch &batch, uint32_t resource, VkImageLayout oldLayout, VkImageLayout newLayout,
+		VkPipelineStageFlags srcStages, VkAccessFlags srcAccess, VkPipelineStageFlags dstStages, VkAccessFlags dstAccess);
+	void RecordBarriers(VkCommandBuffer commandBuffer, const S_RenderBarrierBatch &batch) const;
+	const S_Use* FindUse(uint32_t pass, uint32_t resource) const;
+};
+
+#endif
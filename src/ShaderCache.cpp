@@ -0,0 +1,318 @@
+#include "stdafx.h"
+#include "ShaderCache.h"
+#include "PipelineCache.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+ShaderCache::ShaderCache(VkDevice logicalDevice, const std::string &directory, VkPipelineCache pipelineCache, SubmissionScheduler &scheduler,
+	const VkAllocationCallbacks *pAllocator)
+	: m_LogicalDevice(logicalDevice), m_Directory(directory), m_PipelineCache(pipelineCache), m_Scheduler(scheduler), m_pAllocator(pAllocator)
+{
+}
+
+ShaderCache::~ShaderCache()
+{
+	// The reload job writes into m_Reloads, so it has to finish first. Whatever it built is thrown away.
+	if (m_pReloadPool != nullptr) m_pReloadPool->Wait(m_ReloadCounter);
+	for (S_Reload &reload : m_Reloads)
+	{
+		for (const std::pair<S_Variant*, VkPipeline> &pipeline : reload.pipelines)
+		{
+			if (pipeline.second != VK_NULL_HANDLE) vkDestroyPipeline(m_LogicalDevice, pipeline.second, m_pAllocator);
+		}
+		if (reload.newModule) vkDestroyShaderModule(m_LogicalDevice, reload.module, m_pAllocator);
+	}
+	m_pReloadPool.reset();
+
+	m_Variants.clear();
+	for (VkPipeline pipeline : m_RetiredPipelines) vkDestroyPipeline(m_LogicalDevice, pipeline, m_pAllocator);
+	for (VkShaderModule module : m_RetiredModules) vkDestroyShaderModule(m_LogicalDevice, module, m_pAllocator);
+	for (const std::pair<const uint64_t, S_Module> &module : m_Modules) vkDestroyShaderModule(m_LogicalDevice, module.second.module, m_pAllocator);
+
+#ifdef __linux__
+	if (m_WatchFile >= 0) close(m_WatchFile);
+#endif
+}
+
+ComputePipeline* ShaderCache::GetComputePipeline(const std::string &fileName, uint32_t bufferCount, uint32_t workgroupSize,
+	const std::vector<S_SpecializationConstant> &constants)
+{
+	auto find = [&]() -> S_Variant*
+	{
+		for (const std::unique_ptr<S_Variant> &pVariant : m_Variants)
+		{
+			if (pVariant->fileName != fileName || pVariant->bufferCount != bufferCount || pVariant->workgroupSize != workgroupSize) continue;
+			if (pVariant->constants.size() != constants.size()) continue;
+			bool same = true;
+			for (size_t i = 0; i < constants.size(); i++)
+				same = same && pVariant->constants[i].id == constants[i].id && pVariant->constants[i].value == constants[i].value;
+			if (same) return pVariant.get();
+		}
+		return nullptr;
+	};
+
+	VkShaderModule module;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		S_Variant *pVariant = find();
+		if (pVariant != nullptr)
+		{
+			m_Stats.variantsShared++;
+			return pVariant->pPipeline.get();
+		}
+		module = AcquireModule(fileName);
+	}
+
+	// Building is the slow part, so it happens outside the lock, and different variants can build at once.
+	std::unique_ptr<ComputePipeline> pPipeline(new ComputePipeline(m_LogicalDevice, module, bufferCount, workgroupSize, constants,
+		m_PipelineCache, m_pAllocator));
+
+	// Another thread may have built the same variant in the meantime. Then ours goes.
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	S_Variant *pVariant = find();
+	if (pVariant != nullptr)
+	{
+		m_Stats.variantsShared++;
+		return pVariant->pPipeline.get();
+	}
+
+	m_Variants.push_back(std::unique_ptr<S_Variant>(new S_Variant()));
+	pVariant = m_Variants.back().get();
+	pVariant->fileName = fileName;
+	pVariant->bufferCount = bufferCount;
+	pVariant->workgroupSize = workgroupSize;
+	pVariant->constants = constants;
+	pVariant->pPipeline = std::move(pPipeline);
+	m_Stats.pipelinesCreated++;
+	return pVariant->pPipeline.get();
+}
+
+// Under m_Mutex. A file is loaded the first time it's asked for, after that only reloads change it.
+VkShaderModule ShaderCache::AcquireModule(const std::string &fileName)
+{
+	std::map<std::string, uint64_t>::iterator file = m_Files.find(fileName);
+	if (file != m_Files.end()) return m_Modules[file->second].module;
+
+	std::vector<uint32_t> spirv = ComputePipeline::LoadSpirv(m_Directory + fileName);
+	uint64_t hash = PipelineCache::Checksum((const char*)spirv.data(), spirv.size() * sizeof(uint32_t));
+	std::map<uint64_t, S_Module>::iterator module = m_Modules.find(hash);
+	if (module == m_Modules.end())
+	{
+		S_Module newModule;
+		newModule.module = CreateModule(spirv);
+		module = m_Modules.insert(std::make_pair(hash, newModule)).first;
+		m_Stats.modulesCreated++;
+	}
+	else m_Stats.modulesShared++;
+
+	module->second.references++;
+	m_Files[fileName] = hash;
+	return module->second.module;
+}
+
+// Under m_Mutex. The last file to let go of a module retires it, since pipelines built from it may still be in flight.
+void ShaderCache::ReleaseModule(uint64_t hash)
+{
+	std::map<uint64_t, S_Module>::iterator module = m_Modules.find(hash);
+	if (module == m_Modules.end() || --module->second.references > 0) return;
+	m_RetiredModules.push_back(module->second.module);
+	m_Modules.erase(module);
+}
+
+VkShaderModule ShaderCache::CreateModule(const std::vector<uint32_t> &spirv)
+{
+	VkShaderModuleCreateInfo moduleInfo = {};
+	moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	moduleInfo.codeSize = spirv.size() * sizeof(uint32_t);
+	moduleInfo.pCode = spirv.data();
+
+	VkShaderModule module;
+	VkResult result = vkCreateShaderModule(m_LogicalDevice, &moduleInfo, m_pAllocator, &module);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create shader module.");
+	return module;
+}
+
+bool ShaderCache::Watch()
+{
+	if (m_pReloadPool != nullptr) return true;
+
+#ifdef __linux__
+	// Compilers either write the file in place and close it, or write it elsewhere and move it in.
+	m_WatchFile = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (m_WatchFile < 0) return false;
+	if (inotify_add_watch(m_WatchFile, m_Directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		close(m_WatchFile);
+		m_WatchFile = -1;
+		return false;
+	}
+
+	m_pReloadPool.reset(new JobSystem(2)); // The calling thread, and one worker to rebuild on.
+	return true;
+#else
+	return false;
+#endif
+}
+
+void ShaderCache::BeginFrame()
+{
+	if (m_pReloadPool == nullptr) return;
+
+	ReadChanges();
+	if (!m_ReloadCounter.isDone()) return;
+
+	for (S_Reload &reload : m_Reloads) ApplyReload(reload);
+	m_Reloads.clear();
+	if (!m_Changed.empty()) StartReload();
+}
+
+void ShaderCache::EndFrame(S_TimelinePoint submitted)
+{
+	if (m_RetiredPipelines.empty() && m_RetiredModules.empty()) return;
+	std::vector<VkPipeline> pipelines;
+	std::vector<VkShaderModule> modules;
+	pipelines.swap(m_RetiredPipelines);
+	modules.swap(m_RetiredModules);
+	m_Scheduler.Retire(submitted, [this, pipelines, modules]()
+	{
+		for (VkPipeline pipeline : pipelines) vkDestroyPipeline(m_LogicalDevice, pipeline, m_pAllocator);
+		for (VkShaderModule module : modules) vkDestroyShaderModule(m_LogicalDevice, module, m_pAllocator);
+	});
+}
+
+void ShaderCache::ReadChanges()
+{
+#ifdef __linux__
+	// Each event is a header followed by the file's name.
+	alignas(inotify_event) char buffer[4096];
+	for (;;)
+	{
+		ssize_t length = read(m_WatchFile, buffer, sizeof(buffer));
+		if (length <= 0) break; // Nothing left to read.
+		for (ssize_t offset = 0; offset < length; )
+		{
+			const inotify_event *pEvent = (const inotify_event*)(buffer + offset);
+			if (pEvent->len > 0) m_Changed.insert(pEvent->name);
+			offset += sizeof(inotify_event) + pEvent->len;
+		}
+	}
+#endif
+}
+
+// One job per changed file we've loaded. Files nobody asked for are ignored.
+void ShaderCache::StartReload()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		for (const std::string &fileName : m_Changed)
+		{
+			if (m_Files.count(fileName) == 0) continue;
+
+			S_Reload reload;
+			reload.fileName = fileName;
+			for (const std::unique_ptr<S_Variant> &pVariant : m_Variants)
+			{
+				if (pVariant->fileName == fileName) reload.pipelines.push_back(std::make_pair(pVariant.get(), (VkPipeline)VK_NULL_HANDLE));
+			}
+			m_Reloads.push_back(reload);
+		}
+	}
+	m_Changed.clear();
+
+	// m_Reloads doesn't change again until the counter is done, so the jobs can keep indices into it.
+	for (size_t i = 0; i < m_Reloads.size(); i++)
+		m_pReloadPool->Submit([this, i]() { Reload(m_Reloads[i]); }, &m_ReloadCounter);
+}
+
+// On the reload thread. Leaves the module empty if the file didn't actually change, and the error set if it couldn't be built.
+void ShaderCache::Reload(S_Reload &reload)
+{
+	try
+	{
+		std::vector<uint32_t> spirv = ComputePipeline::LoadSpirv(m_Directory + reload.fileName);
+		reload.hash = PipelineCache::Checksum((const char*)spirv.data(), spirv.size() * sizeof(uint32_t));
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			if (m_Files[reload.fileName] == reload.hash) return;
+			std::map<uint64_t, S_Module>::iterator module = m_Modules.find(reload.hash);
+			if (module != m_Modules.end()) reload.module = module->second.module;
+		}
+
+		if (reload.module == VK_NULL_HANDLE)
+		{
+			reload.module = CreateModule(spirv);
+			reload.newModule = true;
+		}
+		for (std::pair<S_Variant*, VkPipeline> &pipeline : reload.pipelines) pipeline.second = pipeline.first->pPipeline->BuildPipeline(reload.module);
+	}
+	catch (const std::runtime_error &e)
+	{
+		reload.error = e.what();
+		for (std::pair<S_Variant*, VkPipeline> &pipeline : reload.pipelines)
+		{
+			if (pipeline.second != VK_NULL_HANDLE) vkDestroyPipeline(m_LogicalDevice, pipeline.second, m_pAllocator);
+			pipeline.second = VK_NULL_HANDLE;
+		}
+		if (reload.newModule) vkDestroyShaderModule(m_LogicalDevice, reload.module, m_pAllocator);
+		reload.module = VK_NULL_HANDLE;
+		reload.newModule = false;
+	}
+}
+
+// Swaps the new pipelines in. The old ones, and the old module if nothing else uses it, wait for EndFrame.
+void ShaderCache::ApplyReload(S_Reload &reload)
+{
+	if (!reload.error.empty())
+	{
+		std::cerr << "Failed to reload shader " << reload.fileName << ": " << reload.error << std::endl;
+		m_Stats.reloadFailures++;
+		return;
+	}
+	if (reload.module == VK_NULL_HANDLE) return;
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	ReleaseModule(m_Files[reload.fileName]);
+	S_Module &module = m_Modules[reload.hash];
+	if (module.module == VK_NULL_HANDLE)
+	{
+		// A reload applied just before this one may have retired the module we picked up.
+		m_RetiredModules.erase(std::remove(m_RetiredModules.begin(), m_RetiredModules.end(), reload.module), m_RetiredModules.end());
+		module.module = reload.module;
+	}
+	else if (reload.newModule) m_RetiredModules.push_back(reload.module); // Some other file got there first.
+	module.references++;
+	m_Files[reload.fileName] = reload.hash;
+
+	for (const std::pair<S_Variant*, VkPipeline> &pipeline : reload.pipelines)
+		m_RetiredPipelines.push_back(pipeline.first->pPipeline->SwapPipeline(pipeline.second));
+
+	// Variants asked for while the reload ran were built from the old code. There's rarely any, so they build here.
+	uint32_t rebuilt = (uint32_t)reload.pipelines.size();
+	for (const std::unique_ptr<S_Variant> &pVariant : m_Variants)
+	{
+		if (pVariant->fileName != reload.fileName) continue;
+		bool reloaded = false;
+		for (const std::pair<S_Variant*, VkPipeline> &pipeline : reload.pipelines) reloaded = reloaded || pipeline.first == pVariant.get();
+		if (reloaded) continue;
+
+		try
+		{
+			m_RetiredPipelines.push_back(pVariant->pPipeline->SwapPipeline(pVariant->pPipeline->BuildPipeline(module.module)));
+			rebuilt++;
+		}
+		catch (const std::runtime_error &e) { std::cerr << "Failed to rebuild a variant of " << reload.fileName << ": " << e.what() << std::endl; }
+	}
+
+	m_Stats.reloads++;
+	std::cout << "Reloaded shader " << reload.fileName << ", rebuilt " << rebuilt << " pipeline(s)." << std::endl;
+}
+
+void ShaderCache::PrintStats(std::ostream &out) const
+{
+	out << "Shaders: " << m_Stats.modulesCreated << " modules for " << m_Stats.modulesCreated + m_Stats.modulesShared << " files, "
+		<< m_Stats.pipelinesCreated << " pipelines, " << m_Stats.variantsShared << " repeat variant requests, "
+		<< m_Stats.reloads << " reloads, " << m_Stats.reloadFailures << " failed" << std::endl;
+}
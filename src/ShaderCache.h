@@ -0,0 +1,112 @@
+#pragma once
+
+#ifndef SHADERCACHE_H
+#define SHADERCACHE_H
+
+#include <memory>
+#include <mutex>
+
+#include "ComputePipeline.h"
+#include "JobSystem.h"
+#include "SubmissionScheduler.h"
+
+struct S_ShaderCacheStats
+{
+	uint32_t modulesCreated = 0;
+	uint32_t modulesShared = 0; // Files whose SPIR-V matched a module we already had.
+	uint32_t pipelinesCreated = 0;
+	uint32_t variantsShared = 0; // Requests for a variant that already existed.
+	uint32_t reloads = 0;
+	uint32_t reloadFailures = 0;
+};
+
+// Loads SPIR-V from the shader directory, and hands out the compute pipelines built from it.
+// Modules are keyed by a hash of their code, so files with the same code share a VkShaderModule. A pipeline is a
+// module plus specialization constants, so a kernel's variants are one module built with different constants,
+// not separate permutations of the shader. Asking for the same variant twice returns the same pipeline.
+// Once watching, changed files in the directory get a new module, and every pipeline built from them is rebuilt on
+// a background thread. BeginFrame swaps them in when they're ready, so a reload never stalls a frame.
+// Only the VkPipeline inside a ComputePipeline changes, so callers can hold on to the pointers for good.
+class ShaderCache
+{
+public:
+
+	ShaderCache(VkDevice logicalDevice, const std::string &directory, VkPipelineCache pipelineCache, SubmissionScheduler &scheduler,
+		const VkAllocationCallbacks *pAllocator);
+	~ShaderCache(); // Every pipeline it handed out goes with it.
+
+	// fileName is relative to the directory. Safe from several threads at once, but not alongside BeginFrame.
+	ComputePipeline* GetComputePipeline(const std::string &fileName, uint32_t bufferCount, uint32_t workgroupSize,
+		const std::vector<S_SpecializationConstant> &constants = std::vector<S_SpecializationConstant>());
+
+	// Starts watching the directory with inotify. Returns false where that isn't available, and nothing ever reloads.
+	bool Watch();
+
+	// Swaps in finished reloads and starts new ones.
+	void BeginFrame();
+
+	// Retires the pipelines and modules replaced since the last call against the frame that was just submitted.
+	void EndFrame(S_TimelinePoint submitted);
+
+	bool IsWatching() const { return m_pReloadPool != nullptr; }
+	const S_ShaderCacheStats& GetStats() const { return m_Stats; }
+	void PrintStats(std::ostream &out) const;
+
+private:
+
+	struct S_Module
+	{
+		VkShaderModule module = VK_NULL_HANDLE;
+		uint32_t references = 0; // Files holding this code.
+	};
+
+	struct S_Variant
+	{
+		std::string fileName;
+		uint32_t bufferCount;
+		uint32_t workgroupSize;
+		std::vector<S_SpecializationConstant> constants;
+		std::unique_ptr<ComputePipeline> pPipeline;
+	};
+
+	// One file's rebuild, done off the main thread.
+	struct S_Reload
+	{
+		std::string fileName;
+		uint64_t hash = 0;
+		VkShaderModule module = VK_NULL_HANDLE;
+		bool newModule = false; // Otherwise it's one we already had.
+		std::vector<std::pair<S_Variant*, VkPipeline>> pipelines;
+		std::string error;
+	};
+
+	VkDevice m_LogicalDevice;
+	std::string m_Directory;
+	VkPipelineCache m_PipelineCache;
+	SubmissionScheduler &m_Scheduler;
+	const VkAllocationCallbacks *m_pAllocator;
+
+	std::mutex m_Mutex; // Guards the maps and the variants, GetComputePipeline runs on worker threads.
+	std::map<std::string, uint64_t> m_Files; // The hash of what each file held when we last loaded it.
+	std::map<uint64_t, S_Module> m_Modules;
+	std::vector<std::unique_ptr<S_Variant>> m_Variants;
+
+	int m_WatchFile = -1;
+	std::unique_ptr<JobSystem> m_pReloadPool; // Only once watching.
+	S_JobCounter m_ReloadCounter;
+	std::set<std::string> m_Changed; // Waiting for the reload in flight to finish.
+	std::vector<S_Reload> m_Reloads; // Written by the reload job, read once its counter is done.
+	std::vector<VkPipeline> m_RetiredPipelines; // Since the last EndFrame.
+	std::vector<VkShaderModule> m_RetiredModules;
+	S_ShaderCacheStats m_Stats;
+
+	VkShaderModule AcquireModule(const std::string &fileName);
+	void ReleaseModule(uint64_t hash);
+	VkShaderModule CreateModule(const std::vector<uint32_t> &spirv);
+	void ReadChanges();
+	void StartReload();
+	void Reload(S_Reload &reload);
+	void ApplyReload(S_Reload &reload);
+};
+
+#endif
@@ -0,0 +1,72 @@
+#include "stdafx.h"
+#include "StartupReport.h"
+
+void StartupReport::Start()
+{
+	m_Stages.clear();
+	m_Start = m_Last = Clock::now();
+}
+
+void StartupReport::Mark(const std::string &stage)
+{
+	Clock::time_point now = Clock::now();
+	m_Stages.push_back({ stage, std::chrono::duration<double, std::milli>(now - m_Last).count() });
+	m_Last = now;
+}
+
+double StartupReport::GetTotalMilliseconds() const
+{
+	return std::chrono::duration<double, std::milli>(m_Last - m_Start).count();
+}
+
+void StartupReport::WriteJson(std::ostream &out, const DeviceCapabilityProfile *pProfile) const
+{
+	out << "{" << std::endl;
+	if (pProfile != nullptr) WriteDeviceJson(out, *pProfile);
+
+	out << "  \"stages\": [" << std::endl;
+	for (size_t i = 0; i < m_Stages.size(); i++)
+	{
+		out << "    { \"name\": \"" << Escape(m_Stages[i].name) << "\", \"ms\": " << m_Stages[i].milliseconds << " }"
+			<< ((i + 1 < m_Stages.size()) ? "," : "") << std::endl;
+	}
+	out << "  ]," << std::endl;
+	out << "  \"totalMs\": " << GetTotalMilliseconds() << std::endl;
+	out << "}" << std::endl;
+}
+
+void StartupReport::WriteDeviceJson(std::ostream &out, const DeviceCapabilityProfile &profile)
+{
+	const VkPhysicalDeviceProperties &properties = profile.GetProperties();
+	const VkPhysicalDeviceMemoryProperties &memoryProperties = profile.GetMemoryProperties();
+	out << "  \"device\": {" << std::endl;
+	out << "    \"name\": \"" << Escape(properties.deviceName) << "\"," << std::endl;
+	out << "    \"vendorID\": " << properties.vendorID << "," << std::endl;
+	out << "    \"deviceID\": " << properties.deviceID << "," << std::endl;
+	out << "    \"driverVersion\": " << properties.driverVersion << "," << std::endl;
+	out << "    \"apiVersion\": \"" << VK_VERSION_MAJOR(properties.apiVersion) << "." << VK_VERSION_MINOR(properties.apiVersion)
+		<< "." << VK_VERSION_PATCH(properties.apiVersion) << "\"," << std::endl;
+	out << "    \"queueFamilies\": " << profile.GetQueueFamilies().size() << "," << std::endl;
+	out << "    \"extensions\": " << profile.GetExtensions().size() << "," << std::endl;
+	out << "    \"memoryTypes\": " << memoryProperties.memoryTypeCount << "," << std::endl;
+	out << "    \"memoryHeaps\": " << memoryProperties.memoryHeapCount << std::endl;
+	out << "  }," << std::endl;
+}
+
+// Device names are the only free text we write, but they come from the driver, so quote them properly.
+std::string StartupReport::Escape(const std::string &text)
+{
+	std::string escaped;
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\') escaped += '\\';
+		if ((unsigned char)c < 0x20)
+		{
+			char code[8];
+			snprintf(code, sizeof(code), "\\u%04x", (unsigned char)c);
+			escaped += code;
+		}
+		else escaped += c;
+	}
+	return escaped;
+}
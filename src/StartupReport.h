@@ -0,0 +1,44 @@
+#pragma once
+
+#ifndef STARTUPREPORT_H
+#define STARTUPREPORT_H
+
+#include <chrono>
+
+#include "DeviceCapabilityProfile.h"
+
+// Wall clock time for each stage of startup, written out as JSON so cold start regressions can be tracked.
+// Each Mark closes the stage that started at the previous Mark (or at Start).
+class StartupReport
+{
+public:
+
+	struct S_Stage
+	{
+		std::string name;
+		double milliseconds;
+	};
+
+	void Start();
+	void Mark(const std::string &stage);
+
+	double GetTotalMilliseconds() const;
+	const std::vector<S_Stage>& GetStages() const { return m_Stages; }
+
+	// The device is optional, so a report can still be written if startup failed before picking one.
+	void WriteJson(std::ostream &out, const DeviceCapabilityProfile *pProfile) const;
+
+	// The "device" member of the report, shared with the other JSON we write so runs can be matched to hardware.
+	static void WriteDeviceJson(std::ostream &out, const DeviceCapabilityProfile &profile);
+	static std::string Escape(const std::string &text);
+
+private:
+
+	typedef std::chrono::steady_clock Clock;
+
+	Clock::time_point m_Start;
+	Clock::time_point m_Last;
+	std::vector<S_Stage> m_Stages;
+};
+
+#endif
@@ -0,0 +1,393 @@
+#include "stdafx.h"
+#include "SubmissionScheduler.h"
+
+SubmissionScheduler::SubmissionScheduler(VkDevice logicalDevice, VkQueue graphicsQueue, VkQueue computeQueue, VkQueue transferQueue,
+	bool timelineSemaphores, const VkAllocationCallbacks *pAllocator)
+	: m_LogicalDevice(logicalDevice), m_pAllocator(pAllocator), m_TimelineSemaphores(false)
+{
+	// The same family often hands back the same queue for more than one type.
+	VkQueue queues[QUEUE_TYPE_COUNT] = { graphicsQueue, computeQueue, transferQueue };
+	for (int type = 0; type < QUEUE_TYPE_COUNT; type++)
+	{
+		int index = 0;
+		while (index < (int)m_Timelines.size() && m_Timelines[index].queue != queues[type]) index++;
+		if (index == (int)m_Timelines.size())
+		{
+			m_Timelines.push_back(S_Timeline());
+			m_Timelines.back().queue = queues[type];
+		}
+		m_TimelineIndices[type] = index;
+	}
+
+	// The extension's functions only come from the device. Without both, we fall back to fences.
+#ifdef VK_KHR_timeline_semaphore
+	if (timelineSemaphores)
+	{
+		m_pfnWaitSemaphores = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(m_LogicalDevice, "vkWaitSemaphoresKHR");
+		m_pfnGetSemaphoreCounterValue = (PFN_vkGetSemaphoreCounterValueKHR)vkGetDeviceProcAddr(m_LogicalDevice, "vkGetSemaphoreCounterValueKHR");
+		m_TimelineSemaphores = (m_pfnWaitSemaphores != nullptr && m_pfnGetSemaphoreCounterValue != nullptr);
+	}
+
+	for (S_Timeline &timeline : m_Timelines)
+	{
+		if (!m_TimelineSemaphores) break;
+
+		VkSemaphoreTypeCreateInfoKHR typeInfo = {};
+		typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+		typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+		typeInfo.initialValue = 0;
+
+		VkSemaphoreCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		createInfo.pNext = &typeInfo;
+		VkResult result = vkCreateSemaphore(m_LogicalDevice, &createInfo, m_pAllocator, &timeline.semaphore);
+		if (result != VK_SUCCESS) throw std::runtime_error("Failed to create timeline semaphore.");
+	}
+#else
+	(void)timelineSemaphores;
+#endif
+}
+
+SubmissionScheduler::~SubmissionScheduler()
+{
+	WaitIdle();
+	for (S_Timeline &timeline : m_Timelines)
+	{
+		if (timeline.semaphore != VK_NULL_HANDLE) vkDestroySemaphore(m_LogicalDevice, timeline.semaphore, m_pAllocator);
+		for (const std::pair<uint64_t, VkFence> &fence : timeline.fences) vkDestroyFence(m_LogicalDevice, fence.second, m_pAllocator);
+	}
+	for (VkFence fence : m_FreeFences) vkDestroyFence(m_LogicalDevice, fence, m_pAllocator);
+}
+
+// Values are handed out in the order submissions arrive, which is the order they go out in.
+S_TimelinePoint SubmissionScheduler::Submit(E_QueueType queue, const S_Submission &submission)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	S_Timeline &timeline = GetTimeline(queue);
+	S_Pending pending;
+	pending.submission = submission;
+	pending.value = ++timeline.submitted;
+	timeline.pending.push_back(std::move(pending));
+	m_Stats.submissions++;
+
+	S_TimelinePoint point;
+	point.queue = queue;
+	point.value = timeline.submitted;
+	return point;
+}
+
+void SubmissionScheduler::Flush()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	FlushAllLocked();
+}
+
+// Transfer and compute go out before graphics, since graphics is usually what waits on them.
+void SubmissionScheduler::FlushAllLocked()
+{
+	for (size_t i = m_Timelines.size(); i > 0; i--) FlushLocked(m_Timelines[i - 1]);
+}
+
+// A submission that waits on something starts a new batch, so the work before it doesn't wait too.
+// Anything that doesn't wait just joins the batch before it. Binary signals end a batch, so whoever waits on them,
+// like present, isn't held up by whatever is merged in after.
+// Without timeline semaphores, everything before a submission that waits goes out first, and the wait is done here.
+void SubmissionScheduler::FlushLocked(S_Timeline &timeline)
+{
+	if (timeline.pending.empty()) return;
+
+	// Taken out first, so a host wait that has to flush another queue can't come back around to these.
+	std::vector<S_Pending> pending;
+	pending.swap(timeline.pending);
+
+	std::vector<S_Batch> batches;
+	bool closed = true;
+	for (const S_Pending &entry : pending)
+	{
+		const S_Submission &submission = entry.submission;
+		bool waits = !submission.waits.empty() || !submission.binaryWaits.empty();
+		if (!m_TimelineSemaphores && !submission.waits.empty())
+		{
+			SubmitBatches(timeline, batches);
+			for (const S_TimelineWait &wait : submission.waits)
+			{
+				S_Timeline &target = GetTimeline(wait.point.queue);
+				if (&target != &timeline && wait.point.value > target.flushed) FlushLocked(target);
+				HostWaitLocked(target, wait.point.value);
+			}
+		}
+
+		if (closed || waits) batches.push_back(S_Batch());
+		S_Batch &batch = batches.back();
+		closed = !submission.binarySignals.empty();
+
+		for (const S_TimelineWait &wait : submission.waits)
+		{
+			if (!m_TimelineSemaphores) break;
+			batch.waitSemaphores.push_back(GetTimeline(wait.point.queue).semaphore);
+			batch.waitValues.push_back(wait.point.value);
+			batch.waitStages.push_back(wait.stages);
+		}
+		for (size_t i = 0; i < submission.binaryWaits.size(); i++)
+		{
+			batch.waitSemaphores.push_back(submission.binaryWaits[i]);
+			batch.waitValues.push_back(0);
+			batch.waitStages.push_back(submission.binaryWaitStages[i]);
+		}
+		batch.commandBuffers.insert(batch.commandBuffers.end(), submission.commandBuffers.begin(), submission.commandBuffers.end());
+		for (VkSemaphore semaphore : submission.binarySignals)
+		{
+			batch.signalSemaphores.push_back(semaphore);
+			batch.signalValues.push_back(0);
+		}
+		batch.value = entry.value;
+	}
+	SubmitBatches(timeline, batches);
+}
+
+// Every batch signals the timeline with its last value. Without timelines, the one fence covers them all.
+void SubmissionScheduler::SubmitBatches(S_Timeline &timeline, std::vector<S_Batch> &batches)
+{
+	if (batches.empty()) return;
+
+	std::vector<VkSubmitInfo> submitInfos(batches.size());
+#ifdef VK_KHR_timeline_semaphore
+	std::vector<VkTimelineSemaphoreSubmitInfoKHR> timelineInfos(batches.size());
+#endif
+	for (size_t i = 0; i < batches.size(); i++)
+	{
+		S_Batch &batch = batches[i];
+		if (m_TimelineSemaphores)
+		{
+			batch.signalSemaphores.push_back(timeline.semaphore);
+			batch.signalValues.push_back(batch.value);
+		}
+
+		VkSubmitInfo &submitInfo = submitInfos[i];
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.waitSemaphoreCount = (uint32_t)batch.waitSemaphores.size();
+		submitInfo.pWaitSemaphores = batch.waitSemaphores.data();
+		submitInfo.pWaitDstStageMask = batch.waitStages.data();
+		submitInfo.commandBufferCount = (uint32_t)batch.commandBuffers.size();
+		submitInfo.pCommandBuffers = batch.commandBuffers.data();
+		submitInfo.signalSemaphoreCount = (uint32_t)batch.signalSemaphores.size();
+		submitInfo.pSignalSemaphores = batch.signalSemaphores.data();
+
+#ifdef VK_KHR_timeline_semaphore
+		if (!m_TimelineSemaphores) continue;
+		VkTimelineSemaphoreSubmitInfoKHR &timelineInfo = timelineInfos[i];
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+		timelineInfo.waitSemaphoreValueCount = (uint32_t)batch.waitValues.size();
+		timelineInfo.pWaitSemaphoreValues = batch.waitValues.data();
+		timelineInfo.signalSemaphoreValueCount = (uint32_t)batch.signalValues.size();
+		timelineInfo.pSignalSemaphoreValues = batch.signalValues.data();
+		submitInfo.pNext = &timelineInfo;
+#endif
+	}
+
+	VkFence fence = (m_TimelineSemaphores) ? VK_NULL_HANDLE : AcquireFence();
+	VkResult result = vkQueueSubmit(timeline.queue, (uint32_t)submitInfos.size(), submitInfos.data(), fence);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to submit to queue.");
+
+	timeline.flushed = batches.back().value;
+	if (fence != VK_NULL_HANDLE) timeline.fences.push_back(std::make_pair(timeline.flushed, fence));
+	m_Stats.batches += batches.size();
+	m_Stats.submitCalls++;
+	batches.clear();
+}
+
+bool SubmissionScheduler::IsComplete(S_TimelinePoint point)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	S_Timeline &timeline = GetTimeline(point.queue);
+	if (point.value <= timeline.completed) return true;
+	if (point.value > timeline.flushed) return false;
+	PollCompleted(timeline);
+	return point.value <= timeline.completed;
+}
+
+// A fence signals once everything submitted before it is done, so the signaled ones from the front all count.
+// They're only recycled while nobody is waiting on one outside the lock.
+void SubmissionScheduler::PollCompleted(S_Timeline &timeline)
+{
+	if (timeline.completed >= timeline.flushed) return;
+
+#ifdef VK_KHR_timeline_semaphore
+	if (m_TimelineSemaphores)
+	{
+		uint64_t value = 0;
+		VkResult result = m_pfnGetSemaphoreCounterValue(m_LogicalDevice, timeline.semaphore, &value);
+		if (result != VK_SUCCESS) throw std::runtime_error("Failed to read timeline semaphore.");
+		timeline.completed = std::max(timeline.completed, value);
+		return;
+	}
+#endif
+
+	size_t signaled = 0;
+	while (signaled < timeline.fences.size() && vkGetFenceStatus(m_LogicalDevice, timeline.fences[signaled].second) == VK_SUCCESS)
+	{
+		timeline.completed = std::max(timeline.completed, timeline.fences[signaled].first);
+		signaled++;
+	}
+	if (m_HostWaiters > 0) return;
+
+	for (size_t i = 0; i < signaled; i++)
+	{
+		VkFence fence = timeline.fences.front().second;
+		vkResetFences(m_LogicalDevice, 1, &fence);
+		m_FreeFences.push_back(fence);
+		timeline.fences.pop_front();
+	}
+}
+
+void SubmissionScheduler::Wait(S_TimelinePoint point)
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	WaitLocked(lock, GetTimeline(point.queue), point.value);
+}
+
+// The lock is let go while we block, so other threads can keep submitting. Waiting on a point that hasn't gone out
+// flushes every queue, since a timeline wait on the GPU would otherwise wait on another queue's work forever.
+void SubmissionScheduler::WaitLocked(std::unique_lock<std::mutex> &lock, S_Timeline &timeline, uint64_t value)
+{
+	if (value > timeline.submitted) throw std::runtime_error("Waiting on a point that was never submitted.");
+	if (value <= timeline.completed) return;
+	if (value > timeline.flushed) FlushAllLocked();
+
+#ifdef VK_KHR_timeline_semaphore
+	if (m_TimelineSemaphores)
+	{
+		VkSemaphoreWaitInfoKHR waitInfo = {};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &timeline.semaphore;
+		waitInfo.pValues = &value;
+
+		lock.unlock();
+		VkResult result = m_pfnWaitSemaphores(m_LogicalDevice, &waitInfo, UINT64_MAX);
+		lock.lock();
+		if (result != VK_SUCCESS) throw std::runtime_error("Failed to wait on timeline semaphore.");
+		timeline.completed = std::max(timeline.completed, value);
+		return;
+	}
+#endif
+
+	// The first fence at or past the value covers it.
+	PollCompleted(timeline);
+	if (value <= timeline.completed) return;
+	auto it = timeline.fences.begin();
+	while (it->first < value) ++it;
+	VkFence fence = it->second;
+	uint64_t fenceValue = it->first;
+
+	m_HostWaiters++;
+	lock.unlock();
+	VkResult result = vkWaitForFences(m_LogicalDevice, 1, &fence, VK_TRUE, UINT64_MAX);
+	lock.lock();
+	m_HostWaiters--;
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to wait for submission fence.");
+	timeline.completed = std::max(timeline.completed, fenceValue);
+	PollCompleted(timeline);
+}
+
+// Only during a flush without timeline semaphores. The lock stays held, since the flush is halfway through.
+void SubmissionScheduler::HostWaitLocked(S_Timeline &timeline, uint64_t value)
+{
+	if (value <= timeline.completed) return;
+	if (value > timeline.flushed) throw std::runtime_error("Submission waits on work that hasn't been submitted before it.");
+
+	PollCompleted(timeline);
+	if (value <= timeline.completed) return;
+	auto it = timeline.fences.begin();
+	while (it->first < value) ++it;
+
+	VkResult result = vkWaitForFences(m_LogicalDevice, 1, &it->second, VK_TRUE, UINT64_MAX);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to wait for submission fence.");
+	timeline.completed = std::max(timeline.completed, it->first);
+	m_Stats.hostWaits++;
+	PollCompleted(timeline);
+}
+
+void SubmissionScheduler::WaitIdle()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		FlushAllLocked();
+		for (S_Timeline &timeline : m_Timelines) WaitLocked(lock, timeline, timeline.submitted);
+	}
+	Collect();
+}
+
+void SubmissionScheduler::Retire(S_TimelinePoint point, std::function<void()> release)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	S_Retired retired;
+	retired.point = point;
+	retired.release = std::move(release);
+	m_Retired.push_back(std::move(retired));
+}
+
+// The callbacks run outside the lock, so they're free to submit or retire more.
+void SubmissionScheduler::Collect()
+{
+	std::vector<std::function<void()>> releases;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_Retired.empty()) return;
+		for (S_Timeline &timeline : m_Timelines) PollCompleted(timeline);
+
+		size_t kept = 0;
+		for (size_t i = 0; i < m_Retired.size(); i++)
+		{
+			S_Retired &retired = m_Retired[i];
+			if (retired.point.value <= GetTimeline(retired.point.queue).completed) releases.push_back(std::move(retired.release));
+			else m_Retired[kept++] = std::move(retired);
+		}
+		m_Retired.resize(kept);
+	}
+
+	for (std::function<void()> &release : releases) release();
+}
+
+S_TimelinePoint SubmissionScheduler::GetLastSubmitted(E_QueueType queue)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	S_TimelinePoint point;
+	point.queue = queue;
+	point.value = GetTimeline(queue).submitted;
+	return point;
+}
+
+VkFence SubmissionScheduler::AcquireFence()
+{
+	if (!m_FreeFences.empty())
+	{
+		VkFence fence = m_FreeFences.back();
+		m_FreeFences.pop_back();
+		return fence;
+	}
+
+	VkFenceCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	VkFence fence;
+	VkResult result = vkCreateFence(m_LogicalDevice, &createInfo, m_pAllocator, &fence);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create submission fence.");
+	return fence;
+}
+
+S_SubmissionStats SubmissionScheduler::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Stats;
+}
+
+void SubmissionScheduler::PrintStats(std::ostream &out) const
+{
+	S_SubmissionStats stats = GetStats();
+	out << "Submissions: " << stats.submissions << " submitted in " << stats.batches << " batches over " << stats.submitCalls
+		<< " vkQueueSubmit calls, " << m_Timelines.size() << " queues with " << ((m_TimelineSemaphores) ? "timeline semaphores" : "fences");
+	if (!m_TimelineSemaphores) out << ", " << stats.hostWaits << " waits on the CPU";
+	out << std::endl;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#ifndef SUBMISSIONSCHEDULER_H
+#define SUBMISSIONSCHEDULER_H
+
+#include <deque>
+#include <mutex>
+
+enum E_QueueType
+{
+	QUEUE_GRAPHICS,
+	QUEUE_COMPUTE,
+	QUEUE_TRANSFER,
+	QUEUE_TYPE_COUNT
+};
+
+// A point on one queue's timeline. Every timeline starts at 0, so a point with value 0 is always complete.
+struct S_TimelinePoint
+{
+	E_QueueType queue = QUEUE_GRAPHICS;
+	uint64_t value = 0;
+};
+
+struct S_TimelineWait
+{
+	S_TimelinePoint point;
+	VkPipelineStageFlags stages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT; // What can't start until the point is reached.
+};
+
+// Command buffers that run in order on one queue, and what they wait on and signal besides their timeline.
+// Binary semaphores are only for the swapchain, whose acquire and present can't use timelines.
+struct S_Submission
+{
+	std::vector<VkCommandBuffer> commandBuffers;
+	std::vector<S_TimelineWait> waits;
+	std::vector<VkSemaphore> binaryWaits;
+	std::vector<VkPipelineStageFlags> binaryWaitStages;
+	std::vector<VkSemaphore> binarySignals;
+};
+
+struct S_SubmissionStats
+{
+	uint64_t submissions = 0; // Handed to Submit.
+	uint64_t batches = 0; // VkSubmitInfos they were merged into.
+	uint64_t submitCalls = 0; // vkQueueSubmit calls those went out in.
+	uint64_t hostWaits = 0; // Waits that had to be done on the CPU during a flush, without timeline semaphores.
+};
+
+// The only place anything is submitted to the graphics, compute and transfer queues.
+// Any thread can Submit, which only queues the work and hands back the point on its queue's timeline that it
+// will signal. Flush sends everything queued in one vkQueueSubmit per queue, merging submissions that don't wait
+// on anything into the batch before them. Dependencies between queues, and completion, are timeline values, so
+// nobody holds on to a fence or a semaphore, and anything freed along the way can be retired against a point.
+// Queue types that share a VkQueue share a timeline, since their work runs in order anyway.
+// Without timeline semaphores, every vkQueueSubmit gets a fence that stands for its last value instead,
+// and a wait on a point that isn't complete yet is done on the CPU before the submission that needs it goes out.
+class SubmissionScheduler
+{
+public:
+
+	SubmissionScheduler(VkDevice logicalDevice, VkQueue graphicsQueue, VkQueue computeQueue, VkQueue transferQueue,
+		bool timelineSemaphores, const VkAllocationCallbacks *pAllocator);
+	~SubmissionScheduler(); // Waits for everything submitted, and runs whatever is still retired.
+
+	// Queue command buffers on a queue, to go out with the next Flush. Safe to call from any thread.
+	S_TimelinePoint Submit(E_QueueType queue, const S_Submission &submission);
+
+	// Submit everything queued so far. Safe to call from any thread.
+	void Flush();
+
+	// Check or wait for a point to be reached. Waiting on a point that hasn't been flushed flushes it first.
+	bool IsComplete(S_TimelinePoint point);
+	void Wait(S_TimelinePoint point);
+	void WaitIdle(); // Flushes and waits for every queue, then runs every retired callback.
+
+	// Run release once the point is complete, from the Collect after that. For freeing things the GPU may still use.
+	void Retire(S_TimelinePoint point, std::function<void()> release);
+	void Collect(); // Never blocks. Call once a frame.
+
+	// The last value handed out on a queue's timeline. Waiting on it waits for everything submitted there so far.
+	S_TimelinePoint GetLastSubmitted(E_QueueType queue);
+
+	bool UsesTimelineSemaphores() const { return m_TimelineSemaphores; }
+	S_SubmissionStats GetStats() const;
+	void PrintStats(std::ostream &out) const;
+
+private:
+
+	struct S_Pending
+	{
+		S_Submission submission;
+		uint64_t value;
+	};
+
+	struct S_Timeline
+	{
+		VkQueue queue = VK_NULL_HANDLE;
+		VkSemaphore semaphore = VK_NULL_HANDLE; // Only with timeline semaphores.
+		uint64_t submitted = 0; // The last value handed out.
+		uint64_t flushed = 0; // The last value that went out in a vkQueueSubmit.
+		uint64_t completed = 0; // The last value we've seen the GPU reach.
+		std::vector<S_Pending> pending; // Submitted but not flushed, in order.
+		std::deque<std::pair<uint64_t, VkFence>> fences; // Only without timeline semaphores, the last value of each vkQueueSubmit.
+	};
+
+	struct S_Retired
+	{
+		S_TimelinePoint point;
+		std::function<void()> release;
+	};
+
+	// The semaphores, values and stages a batch points into, kept alive until it's submitted.
+	struct S_Batch
+	{
+		std::vector<VkCommandBuffer> commandBuffers;
+		std::vector<VkSemaphore> waitSemaphores;
+		std::vector<uint64_t> waitValues; // Ignored for binary semaphores.
+		std::vector<VkPipelineStageFlags> waitStages;
+		std::vector<VkSemaphore> signalSemaphores;
+		std::vector<uint64_t> signalValues;
+		uint64_t value = 0;
+	};
+
+	VkDevice m_LogicalDevice;
+	const VkAllocationCallbacks *m_pAllocator;
+	bool m_TimelineSemaphores;
+
+	mutable std::mutex m_Mutex;
+	std::vector<S_Timeline> m_Timelines; // One per distinct VkQueue.
+	int m_TimelineIndices[QUEUE_TYPE_COUNT];
+	std::vector<S_Retired> m_Retired; // In the order they were retired.
+	std::vector<VkFence> m_FreeFences;
+	int m_HostWaiters = 0; // Threads waiting on a fence outside the lock, so no fence is reset under them.
+	S_SubmissionStats m_Stats;
+
+#ifdef VK_KHR_timeline_semaphore
+	PFN_vkWaitSemaphoresKHR m_pfnWaitSemaphores = nullptr;
+	PFN_vkGetSemaphoreCounterValueKHR m_pfnGetSemaphoreCounterValue = nullptr;
+#endif
+
+	S_Timeline& GetTimeline(E_QueueType queue) { return m_Timelines[m_TimelineIndices[queue]]; }
+	void FlushAllLocked();
+	void FlushLocked(S_Timeline &timeline);
+	void SubmitBatches(S_Timeline &timeline, std::vector<S_Batch> &batches);
+	void PollCompleted(S_Timeline &timeline);
+	void WaitLocked(std::unique_lock<std::mutex> &lock, S_Timeline &timeline, uint64_t value);
+	void HostWaitLocked(S_Timeline &timeline, uint64_t value);
+	VkFence AcquireFence();
+};
+
+#endif
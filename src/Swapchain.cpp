@@ -0,0 +1,177 @@
+#include "stdafx.h"
+#include "Swapchain.h"
+
+Swapchain::Swapchain(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkSurfaceKHR surface,
+	int graphicsFamily, int presentFamily, const VkAllocationCallbacks *pAllocator)
+	: m_PhysicalDevice(physicalDevice), m_LogicalDevice(logicalDevice), m_Surface(surface),
+	m_GraphicsFamily(graphicsFamily), m_PresentFamily(presentFamily), m_pAllocator(pAllocator)
+{
+}
+
+Swapchain::~Swapchain()
+{
+	DestroyImageResources();
+	if (m_Swapchain != VK_NULL_HANDLE) vkDestroySwapchainKHR(m_LogicalDevice, m_Swapchain, m_pAllocator);
+}
+
+// Query the surface capabilities, formats and present modes for this device.
+S_SwapchainSupport Swapchain::QuerySupport(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface)
+{
+	S_SwapchainSupport support;
+	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &support.capabilities);
+
+	uint32_t formatCount = 0;
+	vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, nullptr);
+	support.formats.resize(formatCount);
+	vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, support.formats.data());
+
+	uint32_t presentModeCount = 0;
+	vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, nullptr);
+	support.presentModes.resize(presentModeCount);
+	vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, support.presentModes.data());
+
+	return support;
+}
+
+// We prefer 8-bit BGRA with an sRGB color space, otherwise we take whatever comes first.
+VkSurfaceFormatKHR Swapchain::ChooseSurfaceFormat(const std::vector<VkSurfaceFormatKHR> &formats)
+{
+	// The surface has no preference at all.
+	if (formats.size() == 1 && formats[0].format == VK_FORMAT_UNDEFINED)
+		return { VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+
+	for (const VkSurfaceFormatKHR &format : formats)
+	{
+		if (format.format == VK_FORMAT_B8G8R8A8_UNORM && format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+			return format;
+	}
+	return formats[0];
+}
+
+// Use the configured mode if the surface has it. FIFO is the only mode that's guaranteed to exist.
+VkPresentModeKHR Swapchain::ChoosePresentMode(const std::vector<VkPresentModeKHR> &presentModes, VkPresentModeKHR preferred)
+{
+	for (VkPresentModeKHR presentMode : presentModes)
+	{
+		if (presentMode == preferred) return presentMode;
+	}
+	return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+// Most surfaces dictate the extent, otherwise we clamp the framebuffer size to what's allowed.
+VkExtent2D Swapchain::ChooseExtent(const VkSurfaceCapabilitiesKHR &capabilities, int width, int height)
+{
+	if (capabilities.currentExtent.width != UINT32_MAX) return capabilities.currentExtent;
+
+	VkExtent2D extent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
+	extent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, extent.width));
+	extent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, extent.height));
+	return extent;
+}
+
+// Build (or rebuild) the swapchain. Any previous swapchain is retired through oldSwapchain,
+// so the caller has to make sure the device is no longer using its images.
+void Swapchain::Create(int width, int height, VkPresentModeKHR preferredPresentMode)
+{
+	S_SwapchainSupport support = QuerySupport(m_PhysicalDevice, m_Surface);
+	VkSurfaceFormatKHR surfaceFormat = ChooseSurfaceFormat(support.formats);
+	VkPresentModeKHR presentMode = ChoosePresentMode(support.presentModes, preferredPresentMode);
+	VkExtent2D extent = ChooseExtent(support.capabilities, width, height);
+
+	// One more than the minimum, so we don't wait on the driver to release an image.
+	uint32_t imageCount = support.capabilities.minImageCount + 1;
+	if (support.capabilities.maxImageCount > 0 && imageCount > support.capabilities.maxImageCount)
+		imageCount = support.capabilities.maxImageCount;
+
+	VkSwapchainCreateInfoKHR createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+	createInfo.surface = m_Surface;
+	createInfo.minImageCount = imageCount;
+	createInfo.imageFormat = surfaceFormat.format;
+	createInfo.imageColorSpace = surfaceFormat.colorSpace;
+	createInfo.imageExtent = extent;
+	createInfo.imageArrayLayers = 1;
+	createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT; // We clear with a transfer for now.
+	createInfo.preTransform = support.capabilities.currentTransform;
+	createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+	createInfo.presentMode = presentMode;
+	createInfo.clipped = VK_TRUE;
+	createInfo.oldSwapchain = m_Swapchain;
+
+	// If graphics and present are different families, the images are shared between them.
+	uint32_t queueFamilyIndices[] = { (uint32_t)m_GraphicsFamily, (uint32_t)m_PresentFamily };
+	if (m_GraphicsFamily != m_PresentFamily)
+	{
+		createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+		createInfo.queueFamilyIndexCount = 2;
+		createInfo.pQueueFamilyIndices = queueFamilyIndices;
+	}
+	else createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkSwapchainKHR swapchain;
+	VkResult result = vkCreateSwapchainKHR(m_LogicalDevice, &createInfo, m_pAllocator, &swapchain);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create swapchain.");
+
+	// Now that the new one exists, we can let go of the old one.
+	DestroyImageResources();
+	if (m_Swapchain != VK_NULL_HANDLE) vkDestroySwapchainKHR(m_LogicalDevice, m_Swapchain, m_pAllocator);
+
+	m_Swapchain = swapchain;
+	m_Format = surfaceFormat.format;
+	m_Extent = extent;
+	m_PresentMode = presentMode;
+
+	// The driver may create more images than we asked for.
+	vkGetSwapchainImagesKHR(m_LogicalDevice, m_Swapchain, &imageCount, nullptr);
+	m_Images.resize(imageCount);
+	vkGetSwapchainImagesKHR(m_LogicalDevice, m_Swapchain, &imageCount, m_Images.data());
+
+	// Views for when we render into the images, and a semaphore per image to present on.
+	m_ImageViews.resize(imageCount);
+	m_RenderFinished.resize(imageCount);
+	for (uint32_t i = 0; i < imageCount; i++)
+	{
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = m_Images[i];
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = m_Format;
+		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.layerCount = 1;
+		result = vkCreateImageView(m_LogicalDevice, &viewInfo, m_pAllocator, &m_ImageViews[i]);
+		if (result != VK_SUCCESS) throw std::runtime_error("Failed to create swapchain image view.");
+
+		VkSemaphoreCreateInfo semaphoreInfo = {};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		result = vkCreateSemaphore(m_LogicalDevice, &semaphoreInfo, m_pAllocator, &m_RenderFinished[i]);
+		if (result != VK_SUCCESS) throw std::runtime_error("Failed to create swapchain semaphore.");
+	}
+}
+
+VkResult Swapchain::AcquireNextImage(VkSemaphore imageAvailable, uint32_t *pImageIndex)
+{
+	return vkAcquireNextImageKHR(m_LogicalDevice, m_Swapchain, UINT64_MAX, imageAvailable, VK_NULL_HANDLE, pImageIndex);
+}
+
+// Present waits on the render-finished semaphore that belongs to this image.
+VkResult Swapchain::Present(VkQueue presentQueue, uint32_t imageIndex)
+{
+	VkPresentInfoKHR presentInfo = {};
+	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+	presentInfo.waitSemaphoreCount = 1;
+	presentInfo.pWaitSemaphores = &m_RenderFinished[imageIndex];
+	presentInfo.swapchainCount = 1;
+	presentInfo.pSwapchains = &m_Swapchain;
+	presentInfo.pImageIndices = &imageIndex;
+	return vkQueuePresentKHR(presentQueue, &presentInfo);
+}
+
+void Swapchain::DestroyImageResources()
+{
+	for (VkImageView imageView : m_ImageViews) vkDestroyImageView(m_LogicalDevice, imageView, m_pAllocator);
+	for (VkSemaphore semaphore : m_RenderFinished) vkDestroySemaphore(m_LogicalDevice, semaphore, m_pAllocator);
+	m_ImageViews.clear();
+	m_RenderFinished.clear();
+	m_Images.clear(); // Owned by the swapchain.
+}
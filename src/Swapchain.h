@@ -0,0 +1,66 @@
+#pragma once
+
+#ifndef SWAPCHAIN_H
+#define SWAPCHAIN_H
+
+// What the surface supports on a physical device.
+struct S_SwapchainSupport
+{
+	VkSurfaceCapabilitiesKHR capabilities;
+	std::vector<VkSurfaceFormatKHR> formats;
+	std::vector<VkPresentModeKHR> presentModes;
+
+	bool isAdequate() const { return !formats.empty() && !presentModes.empty(); }
+};
+
+// Owns the swapchain, its images and views, and one render-finished semaphore per image.
+// Create can be called again on resize, and the old swapchain is handed over to the new one.
+class Swapchain
+{
+public:
+
+	Swapchain(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkSurfaceKHR surface,
+		int graphicsFamily, int presentFamily, const VkAllocationCallbacks *pAllocator);
+	~Swapchain();
+
+	void Create(int width, int height, VkPresentModeKHR preferredPresentMode);
+
+	// These return the raw result, so the caller can rebuild on VK_ERROR_OUT_OF_DATE_KHR or VK_SUBOPTIMAL_KHR.
+	VkResult AcquireNextImage(VkSemaphore imageAvailable, uint32_t *pImageIndex);
+	VkResult Present(VkQueue presentQueue, uint32_t imageIndex);
+
+	VkSwapchainKHR GetHandle() const { return m_Swapchain; }
+	VkFormat GetFormat() const { return m_Format; }
+	VkExtent2D GetExtent() const { return m_Extent; }
+	VkPresentModeKHR GetPresentMode() const { return m_PresentMode; }
+	uint32_t GetImageCount() const { return (uint32_t)m_Images.size(); }
+	VkImage GetImage(uint32_t index) const { return m_Images[index]; }
+	VkImageView GetImageView(uint32_t index) const { return m_ImageViews[index]; }
+	VkSemaphore GetRenderFinished(uint32_t index) const { return m_RenderFinished[index]; }
+
+	static S_SwapchainSupport QuerySupport(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface);
+	static VkSurfaceFormatKHR ChooseSurfaceFormat(const std::vector<VkSurfaceFormatKHR> &formats);
+	static VkPresentModeKHR ChoosePresentMode(const std::vector<VkPresentModeKHR> &presentModes, VkPresentModeKHR preferred);
+	static VkExtent2D ChooseExtent(const VkSurfaceCapabilitiesKHR &capabilities, int width, int height);
+
+private:
+
+	VkPhysicalDevice m_PhysicalDevice;
+	VkDevice m_LogicalDevice;
+	VkSurfaceKHR m_Surface;
+	int m_GraphicsFamily;
+	int m_PresentFamily;
+	const VkAllocationCallbacks *m_pAllocator;
+
+	VkSwapchainKHR m_Swapchain = VK_NULL_HANDLE;
+	VkFormat m_Format = VK_FORMAT_UNDEFINED;
+	VkExtent2D m_Extent = {};
+	VkPresentModeKHR m_PresentMode = VK_PRESENT_MODE_FIFO_KHR;
+	std::vector<VkImage> m_Images;
+	std::vector<VkImageView> m_ImageViews;
+	std::vector<VkSemaphore> m_RenderFinished;
+
+	void DestroyImageResources();
+};
+
+#endif
@@ -0,0 +1,455 @@
+#include "stdafx.h"
+#include "TextureStreamer.h"
+
+#include <cfloat>
+#include <cmath>
+
+TextureStreamer::TextureStreamer(VkDevice logicalDevice, DeviceMemoryAllocator &memoryAllocator, UploadService &uploadService,
+	BindlessHeap *pBindlessHeap, int decodeThreads, SubmissionScheduler &scheduler, BudgetFunction getBudget, const VkAllocationCallbacks *pAllocator)
+	: m_LogicalDevice(logicalDevice), m_MemoryAllocator(memoryAllocator), m_UploadService(uploadService), m_pBindlessHeap(pBindlessHeap),
+	m_Scheduler(scheduler), m_GetBudget(getBudget), m_pAllocator(pAllocator), m_DecodePool(std::max(1, decodeThreads) + 1)
+{
+	// A level has to fit in the ring with room to spare, or every upload would wait for the ring to drain.
+	m_MaxLevelBytes = m_UploadService.GetRingSize() / 2;
+
+	// One sampler for everything, with no LOD clamp since each view only holds the resident levels.
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+	VkResult result = vkCreateSampler(m_LogicalDevice, &samplerInfo, m_pAllocator, &m_Sampler);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create texture sampler.");
+}
+
+// The device has to be done with every image by now. Bindless slots are left alone, the heap is going away too.
+TextureStreamer::~TextureStreamer()
+{
+	m_DecodePool.Wait(m_DecodeCounter); // The jobs write into us.
+
+	for (const S_RetiredImage &image : m_Retired) DestroyImage(image);
+	for (S_Texture &texture : m_Textures)
+		if (texture.image != VK_NULL_HANDLE) DestroyImage({ texture.image, texture.memory, texture.view });
+	vkDestroySampler(m_LogicalDevice, m_Sampler, m_pAllocator);
+}
+
+uint32_t TextureStreamer::Load(const std::string &path)
+{
+	uint32_t index = (uint32_t)m_Textures.size();
+	m_Textures.emplace_back();
+	m_Textures.back().path = path;
+	m_Stats.textureCount++;
+
+	m_DecodePool.Submit([this, index, path]()
+	{
+		std::unique_ptr<S_DecodedTexture> pData(new S_DecodedTexture());
+		try
+		{
+			if (!DecodeFile(path, *pData)) pData.reset();
+		}
+		catch (const std::bad_alloc&)
+		{
+			pData.reset(); // Too big to decode, so it fails like any other bad file rather than taking the pool down.
+		}
+
+		std::lock_guard<std::mutex> lock(m_DecodedMutex);
+		m_Decoded.push_back({ index, std::move(pData) });
+	}, &m_DecodeCounter);
+	return index;
+}
+
+void TextureStreamer::SetPriority(uint32_t texture, float priority)
+{
+	m_Textures[texture].priority = std::max(0.0f, priority);
+}
+
+// Three passes: give every new texture its mip tail, get back under budget, then stream in by priority.
+// Mip tails are tiny, so they go in whatever the budget says. Everything else waits for room.
+void TextureStreamer::Update(VkDeviceSize uploadBudget)
+{
+	CollectDecoded();
+
+	VkDeviceSize budget = m_GetBudget(m_Stats.residentBytes);
+	m_Stats.budget = budget;
+
+	VkDeviceSize uploaded = 0;
+	for (S_Texture &texture : m_Textures)
+	{
+		if (texture.pData != nullptr && texture.residentLevel == NotResident) uploaded += SetResidentLevel(texture, texture.tailLevel);
+	}
+
+	while (m_Stats.residentBytes > budget)
+	{
+		int victim = PickEviction(FLT_MAX);
+		if (victim < 0) break; // Nothing left but mip tails.
+		uploaded += SetResidentLevel(m_Textures[victim], m_Textures[victim].residentLevel + 1);
+	}
+
+	while (uploaded < uploadBudget)
+	{
+		int candidate = PickStreamIn();
+		if (candidate < 0) break;
+		S_Texture &texture = m_Textures[candidate];
+
+		// Make room from anything less important. If there isn't enough, nothing less important can get in either.
+		// Both estimates leave out the driver's padding, which texture.bytes includes and may be more than the level.
+		VkDeviceSize growth = EstimateBytes(texture, texture.residentLevel - 1) - EstimateBytes(texture, texture.residentLevel);
+		while (m_Stats.residentBytes + growth > budget)
+		{
+			int victim = PickEviction(texture.priority);
+			if (victim < 0) break;
+			uploaded += SetResidentLevel(m_Textures[victim], m_Textures[victim].residentLevel + 1);
+		}
+		if (m_Stats.residentBytes + growth > budget) break;
+
+		uploaded += SetResidentLevel(texture, texture.residentLevel - 1);
+	}
+}
+
+// Only the pool's workers produce results, so this never waits on a decode.
+void TextureStreamer::CollectDecoded()
+{
+	std::vector<S_DecodeResult> decoded;
+	{
+		std::lock_guard<std::mutex> lock(m_DecodedMutex);
+		decoded.swap(m_Decoded);
+	}
+
+	for (S_DecodeResult &result : decoded)
+	{
+		S_Texture &texture = m_Textures[result.texture];
+		if (result.pData == nullptr)
+		{
+			std::cerr << "Failed to decode texture: " << texture.path << std::endl;
+			texture.failed = true;
+			m_Stats.failedCount++;
+			continue;
+		}
+
+		texture.pData = std::move(result.pData);
+		uint32_t levelCount = texture.pData->GetLevelCount();
+		texture.tailLevel = levelCount - 1;
+		while (texture.tailLevel > 0 && std::max(texture.pData->GetLevelWidth(texture.tailLevel - 1),
+			texture.pData->GetLevelHeight(texture.tailLevel - 1)) <= MipTailSize) texture.tailLevel--;
+		texture.finestLevel = 0;
+		while (texture.finestLevel < texture.tailLevel && texture.pData->GetLevelSize(texture.finestLevel) > m_MaxLevelBytes)
+			texture.finestLevel++;
+		m_Stats.decodedCount++;
+	}
+}
+
+// What an image holding level and everything coarser would take, before the driver's padding.
+VkDeviceSize TextureStreamer::EstimateBytes(const S_Texture &texture, uint32_t level) const
+{
+	VkDeviceSize bytes = 0;
+	for (uint32_t i = level; i < texture.pData->GetLevelCount(); i++) bytes += texture.pData->GetLevelSize(i);
+	return bytes;
+}
+
+// The least important texture with a level above its mip tail, and of those, the one with the largest level.
+int TextureStreamer::PickEviction(float belowPriority) const
+{
+	int victim = -1;
+	for (int i = 0; i < (int)m_Textures.size(); i++)
+	{
+		const S_Texture &texture = m_Textures[i];
+		if (texture.residentLevel == NotResident || texture.residentLevel >= texture.tailLevel || texture.priority >= belowPriority) continue;
+		if (victim < 0) victim = i;
+		const S_Texture &best = m_Textures[victim];
+		if (texture.priority < best.priority || (texture.priority == best.priority && texture.residentLevel < best.residentLevel)) victim = i;
+	}
+	return victim;
+}
+
+// The most important texture that wants a finer level, and of those, the one that has the least detail so far.
+int TextureStreamer::PickStreamIn() const
+{
+	int candidate = -1;
+	for (int i = 0; i < (int)m_Textures.size(); i++)
+	{
+		const S_Texture &texture = m_Textures[i];
+		if (texture.residentLevel == NotResident || texture.residentLevel <= texture.finestLevel || texture.priority <= 0.0f) continue;
+		if (candidate < 0) candidate = i;
+		const S_Texture &best = m_Textures[candidate];
+		if (texture.priority > best.priority || (texture.priority == best.priority && texture.residentLevel > best.residentLevel)) candidate = i;
+	}
+	return candidate;
+}
+
+// Replaces the texture's image with one holding level and everything coarser, and returns the bytes queued for upload.
+VkDeviceSize TextureStreamer::SetResidentLevel(S_Texture &texture, uint32_t level)
+{
+	const S_DecodedTexture &data = *texture.pData;
+	uint32_t levelCount = data.GetLevelCount() - level;
+
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = Format;
+	imageInfo.extent = { data.GetLevelWidth(level), data.GetLevelHeight(level), 1 };
+	imageInfo.mipLevels = levelCount;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	VkImage image;
+	VkResult result = vkCreateImage(m_LogicalDevice, &imageInfo, m_pAllocator, &image);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create texture image.");
+
+	S_DeviceAllocationRequest request;
+	vkGetImageMemoryRequirements(m_LogicalDevice, image, &request.requirements);
+	request.preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	S_DeviceAllocation memory = m_MemoryAllocator.Allocate(request);
+	result = vkBindImageMemory(m_LogicalDevice, image, memory.memory, memory.offset);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to bind texture image memory.");
+
+	// Coarsest first, so if the ring fills up part way through, the levels that matter most are already on their way.
+	VkDeviceSize uploaded = 0;
+	for (uint32_t i = data.GetLevelCount(); i-- > level; )
+	{
+		VkExtent3D extent = { data.GetLevelWidth(i), data.GetLevelHeight(i), 1 };
+		m_UploadService.UploadImage(image, i - level, extent, &data.pixels[data.levelOffsets[i]], data.GetLevelSize(i),
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		uploaded += data.GetLevelSize(i);
+	}
+
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = Format;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.levelCount = levelCount;
+	viewInfo.subresourceRange.layerCount = 1;
+	VkImageView view;
+	result = vkCreateImageView(m_LogicalDevice, &viewInfo, m_pAllocator, &view);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create texture image view.");
+
+	if (texture.residentLevel != NotResident)
+	{
+		if (level < texture.residentLevel) m_Stats.streamedLevels += texture.residentLevel - level;
+		else m_Stats.evictedLevels += level - texture.residentLevel;
+	}
+	else m_Stats.streamedLevels += levelCount;
+	Retire(texture);
+
+	texture.image = image;
+	texture.memory = memory;
+	texture.view = view;
+	texture.residentLevel = level;
+	texture.bytes = request.requirements.size;
+	if (m_pBindlessHeap != nullptr)
+		texture.handle = m_pBindlessHeap->AddSampledImage(view, m_Sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+	m_Stats.residentBytes += texture.bytes;
+	m_Stats.peakResidentBytes = std::max(m_Stats.peakResidentBytes, m_Stats.residentBytes);
+	m_Stats.uploadedBytes += uploaded;
+	return uploaded;
+}
+
+// Frames already in flight, and the one being recorded, may still sample the old image, so it waits for EndFrame.
+void TextureStreamer::Retire(S_Texture &texture)
+{
+	if (texture.image == VK_NULL_HANDLE) return;
+	m_Retired.push_back({ texture.image, texture.memory, texture.view });
+	if (texture.handle != BindlessHeap::InvalidHandle) m_pBindlessHeap->RemoveSampledImage(texture.handle);
+	m_Stats.residentBytes -= texture.bytes;
+
+	texture.image = VK_NULL_HANDLE;
+	texture.memory = S_DeviceAllocation();
+	texture.view = VK_NULL_HANDLE;
+	texture.handle = BindlessHeap::InvalidHandle;
+	texture.bytes = 0;
+}
+
+void TextureStreamer::EndFrame(S_TimelinePoint submitted)
+{
+	if (m_Retired.empty()) return;
+	std::vector<S_RetiredImage> images;
+	images.swap(m_Retired);
+	m_Scheduler.Retire(submitted, [this, images]()
+	{
+		for (const S_RetiredImage &image : images) DestroyImage(image);
+	});
+}
+
+void TextureStreamer::DestroyImage(const S_RetiredImage &image)
+{
+	vkDestroyImageView(m_LogicalDevice, image.view, m_pAllocator);
+	vkDestroyImage(m_LogicalDevice, image.image, m_pAllocator);
+	m_MemoryAllocator.Free(image.memory);
+}
+
+void TextureStreamer::PrintStats(std::ostream &out) const
+{
+	const double megabyte = 1024.0 * 1024.0;
+	out << "Textures: " << m_Stats.decodedCount << " of " << m_Stats.textureCount << " decoded";
+	if (m_Stats.failedCount > 0) out << " (" << m_Stats.failedCount << " failed)";
+	out << ", " << m_Stats.residentBytes / megabyte << " MB resident of a " << m_Stats.budget / megabyte << " MB budget"
+		<< " (peak " << m_Stats.peakResidentBytes / megabyte << " MB)" << std::endl;
+	out << "  " << m_Stats.streamedLevels << " levels streamed in, " << m_Stats.evictedLevels << " evicted, "
+		<< m_Stats.uploadedBytes / megabyte << " MB uploaded" << std::endl;
+}
+
+// Runs on the decode pool.
+bool TextureStreamer::DecodeFile(const std::string &path, S_DecodedTexture &texture)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open()) return false;
+	std::vector<uint8_t> contents((size_t)file.tellg());
+	file.seekg(0);
+	file.read((char*)contents.data(), contents.size());
+	if (!file.good() || !DecodeTga(contents, texture)) return false;
+
+	GenerateMips(texture);
+	return true;
+}
+
+bool TextureStreamer::DecodeTga(const std::vector<uint8_t> &file, S_DecodedTexture &texture)
+{
+	const size_t HeaderSize = 18;
+	if (file.size() < HeaderSize) return false;
+
+	uint8_t idLength = file[0];
+	uint8_t colorMapType = file[1];
+	uint8_t imageType = file[2];
+	uint32_t colorMapLength = file[5] | (file[6] << 8);
+	uint32_t colorMapEntryBits = file[7];
+	uint32_t width = file[12] | (file[13] << 8);
+	uint32_t height = file[14] | (file[15] << 8);
+	uint32_t pixelBits = file[16];
+	uint8_t descriptor = file[17];
+
+	// 2 and 3 are uncompressed color and grey, 10 and 11 the same with run length encoding. Color mapped images aren't supported.
+	bool rle = (imageType == 10 || imageType == 11);
+	bool grey = (imageType == 3 || imageType == 11);
+	if (imageType != 2 && imageType != 3 && !rle) return false;
+	if (grey ? pixelBits != 8 : (pixelBits != 24 && pixelBits != 32)) return false;
+	if (width == 0 || height == 0 || (descriptor & 0x10)) return false; // Right to left is never used in practice.
+	if (width > MaxDimension || height > MaxDimension) return false;
+
+	size_t position = HeaderSize + idLength + ((colorMapType != 0) ? colorMapLength * ((colorMapEntryBits + 7) / 8) : 0);
+	size_t pixelBytes = pixelBits / 8;
+	size_t pixelCount = (size_t)width * height;
+	if (position > file.size()) return false;
+	if (!rle && file.size() - position < pixelCount * pixelBytes) return false; // Before allocating for a header we can't trust.
+
+	texture.width = width;
+	texture.height = height;
+	texture.pixels.resize(pixelCount * 4);
+	texture.levelOffsets.assign(1, 0);
+
+	// BGR(A) or grey in the file, RGBA for us.
+	auto writePixel = [&](size_t index, const uint8_t *pSource)
+	{
+		uint8_t *pTarget = &texture.pixels[index * 4];
+		if (grey) pTarget[0] = pTarget[1] = pTarget[2] = pSource[0];
+		else
+		{
+			pTarget[0] = pSource[2];
+			pTarget[1] = pSource[1];
+			pTarget[2] = pSource[0];
+		}
+		pTarget[3] = (pixelBytes == 4) ? pSource[3] : 255;
+	};
+
+	size_t pixel = 0;
+	while (pixel < pixelCount)
+	{
+		// Without RLE, the rest of the image is one long raw packet.
+		size_t count = pixelCount - pixel;
+		bool repeat = false;
+		if (rle)
+		{
+			if (position >= file.size()) return false;
+			uint8_t packet = file[position++];
+			count = std::min<size_t>((packet & 0x7F) + 1, pixelCount - pixel);
+			repeat = (packet & 0x80) != 0;
+		}
+
+		size_t sourceBytes = (repeat) ? pixelBytes : count * pixelBytes;
+		if (file.size() - position < sourceBytes) return false;
+		for (size_t i = 0; i < count; i++) writePixel(pixel + i, &file[position + ((repeat) ? 0 : i * pixelBytes)]);
+		position += sourceBytes;
+		pixel += count;
+	}
+
+	// Rows are stored bottom up unless the descriptor says otherwise.
+	if (!(descriptor & 0x20))
+	{
+		size_t rowBytes = (size_t)width * 4;
+		for (uint32_t y = 0; y < height / 2; y++)
+			std::swap_ranges(texture.pixels.begin() + y * rowBytes, texture.pixels.begin() + (y + 1) * rowBytes,
+				texture.pixels.begin() + (height - 1 - y) * rowBytes);
+	}
+	return true;
+}
+
+void TextureStreamer::GenerateMips(S_DecodedTexture &texture)
+{
+	// sRGB to linear is a table lookup. Linear to sRGB goes through a table fine enough not to lose anything in 8 bits.
+	static float s_ToLinear[256];
+	static uint8_t s_ToSrgb[4096];
+	static bool s_TablesReady = [&]()
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			float c = i / 255.0f;
+			s_ToLinear[i] = (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		for (int i = 0; i < 4096; i++)
+		{
+			float c = i / 4095.0f;
+			float srgb = (c <= 0.0031308f) ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+			s_ToSrgb[i] = (uint8_t)std::min(255.0f, srgb * 255.0f + 0.5f);
+		}
+		return true;
+	}();
+	(void)s_TablesReady;
+
+	texture.levelOffsets.assign(1, 0);
+	size_t totalSize = texture.GetLevelSize(0);
+	uint32_t levelCount = 1;
+	while (texture.GetLevelWidth(levelCount - 1) > 1 || texture.GetLevelHeight(levelCount - 1) > 1)
+	{
+		texture.levelOffsets.push_back(totalSize);
+		totalSize += texture.GetLevelSize(levelCount);
+		levelCount++;
+	}
+	texture.pixels.resize(totalSize);
+
+	// Each level averages up to 2x2 texels of the one before. Odd sizes clamp at the edge.
+	for (uint32_t level = 1; level < levelCount; level++)
+	{
+		uint32_t sourceWidth = texture.GetLevelWidth(level - 1), sourceHeight = texture.GetLevelHeight(level - 1);
+		uint32_t width = texture.GetLevelWidth(level), height = texture.GetLevelHeight(level);
+		const uint8_t *pSource = &texture.pixels[texture.levelOffsets[level - 1]];
+		uint8_t *pTarget = &texture.pixels[texture.levelOffsets[level]];
+
+		for (uint32_t y = 0; y < height; y++)
+		{
+			uint32_t y0 = std::min(y * 2, sourceHeight - 1), y1 = std::min(y * 2 + 1, sourceHeight - 1);
+			for (uint32_t x = 0; x < width; x++)
+			{
+				uint32_t x0 = std::min(x * 2, sourceWidth - 1), x1 = std::min(x * 2 + 1, sourceWidth - 1);
+				const uint8_t *pTexels[4] = { &pSource[(y0 * sourceWidth + x0) * 4], &pSource[(y0 * sourceWidth + x1) * 4],
+					&pSource[(y1 * sourceWidth + x0) * 4], &pSource[(y1 * sourceWidth + x1) * 4] };
+				uint8_t *pTexel = &pTarget[(y * width + x) * 4];
+				for (int channel = 0; channel < 3; channel++)
+				{
+					float sum = 0.0f;
+					for (const uint8_t *pSourceTexel : pTexels) sum += s_ToLinear[pSourceTexel[channel]];
+					pTexel[channel] = s_ToSrgb[(int)(sum * 0.25f * 4095.0f + 0.5f)];
+				}
+				pTexel[3] = (uint8_t)((pTexels[0][3] + pTexels[1][3] + pTexels[2][3] + pTexels[3][3] + 2) / 4); // Alpha is linear.
+			}
+		}
+	}
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#ifndef TEXTURESTREAMER_H
+#define TEXTURESTREAMER_H
+
+#include "JobSystem.h"
+#include "UploadService.h"
+#include "BindlessHeap.h"
+
+// A decoded RGBA8 image and its full mip chain.
+struct S_DecodedTexture
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint8_t> pixels; // Every level back to back, finest first, tightly packed.
+	std::vector<size_t> levelOffsets;
+
+	uint32_t GetLevelCount() const { return (uint32_t)levelOffsets.size(); }
+	uint32_t GetLevelWidth(uint32_t level) const { return std::max(1u, width >> level); }
+	uint32_t GetLevelHeight(uint32_t level) const { return std::max(1u, height >> level); }
+	size_t GetLevelSize(uint32_t level) const { return (size_t)GetLevelWidth(level) * GetLevelHeight(level) * 4; }
+};
+
+struct S_TextureStreamerStats
+{
+	uint32_t textureCount = 0;
+	uint32_t decodedCount = 0;
+	uint32_t failedCount = 0;
+	VkDeviceSize residentBytes = 0;
+	VkDeviceSize peakResidentBytes = 0;
+	VkDeviceSize budget = 0; // The last one we were given.
+	uint32_t streamedLevels = 0;
+	uint32_t evictedLevels = 0;
+	VkDeviceSize uploadedBytes = 0;
+};
+
+// Streams textures in and out of device memory to stay inside a memory budget.
+// Files are decoded on a pool of their own, so a long decode never holds up a thread that's recording.
+// Every texture gets its mip tail as soon as it's decoded, and finer levels follow one at a time, most important
+// texture first. When the budget shrinks, or something more important needs the room, the finest levels of the
+// least important textures go first. Textures with no priority only keep what they have until memory runs short.
+// Without sparse residency an image's memory can't grow or shrink, so every change makes a new image holding exactly
+// the resident levels, re-uploaded coarsest first from the decoded copy we keep. The old image is destroyed once the
+// frame that replaced it has finished, the same as the bindless slots.
+class TextureStreamer
+{
+public:
+
+	static const uint32_t MipTailSize = 64; // Levels this size and smaller always stay resident.
+	static const uint32_t MaxDimension = 16384; // Larger files are rejected before decoding, most devices can't create them anyway.
+	static const VkFormat Format = VK_FORMAT_R8G8B8A8_SRGB;
+	static const uint32_t NotResident = UINT32_MAX;
+
+	// Returns how much device memory textures may use, given how much they use right now.
+	typedef std::function<VkDeviceSize(VkDeviceSize residentBytes)> BudgetFunction;
+
+	// Without a bindless heap, textures are only available through their views.
+	TextureStreamer(VkDevice logicalDevice, DeviceMemoryAllocator &memoryAllocator, UploadService &uploadService, BindlessHeap *pBindlessHeap,
+		int decodeThreads, SubmissionScheduler &scheduler, BudgetFunction getBudget, const VkAllocationCallbacks *pAllocator);
+	~TextureStreamer();
+
+	// Starts decoding in the background. The texture has nothing to sample until its mip tail is resident.
+	uint32_t Load(const std::string &path);
+
+	// Higher is more important, something like the screen area the texture covers. 0 only wants the mip tail.
+	void SetPriority(uint32_t texture, float priority);
+
+	// Picks up finished decodes and moves textures towards what the budget allows, queueing their uploads.
+	// Call before the upload service is flushed. Stops early once uploadBudget bytes have been queued.
+	void Update(VkDeviceSize uploadBudget);
+
+	// Retires the images replaced since the last call against the frame that was just submitted.
+	void EndFrame(S_TimelinePoint submitted);
+
+	// InvalidHandle until the texture has something resident, and the handle changes whenever its residency does.
+	uint32_t GetBindlessHandle(uint32_t texture) const { return m_Textures[texture].handle; }
+	VkImageView GetView(uint32_t texture) const { return m_Textures[texture].view; }
+	VkSampler GetSampler() const { return m_Sampler; }
+	uint32_t GetResidentLevel(uint32_t texture) const { return m_Textures[texture].residentLevel; } // NotResident if nothing is.
+
+	const S_TextureStreamerStats& GetStats() const { return m_Stats; }
+	void PrintStats(std::ostream &out) const;
+
+	// Reads uncompressed or run length encoded TGA, 8 bit grey, 24 or 32 bit color. Returns false if it can't.
+	static bool DecodeTga(const std::vector<uint8_t> &file, S_DecodedTexture &texture);
+
+	// Box filters the finest level down to 1x1. The averaging happens in linear space, since the data is sRGB.
+	static void GenerateMips(S_DecodedTexture &texture);
+
+private:
+
+	struct S_Texture
+	{
+		std::string path;
+		std::unique_ptr<S_DecodedTexture> pData; // Null until decoded.
+		bool failed = false;
+		float priority = 0.0f;
+		uint32_t finestLevel = 0; // The finest level that fits in the staging ring.
+		uint32_t tailLevel = 0;
+		uint32_t residentLevel = NotResident;
+
+		VkImage image = VK_NULL_HANDLE;
+		S_DeviceAllocation memory;
+		VkImageView view = VK_NULL_HANDLE;
+		uint32_t handle = BindlessHeap::InvalidHandle;
+		VkDeviceSize bytes = 0;
+	};
+
+	struct S_RetiredImage
+	{
+		VkImage image;
+		S_DeviceAllocation memory;
+		VkImageView view;
+	};
+
+	struct S_DecodeResult
+	{
+		uint32_t texture;
+		std::unique_ptr<S_DecodedTexture> pData; // Null if decoding failed.
+	};
+
+	VkDevice m_LogicalDevice;
+	DeviceMemoryAllocator &m_MemoryAllocator;
+	UploadService &m_UploadService;
+	BindlessHeap *m_pBindlessHeap;
+	SubmissionScheduler &m_Scheduler;
+	BudgetFunction m_GetBudget;
+	const VkAllocationCallbacks *m_pAllocator;
+	VkSampler m_Sampler = VK_NULL_HANDLE;
+
+	std::vector<S_Texture> m_Textures;
+	std::vector<S_RetiredImage> m_Retired; // Since the last EndFrame.
+	VkDeviceSize m_MaxLevelBytes; // Levels bigger than this can't go through the staging ring.
+	S_TextureStreamerStats m_Stats;
+
+	// Decoding. The pool's thread 0 is ours, and we never wait on it until we're shutting down.
+	JobSystem m_DecodePool;
+	S_JobCounter m_DecodeCounter;
+	std::mutex m_DecodedMutex;
+	std::vector<S_DecodeResult> m_Decoded;
+
+	void CollectDecoded();
+	VkDeviceSize EstimateBytes(const S_Texture &texture, uint32_t level) const;
+	int PickEviction(float belowPriority) const;
+	int PickStreamIn() const;
+	VkDeviceSize SetResidentLevel(S_Texture &texture, uint32_t level);
+	void Retire(S_Texture &texture);
+	void DestroyImage(const S_RetiredImage &image);
+	static bool DecodeFile(const std::string &path, S_DecodedTexture &texture);
+};
+
+#endif
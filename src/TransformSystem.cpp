@@ -0,0 +1,293 @@
+#include "stdafx.h"
+#include "TransformSystem.h"
+
+#ifdef TRANSFORMSYSTEM_SSE
+#include <xmmintrin.h>
+#endif
+
+const uint32_t TransformSystem::BatchSize;
+const uint32_t TransformSystem::MergeGap;
+
+// New slots are identity transforms, so padding batches compute something sensible.
+void S_TransformArrays::Resize(size_t count)
+{
+	for (std::vector<float> *pArray : { &positionX, &positionY, &positionZ, &rotationX, &rotationY, &rotationZ }) pArray->resize(count, 0.0f);
+	for (std::vector<float> *pArray : { &rotationW, &scaleX, &scaleY, &scaleZ }) pArray->resize(count, 1.0f);
+}
+
+TransformSystem::TransformSystem(VkDevice logicalDevice, DeviceMemoryAllocator &memoryAllocator, uint32_t capacity, uint32_t frameCount,
+	VkDeviceSize nonCoherentAtomSize, const VkAllocationCallbacks *pAllocator)
+	: m_LogicalDevice(logicalDevice), m_MemoryAllocator(memoryAllocator), m_pAllocator(pAllocator), m_AtomSize(std::max<VkDeviceSize>(nonCoherentAtomSize, 1))
+{
+	m_Capacity = (std::max(1u, capacity) + BatchSize - 1) / BatchSize * BatchSize;
+	m_Transforms.Resize(m_Capacity);
+
+	// Regions start on an atom, so a flush never has to reach into the region before it.
+	VkDeviceSize alignment = std::max<VkDeviceSize>(m_AtomSize, 256); // 256 covers every device's storage buffer offset alignment.
+	m_RegionSize = (m_Capacity * sizeof(S_InstanceTransform) + alignment - 1) / alignment * alignment;
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = m_RegionSize * frameCount;
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VkResult result = vkCreateBuffer(m_LogicalDevice, &bufferInfo, m_pAllocator, &m_Buffer);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create instance buffer.");
+
+	// Device local and host visible is best, the GPU reads it every frame and we only ever write it.
+	// The allocation covers whole atoms for the same reason the regions do.
+	S_DeviceAllocationRequest request;
+	vkGetBufferMemoryRequirements(m_LogicalDevice, m_Buffer, &request.requirements);
+	request.requirements.alignment = std::max(request.requirements.alignment, m_AtomSize);
+	request.requirements.size = (request.requirements.size + m_AtomSize - 1) / m_AtomSize * m_AtomSize;
+	request.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+	request.preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	m_Memory = m_MemoryAllocator.Allocate(request);
+	result = vkBindBufferMemory(m_LogicalDevice, m_Buffer, m_Memory.memory, m_Memory.offset);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to bind instance buffer memory.");
+	if (m_Memory.pMapped == nullptr) throw std::runtime_error("Failed to map instance buffer memory.");
+
+	VkMemoryPropertyFlags flags = m_MemoryAllocator.GetMemoryProperties().memoryTypes[m_Memory.memoryTypeIndex].propertyFlags;
+	m_Coherent = (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+	m_Regions.resize(frameCount);
+	for (S_Region &region : m_Regions) region.dirty.assign((m_Capacity + 63) / 64, 0);
+}
+
+TransformSystem::~TransformSystem()
+{
+	if (m_Buffer != VK_NULL_HANDLE) vkDestroyBuffer(m_LogicalDevice, m_Buffer, m_pAllocator);
+	m_MemoryAllocator.Free(m_Memory);
+}
+
+uint32_t TransformSystem::Add(const glm::vec3 &position, const glm::vec4 &rotation, const glm::vec3 &scale)
+{
+	if (m_Count == m_Capacity) throw std::runtime_error("Transform system is full.");
+	uint32_t object = m_Count++;
+	SetPosition(object, position);
+	SetRotation(object, rotation);
+	SetScale(object, scale);
+	return object;
+}
+
+void TransformSystem::SetPosition(uint32_t object, const glm::vec3 &position)
+{
+	m_Transforms.positionX[object] = position.x;
+	m_Transforms.positionY[object] = position.y;
+	m_Transforms.positionZ[object] = position.z;
+	MarkDirty(object);
+}
+
+void TransformSystem::SetRotation(uint32_t object, const glm::vec4 &rotation)
+{
+	m_Transforms.rotationX[object] = rotation.x;
+	m_Transforms.rotationY[object] = rotation.y;
+	m_Transforms.rotationZ[object] = rotation.z;
+	m_Transforms.rotationW[object] = rotation.w;
+	MarkDirty(object);
+}
+
+void TransformSystem::SetScale(uint32_t object, const glm::vec3 &scale)
+{
+	m_Transforms.scaleX[object] = scale.x;
+	m_Transforms.scaleY[object] = scale.y;
+	m_Transforms.scaleZ[object] = scale.z;
+	MarkDirty(object);
+}
+
+// Every region has its own copy of the matrices, so each one has to hear about the change.
+void TransformSystem::MarkDirty(uint32_t object)
+{
+	for (S_Region &region : m_Regions) region.dirty[object / 64] |= 1ull << (object % 64);
+}
+
+// Runs of dirty objects, widened to whole batches and merged when they're close. Clears the bits as it goes.
+void TransformSystem::CollectRanges(S_Region &region)
+{
+	m_Ranges.clear();
+	for (uint32_t word = 0; word < (uint32_t)region.dirty.size(); word++)
+	{
+		uint64_t bits = region.dirty[word];
+		if (bits == 0) continue;
+		region.dirty[word] = 0;
+
+		for (uint32_t bit = 0; bit < 64; bit++)
+		{
+			if (!(bits & (1ull << bit))) continue;
+			uint32_t object = word * 64 + bit;
+			uint32_t first = object / BatchSize * BatchSize;
+			uint32_t last = first + BatchSize;
+			if (!m_Ranges.empty() && first <= m_Ranges.back().second + MergeGap) m_Ranges.back().second = std::max(m_Ranges.back().second, last);
+			else m_Ranges.push_back({ first, last });
+		}
+	}
+}
+
+void TransformSystem::Update(uint32_t frameIndex, const glm::mat4 &viewProjection)
+{
+	S_Region &region = m_Regions[frameIndex];
+	if (!region.written || memcmp(&region.viewProjection, &viewProjection, sizeof(glm::mat4)) != 0)
+	{
+		std::fill(region.dirty.begin(), region.dirty.end(), 0);
+		m_Ranges.assign(1, { 0u, (m_Count + BatchSize - 1) / BatchSize * BatchSize });
+	}
+	else CollectRanges(region);
+	region.viewProjection = viewProjection;
+	region.written = true;
+	m_Stats.updates++;
+
+	VkDeviceSize regionOffset = GetRegionOffset(frameIndex);
+	S_InstanceTransform *pOutput = (S_InstanceTransform*)((uint8_t*)m_Memory.pMapped + regionOffset);
+	std::vector<VkMappedMemoryRange> flushRanges;
+	for (const std::pair<uint32_t, uint32_t> &range : m_Ranges)
+	{
+		if (range.first == range.second) continue;
+#ifdef TRANSFORMSYSTEM_SSE
+		ComputeSimd(m_Transforms, range.first, range.second, viewProjection, pOutput);
+#else
+		ComputeScalar(m_Transforms, range.first, range.second, viewProjection, pOutput);
+#endif
+		m_Stats.objectsWritten += range.second - range.first;
+		m_Stats.rangesWritten++;
+		if (m_Coherent) continue;
+
+		// Widened to whole atoms, which the allocation and the regions are aligned to.
+		VkDeviceSize begin = regionOffset + range.first * sizeof(S_InstanceTransform);
+		VkDeviceSize end = regionOffset + range.second * sizeof(S_InstanceTransform);
+		begin = begin / m_AtomSize * m_AtomSize;
+		end = std::min((end + m_AtomSize - 1) / m_AtomSize * m_AtomSize, m_Memory.size);
+
+		VkMappedMemoryRange flushRange = {};
+		flushRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		flushRange.memory = m_Memory.memory;
+		flushRange.offset = m_Memory.offset + begin;
+		flushRange.size = end - begin;
+		flushRanges.push_back(flushRange);
+		m_Stats.bytesFlushed += flushRange.size;
+	}
+
+	if (!flushRanges.empty())
+	{
+		VkResult result = vkFlushMappedMemoryRanges(m_LogicalDevice, (uint32_t)flushRanges.size(), flushRanges.data());
+		if (result != VK_SUCCESS) throw std::runtime_error("Failed to flush instance buffer.");
+	}
+}
+
+void TransformSystem::PrintStats(std::ostream &out) const
+{
+	out << "Transforms: " << m_Count << " objects, " << m_Stats.objectsWritten << " matrices written in " << m_Stats.rangesWritten
+		<< " ranges over " << m_Stats.updates << " updates";
+	if (!m_Coherent) out << ", " << m_Stats.bytesFlushed / 1024 << " KB flushed";
+	out << std::endl;
+}
+
+// World is translation * rotation * scale, so its columns are the rotation's columns scaled, then the position.
+void TransformSystem::ComputeScalar(const S_TransformArrays &transforms, uint32_t first, uint32_t last, const glm::mat4 &viewProjection,
+	S_InstanceTransform *pOutput)
+{
+	for (uint32_t i = first; i < last; i++)
+	{
+		float x = transforms.rotationX[i], y = transforms.rotationY[i], z = transforms.rotationZ[i], w = transforms.rotationW[i];
+		float sx = transforms.scaleX[i], sy = transforms.scaleY[i], sz = transforms.scaleZ[i];
+
+		glm::mat4 &world = pOutput[i].world;
+		world[0] = glm::vec4((1.0f - 2.0f * (y * y + z * z)) * sx, 2.0f * (x * y + w * z) * sx, 2.0f * (x * z - w * y) * sx, 0.0f);
+		world[1] = glm::vec4(2.0f * (x * y - w * z) * sy, (1.0f - 2.0f * (x * x + z * z)) * sy, 2.0f * (y * z + w * x) * sy, 0.0f);
+		world[2] = glm::vec4(2.0f * (x * z + w * y) * sz, 2.0f * (y * z - w * x) * sz, (1.0f - 2.0f * (x * x + y * y)) * sz, 0.0f);
+		world[3] = glm::vec4(transforms.positionX[i], transforms.positionY[i], transforms.positionZ[i], 1.0f);
+		pOutput[i].worldViewProjection = viewProjection * world;
+	}
+}
+
+#ifdef TRANSFORMSYSTEM_SSE
+// The registers hold one element for four objects. Transposed, each holds a column of one object's matrix.
+// The instance buffer is write combined, so full aligned columns go out as streaming stores.
+static inline void StoreColumn(__m128 a, __m128 b, __m128 c, __m128 d, float *pColumn0, size_t stride, bool aligned)
+{
+	_MM_TRANSPOSE4_PS(a, b, c, d);
+	if (aligned)
+	{
+		_mm_stream_ps(pColumn0, a);
+		_mm_stream_ps(pColumn0 + stride, b);
+		_mm_stream_ps(pColumn0 + stride * 2, c);
+		_mm_stream_ps(pColumn0 + stride * 3, d);
+	}
+	else
+	{
+		_mm_storeu_ps(pColumn0, a);
+		_mm_storeu_ps(pColumn0 + stride, b);
+		_mm_storeu_ps(pColumn0 + stride * 2, c);
+		_mm_storeu_ps(pColumn0 + stride * 3, d);
+	}
+}
+#endif
+
+// The same math as ComputeScalar, four objects at a time, with each matrix element in a register of its own.
+void TransformSystem::ComputeSimd(const S_TransformArrays &transforms, uint32_t first, uint32_t last, const glm::mat4 &viewProjection,
+	S_InstanceTransform *pOutput)
+{
+#ifdef TRANSFORMSYSTEM_SSE
+	__m128 vp[4][4];
+	for (int column = 0; column < 4; column++)
+		for (int row = 0; row < 4; row++) vp[column][row] = _mm_set1_ps(viewProjection[column][row]);
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const size_t stride = sizeof(S_InstanceTransform) / sizeof(float);
+	bool aligned = ((uintptr_t)pOutput % 16) == 0; // Every column is, if the first one is.
+
+	for (uint32_t i = first; i < last; i += BatchSize)
+	{
+		__m128 x = _mm_loadu_ps(&transforms.rotationX[i]);
+		__m128 y = _mm_loadu_ps(&transforms.rotationY[i]);
+		__m128 z = _mm_loadu_ps(&transforms.rotationZ[i]);
+		__m128 w = _mm_loadu_ps(&transforms.rotationW[i]);
+		__m128 sx = _mm_loadu_ps(&transforms.scaleX[i]);
+		__m128 sy = _mm_loadu_ps(&transforms.scaleY[i]);
+		__m128 sz = _mm_loadu_ps(&transforms.scaleZ[i]);
+
+		__m128 x2 = _mm_add_ps(x, x), y2 = _mm_add_ps(y, y), z2 = _mm_add_ps(z, z);
+		__m128 xx = _mm_mul_ps(x, x2), yy = _mm_mul_ps(y, y2), zz = _mm_mul_ps(z, z2);
+		__m128 xy = _mm_mul_ps(x, y2), xz = _mm_mul_ps(x, z2), yz = _mm_mul_ps(y, z2);
+		__m128 wx = _mm_mul_ps(w, x2), wy = _mm_mul_ps(w, y2), wz = _mm_mul_ps(w, z2);
+
+		// world[column][row]. The last row is always 0, 0, 0, 1.
+		__m128 world[4][4];
+		world[0][0] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx);
+		world[0][1] = _mm_mul_ps(_mm_add_ps(xy, wz), sx);
+		world[0][2] = _mm_mul_ps(_mm_sub_ps(xz, wy), sx);
+		world[1][0] = _mm_mul_ps(_mm_sub_ps(xy, wz), sy);
+		world[1][1] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy);
+		world[1][2] = _mm_mul_ps(_mm_add_ps(yz, wx), sy);
+		world[2][0] = _mm_mul_ps(_mm_add_ps(xz, wy), sz);
+		world[2][1] = _mm_mul_ps(_mm_sub_ps(yz, wx), sz);
+		world[2][2] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz);
+		world[3][0] = _mm_loadu_ps(&transforms.positionX[i]);
+		world[3][1] = _mm_loadu_ps(&transforms.positionY[i]);
+		world[3][2] = _mm_loadu_ps(&transforms.positionZ[i]);
+		world[0][3] = world[1][3] = world[2][3] = zero;
+		world[3][3] = one;
+
+		// viewProjection * world, skipping the terms the last row makes zero.
+		__m128 mvp[4][4];
+		for (int column = 0; column < 4; column++)
+		{
+			for (int row = 0; row < 4; row++)
+			{
+				__m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vp[0][row], world[column][0]), _mm_mul_ps(vp[1][row], world[column][1])),
+					_mm_mul_ps(vp[2][row], world[column][2]));
+				mvp[column][row] = (column == 3) ? _mm_add_ps(sum, vp[3][row]) : sum;
+			}
+		}
+
+		for (int column = 0; column < 4; column++)
+		{
+			StoreColumn(world[column][0], world[column][1], world[column][2], world[column][3], &pOutput[i].world[column][0], stride, aligned);
+			StoreColumn(mvp[column][0], mvp[column][1], mvp[column][2], mvp[column][3], &pOutput[i].worldViewProjection[column][0], stride, aligned);
+		}
+	}
+	_mm_sfence(); // Streaming stores aren't ordered with anything else until this.
+#else
+	ComputeScalar(transforms, first, last, viewProjection, pOutput);
+#endif
+}
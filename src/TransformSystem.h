@@ -0,0 +1,107 @@
+#pragma once
+
+#ifndef TRANSFORMSYSTEM_H
+#define TRANSFORMSYSTEM_H
+
+#include "DeviceMemoryAllocator.h"
+
+// SSE is part of every x86 and x64 target we build for. Anything else gets the scalar path.
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+#define TRANSFORMSYSTEM_SSE
+#endif
+
+// What the vertex shader reads per instance, both matrices column major.
+struct S_InstanceTransform
+{
+	glm::mat4 world;
+	glm::mat4 worldViewProjection;
+};
+static_assert(sizeof(S_InstanceTransform) == 128, "S_InstanceTransform must be two tightly packed matrices.");
+
+// Positions, rotations and scales as structure of arrays, so four objects load as one SSE register per component.
+// Every array has the same length, a multiple of BatchSize, and the padding is kept as identity transforms.
+struct S_TransformArrays
+{
+	std::vector<float> positionX, positionY, positionZ;
+	std::vector<float> rotationX, rotationY, rotationZ, rotationW; // Unit quaternions.
+	std::vector<float> scaleX, scaleY, scaleZ;
+
+	void Resize(size_t count);
+	size_t GetSize() const { return positionX.size(); }
+};
+
+struct S_TransformSystemStats
+{
+	uint64_t updates = 0;
+	uint64_t objectsWritten = 0;
+	uint64_t rangesWritten = 0;
+	uint64_t bytesFlushed = 0; // Only non-coherent memory needs flushing.
+};
+
+// Owns the transforms of every object, and writes their world and world-view-projection matrices straight into a
+// persistently mapped instance buffer, one region per frame in flight.
+// Each region remembers which objects changed since it was last written, so an update only rewrites those,
+// coalesced into ranges, unless the view projection moved. Then every matrix is stale and the whole region goes.
+class TransformSystem
+{
+public:
+
+	static const uint32_t BatchSize = 4; // Objects per SIMD batch.
+	static const uint32_t MergeGap = 16; // Dirty ranges this close together are written as one.
+
+	TransformSystem(VkDevice logicalDevice, DeviceMemoryAllocator &memoryAllocator, uint32_t capacity, uint32_t frameCount,
+		VkDeviceSize nonCoherentAtomSize, const VkAllocationCallbacks *pAllocator);
+	~TransformSystem();
+
+	// Returns the object's index, which is also its slot in the instance buffer.
+	uint32_t Add(const glm::vec3 &position, const glm::vec4 &rotation, const glm::vec3 &scale);
+	void SetPosition(uint32_t object, const glm::vec3 &position);
+	void SetRotation(uint32_t object, const glm::vec4 &rotation);
+	void SetScale(uint32_t object, const glm::vec3 &scale);
+
+	// Writes this frame's region. Only call once the frame's fence has signaled, the GPU may still be reading it before.
+	void Update(uint32_t frameIndex, const glm::mat4 &viewProjection);
+
+	VkBuffer GetBuffer() const { return m_Buffer; }
+	VkDeviceSize GetRegionOffset(uint32_t frameIndex) const { return m_RegionSize * frameIndex; }
+	VkDeviceSize GetRegionSize() const { return m_RegionSize; }
+	uint32_t GetCount() const { return m_Count; }
+	const S_TransformSystemStats& GetStats() const { return m_Stats; }
+	void PrintStats(std::ostream &out) const;
+
+	// Objects [first, last) of the arrays into pOutput[first, last). Both ends must be multiples of BatchSize for the SIMD version.
+	static void ComputeScalar(const S_TransformArrays &transforms, uint32_t first, uint32_t last, const glm::mat4 &viewProjection,
+		S_InstanceTransform *pOutput);
+	static void ComputeSimd(const S_TransformArrays &transforms, uint32_t first, uint32_t last, const glm::mat4 &viewProjection,
+		S_InstanceTransform *pOutput);
+
+private:
+
+	struct S_Region
+	{
+		std::vector<uint64_t> dirty; // A bit per object.
+		glm::mat4 viewProjection; // What the region was last written with.
+		bool written = false;
+	};
+
+	VkDevice m_LogicalDevice;
+	DeviceMemoryAllocator &m_MemoryAllocator;
+	const VkAllocationCallbacks *m_pAllocator;
+	VkBuffer m_Buffer = VK_NULL_HANDLE;
+	S_DeviceAllocation m_Memory;
+	bool m_Coherent;
+	VkDeviceSize m_AtomSize;
+	VkDeviceSize m_RegionSize;
+
+	uint32_t m_Capacity;
+	uint32_t m_Count = 0;
+	S_TransformArrays m_Transforms;
+	std::vector<S_Region> m_Regions;
+	std::vector<std::pair<uint32_t, uint32_t>> m_Ranges; // Scratch for Update.
+	S_TransformSystemStats m_Stats;
+
+	void MarkDirty(uint32_t object);
+	void CollectRanges(S_Region &region);
+};
+
+#endif
@@ -0,0 +1,298 @@
+#include "stdafx.h"
+#include "UploadService.h"
+
+// Staging offsets are kept 16 byte aligned, which covers the texel size of every format we upload.
+static const VkDeviceSize StagingAlignment = 16;
+
+UploadService::UploadService(VkDevice logicalDevice, DeviceMemoryAllocator &memoryAllocator, SubmissionScheduler &scheduler,
+	int transferFamily, int graphicsFamily, VkDeviceSize ringSize, const VkAllocationCallbacks *pAllocator)
+	: m_LogicalDevice(logicalDevice), m_MemoryAllocator(memoryAllocator), m_Scheduler(scheduler),
+	m_TransferFamily(transferFamily), m_GraphicsFamily(graphicsFamily), m_pAllocator(pAllocator), m_RingSize(ringSize)
+{
+	// The ring lives for the whole run, so it gets its own memory and stays mapped.
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = m_RingSize;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VkResult result = vkCreateBuffer(m_LogicalDevice, &bufferInfo, m_pAllocator, &m_RingBuffer);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create staging ring buffer.");
+
+	S_DeviceAllocationRequest request;
+	vkGetBufferMemoryRequirements(m_LogicalDevice, m_RingBuffer, &request.requirements);
+	request.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT; // No flushes needed.
+	request.dedicated = true;
+	m_RingMemory = m_MemoryAllocator.Allocate(request);
+	if (m_RingMemory.pMapped == nullptr) throw std::runtime_error("Failed to map staging ring memory.");
+	result = vkBindBufferMemory(m_LogicalDevice, m_RingBuffer, m_RingMemory.memory, m_RingMemory.offset);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to bind staging ring memory.");
+
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	poolInfo.queueFamilyIndex = m_TransferFamily;
+	result = vkCreateCommandPool(m_LogicalDevice, &poolInfo, m_pAllocator, &m_CommandPool);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create upload command pool.");
+
+	for (S_Batch &batch : m_Batches)
+	{
+		VkCommandBufferAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocateInfo.commandPool = m_CommandPool;
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocateInfo.commandBufferCount = 1;
+		result = vkAllocateCommandBuffers(m_LogicalDevice, &allocateInfo, &batch.commandBuffer);
+		if (result != VK_SUCCESS) throw std::runtime_error("Failed to allocate upload command buffer.");
+	}
+	m_AcquirePoint.queue = QUEUE_TRANSFER;
+}
+
+UploadService::~UploadService()
+{
+	WaitIdle();
+	vkDestroyCommandPool(m_LogicalDevice, m_CommandPool, m_pAllocator); // Frees the command buffers too.
+	vkDestroyBuffer(m_LogicalDevice, m_RingBuffer, m_pAllocator);
+	m_MemoryAllocator.Free(m_RingMemory);
+}
+
+// Copies to the same buffer are merged into one vkCmdCopyBuffer with several regions.
+void UploadService::UploadBuffer(VkBuffer buffer, VkDeviceSize offset, const void *pData, VkDeviceSize size)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	VkBufferCopy region = {};
+	region.srcOffset = Stage(pData, size, StagingAlignment);
+	region.dstOffset = offset;
+	region.size = size;
+
+	auto it = m_BufferIndices.find(buffer);
+	if (it == m_BufferIndices.end())
+	{
+		it = m_BufferIndices.insert(std::make_pair(buffer, m_BufferUploads.size())).first;
+		m_BufferUploads.push_back({ buffer, {} });
+	}
+	m_BufferUploads[it->second].regions.push_back(region);
+}
+
+void UploadService::UploadImage(VkImage image, uint32_t mipLevel, VkExtent3D extent, const void *pData, VkDeviceSize size, VkImageLayout finalLayout)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	S_ImageUpload upload = {};
+	upload.image = image;
+	upload.finalLayout = finalLayout;
+	upload.region.bufferOffset = Stage(pData, size, StagingAlignment); // Tightly packed, so row length and height stay 0.
+	upload.region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	upload.region.imageSubresource.mipLevel = mipLevel;
+	upload.region.imageSubresource.layerCount = 1;
+	upload.region.imageExtent = extent;
+	m_ImageUploads.push_back(upload);
+}
+
+// Copy the data into the ring, making room first if we have to.
+// Running out of room flushes what's queued and then waits on the oldest batch, so a small ring only costs throughput.
+VkDeviceSize UploadService::Stage(const void *pData, VkDeviceSize size, VkDeviceSize alignment)
+{
+	if (size + alignment > m_RingSize) throw std::runtime_error("Upload is larger than the staging ring.");
+
+	RetireCompleted();
+	VkDeviceSize offset;
+	while (!TryAllocate(size, alignment, &offset))
+	{
+		if (!m_BufferUploads.empty() || !m_ImageUploads.empty()) FlushLocked();
+		else RetireOldest();
+	}
+
+	memcpy((char*)m_RingMemory.pMapped + offset, pData, (size_t)size);
+	return offset;
+}
+
+// The head never catches up with the tail, so head == tail always means the ring is empty.
+bool UploadService::TryAllocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *pOffset)
+{
+	if (IsEmpty()) m_Head = m_Tail = 0; // Start over at the front, so we don't wrap needlessly.
+
+	VkDeviceSize start = (m_Head + alignment - 1) & ~(alignment - 1);
+	if (m_Head >= m_Tail)
+	{
+		// Free space is the end of the ring, then the front up to the tail.
+		if (start + size <= m_RingSize) *pOffset = start;
+		else if (size < m_Tail) *pOffset = 0;
+		else return false;
+	}
+	else
+	{
+		if (start + size >= m_Tail) return false;
+		*pOffset = start;
+	}
+
+	m_Head = *pOffset + size;
+	return true;
+}
+
+void UploadService::Flush()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	FlushLocked();
+}
+
+void UploadService::FlushLocked()
+{
+	if (m_BufferUploads.empty() && m_ImageUploads.empty()) return;
+
+	// Batches are reused in order, so if this one is still in flight it's the oldest.
+	if (!m_InFlight.empty() && m_InFlight.front() == m_NextBatch) RetireOldest();
+	S_Batch &batch = m_Batches[m_NextBatch];
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkResetCommandBuffer(batch.commandBuffer, 0);
+	vkBeginCommandBuffer(batch.commandBuffer, &beginInfo);
+	RecordBatch(batch.commandBuffer);
+	vkEndCommandBuffer(batch.commandBuffer);
+
+	S_Submission submission;
+	submission.commandBuffers.push_back(batch.commandBuffer);
+	batch.submitted = m_Scheduler.Submit(QUEUE_TRANSFER, submission);
+	batch.ringEnd = m_Head;
+	m_AcquirePoint = batch.submitted;
+	m_InFlight.push_back(m_NextBatch);
+	m_NextBatch = (m_NextBatch + 1) % BatchCount;
+
+	m_BufferIndices.clear();
+	m_BufferUploads.clear();
+	m_ImageUploads.clear();
+}
+
+// Transition images for the copy, copy everything, then either release it to graphics or leave it in its final layout.
+void UploadService::RecordBatch(VkCommandBuffer commandBuffer)
+{
+	bool transferOwnership = OwnershipTransfers();
+
+	VkImageMemoryBarrier imageBarrier = {};
+	imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	imageBarrier.subresourceRange.levelCount = 1;
+	imageBarrier.subresourceRange.layerCount = 1;
+
+	// We're overwriting the whole level, so the old contents don't matter.
+	std::vector<VkImageMemoryBarrier> imageBarriers;
+	for (const S_ImageUpload &upload : m_ImageUploads)
+	{
+		imageBarrier.srcAccessMask = 0;
+		imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		imageBarrier.image = upload.image;
+		imageBarrier.subresourceRange.baseMipLevel = upload.region.imageSubresource.mipLevel;
+		imageBarriers.push_back(imageBarrier);
+	}
+	if (!imageBarriers.empty())
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			0, nullptr, 0, nullptr, (uint32_t)imageBarriers.size(), imageBarriers.data());
+
+	for (const S_BufferUpload &upload : m_BufferUploads)
+		vkCmdCopyBuffer(commandBuffer, m_RingBuffer, upload.buffer, (uint32_t)upload.regions.size(), upload.regions.data());
+	for (const S_ImageUpload &upload : m_ImageUploads)
+		vkCmdCopyBufferToImage(commandBuffer, m_RingBuffer, upload.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &upload.region);
+
+	// Release barriers go here, and the matching acquire barriers wait for graphics.
+	// Without a family change, the timeline wait already makes the copies visible, and only the layouts need fixing.
+	std::vector<VkBufferMemoryBarrier> bufferBarriers;
+	imageBarriers.clear();
+	if (transferOwnership)
+	{
+		for (const S_BufferUpload &upload : m_BufferUploads)
+		{
+			VkDeviceSize begin = upload.regions[0].dstOffset, end = begin;
+			for (const VkBufferCopy &region : upload.regions)
+			{
+				begin = std::min(begin, region.dstOffset);
+				end = std::max(end, region.dstOffset + region.size);
+			}
+
+			VkBufferMemoryBarrier bufferBarrier = {};
+			bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			bufferBarrier.srcQueueFamilyIndex = m_TransferFamily;
+			bufferBarrier.dstQueueFamilyIndex = m_GraphicsFamily;
+			bufferBarrier.buffer = upload.buffer;
+			bufferBarrier.offset = begin;
+			bufferBarrier.size = end - begin;
+			bufferBarriers.push_back(bufferBarrier);
+
+			bufferBarrier.srcAccessMask = 0;
+			bufferBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+			m_BufferAcquires.push_back(bufferBarrier);
+		}
+	}
+
+	for (const S_ImageUpload &upload : m_ImageUploads)
+	{
+		imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		imageBarrier.dstAccessMask = 0;
+		imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		imageBarrier.newLayout = upload.finalLayout;
+		imageBarrier.srcQueueFamilyIndex = (transferOwnership) ? m_TransferFamily : VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.dstQueueFamilyIndex = (transferOwnership) ? m_GraphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.image = upload.image;
+		imageBarrier.subresourceRange.baseMipLevel = upload.region.imageSubresource.mipLevel;
+		imageBarriers.push_back(imageBarrier);
+
+		if (!transferOwnership) continue;
+		imageBarrier.srcAccessMask = 0;
+		imageBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		m_ImageAcquires.push_back(imageBarrier);
+	}
+
+	if (!bufferBarriers.empty() || !imageBarriers.empty())
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+			0, nullptr, (uint32_t)bufferBarriers.size(), bufferBarriers.data(), (uint32_t)imageBarriers.size(), imageBarriers.data());
+}
+
+// We don't know which stage first reads the uploads, so graphics waits before anything runs.
+// The transfer timeline only counts up, so waiting on the latest batch covers every batch before it.
+void UploadService::RecordAcquire(VkCommandBuffer commandBuffer, std::vector<S_TimelineWait> &waits)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	if (m_AcquirePoint.value != 0)
+	{
+		S_TimelineWait wait;
+		wait.point = m_AcquirePoint;
+		wait.stages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		waits.push_back(wait);
+		m_AcquirePoint.value = 0;
+	}
+
+	if (m_BufferAcquires.empty() && m_ImageAcquires.empty()) return;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr,
+		(uint32_t)m_BufferAcquires.size(), m_BufferAcquires.data(), (uint32_t)m_ImageAcquires.size(), m_ImageAcquires.data());
+	m_BufferAcquires.clear();
+	m_ImageAcquires.clear();
+}
+
+void UploadService::WaitIdle()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	while (!m_InFlight.empty()) RetireOldest();
+}
+
+// Wait for the oldest batch and hand its staging range back. If it hasn't gone out yet, the scheduler flushes it.
+void UploadService::RetireOldest()
+{
+	S_Batch &batch = m_Batches[m_InFlight.front()];
+	m_Scheduler.Wait(batch.submitted);
+	m_Tail = batch.ringEnd;
+	m_InFlight.pop_front();
+}
+
+// Reclaim staging space from batches the GPU has finished, without blocking.
+void UploadService::RetireCompleted()
+{
+	while (!m_InFlight.empty() && m_Scheduler.IsComplete(m_Batches[m_InFlight.front()].submitted))
+		RetireOldest();
+}
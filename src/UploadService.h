@@ -0,0 +1,107 @@
+#pragma once
+
+#ifndef UPLOADSERVICE_H
+#define UPLOADSERVICE_H
+
+#include <deque>
+#include <mutex>
+
+#include "DeviceMemoryAllocator.h"
+#include "SubmissionScheduler.h"
+
+// Streams data to the device on the transfer queue, so uploads never stall graphics.
+// Data is copied into a persistently mapped staging ring, and copies are batched until Flush.
+// When transfer and graphics are different families, every resource is released by the transfer queue
+// and has to be acquired on graphics with RecordAcquire before it's used.
+class UploadService
+{
+public:
+
+	static const int BatchCount = 4; // Batches that can be in flight before Upload has to wait.
+
+	UploadService(VkDevice logicalDevice, DeviceMemoryAllocator &memoryAllocator, SubmissionScheduler &scheduler,
+		int transferFamily, int graphicsFamily, VkDeviceSize ringSize, const VkAllocationCallbacks *pAllocator);
+	~UploadService();
+
+	// Queue a copy into a buffer. The data is copied out immediately, so pData can go away on return.
+	void UploadBuffer(VkBuffer buffer, VkDeviceSize offset, const void *pData, VkDeviceSize size);
+
+	// Queue a copy into one mip level of a color image. The image ends up in finalLayout.
+	void UploadImage(VkImage image, uint32_t mipLevel, VkExtent3D extent, const void *pData, VkDeviceSize size, VkImageLayout finalLayout);
+
+	// Hand everything queued so far to the scheduler, on the transfer queue. It goes out with the scheduler's next Flush.
+	void Flush();
+
+	// Record the acquire half of any ownership transfers into a graphics command buffer, and add the transfer point
+	// that submission has to wait on. Call after Flush, once per graphics submission.
+	void RecordAcquire(VkCommandBuffer commandBuffer, std::vector<S_TimelineWait> &waits);
+
+	// Block until every submitted batch is done. Useful before tearing resources down.
+	void WaitIdle();
+
+	VkDeviceSize GetRingSize() const { return m_RingSize; }
+	bool OwnershipTransfers() const { return m_TransferFamily != m_GraphicsFamily; }
+
+private:
+
+	struct S_BufferUpload
+	{
+		VkBuffer buffer;
+		std::vector<VkBufferCopy> regions;
+	};
+
+	struct S_ImageUpload
+	{
+		VkImage image;
+		VkBufferImageCopy region;
+		VkImageLayout finalLayout;
+	};
+
+	// A submission on the transfer queue, and the end of the staging range it used.
+	struct S_Batch
+	{
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		S_TimelinePoint submitted;
+		VkDeviceSize ringEnd = 0;
+	};
+
+	VkDevice m_LogicalDevice;
+	DeviceMemoryAllocator &m_MemoryAllocator;
+	SubmissionScheduler &m_Scheduler;
+	int m_TransferFamily;
+	int m_GraphicsFamily;
+	const VkAllocationCallbacks *m_pAllocator;
+	std::mutex m_Mutex;
+
+	// Staging ring. Free space runs from m_Head up to m_Tail, wrapping around the end.
+	VkBuffer m_RingBuffer = VK_NULL_HANDLE;
+	S_DeviceAllocation m_RingMemory;
+	VkDeviceSize m_RingSize;
+	VkDeviceSize m_Head = 0;
+	VkDeviceSize m_Tail = 0;
+
+	VkCommandPool m_CommandPool = VK_NULL_HANDLE;
+	S_Batch m_Batches[BatchCount];
+	std::deque<int> m_InFlight; // Batch indices, oldest first.
+	int m_NextBatch = 0;
+	S_TimelinePoint m_AcquirePoint; // The latest batch graphics hasn't waited on yet, 0 if there is none.
+
+	// Copies waiting for the next Flush.
+	std::map<VkBuffer, size_t> m_BufferIndices;
+	std::vector<S_BufferUpload> m_BufferUploads;
+	std::vector<S_ImageUpload> m_ImageUploads;
+
+	// Acquire barriers for graphics, from batches that have been flushed.
+	std::vector<VkBufferMemoryBarrier> m_BufferAcquires;
+	std::vector<VkImageMemoryBarrier> m_ImageAcquires;
+
+	VkDeviceSize Stage(const void *pData, VkDeviceSize size, VkDeviceSize alignment);
+	bool TryAllocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *pOffset);
+	bool IsEmpty() const { return m_InFlight.empty() && m_BufferUploads.empty() && m_ImageUploads.empty(); }
+	void FlushLocked();
+	void RetireOldest();
+	void RetireCompleted();
+	void RecordBatch(VkCommandBuffer commandBuffer);
+};
+
+#endif
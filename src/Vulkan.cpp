@@ -1,43 +1,226 @@
 #include "stdafx.h"
 #include "Vulkan.h"
+#include "Benchmark.h"
+
+#include <random>
 
 std::string Vulkan::Title = "Vulkan";
 int Vulkan::Width = 800;
 int Vulkan::Height = 600;
 std::vector<const char*> Vulkan::ValidationLayers = { "VK_LAYER_LUNARG_standard_validation" };
+bool Vulkan::Headless = false;
+int Vulkan::HeadlessFrames = 60;
+VkFormat Vulkan::OffscreenFormat = VK_FORMAT_R8G8B8A8_UNORM;
+bool Vulkan::UseHostAllocator = true;
+bool Vulkan::PrintAllocatorStats = false;
+VkDeviceSize Vulkan::StagingRingSize = 32 * 1024 * 1024;
+VkPresentModeKHR Vulkan::PresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+int Vulkan::FramesInFlight = 2;
+bool Vulkan::TimelineSemaphores = true;
+int Vulkan::WorkerThreads = 0;
+uint32_t Vulkan::SceneChunks = 64;
+bool Vulkan::BenchmarkRecording = false;
+std::string Vulkan::ShaderDirectory = "shaders/";
+bool Vulkan::ShaderHotReload = false;
+uint32_t Vulkan::ComputeWorkgroupSize = 256;
+uint32_t Vulkan::ComputeMaxElements = 1 << 20;
+bool Vulkan::VerifyCompute = false;
+std::string Vulkan::PipelineCachePath = "pipeline_cache.bin";
+bool Vulkan::PrewarmPipelines = true;
+std::string Vulkan::StartupReportPath = "";
+bool Vulkan::Bindless = true;
+uint32_t Vulkan::BindlessSampledImages = 16384;
+uint32_t Vulkan::BindlessStorageBuffers = 16384;
+std::string Vulkan::MeshPath = "";
+VkDeviceSize Vulkan::MeshStreamBudget = 8 * 1024 * 1024;
+std::vector<std::string> Vulkan::TexturePaths;
+VkDeviceSize Vulkan::TextureBudget = 0;
+VkDeviceSize Vulkan::TextureUploadBudget = 16 * 1024 * 1024;
+int Vulkan::TextureDecodeThreads = 2;
+uint32_t Vulkan::CullInstances = 0;
+std::string Vulkan::ReadbackPath = "";
+E_ReadbackFormat Vulkan::ReadbackFormat = READBACK_RAW;
+uint32_t Vulkan::ReadbackRingSize = 4;
+uint32_t Vulkan::ReadbackFrameRate = 60;
+bool Vulkan::Profile = false;
+std::string Vulkan::ProfileTracePath = "";
 
 // Initialize everything here.
 // Once it's done, we run the main rendering loop.
 // When the program closes, we properly close and delete anything initialized.
 void Vulkan::Run()
 {
-	InitWindow(Vulkan::Width, Vulkan::Height, Vulkan::Title.c_str());
-	InitVulkan();
+	Init();
 	MainLoop();
 	Cleanup();
 }
 
+// When running headless, we skip the window entirely.
+// Every stage of startup is timed, and the report is written once we're ready for the first frame.
+void Vulkan::Init()
+{
+	m_StartupReport.Start();
+	if (!Vulkan::Headless)
+	{
+		InitWindow(Vulkan::Width, Vulkan::Height, Vulkan::Title.c_str());
+		m_StartupReport.Mark("window");
+	}
+	InitVulkan();
+	WriteStartupReport();
+}
+
 // Create a new glfw window. We need to specify glfw for Vulkan instead of OpenGL.
 // We reference this window with a member variable.
+// The window can be resized, and the callback tells us to rebuild the swapchain.
 void Vulkan::InitWindow(int width, int height, const char *title)
 {
 	glfwInit();
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API); // We have to specify that we're not using OpenGL.
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE); // Will be adjusted later.
+	glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 	m_pWindow = glfwCreateWindow(width, height, title, nullptr, nullptr);
+	glfwSetWindowUserPointer(m_pWindow, this);
+	glfwSetFramebufferSizeCallback(m_pWindow, FramebufferResizeCallback);
+}
+
+void Vulkan::FramebufferResizeCallback(GLFWwindow *pWindow, int width, int height)
+{
+	Vulkan *pApp = reinterpret_cast<Vulkan*>(glfwGetWindowUserPointer(pWindow));
+	pApp->m_FramebufferResized = true;
 }
 
 // Create an instance of Vulkan. 
 // Once that's created, we grab any additional extensions and setup callbacks here.
 void Vulkan::InitVulkan()
 {
+	m_pAllocator = (Vulkan::UseHostAllocator) ? m_HostAllocator.Callbacks() : nullptr; // Every create and destroy call goes through this.
 	m_Instance = CreateInstance(Vulkan::Title.c_str(), "No Engine");
-	m_DebugCallback = SetupDebugCallback(m_Instance); // If we want the debug callback.
-	m_Surface = CreateWindowsSurface(m_Instance, m_pWindow);
-	m_PhysicalDevice = CreatePhysicalDevice(m_Instance, m_Surface);
-	m_LogicalDevice = CreateLogicalDevice(m_PhysicalDevice, m_Surface);
-	m_GraphicsQueue = GetDeviceQueue(m_PhysicalDevice, m_Surface, m_LogicalDevice, 0);
-	m_PresentQueue = GetDeviceQueue(m_PhysicalDevice, m_Surface, m_LogicalDevice, 1);
+	m_pDebugMessenger = SetupDebugMessenger(m_Instance); // If we want validation messages.
+	m_StartupReport.Mark("instance");
+	m_Surface = (Vulkan::Headless) ? VK_NULL_HANDLE : CreateWindowsSurface(m_Instance, m_pWindow);
+	m_StartupReport.Mark("surface");
+
+	// Every device gets queried once here, and the chosen device's answers are reused from then on.
+	m_pDeviceProfile = CreatePhysicalDevice(m_Instance, m_Surface);
+	m_PhysicalDevice = m_pDeviceProfile->GetPhysicalDevice();
+	m_QueueFamilies = CheckQueueFamilies(*m_pDeviceProfile, m_Surface);
+	m_StartupReport.Mark("devicePick");
+
+	m_LogicalDevice = CreateLogicalDevice(m_PhysicalDevice, m_QueueFamilies);
+	m_GraphicsQueue = GetDeviceQueue(m_LogicalDevice, 0);
+	m_PresentQueue = (Vulkan::Headless) ? VK_NULL_HANDLE : GetDeviceQueue(m_LogicalDevice, 1);
+	m_TransferQueue = GetDeviceQueue(m_LogicalDevice, 2);
+	m_ComputeQueue = GetDeviceQueue(m_LogicalDevice, 3);
+	NameObject(VK_OBJECT_TYPE_QUEUE, m_GraphicsQueue, "Graphics Queue");
+	NameObject(VK_OBJECT_TYPE_QUEUE, m_TransferQueue, "Transfer Queue");
+	NameObject(VK_OBJECT_TYPE_QUEUE, m_ComputeQueue, "Compute Queue");
+
+	// From here on, nothing submits to a queue directly, and nothing waits on a fence of its own.
+	m_pScheduler = new SubmissionScheduler(m_LogicalDevice, m_GraphicsQueue, m_ComputeQueue, m_TransferQueue,
+		Vulkan::TimelineSemaphores && m_pDeviceProfile->SupportsTimelineSemaphores(), m_pAllocator);
+	m_StartupReport.Mark("deviceCreate");
+
+	m_pMemoryAllocator = CreateMemoryAllocator(*m_pDeviceProfile, m_LogicalDevice);
+	m_pJobSystem = new JobSystem(Vulkan::WorkerThreads);
+
+	// Stale or corrupt cache files are thrown away here, so everything after this can trust it.
+	m_pPipelineCache = new PipelineCache(m_LogicalDevice, m_pDeviceProfile->GetProperties(), Vulkan::PipelineCachePath, m_pAllocator);
+
+	// Every compute pipeline comes from here, so a reload reaches all of them.
+	m_pShaderCache = new ShaderCache(m_LogicalDevice, Vulkan::ShaderDirectory, m_pPipelineCache->GetHandle(), *m_pScheduler, m_pAllocator);
+	if (Vulkan::ShaderHotReload && !m_pShaderCache->Watch())
+		std::cerr << "Shader hot reload isn't available here, shaders will only load once." << std::endl;
+
+	// Uploads run on the transfer queue and get handed over to graphics.
+	int graphicsFamily = m_QueueFamilies.graphicsFamily;
+	m_pUploadService = new UploadService(m_LogicalDevice, *m_pMemoryAllocator, *m_pScheduler,
+		m_QueueFamilies.transferFamily, graphicsFamily, Vulkan::StagingRingSize, m_pAllocator);
+
+	// Only the file's tables are read here. The geometry follows over the first frames.
+	if (!Vulkan::MeshPath.empty())
+		m_pMeshStreamer = new MeshStreamer(m_LogicalDevice, *m_pMemoryAllocator, *m_pUploadService, Vulkan::MeshPath, m_pAllocator);
+
+	// Slots are recycled once the frame that removed them has finished.
+	if (Vulkan::Bindless && m_pDeviceProfile->SupportsBindless())
+	{
+		m_pBindlessHeap = new BindlessHeap(m_LogicalDevice, *m_pDeviceProfile, Vulkan::BindlessSampledImages, Vulkan::BindlessStorageBuffers,
+			*m_pScheduler, m_pAllocator);
+	}
+
+	// Nothing is resident yet, the decodes start here and the mip tails go up with the first frame that has them.
+	m_pTextureStreamer = new TextureStreamer(m_LogicalDevice, *m_pMemoryAllocator, *m_pUploadService, m_pBindlessHeap, Vulkan::TextureDecodeThreads,
+		*m_pScheduler, [this](VkDeviceSize residentBytes) { return QueryTextureBudget(residentBytes); }, m_pAllocator);
+	for (const std::string &path : Vulkan::TexturePaths)
+		m_pTextureStreamer->SetPriority(m_pTextureStreamer->Load(path), 1.0f);
+	m_StartupReport.Mark("memory");
+
+	// The kernels don't care which queue they run on, but the async one overlaps with rendering.
+	// Their pipelines are the ones we know about up front, so they're what gets pre-warmed.
+	m_pComputeKernels = new ComputeKernels(m_LogicalDevice, *m_pMemoryAllocator, *m_pShaderCache,
+		Vulkan::ComputeWorkgroupSize, Vulkan::ComputeMaxElements, (Vulkan::PrewarmPipelines) ? m_pJobSystem : nullptr, m_pAllocator);
+
+	// There's no depth buffer to build a Hi-Z pyramid from yet, so this only culls against the frustum.
+	if (Vulkan::CullInstances > 0)
+	{
+		m_pGpuCulling = new GpuCulling(m_LogicalDevice, *m_pDeviceProfile, *m_pMemoryAllocator, *m_pUploadService, *m_pShaderCache, *m_pScheduler,
+			Vulkan::ComputeWorkgroupSize, Vulkan::CullInstances, 0, 0, m_pAllocator);
+		std::vector<S_CullInstance> instances = GenerateCullInstances(Vulkan::CullInstances);
+		m_pGpuCulling->SetInstances(instances);
+
+		// The instance's matrices sit at its firstInstance, so the draws can find them.
+		m_pTransformSystem = new TransformSystem(m_LogicalDevice, *m_pMemoryAllocator, Vulkan::CullInstances, (Vulkan::Headless) ? 1 : Vulkan::FramesInFlight,
+			m_pDeviceProfile->GetProperties().limits.nonCoherentAtomSize, m_pAllocator);
+		for (const S_CullInstance &instance : instances)
+			m_pTransformSystem->Add(glm::vec3(instance.boundingSphere), glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), glm::vec3(1.0f));
+	}
+	m_StartupReport.Mark("pipelines");
+
+	// Headless runs only ever have one frame in flight.
+	m_pCommandRecorder = new CommandRecorder(m_LogicalDevice, graphicsFamily, m_pJobSystem->GetThreadCount(),
+		(Vulkan::Headless) ? 1 : Vulkan::FramesInFlight, m_pAllocator);
+	if (Vulkan::Profile)
+	{
+		m_pProfiler = new GpuProfiler(m_LogicalDevice, *m_pDeviceProfile, graphicsFamily,
+			(Vulkan::Headless) ? 1 : Vulkan::FramesInFlight, m_pAllocator);
+	}
+
+	// Without a surface, we render into our own image.
+	if (Vulkan::Headless)
+	{
+		m_OffscreenImage = CreateOffscreenImage(m_LogicalDevice, Vulkan::Width, Vulkan::Height, Vulkan::OffscreenFormat);
+		m_OffscreenImageMemory = AllocateImageMemory(m_LogicalDevice, m_OffscreenImage, true); // Render targets get their own memory.
+		m_CommandPool = CreateCommandPool(m_LogicalDevice, graphicsFamily);
+		m_CommandBuffer = AllocateCommandBuffer(m_LogicalDevice, m_CommandPool);
+		NameObject(VK_OBJECT_TYPE_IMAGE, m_OffscreenImage, "Offscreen Image");
+		NameObject(VK_OBJECT_TYPE_COMMAND_BUFFER, m_CommandBuffer, "Offscreen Command Buffer");
+		if (!Vulkan::ReadbackPath.empty())
+		{
+			m_pFrameReadback = new FrameReadback(m_LogicalDevice, *m_pMemoryAllocator, *m_pScheduler, (uint32_t)Vulkan::Width, (uint32_t)Vulkan::Height,
+				Vulkan::OffscreenFormat, Vulkan::ReadbackFormat, Vulkan::ReadbackPath, Vulkan::ReadbackRingSize, Vulkan::ReadbackFrameRate,
+				m_pDeviceProfile->GetProperties().limits.nonCoherentAtomSize, m_pAllocator);
+		}
+	}
+	else
+	{
+		m_pSwapchain = CreateSwapchain(m_PhysicalDevice, m_LogicalDevice, m_Surface);
+		m_Frames = CreateFrameData(m_LogicalDevice, graphicsFamily, Vulkan::FramesInFlight);
+		m_ImagesInFlight.assign(m_pSwapchain->GetImageCount(), 0);
+	}
+	BuildFrameGraph();
+	m_StartupReport.Mark("renderTargets");
+}
+
+void Vulkan::WriteStartupReport()
+{
+	if (Vulkan::StartupReportPath.empty()) return;
+	if (Vulkan::StartupReportPath == "-")
+	{
+		m_StartupReport.WriteJson(std::cout, m_pDeviceProfile);
+		return;
+	}
+
+	std::ofstream out(Vulkan::StartupReportPath);
+	if (!out.is_open()) throw std::runtime_error("Failed to open startup report: " + Vulkan::StartupReportPath);
+	m_StartupReport.WriteJson(out, m_pDeviceProfile);
 }
 
 // We have to define some Vulkan properties and set up the instance.
@@ -60,19 +243,24 @@ VkInstance Vulkan::CreateInstance(const char *appName, const char *engineName)
 	createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 	createInfo.pApplicationInfo = &appInfo;
 
-	// We gather glfw required extensions.
+	// We gather glfw required extensions. Headless runs don't present, so they don't need any.
 	uint32_t glfwExtensionCount = 0;
-	const char** glfwExtensions;
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+	const char** glfwExtensions = nullptr;
+	if (!Vulkan::Headless) glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
 	// Verify glfw Vulkan support here.
 	bool extensionsSupported = CheckGLFWExtensionSupport(glfwExtensions, glfwExtensionCount);
 	if (!extensionsSupported) throw std::runtime_error("Some required GLFW Extensions are not supported by Vulkan.");
 
 	// If we have validation layers that require extensions, we need to add it here.
-	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	std::vector<const char*> extensions;
+	if (glfwExtensionCount > 0) extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
 	if ((int)Vulkan::ValidationLayers.size() > 0)
-		extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+
+	// Descriptor indexing support can only be queried through properties2, so we enable it whenever it's there.
+	m_HasProperties2 = CheckInstanceExtensionSupport(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+	if (m_HasProperties2) extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
 
 	// Fill in create info.
 	createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());;
@@ -88,7 +276,7 @@ VkInstance Vulkan::CreateInstance(const char *appName, const char *engineName)
 
 	// Create the actual instance now.
 	VkInstance instance;
-	VkResult result = vkCreateInstance(&createInfo, nullptr, &instance); // TODO: Fill in custom allocator callback later.
+	VkResult result = vkCreateInstance(&createInfo, m_pAllocator, &instance);
 	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create instance.");
 	return instance;
 }
@@ -101,27 +289,34 @@ bool Vulkan::CheckGLFWExtensionSupport(const char ** glfwExtensions, int glfwExt
 	std::vector<VkExtensionProperties> vkExtensions(vkExtensionCount);
 	vkEnumerateInstanceExtensionProperties(nullptr, &vkExtensionCount, vkExtensions.data()); // Next we fill a vector with it's properties.
 
-	// Check if GLFW extensions are supported in Vulkan.
+	// Check if GLFW extensions are supported in Vulkan. Only the missing ones are worth printing.
+	std::set<std::string> available;
+	for (const VkExtensionProperties &extension : vkExtensions) available.insert(extension.extensionName);
+
 	bool glfwFullySupported = true;
 	for (int g = 0; g < glfwExtensionCount; g++)
 	{
-		for (int v = 0; v < (int)vkExtensionCount; v++)
-		{
-			if (strcmp(glfwExtensions[g], vkExtensions[v].extensionName) == 0)
-			{
-				std::cout << "Supported by Vulkan: " << glfwExtensions[g] << std::endl;
-				break;
-			}
-			if (v == ((int)vkExtensionCount - 1))
-			{
-				std::cout << "Not Supported by Vulkan: " << glfwExtensions[g] << std::endl;
-				glfwFullySupported = false;
-			}
-		}
+		if (available.count(glfwExtensions[g]) > 0) continue;
+		std::cerr << "Not Supported by Vulkan: " << glfwExtensions[g] << std::endl;
+		glfwFullySupported = false;
 	}
 	return glfwFullySupported;
 }
 
+bool Vulkan::CheckInstanceExtensionSupport(const char *extension)
+{
+	uint32_t extensionCount = 0;
+	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+
+	for (const VkExtensionProperties &properties : extensions)
+	{
+		if (strcmp(properties.extensionName, extension) == 0) return true;
+	}
+	return false;
+}
+
 bool Vulkan::CheckValidationLayerSupport(std::vector<const char*> validationLayers)
 {
 	// Query Vulkan for layer support.
@@ -130,77 +325,39 @@ bool Vulkan::CheckValidationLayerSupport(std::vector<const char*> validationLaye
 	std::vector<VkLayerProperties> availableLayers(availableLayerCount);
 	vkEnumerateInstanceLayerProperties(&availableLayerCount, availableLayers.data());
 
-	// Check if all validation layers exist in available layers.
+	// Check if all validation layers exist in available layers. Only the missing ones are worth printing.
+	std::set<std::string> available;
+	for (const VkLayerProperties &layer : availableLayers) available.insert(layer.layerName);
+
 	bool layersFullySupported = true;
-	for (int v = 0; v < (int)validationLayers.size(); v++)
+	for (const char *layer : validationLayers)
 	{
-		for (int a = 0; a < (int)availableLayerCount; a++)
-		{
-			if (strcmp(validationLayers[v], availableLayers[a].layerName) == 0)
-			{
-				std::cout << "Supported by Vulkan: " << validationLayers[v] << std::endl;
-				break;
-			}
-			if (a == ((int)availableLayerCount - 1))
-			{
-				std::cout << "Not Supported by Vulkan: " << validationLayers[v] << std::endl;
-				layersFullySupported = false;
-			}
-		}
+		if (available.count(layer) > 0) continue;
+		std::cerr << "Not Supported by Vulkan: " << layer << std::endl;
+		layersFullySupported = false;
 	}
 	return layersFullySupported;
 }
 
-VkDebugReportCallbackEXT Vulkan::SetupDebugCallback(VkInstance instance)
-{
-	if (Vulkan::ValidationLayers.size() <= 0) return VkDebugReportCallbackEXT(); // Validation layers weren't requested.
-
- 	VkDebugReportCallbackCreateInfoEXT createInfo = {};
-	createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
-	createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
-	createInfo.pfnCallback = DebugCallback; // Pointer to the callback function.
-	createInfo.pUserData = nullptr; // We can add pointers to our own data here.
-
-	VkDebugReportCallbackEXT debugCallback;
-	VkResult result = Vulkan::CreateDebugReportCallbackEXT(instance, &createInfo, nullptr, &debugCallback); // TODO: Fill in custom allocator callback later.
-	if (result != VK_SUCCESS) throw std::runtime_error("Failed to set up debug callback.");
-	return debugCallback;
-}
-
-// The flag parameter specifies the type of message.
-// The objType parameter specifies the type of object (the subject of the debug message). 
-VKAPI_ATTR VkBool32 VKAPI_CALL Vulkan::DebugCallback(VkDebugReportFlagsEXT flags, VkDebugReportObjectTypeEXT objType, 
-	uint64_t obj, size_t location, int32_t code, const char * layerPrefix, const char * msg, void * userData)
+// Messages are queued from whatever thread reports them and printed on a thread of their own,
+// so validation doesn't serialize the driver on console output.
+DebugMessenger* Vulkan::SetupDebugMessenger(VkInstance instance)
 {
-	// TODO: Add more stuff for debugging here.
-	std::cerr << "DebugCallback: " << flags << objType << obj << location << code << layerPrefix << msg << userData << std::endl;
-	return VK_FALSE;
-}
+	if (Vulkan::ValidationLayers.size() <= 0) return nullptr; // Validation layers weren't requested.
 
-VkResult Vulkan::CreateDebugReportCallbackEXT(VkInstance instance, const VkDebugReportCallbackCreateInfoEXT * pCreateInfo,
-	const VkAllocationCallbacks * pAllocator, VkDebugReportCallbackEXT * pCallback)
-{
-	auto fn = (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugReportCallbackEXT");
-	if (fn != nullptr) return fn(instance, pCreateInfo, pAllocator, pCallback);
-	return VK_ERROR_EXTENSION_NOT_PRESENT;
-}
-
-void Vulkan::DestroyDebugReportCallbackEXT(VkInstance instance, VkDebugReportCallbackEXT callback,
-	const VkAllocationCallbacks * pAllocator)
-{
-	auto fn = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugReportCallbackEXT");
-	if (fn != nullptr) fn(instance, callback, pAllocator);
+	VkDebugUtilsMessageSeverityFlagsEXT severities = VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT;
+	return new DebugMessenger(instance, severities, std::cerr, m_pAllocator);
 }
 
 VkSurfaceKHR Vulkan::CreateWindowsSurface(VkInstance instance, GLFWwindow *pWindow)
 {
 	VkSurfaceKHR surface;
-	VkResult result = glfwCreateWindowSurface(instance, pWindow, nullptr, &surface);
+	VkResult result = glfwCreateWindowSurface(instance, pWindow, m_pAllocator, &surface);
 	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create surface.");
 	return surface;
 }
 
-VkPhysicalDevice Vulkan::CreatePhysicalDevice(VkInstance instance, VkSurfaceKHR surface)
+DeviceCapabilityProfile* Vulkan::CreatePhysicalDevice(VkInstance instance, VkSurfaceKHR surface)
 {
 	uint32_t deviceCount = 0;
 	vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr); // We first query the number of devices.
@@ -211,36 +368,44 @@ VkPhysicalDevice Vulkan::CreatePhysicalDevice(VkInstance instance, VkSurfaceKHR
 	std::vector<VkPhysicalDevice> devices(deviceCount);
 	vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
+	// Without properties2 on the instance, these stay null and no device reports descriptor indexing.
+	PFN_vkGetPhysicalDeviceFeatures2KHR pfnGetFeatures2 = nullptr;
+	PFN_vkGetPhysicalDeviceProperties2KHR pfnGetProperties2 = nullptr;
+	if (m_HasProperties2)
+	{
+		pfnGetFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR");
+		pfnGetProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2KHR");
+	}
+
 	// Use an ordered map to automatically sort candidates by rank.
-	std::multimap<int, VkPhysicalDevice> physicalDeviceCandidates;
+	// Each device is profiled once, and ranking only looks at the profile.
+	std::vector<DeviceCapabilityProfile> profiles;
 	for (int i = 0; i < (int)deviceCount; i++)
+		profiles.push_back(DeviceCapabilityProfile(devices[i], surface, pfnGetFeatures2, pfnGetProperties2));
+
+	std::multimap<int, size_t> physicalDeviceCandidates;
+	for (size_t i = 0; i < profiles.size(); i++)
 	{
-		int rank = RankPhysicalDevice(devices[i], surface);
-		physicalDeviceCandidates.insert(std::make_pair(rank, devices[i]));
+		int rank = RankPhysicalDevice(profiles[i], surface);
+		physicalDeviceCandidates.insert(std::make_pair(rank, i));
 	}
 
 	// Check the best candidate (highest rank), and if it meets requirements.
-	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-	if (physicalDeviceCandidates.rbegin()->first > 0) 
-		physicalDevice = physicalDeviceCandidates.rbegin()->second; // Get the value.
-
-	// Additional check for the physical device.
-	if (physicalDevice == VK_NULL_HANDLE) throw std::runtime_error("Failed to find any GPUs that meet standard requirements.");
-	return physicalDevice;
+	if (physicalDeviceCandidates.rbegin()->first <= 0) 
+		throw std::runtime_error("Failed to find any GPUs that meet standard requirements.");
+	return new DeviceCapabilityProfile(profiles[physicalDeviceCandidates.rbegin()->second]);
 }
 
 // If there are multiple GPUs and we want to use the 'best' one, we rank them here.
 // This can also serve as a check for the physical device.
 // If it doesn't meet any of these requirements of base requirements, returns 0.
-int Vulkan::RankPhysicalDevice(VkPhysicalDevice device, VkSurfaceKHR surface)
+int Vulkan::RankPhysicalDevice(const DeviceCapabilityProfile &profile, VkSurfaceKHR surface)
 {
 	int score = 0; // If it's not suitable, we just return 0.
 
-	// Get properties and features of this device.
-	VkPhysicalDeviceProperties deviceProperties;
-	VkPhysicalDeviceFeatures deviceFeatures;
-	vkGetPhysicalDeviceProperties(device, &deviceProperties);
-	vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+	// Properties and features of this device.
+	const VkPhysicalDeviceProperties &deviceProperties = profile.GetProperties();
+	const VkPhysicalDeviceFeatures &deviceFeatures = profile.GetFeatures();
 
 	// Discrete GPUs have a significant performance advantage
 	if (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
@@ -251,13 +416,29 @@ int Vulkan::RankPhysicalDevice(VkPhysicalDevice device, VkSurfaceKHR surface)
 	// Maximum possible size of textures affects graphics quality
 	score += deviceProperties.limits.maxImageDimension2D;
 
-	// Application can't function without geometry shaders, return 0 if not supported.
-	if (!deviceFeatures.geometryShader) return 0;
+	// Bindless saves us a lot of CPU time, but we can run without it.
+	if (profile.SupportsBindless()) score += 500;
+
+	// More device memory means more textures at full resolution, a point per 32MB up to 16GB.
+	// Integrated GPUs and software rasterizers report system RAM as device local, so only discrete GPUs count it,
+	// and the cap keeps it from ever outweighing being discrete.
+	// Knowing the real budget lets us use it without getting paged out.
+	if (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
+		score += (int)std::min<VkDeviceSize>(profile.GetDeviceLocalBytes() >> 25, 512);
+	if (profile.SupportsMemoryBudget()) score += 100;
+
+	// The scene is drawn from GPU written commands, many per call, each finding its instance through firstInstance.
+	if (!deviceFeatures.multiDrawIndirect || !deviceFeatures.drawIndirectFirstInstance) return 0;
 
 	// We check the queue family to ensure that it can handle the operations we need.
-	bool queueComplete = CheckQueueFamilies(device, surface).isComplete();
+	bool queueComplete = CheckQueueFamilies(profile, surface).isComplete();
 	if (!queueComplete) return 0; // return 0 if not supported.
 
+	// The device needs the extensions we enable, and the surface needs at least one format and present mode.
+	bool extensionsSupported = profile.HasExtensions(GetDeviceExtensions());
+	if (!extensionsSupported) return 0;
+	if (surface != VK_NULL_HANDLE && !profile.GetSwapchainSupport().isAdequate()) return 0;
+
 	// Return weighted score, if it meets the general requirements.
 	return score;
 }
@@ -265,50 +446,88 @@ int Vulkan::RankPhysicalDevice(VkPhysicalDevice device, VkSurfaceKHR surface)
 // Checks the queue families for our device, then returns the index that supports it.
 // If it doesn't meet requirements, return -1.
 // Extend this to search for specific families, so we have handles for each one.
-S_QueueFamilies Vulkan::CheckQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface)
+S_QueueFamilies Vulkan::CheckQueueFamilies(const DeviceCapabilityProfile &profile, VkSurfaceKHR surface)
 {
 	// Fill out this struct with a list of the families we need.
+	// Without a surface, we only care about graphics and compute capability.
 	S_QueueFamilies queueFamilyResults;
+	queueFamilyResults.requiresPresent = (surface != VK_NULL_HANDLE);
 
-	// Query for queue families.
-	uint32_t queueFamilyCount = 0;
-	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
-	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+	// The queue families were queried along with the rest of the profile.
+	const std::vector<VkQueueFamilyProperties> &queueFamilies = profile.GetQueueFamilies();
+	uint32_t queueFamilyCount = (uint32_t)queueFamilies.size();
 
 	// We set up a way to check for each property, and by the end choose the ones we need.
 	for (int i = 0; i < (int)queueFamilyCount; i++)
 	{
 		bool graphics = queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT;
 		bool compute = queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT;
-		bool transfer = queueFamilies[i].queueFlags & VK_QUEUE_TRANSFER_BIT;
 		bool sparse = queueFamilies[i].queueFlags & VK_QUEUE_SPARSE_BINDING_BIT; // Related to sparse memory.
 		bool protect = queueFamilies[i].queueFlags & VK_QUEUE_PROTECTED_BIT; // Related to protected memory.
 
 		// We make sure it supports the graphics operations queue family.
-		if (graphics) queueFamilyResults.graphicsFamily = i;
-		else if (compute | transfer | sparse | protect) {} // Change this if we need it later.
+		// Headless rendering also runs compute work on this family, so it needs both.
+		if (graphics && (queueFamilyResults.requiresPresent || compute)) queueFamilyResults.graphicsFamily = i;
+		else if (compute | sparse | protect) {} // Change this if we need it later.
 		
 		// We check if it has presentation support for the surface.
-		VkBool32 presentation = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentation);
-		if (presentation) queueFamilyResults.presentFamily = i;
+		if (queueFamilyResults.requiresPresent && profile.SupportsPresent(i)) queueFamilyResults.presentFamily = i;
 
 		// If it's done filling out the queuefamily, we break.
 		if (queueFamilyResults.isComplete()) break;
 	}
 
+	// Uploads go on a family without graphics when there is one, so they overlap with rendering.
+	// A transfer-only family is usually a dedicated copy engine, so it beats an async compute family.
+	// Every graphics family can transfer too, so we fall back to sharing it.
+	queueFamilyResults.transferFamily = queueFamilyResults.graphicsFamily;
+	int bestTransferScore = 0;
+	for (int i = 0; i < (int)queueFamilyCount; i++)
+	{
+		VkQueueFlags flags = queueFamilies[i].queueFlags;
+		if (flags & VK_QUEUE_GRAPHICS_BIT) continue;
+
+		int score = 0;
+		if (flags & VK_QUEUE_COMPUTE_BIT) score = 1; // Compute families can always transfer, even if they don't say so.
+		else if (flags & VK_QUEUE_TRANSFER_BIT) score = 2;
+		if (score > bestTransferScore)
+		{
+			bestTransferScore = score;
+			queueFamilyResults.transferFamily = i;
+		}
+	}
+
+	// Async compute goes on the first compute family without graphics, if there is one.
+	queueFamilyResults.computeFamily = queueFamilyResults.graphicsFamily;
+	for (int i = 0; i < (int)queueFamilyCount; i++)
+	{
+		VkQueueFlags flags = queueFamilies[i].queueFlags;
+		if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT))
+		{
+			queueFamilyResults.computeFamily = i;
+			break;
+		}
+	}
+
 	return queueFamilyResults;
 }
 
-VkDevice Vulkan::CreateLogicalDevice(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface)
+// The device extensions we need. Headless runs don't present, so they don't need a swapchain.
+std::vector<const char*> Vulkan::GetDeviceExtensions()
 {
-	// We check the queue family again of the chosen device, to get the index.
-	S_QueueFamilies queueFamilyResults = CheckQueueFamilies(physicalDevice, surface);
+	std::vector<const char*> deviceExtensions;
+	if (!Vulkan::Headless) deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+	return deviceExtensions;
+}
 
+VkDevice Vulkan::CreateLogicalDevice(VkPhysicalDevice physicalDevice, const S_QueueFamilies &queueFamilies)
+{
 	// Setup the queues first.
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-	std::set<int> uniqueQueueFamilies = { queueFamilyResults.graphicsFamily, queueFamilyResults.presentFamily };
+	std::set<int> uniqueQueueFamilies = { queueFamilies.graphicsFamily };
+	if (queueFamilies.presentFamily >= 0) uniqueQueueFamilies.insert(queueFamilies.presentFamily);
+	uniqueQueueFamilies.insert(queueFamilies.transferFamily);
+	uniqueQueueFamilies.insert(queueFamilies.computeFamily);
 
 	// For each queue, we fill in the createinfos.
 	float queuePriority = 1.0f; // Value from 0.0 - 1.0. Required!
@@ -323,17 +542,74 @@ VkDevice Vulkan::CreateLogicalDevice(VkPhysicalDevice physicalDevice, VkSurfaceK
 	}
 
 	// Setup the logical device features.
-	VkPhysicalDeviceFeatures deviceFeatures = {}; // We'll add features here later.
+	// The profiler's statistics query spans the scene's secondaries, so it needs both of these or neither.
+	const VkPhysicalDeviceFeatures &supportedFeatures = m_pDeviceProfile->GetFeatures();
+	VkPhysicalDeviceFeatures deviceFeatures = {};
+	deviceFeatures.multiDrawIndirect = VK_TRUE; // Required when ranking the device.
+	deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+	if (Vulkan::Profile && supportedFeatures.pipelineStatisticsQuery && supportedFeatures.inheritedQueries)
+	{
+		deviceFeatures.pipelineStatisticsQuery = VK_TRUE;
+		deviceFeatures.inheritedQueries = VK_TRUE;
+	}
+
+	// Bindless only needs the update-after-bind and indexing features, not everything the device has.
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
+	indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	bool bindless = Vulkan::Bindless && m_pDeviceProfile->SupportsBindless();
+	if (bindless)
+	{
+		indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+		indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+		indexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+		indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+		indexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+		indexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+	}
+
+	// The scheduler's timelines. Through the extension, so an instance on 1.0 and older headers still work.
+	void *pFeatures = (bindless) ? &indexingFeatures : nullptr;
+#ifdef VK_KHR_timeline_semaphore
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = {};
+	timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+	bool timelines = Vulkan::TimelineSemaphores && m_pDeviceProfile->SupportsTimelineSemaphores();
+	if (timelines)
+	{
+		timelineFeatures.timelineSemaphore = VK_TRUE;
+		timelineFeatures.pNext = pFeatures;
+		pFeatures = &timelineFeatures;
+	}
+#endif
 
 	// Fill in the device create info.
 	VkDeviceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	createInfo.pNext = pFeatures;
 	createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size()); 
 	createInfo.pQueueCreateInfos = queueCreateInfos.data(); // Point to the queue create info.
 	createInfo.pEnabledFeatures = &deviceFeatures; // Link the device features we specify above.
 
-	// We'll add in extensions later.
-	createInfo.enabledExtensionCount = 0;
+	// Device extensions were already verified when ranking the device, and the profile checked the bindless ones.
+	std::vector<const char*> deviceExtensions = GetDeviceExtensions();
+	if (bindless)
+	{
+		deviceExtensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+		deviceExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+	}
+	const char *drawCountExtension = m_pDeviceProfile->GetDrawIndirectCountExtension(); // Culling falls back to a draw per instance without it.
+	if (drawCountExtension != nullptr) deviceExtensions.push_back(drawCountExtension);
+#ifdef VK_EXT_memory_budget
+	if (m_pDeviceProfile->SupportsMemoryBudget())
+	{
+		deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		m_pfnGetMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(m_Instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+	}
+#endif
+#ifdef VK_KHR_timeline_semaphore
+	if (timelines) deviceExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+#endif
+	createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
 	// If we have validation layers,, we already verified them, so we add them in here now.
 	if ((int)Vulkan::ValidationLayers.size() > 0)
@@ -345,17 +621,16 @@ VkDevice Vulkan::CreateLogicalDevice(VkPhysicalDevice physicalDevice, VkSurfaceK
 
 	// Create the actual device now.
 	VkDevice logicalDevice;
-	VkResult result = vkCreateDevice(physicalDevice, &createInfo, nullptr, &logicalDevice); // TODO: Fill in custom allocator callback later.
+	VkResult result = vkCreateDevice(physicalDevice, &createInfo, m_pAllocator, &logicalDevice);
 	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create logical device.");
 
 	return logicalDevice;
 }
 
-VkQueue Vulkan::GetDeviceQueue(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, VkDevice logicalDevice, int familyIndex)
+VkQueue Vulkan::GetDeviceQueue(VkDevice logicalDevice, int familyIndex)
 {
-	// We check the queue family again of the chosen device, to get the index.
-	S_QueueFamilies queueFamily = CheckQueueFamilies(physicalDevice, surface);
-	int family = queueFamily.family(familyIndex);
+	// The families were chosen along with the device.
+	int family = m_QueueFamilies.family(familyIndex);
 	
 	// Get the device queue reference from the logical device.
 	// Since queues are automatically created with the logical device, we can directly grab it.
@@ -364,24 +639,601 @@ VkQueue Vulkan::GetDeviceQueue(VkPhysicalDevice physicalDevice, VkSurfaceKHR sur
 	return deviceQueue;
 }
 
+// All buffers and images get their memory from here, instead of one vkAllocateMemory each.
+// The allocator needs the memory types and the granularity that linear and optimal resources have to keep apart.
+DeviceMemoryAllocator* Vulkan::CreateMemoryAllocator(const DeviceCapabilityProfile &profile, VkDevice logicalDevice)
+{
+	S_DeviceMemoryBackend backend = DeviceMemoryAllocator::CreateVulkanBackend(logicalDevice, m_pAllocator);
+	return new DeviceMemoryAllocator(profile.GetMemoryProperties(), profile.GetProperties().limits.bufferImageGranularity, backend);
+}
+
+// The offscreen image stands in for a swapchain image when we don't have a surface.
+// We clear into it, then copy out of it for readback.
+VkImage Vulkan::CreateOffscreenImage(VkDevice logicalDevice, int width, int height, VkFormat format)
+{
+	VkImageCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	createInfo.imageType = VK_IMAGE_TYPE_2D;
+	createInfo.format = format;
+	createInfo.extent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1 };
+	createInfo.mipLevels = 1;
+	createInfo.arrayLayers = 1;
+	createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	createInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	VkImage image;
+	VkResult result = vkCreateImage(logicalDevice, &createInfo, m_pAllocator, &image);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create offscreen image.");
+	return image;
+}
+
+// Optimal tiling images prefer device local memory.
+S_DeviceAllocation Vulkan::AllocateImageMemory(VkDevice logicalDevice, VkImage image, bool dedicated)
+{
+	S_DeviceAllocationRequest request;
+	vkGetImageMemoryRequirements(logicalDevice, image, &request.requirements);
+	request.preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	request.kind = RESOURCE_OPTIMAL;
+	request.dedicated = dedicated;
+
+	S_DeviceAllocation allocation = m_pMemoryAllocator->Allocate(request);
+	VkResult result = vkBindImageMemory(logicalDevice, image, allocation.memory, allocation.offset);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to bind image memory.");
+	return allocation;
+}
+
+VkCommandPool Vulkan::CreateCommandPool(VkDevice logicalDevice, int familyIndex)
+{
+	VkCommandPoolCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	createInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // We re-record the same buffer every frame.
+	createInfo.queueFamilyIndex = familyIndex;
+
+	VkCommandPool commandPool;
+	VkResult result = vkCreateCommandPool(logicalDevice, &createInfo, m_pAllocator, &commandPool);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create command pool.");
+	return commandPool;
+}
+
+VkCommandBuffer Vulkan::AllocateCommandBuffer(VkDevice logicalDevice, VkCommandPool commandPool)
+{
+	VkCommandBufferAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocateInfo.commandPool = commandPool;
+	allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocateInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	VkResult result = vkAllocateCommandBuffers(logicalDevice, &allocateInfo, &commandBuffer);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to allocate command buffer.");
+	return commandBuffer;
+}
+
+VkSemaphore Vulkan::CreateBinarySemaphore(VkDevice logicalDevice)
+{
+	VkSemaphoreCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+	VkSemaphore semaphore;
+	VkResult result = vkCreateSemaphore(logicalDevice, &createInfo, m_pAllocator, &semaphore);
+	if (result != VK_SUCCESS) throw std::runtime_error("Failed to create semaphore.");
+	return semaphore;
+}
+
+// Queue the next part of the mesh and any texture levels that fit, so they go out with this frame's uploads.
+void Vulkan::StreamAssets()
+{
+	m_pTextureStreamer->Update(Vulkan::TextureUploadBudget);
+
+	if (m_pMeshStreamer == nullptr || m_pMeshStreamer->IsComplete()) return;
+	if (m_pMeshStreamer->Stream(Vulkan::MeshStreamBudget))
+	{
+		std::cout << "Streamed " << m_pMeshStreamer->GetMeshCount() << " meshes (" << m_pMeshStreamer->GetTotalBytes() / 1024
+			<< " KB) by frame " << m_FrameNumber << std::endl;
+	}
+}
+
+// The configured budget, capped by what the driver says we can have on top of what everything else is using.
+// The budget moves with other applications, so we leave a tenth of it spare rather than sit right at the edge.
+VkDeviceSize Vulkan::QueryTextureBudget(VkDeviceSize residentBytes)
+{
+	uint32_t heap = m_pDeviceProfile->GetDeviceLocalHeap();
+	VkDeviceSize budget = (Vulkan::TextureBudget != 0) ? Vulkan::TextureBudget : m_pDeviceProfile->GetDeviceLocalBytes() / 2;
+
+#ifdef VK_EXT_memory_budget
+	if (m_pfnGetMemoryProperties2 != nullptr)
+	{
+		VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+		budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+		VkPhysicalDeviceMemoryProperties2KHR memoryProperties = {};
+		memoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+		memoryProperties.pNext = &budgetProperties;
+		m_pfnGetMemoryProperties2(m_PhysicalDevice, &memoryProperties);
+
+		// Usage includes our own textures, which we're about to decide about anyway.
+		VkDeviceSize heapUsage = budgetProperties.heapUsage[heap];
+		VkDeviceSize otherUsage = (heapUsage > residentBytes) ? heapUsage - residentBytes : 0;
+		VkDeviceSize heapBudget = budgetProperties.heapBudget[heap] / 10 * 9;
+		budget = std::min(budget, (heapBudget > otherUsage) ? heapBudget - otherUsage : 0);
+	}
+#else
+	(void)heap;
+	(void)residentBytes;
+#endif
+	return budget;
+}
+
+// Record and submit one headless frame.
+// Right now we just clear the offscreen image, and leave it ready to be copied out.
+void Vulkan::DrawOffscreenFrame(int frame)
+{
+	// Anything uploaded since last frame has to be acquired before we use it.
+	S_Submission submission;
+	m_FrameNumber = frame; // The passes read it from here.
+	m_pScheduler->Collect();
+	m_pShaderCache->BeginFrame();
+	if (m_pTransformSystem != nullptr) UpdateTransforms(0);
+	StreamAssets();
+	m_pUploadService->Flush();
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkResetCommandBuffer(m_CommandBuffer, 0);
+	vkBeginCommandBuffer(m_CommandBuffer, &beginInfo);
+	if (m_pProfiler != nullptr) m_pProfiler->BeginFrame(m_CommandBuffer, 0);
+	m_pUploadService->RecordAcquire(m_CommandBuffer, submission.waits);
+	m_pFrameGraph->SetImportedImage(m_Backbuffer, m_OffscreenImage);
+	m_pFrameGraph->Execute(m_CommandBuffer);
+	if (m_pProfiler != nullptr) m_pProfiler->EndFrame(m_CommandBuffer);
+	vkEndCommandBuffer(m_CommandBuffer);
+
+	// The uploads and the frame go out together, one vkQueueSubmit per queue.
+	submission.commandBuffers.push_back(m_CommandBuffer);
+	S_TimelinePoint submitted = m_pScheduler->Submit(QUEUE_GRAPHICS, submission);
+	m_pScheduler->Flush();
+	EndFrame(submitted);
+	if (m_pFrameReadback != nullptr) m_pFrameReadback->Submit(submitted);
+
+	// Wait for this frame before we re-record the command buffer.
+	m_pScheduler->Wait(submitted);
+}
+
+// The frame as a render graph: a clear and the scene, into either the swapchain image or the offscreen image.
+// The graph takes care of every transition, including leaving the image ready to present or copy out.
+void Vulkan::BuildFrameGraph()
+{
+	delete m_pFrameGraph;
+	m_pFrameGraph = new RenderGraph();
+
+	S_RenderImageDesc desc;
+	desc.width = (Vulkan::Headless) ? (uint32_t)Vulkan::Width : m_pSwapchain->GetExtent().width;
+	desc.height = (Vulkan::Headless) ? (uint32_t)Vulkan::Height : m_pSwapchain->GetExtent().height;
+	desc.format = (Vulkan::Headless) ? Vulkan::OffscreenFormat : m_pSwapchain->GetFormat();
+
+	// We don't care about last frame's contents. The swapchain image is only ours once the acquire semaphore
+	// has been waited on, and that wait happens at the transfer stage.
+	m_Backbuffer = m_pFrameGraph->ImportImage("Backbuffer", desc, VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		(Vulkan::Headless) ? RENDER_ACCESS_TRANSFER_READ : RENDER_ACCESS_PRESENT);
+
+	uint32_t clear = AddFramePass("Clear", [this](VkCommandBuffer commandBuffer)
+	{
+		RecordClear(commandBuffer, m_pFrameGraph->GetImage(m_Backbuffer), m_FrameNumber);
+	});
+	m_pFrameGraph->Use(clear, m_Backbuffer, RENDER_ACCESS_TRANSFER_WRITE);
+
+	// The cull writes buffers the graph doesn't track, so it has to ask not to be culled itself.
+	if (m_pGpuCulling != nullptr)
+	{
+		uint32_t width = desc.width, height = desc.height;
+		uint32_t cull = AddFramePass("Cull", [this, width, height](VkCommandBuffer commandBuffer)
+		{
+			m_pGpuCulling->RecordCull(commandBuffer, GetViewProjection(m_FrameNumber, width, height));
+		});
+		m_pFrameGraph->SetSideEffects(cull);
+	}
+
+	// The scene doesn't draw into anything yet, so it has to ask not to be culled.
+	uint32_t scene = AddFramePass("Scene", [this](VkCommandBuffer commandBuffer) { RecordScene(commandBuffer, m_CurrentFrame); });
+	m_pFrameGraph->SetSideEffects(scene);
+
+	// The copy lands in a buffer the graph doesn't track, so it has side effects too.
+	if (m_pFrameReadback != nullptr)
+	{
+		uint32_t readback = AddFramePass("Readback", [this](VkCommandBuffer commandBuffer)
+		{
+			m_pFrameReadback->RecordCopy(commandBuffer, m_pFrameGraph->GetImage(m_Backbuffer));
+		});
+		m_pFrameGraph->Use(readback, m_Backbuffer, RENDER_ACCESS_TRANSFER_READ);
+		m_pFrameGraph->SetSideEffects(readback);
+	}
+
+	m_pFrameGraph->Realize(m_LogicalDevice, *m_pMemoryAllocator, m_pAllocator);
+}
+
+// Every frame pass shows up as a debug label and a profiler scope.
+uint32_t Vulkan::AddFramePass(const char *name, std::function<void(VkCommandBuffer commandBuffer)> record)
+{
+	return m_pFrameGraph->AddPass(name, [this, name, record](VkCommandBuffer commandBuffer)
+	{
+		BeginLabel(commandBuffer, name);
+		{
+			GpuProfileScope scope(m_pProfiler, commandBuffer, name);
+			record(commandBuffer);
+		}
+		EndLabel(commandBuffer);
+	});
+}
+
+// The graph has already put the image in the transfer layout.
+void Vulkan::RecordClear(VkCommandBuffer commandBuffer, VkImage image, int frame)
+{
+	VkImageSubresourceRange range = {};
+	range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	range.levelCount = 1;
+	range.layerCount = 1;
+
+	// Cycle the clear color so consecutive frames are distinguishable.
+	float t = (float)(frame % 60) / 60.0f;
+	VkClearColorValue clearColor = { { t, 0.0f, 1.0f - t, 1.0f } };
+	vkCmdClearColorImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clearColor, 1, &range);
+}
+
+// Record every scene chunk into its own secondary, spread over the job system, then execute them in order.
+// The frame's fence has already been waited on, so its per-thread pools are free to reset.
+// The secondaries run inside the profiler's statistics query, if there is one, so they have to say they inherit it.
+void Vulkan::RecordScene(VkCommandBuffer primary, int frameIndex)
+{
+	VkCommandBufferInheritanceInfo inheritance = {};
+	inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritance.pipelineStatistics = (m_pProfiler != nullptr) ? m_pProfiler->GetInheritedStatistics() : 0;
+
+	m_pCommandRecorder->BeginFrame(frameIndex);
+	m_pCommandRecorder->RecordParallel(*m_pJobSystem, primary, Vulkan::SceneChunks, &inheritance,
+		[this](VkCommandBuffer commandBuffer, uint32_t chunk) { RecordSceneChunk(commandBuffer, chunk); });
+}
+
+// Runs on any worker thread, so it must only touch the command buffer it's given and read-only scene data.
+// There's no geometry yet, so chunks are empty for now.
+// Secondaries don't inherit bound sets, so each chunk binds the heap once and its draws only push handles.
+void Vulkan::RecordSceneChunk(VkCommandBuffer commandBuffer, uint32_t chunk)
+{
+	if (m_pBindlessHeap != nullptr) m_pBindlessHeap->Bind(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS);
+}
+
+Swapchain* Vulkan::CreateSwapchain(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkSurfaceKHR surface)
+{
+	Swapchain *pSwapchain = new Swapchain(physicalDevice, logicalDevice, surface,
+		m_QueueFamilies.graphicsFamily, m_QueueFamilies.presentFamily, m_pAllocator);
+
+	int width, height;
+	glfwGetFramebufferSize(m_pWindow, &width, &height);
+	pSwapchain->Create(width, height, Vulkan::PresentMode);
+	return pSwapchain;
+}
+
+// Called when the window changes size, or when the swapchain no longer matches the surface.
+void Vulkan::RecreateSwapchain()
+{
+	// A minimized window has no size, so we wait until it comes back.
+	int width = 0, height = 0;
+	glfwGetFramebufferSize(m_pWindow, &width, &height);
+	while ((width == 0 || height == 0) && !glfwWindowShouldClose(m_pWindow))
+	{
+		glfwWaitEvents();
+		glfwGetFramebufferSize(m_pWindow, &width, &height);
+	}
+
+	// Resizes are rare, so it's fine to drain the device instead of tracking each image.
+	vkDeviceWaitIdle(m_LogicalDevice);
+	m_pSwapchain->Create(width, height, Vulkan::PresentMode);
+	m_ImagesInFlight.assign(m_pSwapchain->GetImageCount(), 0);
+	BuildFrameGraph(); // The extent and format may have changed.
+	m_FramebufferResized = false;
+}
+
+// Each frame in flight gets its own pool, so resetting it never touches a buffer the GPU still reads.
+// Nothing has been submitted yet, so the first wait on each frame returns immediately.
+std::vector<S_FrameData> Vulkan::CreateFrameData(VkDevice logicalDevice, int familyIndex, int frameCount)
+{
+	std::vector<S_FrameData> frames(frameCount);
+	for (int i = 0; i < frameCount; i++)
+	{
+		S_FrameData &frame = frames[i];
+		frame.commandPool = CreateCommandPool(logicalDevice, familyIndex);
+		frame.commandBuffer = AllocateCommandBuffer(logicalDevice, frame.commandPool);
+		frame.imageAvailable = CreateBinarySemaphore(logicalDevice);
+		NameObject(VK_OBJECT_TYPE_COMMAND_BUFFER, frame.commandBuffer, ("Frame " + std::to_string(i) + " Command Buffer").c_str());
+	}
+	return frames;
+}
+
+void Vulkan::DestroyFrameData(VkDevice logicalDevice, std::vector<S_FrameData> &frames)
+{
+	for (S_FrameData &frame : frames)
+	{
+		vkDestroySemaphore(logicalDevice, frame.imageAvailable, m_pAllocator);
+		vkDestroyCommandPool(logicalDevice, frame.commandPool, m_pAllocator); // Frees the command buffer too.
+	}
+	frames.clear();
+}
+
+// Only wait for the frame that last used this slot, so we can record frame N+1 while the GPU runs frame N.
+void Vulkan::DrawFrame()
+{
+	S_FrameData &frame = m_Frames[m_CurrentFrame];
+	m_pScheduler->Wait(frame.submitted);
+	m_pScheduler->Collect();
+
+	uint32_t imageIndex;
+	VkResult result = m_pSwapchain->AcquireNextImage(frame.imageAvailable, &imageIndex);
+	if (result == VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		RecreateSwapchain();
+		return;
+	}
+	if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) throw std::runtime_error("Failed to acquire swapchain image.");
+
+	// With more images than frames in flight, another frame may still be using this image.
+	// Waiting on a value that's already been reached costs nothing, so there's no need to check which frame it was.
+	S_TimelinePoint imageInFlight;
+	imageInFlight.queue = QUEUE_GRAPHICS;
+	imageInFlight.value = m_ImagesInFlight[imageIndex];
+	m_pScheduler->Wait(imageInFlight);
+
+	vkResetCommandPool(m_LogicalDevice, frame.commandPool, 0);
+	m_pShaderCache->BeginFrame();
+	if (m_pTransformSystem != nullptr) UpdateTransforms(m_CurrentFrame);
+
+	// The clear can't start until the image has been released by the presentation engine.
+	// Anything uploaded since last frame has to be acquired before we use it too.
+	S_Submission submission;
+	submission.binaryWaits.push_back(frame.imageAvailable);
+	submission.binaryWaitStages.push_back(VK_PIPELINE_STAGE_TRANSFER_BIT);
+	StreamAssets();
+	m_pUploadService->Flush();
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(frame.commandBuffer, &beginInfo);
+	if (m_pProfiler != nullptr) m_pProfiler->BeginFrame(frame.commandBuffer, m_CurrentFrame);
+	m_pUploadService->RecordAcquire(frame.commandBuffer, submission.waits);
+	m_pFrameGraph->SetImportedImage(m_Backbuffer, m_pSwapchain->GetImage(imageIndex));
+	m_pFrameGraph->Execute(frame.commandBuffer);
+	if (m_pProfiler != nullptr) m_pProfiler->EndFrame(frame.commandBuffer);
+	vkEndCommandBuffer(frame.commandBuffer);
+
+	// Present can't wait on a timeline, so it gets a binary semaphore, and has to come after the flush.
+	submission.commandBuffers.push_back(frame.commandBuffer);
+	submission.binarySignals.push_back(m_pSwapchain->GetRenderFinished(imageIndex));
+	frame.submitted = m_pScheduler->Submit(QUEUE_GRAPHICS, submission);
+	m_ImagesInFlight[imageIndex] = frame.submitted.value;
+	m_pScheduler->Flush();
+	EndFrame(frame.submitted);
+
+	result = m_pSwapchain->Present(m_PresentQueue, imageIndex);
+	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || m_FramebufferResized) RecreateSwapchain();
+	else if (result != VK_SUCCESS) throw std::runtime_error("Failed to present swapchain image.");
+
+	m_CurrentFrame = (m_CurrentFrame + 1) % (int)m_Frames.size();
+	m_FrameNumber++;
+}
+
+// Whatever the frame replaced or read back is released once the GPU is done with it.
+void Vulkan::EndFrame(S_TimelinePoint submitted)
+{
+	m_pTextureStreamer->EndFrame(submitted);
+	m_pShaderCache->EndFrame(submitted);
+	if (m_pGpuCulling != nullptr) m_pGpuCulling->EndFrame(submitted);
+	if (m_pBindlessHeap != nullptr) m_pBindlessHeap->EndFrame(submitted);
+}
+
+// Run every kernel on the compute queue over random data, and compare with what the CPU gets.
+// Sizes go from a single element up to the most the kernels were built for, so each scan depth gets exercised.
+void Vulkan::VerifyComputeKernels()
+{
+	int computeFamily = m_QueueFamilies.computeFamily;
+	VkCommandPool commandPool = CreateCommandPool(m_LogicalDevice, computeFamily);
+	VkCommandBuffer commandBuffer = AllocateCommandBuffer(m_LogicalDevice, commandPool);
+
+	uint32_t maxCount = m_pComputeKernels->GetMaxCount();
+	S_ComputeBuffer data = m_pComputeKernels->CreateStorageBuffer((VkDeviceSize)maxCount * sizeof(uint32_t), true);
+	S_ComputeBuffer sum = m_pComputeKernels->CreateStorageBuffer(sizeof(uint32_t), true);
+	uint32_t *pData = static_cast<uint32_t*>(data.memory.pMapped);
+	uint32_t *pSum = static_cast<uint32_t*>(sum.memory.pMapped);
+
+	// Runs one kernel and waits for it. The buffers are coherent, so a host barrier is all we need.
+	auto run = [&](std::function<void(VkCommandBuffer)> record)
+	{
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		record(commandBuffer);
+
+		VkMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+		VkResult result = vkEndCommandBuffer(commandBuffer);
+		if (result != VK_SUCCESS) throw std::runtime_error("Failed to record compute command buffer.");
+
+		S_Submission submission;
+		submission.commandBuffers.push_back(commandBuffer);
+		m_pScheduler->Wait(m_pScheduler->Submit(QUEUE_COMPUTE, submission));
+		m_pComputeKernels->ResetDescriptors();
+	};
+
+	std::mt19937 random(1234);
+	std::vector<uint32_t> counts = { 1, 1000, 65537, maxCount };
+	for (uint32_t count : counts)
+	{
+		if (count > maxCount) continue;
+		std::vector<uint32_t> input(count);
+		for (uint32_t &value : input) value = random() & 0xffff; // Small enough that the sums don't wrap.
+
+		std::copy(input.begin(), input.end(), pData);
+		run([&](VkCommandBuffer cmd) { m_pComputeKernels->RecordReduce(cmd, data.buffer, count, sum.buffer); });
+		if (*pSum != ComputeKernels::ReferenceReduce(input)) throw std::runtime_error("Compute reduce doesn't match the CPU.");
+
+		std::copy(input.begin(), input.end(), pData);
+		run([&](VkCommandBuffer cmd) { m_pComputeKernels->RecordScan(cmd, data.buffer, count); });
+		if (!std::equal(pData, pData + count, ComputeKernels::ReferenceScan(input).begin()))
+			throw std::runtime_error("Compute scan doesn't match the CPU.");
+
+		for (uint32_t &value : input) value = random(); // Full 32-bit keys, so every radix pass matters.
+		std::copy(input.begin(), input.end(), pData);
+		run([&](VkCommandBuffer cmd) { m_pComputeKernels->RecordRadixSort(cmd, data.buffer, count); });
+		if (!std::equal(pData, pData + count, ComputeKernels::ReferenceSort(input).begin()))
+			throw std::runtime_error("Compute sort doesn't match the CPU.");
+
+		std::cout << "Compute kernels match the CPU for " << count << " elements." << std::endl;
+	}
+
+	m_pComputeKernels->DestroyStorageBuffer(data);
+	m_pComputeKernels->DestroyStorageBuffer(sum);
+	vkDestroyCommandPool(m_LogicalDevice, commandPool, m_pAllocator);
+}
+
+// A cube of instances around the origin, each drawing the same index range, so the camera only ever sees part of it.
+std::vector<S_CullInstance> Vulkan::GenerateCullInstances(uint32_t count)
+{
+	uint32_t side = 1;
+	while (side * side * side < count) side++;
+	float spacing = 4.0f;
+	float offset = (side - 1) * spacing * 0.5f;
+
+	std::vector<S_CullInstance> instances(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t x = i % side, y = (i / side) % side, z = i / (side * side);
+		instances[i].boundingSphere = glm::vec4(x * spacing - offset, y * spacing - offset, z * spacing - offset, 1.0f);
+		instances[i].indexCount = 36; // A cube.
+	}
+	return instances;
+}
+
+// The camera circles the origin, one turn every ten seconds at 60 frames a second.
+// Vulkan's clip space has y pointing down, the opposite of what GLM assumes.
+glm::mat4 Vulkan::GetViewProjection(int frame, uint32_t width, uint32_t height)
+{
+	float angle = glm::radians((float)(frame % 600) * 0.6f);
+	glm::vec3 eye(std::cos(angle) * 50.0f, 10.0f, std::sin(angle) * 50.0f);
+	glm::mat4 view = glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), (float)width / (float)std::max(1u, height), 0.1f, 1000.0f);
+	projection[1][1] *= -1.0f;
+	return projection * view;
+}
+
+// Every eighth instance spins in place. Only the rotation changes, so the bounding spheres the cull uses stay right.
+void Vulkan::UpdateTransforms(uint32_t frameIndex)
+{
+	float angle = glm::radians((float)m_FrameNumber * 2.0f);
+	glm::vec4 rotation(0.0f, std::sin(angle * 0.5f), 0.0f, std::cos(angle * 0.5f));
+	for (uint32_t object = 0; object < m_pTransformSystem->GetCount(); object += 8) m_pTransformSystem->SetRotation(object, rotation);
+
+	uint32_t width = (Vulkan::Headless) ? (uint32_t)Vulkan::Width : m_pSwapchain->GetExtent().width;
+	uint32_t height = (Vulkan::Headless) ? (uint32_t)Vulkan::Height : m_pSwapchain->GetExtent().height;
+	m_pTransformSystem->Update(frameIndex, GetViewProjection(m_FrameNumber, width, height));
+}
+
+// Headless runs render a fixed number of frames, since there's no window to close.
 void Vulkan::MainLoop()
 {
+	if (Vulkan::Headless && Vulkan::BenchmarkRecording)
+	{
+		Benchmark::RecordingScaling(m_LogicalDevice, *m_pScheduler, m_QueueFamilies.graphicsFamily,
+			*m_pMemoryAllocator, m_pAllocator, std::cout);
+		return;
+	}
+
+	if (Vulkan::Headless && Vulkan::VerifyCompute)
+	{
+		VerifyComputeKernels();
+		return;
+	}
+
+	if (Vulkan::Headless)
+	{
+		for (int frame = 0; frame < Vulkan::HeadlessFrames; frame++)
+			DrawOffscreenFrame(frame);
+		return;
+	}
+
 	while (!glfwWindowShouldClose(m_pWindow)) 
 	{
 		glfwPollEvents();
+		DrawFrame();
 	}
+
+	// Let the last frames finish before we start destroying things.
+	// The scheduler only knows about its own queues, and the last presents still need their semaphores.
+	vkDeviceWaitIdle(m_LogicalDevice);
 }
 
 void Vulkan::Cleanup()
 {
-	vkDestroyDevice(m_LogicalDevice, nullptr); // Destroy the device first.
+	m_pScheduler->WaitIdle(); // Releases anything still retired, before the stats below.
+	if (Vulkan::PrintAllocatorStats) m_pMemoryAllocator->PrintStats(std::cout); // Before we start freeing things.
+	if (Vulkan::PrintAllocatorStats) m_pFrameGraph->PrintStats(std::cout);
+	if (!Vulkan::TexturePaths.empty()) m_pTextureStreamer->PrintStats(std::cout);
+	if (m_pGpuCulling != nullptr) m_pGpuCulling->PrintStats(std::cout);
+	if (m_pShaderCache->IsWatching()) m_pShaderCache->PrintStats(std::cout);
+	if (m_pTransformSystem != nullptr) m_pTransformSystem->PrintStats(std::cout);
+	if (m_pFrameReadback != nullptr) m_pFrameReadback->PrintStats((Vulkan::ReadbackPath == "-") ? std::cerr : std::cout); // Stdout is the frames.
+
+	// The device is idle by now, so every frame's queries have landed.
+	if (m_pProfiler != nullptr)
+	{
+		m_pProfiler->Finish();
+		m_pProfiler->PrintStats(std::cout);
+		m_pScheduler->PrintStats(std::cout);
+		if (!Vulkan::ProfileTracePath.empty() && !m_pProfiler->WriteChromeTrace(Vulkan::ProfileTracePath))
+			std::cerr << "Failed to write profile trace: " << Vulkan::ProfileTracePath << std::endl;
+	}
+
+	// Destroy anything created on the device.
+	delete m_pProfiler;
+	delete m_pFrameGraph; // Its transient images go back to the allocator.
+	delete m_pCommandRecorder;
+	delete m_pJobSystem;
+	delete m_pUploadService; // Waits for any uploads still in flight.
+	delete m_pMeshStreamer;
+	delete m_pTextureStreamer; // Before the bindless heap its slots are in.
+	delete m_pComputeKernels;
+	delete m_pGpuCulling;
+	delete m_pTransformSystem;
+	delete m_pFrameReadback; // Waits for the encoder to write out every frame it was handed.
+	delete m_pScheduler; // After everything that submits or waits through it.
+	delete m_pBindlessHeap;
+	delete m_pShaderCache; // After everything holding its pipelines.
+	m_pPipelineCache->Save(); // Once everything that compiles pipelines is gone.
+	delete m_pPipelineCache;
+	DestroyFrameData(m_LogicalDevice, m_Frames);
+	delete m_pSwapchain; // Destroyed BEFORE the surface.
+	if (m_CommandPool != VK_NULL_HANDLE) vkDestroyCommandPool(m_LogicalDevice, m_CommandPool, m_pAllocator);
+	if (m_OffscreenImage != VK_NULL_HANDLE) vkDestroyImage(m_LogicalDevice, m_OffscreenImage, m_pAllocator);
+	m_pMemoryAllocator->Free(m_OffscreenImageMemory);
+
+	delete m_pMemoryAllocator; // Anything still allocated is released along with the allocator's blocks.
+	delete m_pDeviceProfile;
+
+	vkDestroyDevice(m_LogicalDevice, m_pAllocator); // Destroy the device first.
+
+	delete m_pDebugMessenger; // Prints anything still queued.
 
-	if ((int)Vulkan::ValidationLayers.size() > 0) 
-		Vulkan::DestroyDebugReportCallbackEXT(m_Instance, m_DebugCallback, nullptr);
+	if (m_Surface != VK_NULL_HANDLE) vkDestroySurfaceKHR(m_Instance, m_Surface, m_pAllocator); // Destroyed BEFORE instance.
+	vkDestroyInstance(m_Instance, m_pAllocator);
 
-	vkDestroySurfaceKHR(m_Instance, m_Surface, nullptr); // Destroyed BEFORE instance.
-	vkDestroyInstance(m_Instance, nullptr); // TODO: Fill in custom allocator callback later.
+	if (Vulkan::PrintAllocatorStats && m_pAllocator != nullptr) m_HostAllocator.PrintStats(std::cout);
 
+	if (Vulkan::Headless) return; // We never initialized glfw.
 	glfwDestroyWindow(m_pWindow);
 	glfwTerminate();
 }
@@ -3,20 +3,55 @@
 #ifndef VULKAN_H
 #define VULKAN_H
 
+#include "HostAllocator.h"
+#include "DeviceMemoryAllocator.h"
+#include "Swapchain.h"
+#include "CommandRecorder.h"
+#include "SubmissionScheduler.h"
+#include "UploadService.h"
+#include "ComputeKernels.h"
+#include "PipelineCache.h"
+#include "ShaderCache.h"
+#include "DeviceCapabilityProfile.h"
+#include "StartupReport.h"
+#include "DebugMessenger.h"
+#include "GpuProfiler.h"
+#include "RenderGraph.h"
+#include "BindlessHeap.h"
+#include "MeshStreamer.h"
+#include "TextureStreamer.h"
+#include "GpuCulling.h"
+#include "TransformSystem.h"
+#include "FrameReadback.h"
+
 struct S_QueueFamilies
 {
 	int graphicsFamily = -1;
 	int presentFamily = -1;
+	int transferFamily = -1; // Same as graphics when the device has nothing better.
+	int computeFamily = -1; // Same as graphics when the device has no async compute.
+	bool requiresPresent = true; // Headless devices don't need a present family.
 
-	bool isComplete() { return graphicsFamily >= 0 && presentFamily >= 0; }
+	bool isComplete() { return graphicsFamily >= 0 && (presentFamily >= 0 || !requiresPresent); }
 	int family(int index)
 	{
 		if (index == 0) return graphicsFamily;
 		else if (index == 1) return presentFamily;
+		else if (index == 2) return transferFamily;
+		else if (index == 3) return computeFamily;
 		else return -1;
 	}
 };
 
+// Everything one frame in flight needs, so the CPU can record it while the GPU still works on the others.
+struct S_FrameData
+{
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	VkSemaphore imageAvailable = VK_NULL_HANDLE;
+	S_TimelinePoint submitted; // On graphics. Once it's reached, the frame's command buffer is free again.
+};
+
 class Vulkan
 {
 public:
@@ -27,54 +62,215 @@ public:
 	static int Height;
 	static std::vector<const char*> ValidationLayers; 
 
+	// Presentation properties. The present mode falls back to FIFO if the surface doesn't support it.
+	static VkPresentModeKHR PresentMode;
+	static int FramesInFlight;
+
+	// Submission properties. Every queue is submitted to through the scheduler, with timeline semaphores if the device has them.
+	static bool TimelineSemaphores; // Off forces the fence fallback, for comparing the two.
+
+	// Headless properties. No window or surface is created, and we render into an offscreen image instead.
+	static bool Headless;
+	static int HeadlessFrames;
+	static VkFormat OffscreenFormat;
+
+	// Host memory properties. The custom allocator can be switched off to compare against the driver's own.
+	static bool UseHostAllocator;
+	static bool PrintAllocatorStats;
+	static VkDeviceSize StagingRingSize;
+
+	// Recording properties. The scene is split into chunks that are recorded in parallel, one secondary each.
+	static int WorkerThreads; // 0 uses one thread per core.
+	static uint32_t SceneChunks;
+	static bool BenchmarkRecording; // Headless only, measures recording throughput instead of rendering.
+
+	// Compute properties. The workgroup size is baked into the kernels through a specialization constant.
+	static std::string ShaderDirectory;
+	static bool ShaderHotReload; // Rebuild pipelines when their SPIR-V in the shader directory changes.
+	static uint32_t ComputeWorkgroupSize;
+	static uint32_t ComputeMaxElements;
+	static bool VerifyCompute; // Headless only, checks the kernels against the CPU instead of rendering.
+
+	// Pipeline cache properties. An empty path keeps the cache in memory only.
+	static std::string PipelineCachePath;
+	static bool PrewarmPipelines; // Compile the known pipelines on the worker threads before the first frame.
+
+	// Where the startup timing report goes as JSON. Empty writes nothing, "-" writes to stdout.
+	static std::string StartupReportPath;
+
+	// Bindless properties. Only used if the device supports descriptor indexing, and clamped to its limits.
+	static bool Bindless;
+	static uint32_t BindlessSampledImages;
+	static uint32_t BindlessStorageBuffers;
+
+	// Mesh properties. The .vmesh file is streamed in the background, a budget's worth of bytes per frame.
+	static std::string MeshPath; // Empty loads nothing.
+	static VkDeviceSize MeshStreamBudget;
+
+	// Texture properties. Textures are decoded in the background and kept inside the budget, mip tails first.
+	static std::vector<std::string> TexturePaths; // TGA files.
+	static VkDeviceSize TextureBudget; // 0 uses half the device local heap. Always capped by VK_EXT_memory_budget if we have it.
+	static VkDeviceSize TextureUploadBudget; // Per frame.
+	static int TextureDecodeThreads;
+
+	// Culling properties. Instances are culled on the GPU every frame, and only the survivors are drawn.
+	static uint32_t CullInstances; // A generated field of this many instances, 0 for none.
+
+	// Readback properties. Headless frames are copied back and written out on a thread of their own, so rendering never waits on I/O.
+	static std::string ReadbackPath; // Empty reads nothing back, "-" writes to stdout.
+	static E_ReadbackFormat ReadbackFormat;
+	static uint32_t ReadbackRingSize; // Frames that can wait to be written before new ones are dropped.
+	static uint32_t ReadbackFrameRate; // Only written into Y4M headers.
+
+	// Profiling properties. Frame times are printed on exit, and the Chrome trace goes to the path if there is one.
+	static bool Profile;
+	static std::string ProfileTracePath;
+
 	void Run();
 
+	// Run in pieces, for anything driving the engine itself, like the benchmark suite.
+	// Between Init and Cleanup the device is ready, and headless frames can be drawn one at a time.
+	void Init();
+	void DrawOffscreenFrame(int frame); // Headless only. Returns once the GPU has finished the frame.
+	void Cleanup();
+
+	VkDevice GetDevice() const { return m_LogicalDevice; }
+	int GetGraphicsFamily() const { return m_QueueFamilies.graphicsFamily; }
+	const VkAllocationCallbacks* GetAllocationCallbacks() const { return m_pAllocator; }
+	const DeviceCapabilityProfile& GetDeviceProfile() const { return *m_pDeviceProfile; }
+	DeviceMemoryAllocator& GetMemoryAllocator() { return *m_pMemoryAllocator; }
+	UploadService& GetUploadService() { return *m_pUploadService; }
+	SubmissionScheduler& GetScheduler() { return *m_pScheduler; }
+	const StartupReport& GetStartupReport() const { return m_StartupReport; }
+
 private:
 
 	GLFWwindow * m_pWindow = nullptr;
+	HostAllocator m_HostAllocator;
+	const VkAllocationCallbacks *m_pAllocator = nullptr;
 	VkInstance m_Instance;
-	VkDebugReportCallbackEXT m_DebugCallback;
+	bool m_HasProperties2 = false; // VK_KHR_get_physical_device_properties2 is enabled on the instance.
+	DebugMessenger *m_pDebugMessenger = nullptr; // Only with validation layers.
 	VkSurfaceKHR m_Surface;
+	StartupReport m_StartupReport;
 
 	VkPhysicalDevice m_PhysicalDevice = VK_NULL_HANDLE;
+	DeviceCapabilityProfile *m_pDeviceProfile = nullptr; // Everything we know about the physical device.
+	S_QueueFamilies m_QueueFamilies; // Chosen once, along with the device.
 	VkDevice m_LogicalDevice;
 	VkQueue m_GraphicsQueue;
 	VkQueue m_PresentQueue;
+	VkQueue m_TransferQueue;
+	VkQueue m_ComputeQueue;
+	SubmissionScheduler *m_pScheduler = nullptr; // Everything but present goes through here.
+	DeviceMemoryAllocator *m_pMemoryAllocator = nullptr;
+	UploadService *m_pUploadService = nullptr;
+	ComputeKernels *m_pComputeKernels = nullptr;
+	PipelineCache *m_pPipelineCache = nullptr;
+	ShaderCache *m_pShaderCache = nullptr;
+	GpuProfiler *m_pProfiler = nullptr; // Only when profiling.
+	BindlessHeap *m_pBindlessHeap = nullptr; // Only if the device supports it.
+	MeshStreamer *m_pMeshStreamer = nullptr; // Only with a mesh to load.
+	TextureStreamer *m_pTextureStreamer = nullptr;
+	GpuCulling *m_pGpuCulling = nullptr; // Only with instances to cull.
+	TransformSystem *m_pTransformSystem = nullptr; // The culled instances' matrices.
+	FrameReadback *m_pFrameReadback = nullptr; // Only headless, with somewhere to write the frames.
+	PFN_vkGetPhysicalDeviceMemoryProperties2KHR m_pfnGetMemoryProperties2 = nullptr; // Only with VK_EXT_memory_budget.
+
+	// Swapchain and frame pacing.
+	Swapchain *m_pSwapchain = nullptr;
+	std::vector<S_FrameData> m_Frames;
+	std::vector<uint64_t> m_ImagesInFlight; // The graphics timeline value that last used each swapchain image.
+	int m_CurrentFrame = 0; // Which of the frames in flight we're recording.
+	int m_FrameNumber = 0;
+	bool m_FramebufferResized = false;
+
+	// The frame's passes, rebuilt whenever the render target changes.
+	RenderGraph *m_pFrameGraph = nullptr;
+	uint32_t m_Backbuffer = 0; // The swapchain or offscreen image, imported into the graph.
+
+	// Multithreaded recording.
+	JobSystem *m_pJobSystem = nullptr;
+	CommandRecorder *m_pCommandRecorder = nullptr;
 
+	// Offscreen render target, used when running headless.
+	VkImage m_OffscreenImage = VK_NULL_HANDLE;
+	S_DeviceAllocation m_OffscreenImageMemory;
+	VkCommandPool m_CommandPool = VK_NULL_HANDLE;
+	VkCommandBuffer m_CommandBuffer = VK_NULL_HANDLE;
 
 	void InitWindow(int width, int height, const char *title);
 	void InitVulkan();
+	void WriteStartupReport();
 
 	// Functions for setting up the instance and verifying extensions and layers.
 	VkInstance CreateInstance(const char *appName, const char *engineName);
 	bool CheckGLFWExtensionSupport(const char ** glfwExtensions, int glfwExtensionCount);
+	bool CheckInstanceExtensionSupport(const char *extension);
 	bool CheckValidationLayerSupport(std::vector<const char*> validationLayers);
 
-	// Functions for setting up the debug callback.
-	VkDebugReportCallbackEXT SetupDebugCallback(VkInstance instance);
-	static VKAPI_ATTR VkBool32 VKAPI_CALL DebugCallback(VkDebugReportFlagsEXT flags, VkDebugReportObjectTypeEXT objType,
-		uint64_t obj, size_t location, int32_t code, const char* layerPrefix, const char* msg, void* userData);
-	static VkResult CreateDebugReportCallbackEXT(VkInstance instance, const VkDebugReportCallbackCreateInfoEXT* pCreateInfo, 
-		const VkAllocationCallbacks* pAllocator, VkDebugReportCallbackEXT* pCallback);
-	static void DestroyDebugReportCallbackEXT(VkInstance instance, VkDebugReportCallbackEXT callback, 
-		const VkAllocationCallbacks* pAllocator);
+	// Functions for setting up debug messages. Names and labels show up in validation messages,
+	// and cost nothing when validation is off.
+	DebugMessenger* SetupDebugMessenger(VkInstance instance);
+	template<typename T> void NameObject(VkObjectType type, T handle, const char *name)
+	{
+		if (m_pDebugMessenger != nullptr) m_pDebugMessenger->SetObjectName(m_LogicalDevice, type, (uint64_t)handle, name);
+	}
+	void BeginLabel(VkCommandBuffer commandBuffer, const char *name) { if (m_pDebugMessenger != nullptr) m_pDebugMessenger->BeginLabel(commandBuffer, name); }
+	void EndLabel(VkCommandBuffer commandBuffer) { if (m_pDebugMessenger != nullptr) m_pDebugMessenger->EndLabel(commandBuffer); }
 
 	// Functions for creating the surface.
 	VkSurfaceKHR CreateWindowsSurface(VkInstance instance, GLFWwindow *pWindow);
 
 	// Functions for initializing physical devices.
-	VkPhysicalDevice CreatePhysicalDevice(VkInstance instance, VkSurfaceKHR surface);
-	int RankPhysicalDevice(VkPhysicalDevice device, VkSurfaceKHR surface);
-	S_QueueFamilies CheckQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface); // Choose and sort queue families for the device.
+	DeviceCapabilityProfile* CreatePhysicalDevice(VkInstance instance, VkSurfaceKHR surface); // Profiles every device, returns the best.
+	int RankPhysicalDevice(const DeviceCapabilityProfile &profile, VkSurfaceKHR surface);
+	S_QueueFamilies CheckQueueFamilies(const DeviceCapabilityProfile &profile, VkSurfaceKHR surface); // Choose and sort queue families for the device.
+	std::vector<const char*> GetDeviceExtensions();
 
 	// Functions for creating logical devices.
-	VkDevice CreateLogicalDevice(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface);
-	VkQueue GetDeviceQueue(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, VkDevice logicalDevice, int familyIndex);
+	VkDevice CreateLogicalDevice(VkPhysicalDevice physicalDevice, const S_QueueFamilies &queueFamilies);
+	VkQueue GetDeviceQueue(VkDevice logicalDevice, int familyIndex);
+
+	// Functions for managing device memory.
+	DeviceMemoryAllocator* CreateMemoryAllocator(const DeviceCapabilityProfile &profile, VkDevice logicalDevice);
+	S_DeviceAllocation AllocateImageMemory(VkDevice logicalDevice, VkImage image, bool dedicated);
+
+	// Functions for the offscreen render target.
+	VkImage CreateOffscreenImage(VkDevice logicalDevice, int width, int height, VkFormat format);
+	VkCommandPool CreateCommandPool(VkDevice logicalDevice, int familyIndex);
+	VkCommandBuffer AllocateCommandBuffer(VkDevice logicalDevice, VkCommandPool commandPool);
+	VkSemaphore CreateBinarySemaphore(VkDevice logicalDevice);
+	void StreamAssets();
+	VkDeviceSize QueryTextureBudget(VkDeviceSize residentBytes);
 
+	// Functions for the swapchain and frames in flight.
+	Swapchain* CreateSwapchain(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkSurfaceKHR surface);
+	void RecreateSwapchain();
+	std::vector<S_FrameData> CreateFrameData(VkDevice logicalDevice, int familyIndex, int frameCount);
+	void DestroyFrameData(VkDevice logicalDevice, std::vector<S_FrameData> &frames);
+	void DrawFrame();
+	void EndFrame(S_TimelinePoint submitted);
+	static void FramebufferResizeCallback(GLFWwindow *pWindow, int width, int height);
 
+	// Functions for the frame graph.
+	void BuildFrameGraph();
+	uint32_t AddFramePass(const char *name, std::function<void(VkCommandBuffer commandBuffer)> record);
+	void RecordClear(VkCommandBuffer commandBuffer, VkImage image, int frame);
+
+	// Functions for recording the scene.
+	void RecordScene(VkCommandBuffer primary, int frameIndex);
+	void RecordSceneChunk(VkCommandBuffer commandBuffer, uint32_t chunk);
+
+	// Functions for the compute kernels.
+	void VerifyComputeKernels();
+
+	// Functions for GPU culling.
+	std::vector<S_CullInstance> GenerateCullInstances(uint32_t count);
+	glm::mat4 GetViewProjection(int frame, uint32_t width, uint32_t height);
+	void UpdateTransforms(uint32_t frameIndex);
 
 	void MainLoop();
-	void Cleanup();
 
 };
 
@@ -0,0 +1,12 @@
+// The global bindless heap, include it from any shader that reads textures or buffers by handle.
+// Bindings and the push constant budget have to match BindlessHeap.
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(set = 0, binding = 0) uniform sampler2D g_Textures[];
+layout(std430, set = 0, binding = 1) buffer BindlessBuffer { uint data[]; } g_Buffers[];
+
+// Handles that can differ within a draw or a subgroup have to be wrapped in nonuniformEXT.
+vec4 SampleTexture(uint handle, vec2 uv)
+{
+	return texture(g_Textures[nonuniformEXT(handle)], uv);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#ifndef CHECK_H
+#define CHECK_H
+
+// Just enough for the tests that run without a GPU. A failed check prints where it was and carries on,
+// and the test's main returns the number of failures, so CTest sees anything but 0 as a failure.
+inline int& CheckFailures()
+{
+	static int failures = 0;
+	return failures;
+}
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" << #condition << ") failed." << std::endl; \
+			CheckFailures()++; \
+		} \
+	} while (0)
+
+#define CHECK_THROWS(expression) \
+	do \
+	{ \
+		bool thrown = false; \
+		try { expression; } \
+		catch (const std::exception&) { thrown = true; } \
+		if (!thrown) \
+		{ \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK_THROWS(" << #expression << ") didn't throw." << std::endl; \
+			CheckFailures()++; \
+		} \
+	} while (0)
+
+#endif
@@ -0,0 +1,254 @@
+#include "stdafx.h"
+#include "DeviceMemoryAllocator.h"
+#include "Check.h"
+
+// Drives the allocator through a fake backend and a made up set of memory types, so it runs without a GPU.
+
+static const VkDeviceSize BlockSize = 1024 * 1024;
+
+// Hands out handles backed by host memory, and keeps track of what's still allocated.
+struct S_FakeDevice
+{
+	std::map<VkDeviceMemory, std::vector<char>> allocations;
+	std::vector<VkDeviceSize> allocatedSizes; // Every size asked for, in order.
+	uint64_t nextHandle = 1;
+
+	S_DeviceMemoryBackend CreateBackend()
+	{
+		S_DeviceMemoryBackend backend;
+		backend.allocate = [this](uint32_t memoryTypeIndex, VkDeviceSize size, VkDeviceMemory *pMemory)
+		{
+			*pMemory = (VkDeviceMemory)(uintptr_t)nextHandle++;
+			allocations[*pMemory].resize((size_t)size);
+			allocatedSizes.push_back(size);
+			return VK_SUCCESS;
+		};
+		backend.free = [this](VkDeviceMemory memory)
+		{
+			if (allocations.erase(memory) == 0) throw std::runtime_error("Fake device freed memory it never allocated.");
+		};
+		backend.map = [this](VkDeviceMemory memory) { return (void*)allocations[memory].data(); };
+		return backend;
+	}
+};
+
+// Type 0 is device local, type 1 is host visible, and type 2 is both, the way integrated GPUs often look.
+static VkPhysicalDeviceMemoryProperties CreateMemoryProperties()
+{
+	VkPhysicalDeviceMemoryProperties properties = {};
+	properties.memoryHeapCount = 2;
+	properties.memoryHeaps[0].size = 1024ull * 1024 * 1024;
+	properties.memoryHeaps[0].flags = VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+	properties.memoryHeaps[1].size = 256ull * 1024 * 1024;
+
+	properties.memoryTypeCount = 3;
+	properties.memoryTypes[0].propertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	properties.memoryTypes[0].heapIndex = 0;
+	properties.memoryTypes[1].propertyFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	properties.memoryTypes[1].heapIndex = 1;
+	properties.memoryTypes[2].propertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	properties.memoryTypes[2].heapIndex = 0;
+	return properties;
+}
+
+static S_DeviceAllocationRequest CreateRequest(VkDeviceSize size, VkDeviceSize alignment, E_ResourceKind kind = RESOURCE_LINEAR)
+{
+	S_DeviceAllocationRequest request;
+	request.requirements.size = size;
+	request.requirements.alignment = alignment;
+	request.requirements.memoryTypeBits = 0x7;
+	request.preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	request.kind = kind;
+	return request;
+}
+
+static bool Overlap(const S_DeviceAllocation &a, const S_DeviceAllocation &b)
+{
+	return a.memory == b.memory && a.offset < b.offset + b.size && b.offset < a.offset + a.size;
+}
+
+// Allocations split the free range, and freeing them merges the neighbours back into one.
+static void TestTlsfSplitAndMerge()
+{
+	TlsfMetadata metadata(1024);
+	VkDeviceSize offsets[3];
+	for (VkDeviceSize &offset : offsets) CHECK(metadata.Allocate(256, 1, &offset));
+	CHECK(offsets[0] == 0 && offsets[1] == 256 && offsets[2] == 512);
+	CHECK(metadata.GetFreeBytes() == 256);
+	CHECK(metadata.GetAllocationCount() == 3);
+
+	VkDeviceSize offset;
+	CHECK(!metadata.Allocate(512, 1, &offset)); // Only the 256 byte tail is left.
+
+	// The middle range has allocated neighbours, so it stays on its own until the first one goes.
+	metadata.Free(offsets[1]);
+	CHECK(metadata.GetLargestFreeRange() == 256);
+	metadata.Free(offsets[0]);
+	CHECK(metadata.GetLargestFreeRange() == 512);
+	metadata.Free(offsets[2]);
+	CHECK(metadata.IsEmpty());
+	CHECK(metadata.GetFreeBytes() == 1024);
+	CHECK(metadata.GetLargestFreeRange() == 1024);
+
+	// Everything merged, so the whole block fits again.
+	CHECK(metadata.Allocate(1024, 1, &offset) && offset == 0);
+	metadata.Free(offset);
+	CHECK_THROWS(metadata.Free(offset));
+	CHECK(!metadata.Allocate(0, 1, &offset));
+}
+
+// Aligned allocations start on their alignment, and the padding in front of them is still usable.
+static void TestTlsfAlignment()
+{
+	TlsfMetadata metadata(4096);
+	VkDeviceSize first, aligned, small;
+	CHECK(metadata.Allocate(1, 1, &first) && first == 0);
+	CHECK(metadata.Allocate(100, 256, &aligned) && aligned == 256);
+	CHECK(metadata.GetFreeBytes() == 4096 - 101);
+
+	CHECK(metadata.Allocate(16, 16, &small));
+	CHECK(small % 16 == 0);
+	CHECK(small + 16 <= aligned || small >= aligned + 100);
+	CHECK(small >= 1);
+
+	metadata.Free(aligned);
+	metadata.Free(small);
+	metadata.Free(first);
+	CHECK(metadata.IsEmpty());
+	CHECK(metadata.GetLargestFreeRange() == 4096);
+}
+
+static void TestMemoryTypeSelection()
+{
+	S_FakeDevice device;
+	DeviceMemoryAllocator allocator(CreateMemoryProperties(), 1, device.CreateBackend(), BlockSize);
+
+	CHECK(allocator.FindMemoryType(0x7, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) == 0); // The first of the equally good ones.
+	CHECK(allocator.FindMemoryType(0x7, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) == 2);
+	CHECK(allocator.FindMemoryType(0x3, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) == 1);
+	CHECK(allocator.FindMemoryType(0x1, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, 0) == -1);
+
+	S_DeviceAllocationRequest request = CreateRequest(64, 1);
+	request.requiredFlags = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+	CHECK_THROWS(allocator.Allocate(request));
+}
+
+// Small allocations share a block, aligned and without overlapping, and host visible ones come back mapped.
+static void TestSubAllocation()
+{
+	S_FakeDevice device;
+	DeviceMemoryAllocator allocator(CreateMemoryProperties(), 1, device.CreateBackend(), BlockSize);
+
+	S_DeviceAllocation a = allocator.Allocate(CreateRequest(1000, 256));
+	S_DeviceAllocation b = allocator.Allocate(CreateRequest(1000, 256));
+	CHECK(a.memory == b.memory);
+	CHECK(a.memoryTypeIndex == 0 && !a.dedicated && a.pMapped == nullptr);
+	CHECK(a.offset % 256 == 0 && b.offset % 256 == 0);
+	CHECK(!Overlap(a, b));
+	CHECK(device.allocatedSizes.size() == 1 && device.allocatedSizes[0] == BlockSize);
+
+	S_DeviceMemoryStats stats = allocator.GetStats();
+	CHECK(stats.blockCount == 1 && stats.allocationCount == 2);
+	CHECK(stats.usedBytes == 2000 && stats.reservedBytes == BlockSize);
+
+	S_DeviceAllocationRequest request = CreateRequest(64, 64);
+	request.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+	request.preferredFlags = 0;
+	S_DeviceAllocation mapped = allocator.Allocate(request);
+	CHECK(mapped.memoryTypeIndex == 1);
+	CHECK(mapped.pMapped == device.allocations[mapped.memory].data() + mapped.offset);
+
+	allocator.Free(a);
+	allocator.Free(b);
+	allocator.Free(mapped);
+	CHECK(allocator.GetStats().allocationCount == 0);
+	CHECK(allocator.GetStats().blockCount == 2); // Each pool keeps its last block.
+	CHECK_THROWS(allocator.Free(a));
+}
+
+// With a granularity above a byte, buffers and optimal images never share a block. Without one they can.
+static void TestGranularitySeparation()
+{
+	{
+		S_FakeDevice device;
+		DeviceMemoryAllocator allocator(CreateMemoryProperties(), 4096, device.CreateBackend(), BlockSize);
+		S_DeviceAllocation buffer = allocator.Allocate(CreateRequest(512, 16, RESOURCE_LINEAR));
+		S_DeviceAllocation image = allocator.Allocate(CreateRequest(512, 16, RESOURCE_OPTIMAL));
+		CHECK(buffer.memoryTypeIndex == image.memoryTypeIndex);
+		CHECK(buffer.memory != image.memory);
+		CHECK(buffer.poolIndex != image.poolIndex);
+		allocator.Free(buffer);
+		allocator.Free(image);
+	}
+	{
+		S_FakeDevice device;
+		DeviceMemoryAllocator allocator(CreateMemoryProperties(), 1, device.CreateBackend(), BlockSize);
+		S_DeviceAllocation buffer = allocator.Allocate(CreateRequest(512, 16, RESOURCE_LINEAR));
+		S_DeviceAllocation image = allocator.Allocate(CreateRequest(512, 16, RESOURCE_OPTIMAL));
+		CHECK(buffer.memory == image.memory);
+		CHECK(!Overlap(buffer, image));
+		allocator.Free(buffer);
+		allocator.Free(image);
+	}
+}
+
+// Asking for it, or being more than half a block, gets a VkDeviceMemory of exactly the requested size.
+static void TestDedicated()
+{
+	S_FakeDevice device;
+	DeviceMemoryAllocator allocator(CreateMemoryProperties(), 1, device.CreateBackend(), BlockSize);
+
+	S_DeviceAllocationRequest request = CreateRequest(4096, 256);
+	request.dedicated = true;
+	S_DeviceAllocation forced = allocator.Allocate(request);
+	S_DeviceAllocation large = allocator.Allocate(CreateRequest(BlockSize / 2 + 1, 256));
+	CHECK(forced.dedicated && forced.offset == 0 && forced.size == 4096);
+	CHECK(large.dedicated && large.size == BlockSize / 2 + 1);
+	CHECK(forced.memory != large.memory);
+	CHECK(device.allocatedSizes.size() == 2);
+	CHECK(device.allocatedSizes[0] == 4096 && device.allocatedSizes[1] == BlockSize / 2 + 1);
+
+	S_DeviceMemoryStats stats = allocator.GetStats();
+	CHECK(stats.dedicatedCount == 2 && stats.blockCount == 0);
+
+	allocator.Free(forced);
+	CHECK(device.allocations.size() == 1);
+	allocator.Free(large);
+	CHECK(device.allocations.empty());
+}
+
+// A full block makes a new one, emptied blocks go back to the device but for the last, and nothing outlives the allocator.
+static void TestBlockLifetime()
+{
+	S_FakeDevice device;
+	{
+		DeviceMemoryAllocator allocator(CreateMemoryProperties(), 1, device.CreateBackend(), BlockSize);
+		std::vector<S_DeviceAllocation> allocations;
+		for (int i = 0; i < 3; i++) allocations.push_back(allocator.Allocate(CreateRequest(BlockSize * 2 / 5, 256)));
+		CHECK(allocator.GetStats().blockCount == 2);
+		CHECK(allocations[0].memory == allocations[1].memory && allocations[1].memory != allocations[2].memory);
+
+		for (const S_DeviceAllocation &allocation : allocations) allocator.Free(allocation);
+		CHECK(allocator.GetStats().blockCount == 1);
+		CHECK(device.allocations.size() == 1);
+
+		// Leave one allocated for the destructor to clean up.
+		allocator.Allocate(CreateRequest(256, 256));
+	}
+	CHECK(device.allocations.empty());
+}
+
+int main()
+{
+	TestTlsfSplitAndMerge();
+	TestTlsfAlignment();
+	TestMemoryTypeSelection();
+	TestSubAllocation();
+	TestGranularitySeparation();
+	TestDedicated();
+	TestBlockLifetime();
+
+	if (CheckFailures() == 0) std::cout << "DeviceMemoryAllocator: all checks passed." << std::endl;
+	return CheckFailures();
+}
@@ -0,0 +1,255 @@
+#include "stdafx.h"
+#include "RenderGraph.h"
+#include "Check.h"
+
+// Compiles a deferred-style frame with made up memory requirements, so it runs without a GPU.
+//
+//   Depth     writes depth
+//   GBuffer   writes albedo, writes depth
+//   Lighting  samples albedo and depth, writes hdr
+//   Debug     samples depth, writes debug     <- nothing needs debug, so it's culled
+//   Blur      samples hdr, writes bloom
+//   Tonemap   samples hdr and bloom, writes the backbuffer
+//   Stats     reads hdr as storage            <- has side effects, so it's kept
+
+static const VkDeviceSize MiB = 1024 * 1024;
+
+// Sizes the images by their pixels, and records what the graph asked for.
+struct S_FakeRequirements
+{
+	std::map<uint32_t, VkImageUsageFlags> usage;
+
+	RenderGraph::RequirementsFunction CreateFunction()
+	{
+		return [this](uint32_t resource, const S_RenderImageDesc &desc, VkImageUsageFlags imageUsage)
+		{
+			usage[resource] = imageUsage;
+			VkMemoryRequirements requirements = {};
+			VkDeviceSize pixelSize = (desc.format == VK_FORMAT_R16G16B16A16_SFLOAT) ? 8 : 4;
+			requirements.size = (VkDeviceSize)desc.width * desc.height * pixelSize;
+			requirements.alignment = 64 * 1024;
+			requirements.memoryTypeBits = 0x1;
+			return requirements;
+		};
+	}
+};
+
+struct S_TestFrame
+{
+	RenderGraph graph;
+	uint32_t backbuffer, depth, albedo, hdr, debug, bloom;
+	uint32_t depthPass, gbufferPass, lightingPass, debugPass, blurPass, tonemapPass, statsPass;
+
+	S_TestFrame()
+	{
+		auto image = [](uint32_t width, uint32_t height, VkFormat format)
+		{
+			S_RenderImageDesc desc;
+			desc.width = width;
+			desc.height = height;
+			desc.format = format;
+			return desc;
+		};
+		auto nothing = [](VkCommandBuffer) {};
+
+		backbuffer = graph.ImportImage("Backbuffer", image(1024, 1024, VK_FORMAT_B8G8R8A8_SRGB), VK_IMAGE_LAYOUT_UNDEFINED,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, RENDER_ACCESS_PRESENT);
+		depth = graph.CreateImage("Depth", image(1024, 1024, VK_FORMAT_D32_SFLOAT)); // 4 MiB
+		albedo = graph.CreateImage("Albedo", image(1024, 1024, VK_FORMAT_R8G8B8A8_UNORM)); // 4 MiB
+		hdr = graph.CreateImage("HDR", image(1024, 1024, VK_FORMAT_R16G16B16A16_SFLOAT)); // 8 MiB
+		debug = graph.CreateImage("Debug", image(1024, 1024, VK_FORMAT_R8G8B8A8_UNORM));
+		bloom = graph.CreateImage("Bloom", image(512, 512, VK_FORMAT_R16G16B16A16_SFLOAT)); // 2 MiB
+
+		depthPass = graph.AddPass("Depth", nothing);
+		graph.Use(depthPass, depth, RENDER_ACCESS_DEPTH_ATTACHMENT);
+
+		gbufferPass = graph.AddPass("GBuffer", nothing);
+		graph.Use(gbufferPass, albedo, RENDER_ACCESS_COLOR_ATTACHMENT);
+		graph.Use(gbufferPass, depth, RENDER_ACCESS_DEPTH_ATTACHMENT);
+
+		lightingPass = graph.AddPass("Lighting", nothing);
+		graph.Use(lightingPass, albedo, RENDER_ACCESS_SAMPLED);
+		graph.Use(lightingPass, depth, RENDER_ACCESS_SAMPLED);
+		graph.Use(lightingPass, hdr, RENDER_ACCESS_STORAGE_WRITE);
+
+		debugPass = graph.AddPass("Debug", nothing);
+		graph.Use(debugPass, depth, RENDER_ACCESS_SAMPLED);
+		graph.Use(debugPass, debug, RENDER_ACCESS_COLOR_ATTACHMENT);
+
+		blurPass = graph.AddPass("Blur", nothing);
+		graph.Use(blurPass, hdr, RENDER_ACCESS_SAMPLED);
+		graph.Use(blurPass, bloom, RENDER_ACCESS_COLOR_ATTACHMENT);
+
+		tonemapPass = graph.AddPass("Tonemap", nothing);
+		graph.Use(tonemapPass, hdr, RENDER_ACCESS_SAMPLED);
+		graph.Use(tonemapPass, bloom, RENDER_ACCESS_SAMPLED);
+		graph.Use(tonemapPass, backbuffer, RENDER_ACCESS_COLOR_ATTACHMENT);
+
+		statsPass = graph.AddPass("Stats", nothing);
+		graph.Use(statsPass, hdr, RENDER_ACCESS_STORAGE_READ);
+		graph.SetSideEffects(statsPass);
+	}
+};
+
+static const S_RenderImageBarrier* FindBarrier(const S_RenderBarrierBatch &batch, uint32_t resource)
+{
+	for (const S_RenderImageBarrier &barrier : batch.imageBarriers)
+	{
+		if (barrier.resource == resource) return &barrier;
+	}
+	return nullptr;
+}
+
+static void TestCulling()
+{
+	S_TestFrame frame;
+	S_FakeRequirements requirements;
+	frame.graph.Compile(requirements.CreateFunction());
+
+	const std::vector<S_CompiledPass> &passes = frame.graph.GetCompiledPasses();
+	uint32_t expected[] = { frame.depthPass, frame.gbufferPass, frame.lightingPass, frame.blurPass, frame.tonemapPass, frame.statsPass };
+	CHECK(passes.size() == 6);
+	for (size_t i = 0; i < passes.size() && i < 6; i++) CHECK(passes[i].pass == expected[i]);
+	CHECK(frame.graph.GetStats().passCount == 6);
+	CHECK(frame.graph.GetStats().culledPassCount == 1);
+
+	// Only the culled pass used it, so it never gets memory or asks for requirements.
+	CHECK(frame.graph.GetPlacement(frame.debug).heap == -1);
+	CHECK(requirements.usage.count(frame.debug) == 0);
+	CHECK(requirements.usage.count(frame.backbuffer) == 0);
+
+	// Usage is gathered from every live pass.
+	CHECK(requirements.usage[frame.hdr] == (VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT));
+	CHECK(requirements.usage[frame.depth] == (VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT));
+
+	// A pass that touches nothing at all has no reason to run either.
+	S_TestFrame withEmpty;
+	withEmpty.graph.AddPass("Empty", [](VkCommandBuffer) {});
+	withEmpty.graph.Compile(S_FakeRequirements().CreateFunction());
+	CHECK(withEmpty.graph.GetStats().culledPassCount == 2);
+}
+
+// Placed largest first: HDR lives through to the end, so nothing shares it. Depth and albedo overlap each other,
+// and bloom only starts once both are done, so it reuses depth's memory.
+static void TestAliasing()
+{
+	S_TestFrame frame;
+	frame.graph.Compile(S_FakeRequirements().CreateFunction());
+
+	const S_TransientPlacement &hdr = frame.graph.GetPlacement(frame.hdr);
+	const S_TransientPlacement &depth = frame.graph.GetPlacement(frame.depth);
+	const S_TransientPlacement &albedo = frame.graph.GetPlacement(frame.albedo);
+	const S_TransientPlacement &bloom = frame.graph.GetPlacement(frame.bloom);
+	CHECK(depth.firstUse == 0 && depth.lastUse == 2);
+	CHECK(albedo.firstUse == 1 && albedo.lastUse == 2);
+	CHECK(hdr.firstUse == 2 && hdr.lastUse == 5);
+	CHECK(bloom.firstUse == 3 && bloom.lastUse == 4);
+
+	CHECK(hdr.heap == 0 && depth.heap == 0 && albedo.heap == 0 && bloom.heap == 0);
+	CHECK(hdr.offset == 0 && hdr.size == 8 * MiB);
+	CHECK(depth.offset == 8 * MiB);
+	CHECK(albedo.offset == 12 * MiB);
+	CHECK(bloom.offset == depth.offset);
+
+	CHECK(frame.graph.GetHeaps().size() == 1);
+	CHECK(frame.graph.GetHeaps()[0].size == 16 * MiB);
+	CHECK(frame.graph.GetHeaps()[0].alignment == 64 * 1024);
+	CHECK(frame.graph.GetStats().transientBytes == 18 * MiB);
+	CHECK(frame.graph.GetStats().aliasedBytes == 16 * MiB);
+
+	// Images that can't live in the same memory types get a heap of their own.
+	S_TestFrame split;
+	split.graph.Compile([](uint32_t resource, const S_RenderImageDesc &desc, VkImageUsageFlags usage)
+	{
+		VkMemoryRequirements requirements = {};
+		requirements.size = (VkDeviceSize)desc.width * desc.height * 4;
+		requirements.alignment = 256;
+		requirements.memoryTypeBits = (usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT) ? 0x2 : 0x1;
+		return requirements;
+	});
+	CHECK(split.graph.GetHeaps().size() == 2);
+	CHECK(split.graph.GetPlacement(split.depth).heap != split.graph.GetPlacement(split.bloom).heap);
+}
+
+static void TestBarriers()
+{
+	S_TestFrame frame;
+	frame.graph.Compile(S_FakeRequirements().CreateFunction());
+	const std::vector<S_CompiledPass> &passes = frame.graph.GetCompiledPasses();
+	if (passes.size() != 6)
+	{
+		CHECK(passes.size() == 6);
+		return;
+	}
+
+	// Every image a pass changes is in the pass's one batch.
+	const S_RenderBarrierBatch &gbuffer = passes[1].barriers;
+	CHECK(gbuffer.imageBarriers.size() == 2);
+	CHECK(FindBarrier(gbuffer, frame.albedo) != nullptr && FindBarrier(gbuffer, frame.depth) != nullptr);
+	CHECK(gbuffer.dstStages == (VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+		VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT));
+
+	const S_RenderBarrierBatch &lighting = passes[2].barriers;
+	CHECK(lighting.imageBarriers.size() == 3);
+	const S_RenderImageBarrier *pDepthRead = FindBarrier(lighting, frame.depth);
+	CHECK(pDepthRead != nullptr && pDepthRead->oldLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL &&
+		pDepthRead->newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+	// Blur's barrier on HDR covers Tonemap's read in the same layout, so Tonemap doesn't need one.
+	// Stats wants another layout, so it gets its own.
+	const S_RenderImageBarrier *pHdrRead = FindBarrier(passes[3].barriers, frame.hdr);
+	CHECK(pHdrRead != nullptr && pHdrRead->oldLayout == VK_IMAGE_LAYOUT_GENERAL && pHdrRead->srcAccess == (VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT));
+	CHECK(FindBarrier(passes[4].barriers, frame.hdr) == nullptr);
+	CHECK(passes[4].barriers.imageBarriers.size() == 2);
+	const S_RenderImageBarrier *pHdrStorage = FindBarrier(passes[5].barriers, frame.hdr);
+	CHECK(pHdrStorage != nullptr && pHdrStorage->newLayout == VK_IMAGE_LAYOUT_GENERAL);
+
+	// Bloom's first write throws away what's there, but has to wait for depth, which used the memory before it.
+	const S_RenderImageBarrier *pBloomWrite = FindBarrier(passes[3].barriers, frame.bloom);
+	CHECK(pBloomWrite != nullptr && pBloomWrite->oldLayout == VK_IMAGE_LAYOUT_UNDEFINED);
+	CHECK(pBloomWrite != nullptr && (pBloomWrite->srcAccess & VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT) != 0);
+	CHECK((passes[3].barriers.srcStages & VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT) != 0);
+
+	// Nothing came before the first pass, and the backbuffer is left ready to present.
+	CHECK(passes[0].barriers.srcStages == VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+	const S_RenderBarrierBatch &finalBarriers = frame.graph.GetFinalBarriers();
+	CHECK(finalBarriers.imageBarriers.size() == 1);
+	CHECK(FindBarrier(finalBarriers, frame.backbuffer) != nullptr && finalBarriers.imageBarriers[0].newLayout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+	CHECK(frame.graph.GetStats().barrierBatchCount == 7);
+	CHECK(frame.graph.GetStats().imageBarrierCount == 12);
+}
+
+static void TestErrors()
+{
+	// Compiling again starts from scratch.
+	S_TestFrame frame;
+	frame.graph.Compile(S_FakeRequirements().CreateFunction());
+	frame.graph.Compile(S_FakeRequirements().CreateFunction());
+	CHECK(frame.graph.GetCompiledPasses().size() == 6);
+	CHECK(frame.graph.GetStats().imageBarrierCount == 12);
+	CHECK(frame.graph.GetHeaps().size() == 1);
+
+	CHECK_THROWS(frame.graph.Use(frame.statsPass, frame.hdr, RENDER_ACCESS_SAMPLED));
+	CHECK_THROWS(frame.graph.SetImportedImage(frame.hdr, VK_NULL_HANDLE));
+
+	// A transient is undefined at the start of every frame, so reading it first is a mistake.
+	RenderGraph graph;
+	uint32_t output = graph.ImportImage("Output", S_RenderImageDesc(), VK_IMAGE_LAYOUT_UNDEFINED, 0, RENDER_ACCESS_PRESENT);
+	uint32_t unwritten = graph.CreateImage("Unwritten", S_RenderImageDesc());
+	uint32_t pass = graph.AddPass("Copy", [](VkCommandBuffer) {});
+	graph.Use(pass, unwritten, RENDER_ACCESS_SAMPLED);
+	graph.Use(pass, output, RENDER_ACCESS_COLOR_ATTACHMENT);
+	CHECK_THROWS(graph.Compile(S_FakeRequirements().CreateFunction()));
+}
+
+int main()
+{
+	TestCulling();
+	TestAliasing();
+	TestBarriers();
+	TestErrors();
+
+	if (CheckFailures() == 0) std::cout << "RenderGraph: all checks passed." << std::endl;
+	return CheckFailures();
+}